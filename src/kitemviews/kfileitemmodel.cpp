@@ -23,6 +23,7 @@
 
 #include "dolphin_generalsettings.h"
 #include "dolphindebug.h"
+#include "private/kfileitemmodelchangecoalescer.h"
 #include "private/kfileitemmodeldirlister.h"
 #include "private/kfileitemmodelsortalgorithm.h"
 
@@ -33,27 +34,67 @@
 #include <QMimeData>
 #include <QTimer>
 #include <QWidget>
+#include <QtConcurrentMap>
+#include <QtConcurrentRun>
+
+#include <algorithm>
+#include <iterator>
+#include <limits>
 
 // #define KFILEITEMMODEL_DEBUG
 
+namespace {
+    // Number of items whose values are cached by data(). The view
+    // requests the values of the visible items for each repaint.
+    const int DataCacheSize = 1000;
+}
+
 KFileItemModel::KFileItemModel(QObject* parent) :
     KItemModelBase("text", parent),
     m_dirLister(nullptr),
+    m_naturalSorting(false),
+    m_useSortKeys(false),
     m_sortDirsFirst(true),
+    m_itemSortOrder(Qt::AscendingOrder),
     m_sortRole(NameRole),
     m_sortingProgressPercent(-1),
     m_roles(),
+    m_itemDataArena(),
     m_itemData(),
+    m_dataCache(DataCacheSize),
+    m_fileCount(0),
+    m_folderCount(0),
+    m_totalFileSize(0),
     m_items(),
+    m_keyboardSearchIndex(),
+    m_keyboardSearchIndexValid(false),
+    m_keyboardSearchSuccessors(),
+    m_keyboardSearchSuccessorsValid(false),
     m_filter(),
     m_filteredItems(),
+    m_showHiddenFiles(false),
+    m_showDirectoriesOnly(false),
+    m_hiddenItems(),
+    m_pendingHiddenItems(),
+    m_hiddenItemsSorted(true),
     m_requestRole(),
     m_maximumUpdateIntervalTimer(nullptr),
     m_resortAllItemsTimer(nullptr),
     m_pendingItemsToInsert(),
+    m_pendingItemBatches(),
+    m_preparedItems(),
+    m_itemBatchPipelineEnabled(true),
     m_groups(),
+    m_groupsDate(),
+    m_dayChangedTimer(nullptr),
     m_expandedDirs(),
-    m_urlsToExpand()
+    m_urlsToExpand(),
+    m_snapshotsEnabled(false),
+    m_directoryStampValid(false),
+    m_directoryStamp(),
+    m_directoryListed(false),
+    m_directoriesToReconcile(),
+    m_changeCoalescer(nullptr)
 {
     m_collator.setNumericMode(true);
 
@@ -61,6 +102,7 @@ KFileItemModel::KFileItemModel(QObject* parent) :
 
     m_dirLister = new KFileItemModelDirLister(this);
     m_dirLister->setDelayedMimeTypes(true);
+    m_dirLister->setShowingDotFiles(true);
 
     const QWidget* parentWidget = qobject_cast<QWidget*>(parent);
     if (parentWidget) {
@@ -69,10 +111,11 @@ KFileItemModel::KFileItemModel(QObject* parent) :
 
     connect(m_dirLister, &KFileItemModelDirLister::started, this, &KFileItemModel::directoryLoadingStarted);
     connect(m_dirLister, static_cast<void(KFileItemModelDirLister::*)()>(&KFileItemModelDirLister::canceled), this, &KFileItemModel::slotCanceled);
+    connect(m_dirLister, static_cast<void(KFileItemModelDirLister::*)(const QUrl&)>(&KFileItemModelDirLister::canceled), this, &KFileItemModel::slotDirectoryCanceled);
     connect(m_dirLister, static_cast<void(KFileItemModelDirLister::*)(const QUrl&)>(&KFileItemModelDirLister::completed), this, &KFileItemModel::slotCompleted);
-    connect(m_dirLister, &KFileItemModelDirLister::itemsAdded, this, &KFileItemModel::slotItemsAdded);
-    connect(m_dirLister, &KFileItemModelDirLister::itemsDeleted, this, &KFileItemModel::slotItemsDeleted);
-    connect(m_dirLister, &KFileItemModelDirLister::refreshItems, this, &KFileItemModel::slotRefreshItems);
+    connect(m_dirLister, &KFileItemModelDirLister::itemsAdded, this, &KFileItemModel::slotListerItemsAdded);
+    connect(m_dirLister, &KFileItemModelDirLister::itemsDeleted, this, &KFileItemModel::slotListerItemsDeleted);
+    connect(m_dirLister, &KFileItemModelDirLister::refreshItems, this, &KFileItemModel::slotListerRefreshItems);
     connect(m_dirLister, static_cast<void(KFileItemModelDirLister::*)()>(&KFileItemModelDirLister::clear), this, &KFileItemModel::slotClear);
     connect(m_dirLister, &KFileItemModelDirLister::infoMessage, this, &KFileItemModel::infoMessage);
     connect(m_dirLister, &KFileItemModelDirLister::errorMessage, this, &KFileItemModel::errorMessage);
@@ -104,38 +147,88 @@ KFileItemModel::KFileItemModel(QObject* parent) :
     m_resortAllItemsTimer = new QTimer(this);
     m_resortAllItemsTimer->setInterval(500);
     m_resortAllItemsTimer->setSingleShot(true);
-    connect(m_resortAllItemsTimer, &QTimer::timeout, this, &KFileItemModel::resortAllItems);
+    connect(m_resortAllItemsTimer, &QTimer::timeout, this, &KFileItemModel::resortChangedItems);
+
+    // The groups of time roles must be updated at midnight.
+    m_dayChangedTimer = new QTimer(this);
+    m_dayChangedTimer->setSingleShot(true);
+    connect(m_dayChangedTimer, &QTimer::timeout, this, &KFileItemModel::slotDayChanged);
+
+    // Directories which are changed constantly, e.g., by downloads or builds, would
+    // result in an update of the model for each change. The changes are merged per
+    // item and applied as one update.
+    m_changeCoalescer = new KFileItemModelChangeCoalescer(this);
+    connect(m_changeCoalescer, &KFileItemModelChangeCoalescer::changesCoalesced, this, &KFileItemModel::slotChangesCoalesced);
 
     connect(GeneralSettings::self(), &GeneralSettings::sortingChoiceChanged, this, &KFileItemModel::slotSortingChoiceChanged);
 }
 
 KFileItemModel::~KFileItemModel()
 {
-    qDeleteAll(m_itemData);
-    qDeleteAll(m_filteredItems);
-    qDeleteAll(m_pendingItemsToInsert);
+    saveSnapshot();
+
+    // The worker threads must not create items anymore.
+    foreach (const QFuture<QVector<SortRecord> >& batch, m_pendingItemBatches) {
+        batch.waitForFinished();
+    }
+    m_dataCache.clear();
+    m_itemDataArena.clear();
 }
 
 void KFileItemModel::loadDirectory(const QUrl &url)
 {
+    saveSnapshot();
+
+    m_directoryStampValid = m_snapshotsEnabled && KFileItemModelSnapshot::directoryStamp(url, &m_directoryStamp);
     m_dirLister->openUrl(url);
+
+    if (m_directoryStampValid) {
+        // The items of the snapshot are added after opening the URL, because the
+        // dir lister clears the model when opening a URL.
+        loadSnapshot(url);
+    }
 }
 
 void KFileItemModel::refreshDirectory(const QUrl &url)
 {
-    // Refresh all expanded directories first (Bug 295300)
+    m_directoryStampValid = m_snapshotsEnabled && KFileItemModelSnapshot::directoryStamp(url, &m_directoryStamp);
+
+    const QUrl rootUrl = directory();
+    if (url.adjusted(QUrl::StripTrailingSlash) != rootUrl.adjusted(QUrl::StripTrailingSlash)) {
+        // Refresh all expanded directories first (Bug 295300)
+        QHashIterator<QUrl, QUrl> expandedDirs(m_expandedDirs);
+        while (expandedDirs.hasNext()) {
+            expandedDirs.next();
+            m_dirLister->openUrl(expandedDirs.value(), KDirLister::Reload);
+        }
+
+        m_dirLister->openUrl(url, KDirLister::Reload);
+        return;
+    }
+
+    // The current directory and the expanded directories are listed again
+    // without clearing the model. The listed items are compared with the
+    // items of the model in reconcileDirectory(), so that the values of
+    // unchanged items, e.g. their previews, are kept.
+    m_changeCoalescer->flush();
+    m_directoryListed = false;
+
     QHashIterator<QUrl, QUrl> expandedDirs(m_expandedDirs);
     while (expandedDirs.hasNext()) {
         expandedDirs.next();
-        m_dirLister->openUrl(expandedDirs.value(), KDirLister::Reload);
+        m_dirLister->openUrl(expandedDirs.value(), KDirLister::Keep | KDirLister::Reload);
+        m_directoriesToReconcile.insert(expandedDirs.value(), KFileItemList());
     }
 
-    m_dirLister->openUrl(url, KDirLister::Reload);
+    // Note that reopening a directory might cancel its previous listing
+    // synchronously, which reconciles the items that have been listed so far.
+    m_dirLister->openUrl(rootUrl, KDirLister::Keep | KDirLister::Reload);
+    m_directoriesToReconcile.insert(rootUrl, KFileItemList());
 }
 
 QUrl KFileItemModel::directory() const
 {
-    return m_dirLister->url();
+    return m_dirLister->directoryUrl();
 }
 
 void KFileItemModel::cancelDirectoryLoading()
@@ -152,11 +245,23 @@ QHash<QByteArray, QVariant> KFileItemModel::data(int index) const
 {
     if (index >= 0 && index < count()) {
         ItemData* data = m_itemData.at(index);
-        if (data->values.isEmpty()) {
-            data->values = retrieveData(data->item, data->parent);
+        if (!(data->flags & MimeTypeRolesStoredFlag)) {
+            // Remember the MIME-type dependent roles that are known when the item is
+            // accessed the first time. Later changes must be applied with setData(),
+            // otherwise the view would not get notified about them.
+            storeMimeTypeRoles(data);
         }
 
-        return data->values;
+        // The cached values are shared implicitly with the caller.
+        const QHash<QByteArray, QVariant>* cachedValues = m_dataCache.object(data);
+        if (cachedValues) {
+            return *cachedValues;
+        }
+
+        QHash<QByteArray, QVariant> values = retrieveData(data->item, data->parent);
+        insertStoredValues(data, values);
+        m_dataCache.insert(data, new QHash<QByteArray, QVariant>(values));
+        return values;
     }
     return QHash<QByteArray, QVariant>();
 }
@@ -167,7 +272,8 @@ bool KFileItemModel::setData(int index, const QHash<QByteArray, QVariant>& value
         return false;
     }
 
-    QHash<QByteArray, QVariant> currentValues = data(index);
+    ItemData* itemData = m_itemData.at(index);
+    const QHash<QByteArray, QVariant> currentValues = data(index);
 
     // Determine which roles have been changed
     QSet<QByteArray> changedRoles;
@@ -177,22 +283,28 @@ bool KFileItemModel::setData(int index, const QHash<QByteArray, QVariant>& value
         const QByteArray role = sharedValue(it.key());
         const QVariant value = it.value();
 
-        if (currentValues[role] != value) {
-            currentValues[role] = value;
+        if (currentValues.value(role) != value) {
             changedRoles.insert(role);
         }
+        setStoredValue(itemData, role, value);
     }
+    m_dataCache.remove(itemData);
 
     if (changedRoles.isEmpty()) {
         return false;
     }
 
-    m_itemData[index]->values = currentValues;
     if (changedRoles.contains("text")) {
-        QUrl url = m_itemData[index]->item.url();
+        m_items.remove(itemData->item.url());
+        removeFromKeyboardSearchIndex({{itemData->item.text().toCaseFolded(), itemData}});
+        QUrl url = itemData->item.url();
         url = url.adjusted(QUrl::RemoveFilename);
-        url.setPath(url.path() + currentValues["text"].toString());
-        m_itemData[index]->item.setUrl(url);
+        url.setPath(url.path() + values.value("text").toString());
+        itemData->item.setUrl(url);
+        m_items.insert(url, itemData);
+        addToKeyboardSearchIndex({itemData});
+        updateSortKey(itemData);
+        m_dataCache.remove(itemData);
     }
 
     emitItemsChangedAndTriggerResorting(KItemRangeList() << KItemRange(index, 1), changedRoles);
@@ -200,11 +312,61 @@ bool KFileItemModel::setData(int index, const QHash<QByteArray, QVariant>& value
     return true;
 }
 
+void KFileItemModel::setItemsData(const QHash<int, QHash<QByteArray, QVariant> >& values)
+{
+    QVector<int> changedIndexes;
+    QSet<QByteArray> changedRoles;
+
+    QHashIterator<int, QHash<QByteArray, QVariant> > itemIt(values);
+    while (itemIt.hasNext()) {
+        itemIt.next();
+        const int index = itemIt.key();
+        if (index < 0 || index >= count()) {
+            continue;
+        }
+
+        Q_ASSERT(!itemIt.value().contains("text"));
+
+        ItemData* itemData = m_itemData.at(index);
+        const QHash<QByteArray, QVariant> currentValues = data(index);
+
+        bool itemChanged = false;
+        QHashIterator<QByteArray, QVariant> it(itemIt.value());
+        while (it.hasNext()) {
+            it.next();
+            const QByteArray role = sharedValue(it.key());
+            const QVariant value = it.value();
+
+            if (currentValues.value(role) != value) {
+                changedRoles.insert(role);
+                itemChanged = true;
+            }
+            setStoredValue(itemData, role, value);
+        }
+        m_dataCache.remove(itemData);
+
+        if (itemChanged) {
+            changedIndexes.append(index);
+        }
+    }
+
+    if (changedIndexes.isEmpty()) {
+        return;
+    }
+
+    std::sort(changedIndexes.begin(), changedIndexes.end());
+    emitItemsChangedAndTriggerResorting(KItemRangeList::fromSortedContainer(changedIndexes), changedRoles);
+}
+
 void KFileItemModel::setSortDirectoriesFirst(bool dirsFirst)
 {
     if (dirsFirst != m_sortDirsFirst) {
+        finishPendingItemBatches();
         m_sortDirsFirst = dirsFirst;
-        resortAllItems();
+        if (m_sortRole != SizeRole) {
+            // When sorting by size, directories are always sorted first.
+            reorderAllItems(dirsFirst ? SortDirectoriesFirst : MixDirectoriesAndFiles);
+        }
     }
 }
 
@@ -215,26 +377,62 @@ bool KFileItemModel::sortDirectoriesFirst() const
 
 void KFileItemModel::setShowHiddenFiles(bool show)
 {
-    m_dirLister->setShowingDotFiles(show);
-    m_dirLister->emitChanges();
-    if (show) {
-        dispatchPendingItemsToInsert();
+    if (show != m_showHiddenFiles) {
+        m_showHiddenFiles = show;
+        updateShownItems();
     }
 }
 
 bool KFileItemModel::showHiddenFiles() const
 {
-    return m_dirLister->showingDotFiles();
+    return m_showHiddenFiles;
 }
 
 void KFileItemModel::setShowDirectoriesOnly(bool enabled)
 {
-    m_dirLister->setDirOnlyMode(enabled);
+    if (enabled == m_showDirectoriesOnly) {
+        return;
+    }
+
+    m_showDirectoriesOnly = enabled;
+
+    if (enabled && m_dirLister->directoryUrl().isEmpty()) {
+        // No directory has been loaded yet (e.g. in the folders panel). The
+        // files will never be needed, so the dir lister can skip them.
+        m_dirLister->setDirOnlyMode(true);
+    } else if (!enabled && m_dirLister->dirOnlyMode()) {
+        // The files have not been listed, so the dir lister has to add them.
+        m_dirLister->setDirOnlyMode(false);
+        m_dirLister->emitChanges();
+        dispatchPendingItemsToInsert();
+    } else {
+        updateShownItems();
+    }
 }
 
 bool KFileItemModel::showDirectoriesOnly() const
 {
-    return m_dirLister->dirOnlyMode();
+    return m_showDirectoriesOnly;
+}
+
+void KFileItemModel::setLocalListingEnabled(bool enabled)
+{
+    m_dirLister->setLocalListingEnabled(enabled);
+}
+
+bool KFileItemModel::localListingEnabled() const
+{
+    return m_dirLister->localListingEnabled();
+}
+
+void KFileItemModel::setSnapshotsEnabled(bool enabled)
+{
+    m_snapshotsEnabled = enabled;
+}
+
+bool KFileItemModel::snapshotsEnabled() const
+{
+    return m_snapshotsEnabled;
 }
 
 QMimeData* KFileItemModel::createMimeData(const KItemSet& indexes) const
@@ -278,17 +476,46 @@ QMimeData* KFileItemModel::createMimeData(const KItemSet& indexes) const
 int KFileItemModel::indexForKeyboardSearch(const QString& text, int startFromIndex) const
 {
     startFromIndex = qMax(0, startFromIndex);
-    for (int i = startFromIndex; i < count(); ++i) {
-        if (fileItem(i).text().startsWith(text, Qt::CaseInsensitive)) {
-            return i;
-        }
+
+    // If further characters are typed, the current item usually still matches.
+    if (startFromIndex < count() && m_itemData.at(startFromIndex)->item.text().startsWith(text, Qt::CaseInsensitive)) {
+        return startFromIndex;
+    }
+
+    if (!m_keyboardSearchIndexValid) {
+        buildKeyboardSearchIndex();
+    }
+
+    // All items that start with the searched text are stored next to each other in
+    // m_keyboardSearchIndex. Find the first one behind startFromIndex, or the first
+    // one in the model if there is no match behind startFromIndex.
+    const QString key = text.toCaseFolded();
+    const auto begin = std::lower_bound(m_keyboardSearchIndex.constBegin(), m_keyboardSearchIndex.constEnd(), key,
+                                        [](const KeyboardSearchEntry& entry, const QString& key) {
+                                            return entry.key < key;
+                                        });
+    const auto end = std::partition_point(begin, m_keyboardSearchIndex.constEnd(),
+                                          [&key](const KeyboardSearchEntry& entry) {
+                                              return entry.key.startsWith(key);
+                                          });
+    if (begin == end) {
+        return -1;
     }
-    for (int i = 0; i < startFromIndex; ++i) {
-        if (fileItem(i).text().startsWith(text, Qt::CaseInsensitive)) {
-            return i;
+
+    if (!m_keyboardSearchSuccessorsValid) {
+        QVector<int> indexes;
+        indexes.reserve(m_keyboardSearchIndex.count());
+        foreach (const KeyboardSearchEntry& entry, m_keyboardSearchIndex) {
+            indexes.append(entry.data->index);
         }
+        m_keyboardSearchSuccessors.build(indexes);
+        m_keyboardSearchSuccessorsValid = true;
     }
-    return -1;
+
+    const int first = begin - m_keyboardSearchIndex.constBegin();
+    const int last = end - m_keyboardSearchIndex.constBegin();
+    const int nextMatch = m_keyboardSearchSuccessors.successor(first, last, startFromIndex);
+    return nextMatch >= 0 ? nextMatch : m_keyboardSearchSuccessors.successor(first, last, 0);
 }
 
 bool KFileItemModel::supportsDropping(int index) const
@@ -316,37 +543,32 @@ QString KFileItemModel::roleDescription(const QByteArray& role) const
 
 QList<QPair<int, QVariant> > KFileItemModel::groups() const
 {
+    const QDate currentDate = QDate::currentDate();
+    if (m_groupsDate.isValid() && m_groupsDate != currentDate) {
+        m_groups.clear();
+    }
+
     if (!m_itemData.isEmpty() && m_groups.isEmpty()) {
 #ifdef KFILEITEMMODEL_DEBUG
         QElapsedTimer timer;
         timer.start();
 #endif
+        m_groups = groupsForRange(0, count());
+
         switch (typeForRole(sortRole())) {
-        case NameRole:        m_groups = nameRoleGroups(); break;
-        case SizeRole:        m_groups = sizeRoleGroups(); break;
         case ModificationTimeRole:
-            m_groups = timeRoleGroups([](const ItemData *item) {
-                return item->item.time(KFileItem::ModificationTime);
-            });
-            break;
         case CreationTimeRole:
-            m_groups = timeRoleGroups([](const ItemData *item) {
-                return item->item.time(KFileItem::CreationTime);
-            });
-            break;
         case AccessTimeRole:
-            m_groups = timeRoleGroups([](const ItemData *item) {
-                return item->item.time(KFileItem::AccessTime);
-            });
+        case DeletionTimeRole: {
+            const qint64 msecsUntilMidnight = QDateTime::currentDateTime().msecsTo(QDateTime(currentDate.addDays(1)));
+            m_groupsDate = currentDate;
+            m_dayChangedTimer->start(int(qMax(qint64(0), msecsUntilMidnight)) + 1000);
             break;
-        case DeletionTimeRole:
-            m_groups = timeRoleGroups([](const ItemData *item) {
-                return item->values.value("deletiontime").toDateTime();
-            });
+        }
+        default:
+            m_groupsDate = QDate();
+            m_dayChangedTimer->stop();
             break;
-        case PermissionsRole: m_groups = permissionRoleGroups(); break;
-        case RatingRole:      m_groups = ratingRoleGroups(); break;
-        default:              m_groups = genericStringRoleGroups(sortRole()); break;
         }
 
 #ifdef KFILEITEMMODEL_DEBUG
@@ -384,34 +606,14 @@ int KFileItemModel::index(const QUrl& url) const
 {
     const QUrl urlToFind = url.adjusted(QUrl::StripTrailingSlash);
 
-    const int itemCount = m_itemData.count();
-    int itemsInHash = m_items.count();
-
-    int index = m_items.value(urlToFind, -1);
-    while (index < 0 && itemsInHash < itemCount) {
-        // Not all URLs are stored yet in m_items. We grow m_items until either
-        // urlToFind is found, or all URLs have been stored in m_items.
-        // Note that we do not add the URLs to m_items one by one, but in
-        // larger blocks. After each block, we check if urlToFind is in
-        // m_items. We could in principle compare urlToFind with each URL while
-        // we are going through m_itemData, but comparing two QUrls will,
-        // unlike calling qHash for the URLs, trigger a parsing of the URLs
-        // which costs both CPU cycles and memory.
-        const int blockSize = 1000;
-        const int currentBlockEnd = qMin(itemsInHash + blockSize, itemCount);
-        for (int i = itemsInHash; i < currentBlockEnd; ++i) {
-            const QUrl nextUrl = m_itemData.at(i)->item.url();
-            m_items.insert(nextUrl, i);
-        }
-
-        itemsInHash = currentBlockEnd;
-        index = m_items.value(urlToFind, -1);
-    }
+    const ItemData* data = m_items.value(urlToFind);
+    const int index = data ? data->index : -1;
 
     if (index < 0) {
-        // The item could not be found, even though all items from m_itemData
-        // should be in m_items now. We print some diagnostic information which
-        // might help to find the cause of the problem, but only once. This
+        // The item could not be found. If m_items does not contain all items
+        // from m_itemData, the model is in an inconsistent state. We print some
+        // diagnostic information which might help to find the cause of the
+        // problem, but only once. This
         // prevents that obtaining and printing the debugging information
         // wastes CPU cycles and floods the shell or .xsession-errors.
         static bool printDebugInfo = true;
@@ -450,9 +652,50 @@ int KFileItemModel::index(const QUrl& url) const
     return index;
 }
 
+bool KFileItemModel::isDir(int index) const
+{
+    return fileItem(index).isDir();
+}
+
+qulonglong KFileItemModel::fileSize(int index) const
+{
+    const KFileItem item = fileItem(index);
+    return item.isDir() ? 0 : item.size();
+}
+
+int KFileItemModel::fileCount() const
+{
+    return m_fileCount;
+}
+
+int KFileItemModel::folderCount() const
+{
+    return m_folderCount;
+}
+
+KIO::filesize_t KFileItemModel::totalFileSize() const
+{
+    return m_totalFileSize;
+}
+
+qint64 KFileItemModel::receivedChangeCount() const
+{
+    return m_changeCoalescer->receivedChangeCount();
+}
+
+qint64 KFileItemModel::appliedUpdateCount() const
+{
+    return m_changeCoalescer->emittedUpdateCount();
+}
+
+qint64 KFileItemModel::appliedChangeCount() const
+{
+    return m_changeCoalescer->emittedChangeCount();
+}
+
 KFileItem KFileItemModel::rootItem() const
 {
-    return m_dirLister->rootItem();
+    return m_dirLister->directoryItem();
 }
 
 void KFileItemModel::clear()
@@ -487,25 +730,37 @@ void KFileItemModel::setRoles(const QSet<QByteArray>& roles)
         const QByteArray& role = it.next();
         m_requestRole[typeForRole(role)] = true;
     }
+    m_dataCache.clear();
 
     if (count() > 0) {
-        // Update m_data with the changed requested roles
-        const int maxIndex = count() - 1;
-        for (int i = 0; i <= maxIndex; ++i) {
-            m_itemData[i]->values = retrieveData(m_itemData.at(i)->item, m_itemData.at(i)->parent);
+        // The stored values might belong to roles that are not requested anymore.
+        // The requested roles are retrieved the next time data(int) is called.
+        foreach (ItemData* itemData, m_itemData) {
+            clearStoredValues(itemData);
         }
+        prepareItemsForSorting(m_itemData);
 
         emit itemsChanged(KItemRangeList() << KItemRange(0, count()), changedRoles);
     }
 
-    // Clear the 'values' of all filtered items. They will be re-populated with the
-    // correct roles the next time 'values' will be accessed via data(int).
+    // Clear the stored values of all filtered items. They will be re-populated with the
+    // correct roles when the items get visible again.
     QHash<KFileItem, ItemData*>::iterator filteredIt = m_filteredItems.begin();
     const QHash<KFileItem, ItemData*>::iterator filteredEnd = m_filteredItems.end();
     while (filteredIt != filteredEnd) {
-        (*filteredIt)->values.clear();
+        clearStoredValues(*filteredIt);
         ++filteredIt;
     }
+
+    // The same applies to the hidden items. Their order might depend on the
+    // cleared values, so they are sorted again when they get visible.
+    foreach (ItemData* itemData, m_hiddenItems) {
+        clearStoredValues(itemData);
+    }
+    foreach (ItemData* itemData, m_pendingHiddenItems) {
+        clearStoredValues(itemData);
+    }
+    m_hiddenItemsSorted = m_hiddenItems.isEmpty();
 }
 
 QSet<QByteArray> KFileItemModel::roles() const
@@ -532,7 +787,7 @@ bool KFileItemModel::setExpanded(int index, bool expanded)
         m_expandedDirs.insert(targetUrl, url);
         m_dirLister->openUrl(url, KDirLister::Keep);
 
-        const QVariantList previouslyExpandedChildren = m_itemData.at(index)->values.value("previouslyExpandedChildren").value<QVariantList>();
+        const QVariantList previouslyExpandedChildren = m_itemData.at(index)->extraValues.value("previouslyExpandedChildren").value<QVariantList>();
         foreach (const QVariant& var, previouslyExpandedChildren) {
             m_urlsToExpand.insert(var.toUrl());
         }
@@ -561,7 +816,7 @@ bool KFileItemModel::setExpanded(int index, bool expanded)
         int childIndex = firstChildIndex;
         while (childIndex < itemCount && expandedParentsCount(childIndex) > parentLevel) {
             ItemData* itemData = m_itemData.at(childIndex);
-            if (itemData->values.value("isExpanded").toBool()) {
+            if (itemData->flags & IsExpandedFlag) {
                 const QUrl targetUrl = itemData->item.targetUrl();
                 const QUrl url = itemData->item.url();
                 m_expandedDirs.remove(targetUrl);
@@ -575,7 +830,8 @@ bool KFileItemModel::setExpanded(int index, bool expanded)
         removeFilteredChildren(KItemRangeList() << KItemRange(index, 1 + childrenCount));
         removeItems(KItemRangeList() << KItemRange(firstChildIndex, childrenCount), DeleteItemData);
 
-        m_itemData.at(index)->values.insert("previouslyExpandedChildren", expandedChildren);
+        m_itemData.at(index)->extraValues.insert(sharedValue("previouslyExpandedChildren"), expandedChildren);
+        m_dataCache.remove(m_itemData.at(index));
     }
 
     return true;
@@ -584,7 +840,7 @@ bool KFileItemModel::setExpanded(int index, bool expanded)
 bool KFileItemModel::isExpanded(int index) const
 {
     if (index >= 0 && index < count()) {
-        return m_itemData.at(index)->values.value("isExpanded").toBool();
+        return m_itemData.at(index)->flags & IsExpandedFlag;
     }
     return false;
 }
@@ -629,7 +885,7 @@ void KFileItemModel::expandParentDirectories(const QUrl &url)
     // expanded is added to m_urlsToExpand. KDirLister
     // does not care whether the parent-URL has already been
     // expanded.
-    QUrl urlToExpand = m_dirLister->url();
+    QUrl urlToExpand = m_dirLister->directoryUrl();
     const int pos = urlToExpand.path().length();
 
     // first subdir can be empty, if m_dirLister->url().path() does not end with '/'
@@ -648,22 +904,16 @@ void KFileItemModel::expandParentDirectories(const QUrl &url)
     // KDirLister::open() must called at least once to trigger an initial
     // loading. The pending URLs that must be restored are handled
     // in slotCompleted().
-    QSetIterator<QUrl> it2(m_urlsToExpand);
-    while (it2.hasNext()) {
-        const int idx = index(it2.next());
-        if (idx >= 0 && !isExpanded(idx)) {
-            setExpanded(idx, true);
-            break;
-        }
-    }
+    expandVisibleUrls();
 }
 
 void KFileItemModel::setNameFilter(const QString& nameFilter)
 {
     if (m_filter.pattern() != nameFilter) {
         dispatchPendingItemsToInsert();
+        const bool narrowed = m_filter.isNarrowedBy(nameFilter);
         m_filter.setPattern(nameFilter);
-        applyFilters();
+        applyFilters(narrowed ? FilterVisibleItemsOnly : FilterAllItems);
     }
 }
 
@@ -687,52 +937,91 @@ QStringList KFileItemModel::mimeTypeFilters() const
 }
 
 
-void KFileItemModel::applyFilters()
+void KFileItemModel::applyFilters(ApplyFiltersBehavior behavior)
 {
     // Check which shown items from m_itemData must get
     // hidden and hence moved to m_filteredItems.
     QVector<int> newFilteredIndexes;
 
+    const QVector<bool> itemsMatch = filterMatches(m_itemData);
     const int itemCount = m_itemData.count();
     for (int index = 0; index < itemCount; ++index) {
         ItemData* itemData = m_itemData.at(index);
 
         // Only filter non-expanded items as child items may never
         // exist without a parent item
-        if (!itemData->values.value("isExpanded").toBool()) {
-            const KFileItem item = itemData->item;
-            if (!m_filter.matches(item)) {
-                newFilteredIndexes.append(index);
-                m_filteredItems.insert(item, itemData);
-            }
+        if (!(itemData->flags & IsExpandedFlag) && !itemsMatch.at(index)) {
+            newFilteredIndexes.append(index);
+            m_filteredItems.insert(itemData->item, itemData);
         }
     }
 
     const KItemRangeList removedRanges = KItemRangeList::fromSortedContainer(newFilteredIndexes);
     removeItems(removedRanges, KeepItemData);
 
+    if (behavior == FilterVisibleItemsOnly) {
+        // The hidden items cannot match with a narrowed filter.
+        return;
+    }
+
     // Check which hidden items from m_filteredItems should
     // get visible again and hence removed from m_filteredItems.
+    // The order of m_filteredItems.values() is the order of the
+    // iteration below, because the hash is not modified in between.
     QList<ItemData*> newVisibleItems;
 
+    const QVector<bool> filteredItemsMatch = filterMatches(m_filteredItems.values());
+    int filteredIndex = 0;
     QHash<KFileItem, ItemData*>::iterator it = m_filteredItems.begin();
     while (it != m_filteredItems.end()) {
-        if (m_filter.matches(it.key())) {
+        if (filteredItemsMatch.at(filteredIndex)) {
             newVisibleItems.append(it.value());
             it = m_filteredItems.erase(it);
         } else {
             ++it;
         }
+        ++filteredIndex;
     }
 
     insertItems(newVisibleItems);
 }
 
+QVector<bool> KFileItemModel::filterMatches(const QList<ItemData*>& itemDataList) const
+{
+    const int count = itemDataList.count();
+    QVector<bool> result(count);
+    bool* matches = result.data();
+
+    // Checking an item is cheap, so use chunks of items to keep
+    // the overhead of the thread pool low.
+    const int chunkSize = 10000;
+    auto checkItems = [this, &itemDataList, matches, count, chunkSize](int begin) {
+        const int end = qMin(begin + chunkSize, count);
+        for (int i = begin; i < end; ++i) {
+            matches[i] = m_filter.matches(itemDataList.at(i)->item);
+        }
+    };
+
+    if (count > chunkSize && m_filter.isThreadSafe()) {
+        QVector<int> chunks;
+        for (int begin = 0; begin < count; begin += chunkSize) {
+            chunks.append(begin);
+        }
+        QtConcurrent::blockingMap(chunks, checkItems);
+    } else {
+        for (int begin = 0; begin < count; begin += chunkSize) {
+            checkItems(begin);
+        }
+    }
+
+    return result;
+}
+
 void KFileItemModel::removeFilteredChildren(const KItemRangeList& itemRanges)
 {
-    if (m_filteredItems.isEmpty() || !m_requestRole[ExpandedParentsCountRole]) {
-        // There are either no filtered items, or it is not possible to expand
-        // folders -> there cannot be any filtered children.
+    if ((m_filteredItems.isEmpty() && m_hiddenItems.isEmpty()) || !m_requestRole[ExpandedParentsCountRole]) {
+        // There are either no filtered or hidden items, or it is not possible to
+        // expand folders -> there cannot be any filtered or hidden children.
         return;
     }
 
@@ -746,12 +1035,153 @@ void KFileItemModel::removeFilteredChildren(const KItemRangeList& itemRanges)
     QHash<KFileItem, ItemData*>::iterator it = m_filteredItems.begin();
     while (it != m_filteredItems.end()) {
         if (parents.contains(it.value()->parent)) {
-            delete it.value();
+            destroyItemData(it.value());
+            it = m_filteredItems.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    // Removing items keeps the order of m_hiddenItems.
+    QList<ItemData*>::iterator hiddenEnd = std::remove_if(m_hiddenItems.begin(), m_hiddenItems.end(),
+        [this, &parents](ItemData* itemData) {
+            if (parents.contains(itemData->parent)) {
+                destroyItemData(itemData);
+                return true;
+            }
+            return false;
+        });
+    m_hiddenItems.erase(hiddenEnd, m_hiddenItems.end());
+}
+
+bool KFileItemModel::isShownItem(const KFileItem& item) const
+{
+    return (m_showHiddenFiles || !item.isHidden()) && (!m_showDirectoriesOnly || item.isDir());
+}
+
+void KFileItemModel::updateShownItems()
+{
+    dispatchPendingItemsToInsert();
+
+    // Merging the hidden items requires that m_itemData is sorted.
+    if (!m_itemsToResort.isEmpty()) {
+        resortChangedItems();
+    }
+    sortHiddenItems();
+
+#ifdef KFILEITEMMODEL_DEBUG
+    QElapsedTimer timer;
+    timer.start();
+#endif
+
+    // Collapse the expanded folders which get hidden, because child
+    // items may never exist without a parent item.
+    for (int index = 0; index < m_itemData.count(); ++index) {
+        const ItemData* itemData = m_itemData.at(index);
+        if ((itemData->flags & IsExpandedFlag) && !isShownItem(itemData->item)) {
+            setExpanded(index, false);
+        }
+    }
+
+    // Move the items which are not shown anymore to m_hiddenItems. The
+    // items from m_itemData are sorted already.
+    QVector<int> newHiddenIndexes;
+    QList<ItemData*> newHiddenItems;
+    const int itemCount = m_itemData.count();
+    for (int index = 0; index < itemCount; ++index) {
+        ItemData* itemData = m_itemData.at(index);
+        if (!isShownItem(itemData->item)) {
+            newHiddenIndexes.append(index);
+            newHiddenItems.append(itemData);
+        }
+    }
+    removeItems(KItemRangeList::fromSortedContainer(newHiddenIndexes), KeepItemData);
+
+    QList<ItemData*> newHiddenFilteredItems;
+    QHash<KFileItem, ItemData*>::iterator it = m_filteredItems.begin();
+    while (it != m_filteredItems.end()) {
+        if (!isShownItem(it.key())) {
+            newHiddenFilteredItems.append(it.value());
             it = m_filteredItems.erase(it);
         } else {
             ++it;
         }
     }
+    if (!newHiddenFilteredItems.isEmpty()) {
+        prepareItemsForSorting(newHiddenFilteredItems);
+        sort(newHiddenFilteredItems.begin(), newHiddenFilteredItems.end());
+        newHiddenItems = mergeItemDataLists(newHiddenItems, newHiddenFilteredItems);
+    }
+
+    // Take the hidden items which are shown now. Both resulting lists keep
+    // the order of m_hiddenItems.
+    QList<ItemData*> newShownItems;
+    QList<ItemData*> remainingHiddenItems;
+    remainingHiddenItems.reserve(m_hiddenItems.count());
+    foreach (ItemData* itemData, m_hiddenItems) {
+        if (isShownItem(itemData->item)) {
+            newShownItems.append(itemData);
+        } else {
+            remainingHiddenItems.append(itemData);
+        }
+    }
+    m_hiddenItems = mergeItemDataLists(remainingHiddenItems, newHiddenItems);
+
+    if (m_filter.hasSetFilters()) {
+        QList<ItemData*> newVisibleItems;
+        newVisibleItems.reserve(newShownItems.count());
+        const QVector<bool> itemsMatch = filterMatches(newShownItems);
+        for (int i = 0; i < newShownItems.count(); ++i) {
+            ItemData* itemData = newShownItems.at(i);
+            if (itemsMatch.at(i)) {
+                newVisibleItems.append(itemData);
+            } else {
+                m_filteredItems.insert(itemData->item, itemData);
+            }
+        }
+        newShownItems = newVisibleItems;
+    }
+
+    insertItems(newShownItems, NewItemsAreSorted);
+
+#ifdef KFILEITEMMODEL_DEBUG
+    qCDebug(DolphinDebug) << "[TIME] Updating shown items:" << timer.elapsed();
+#endif
+}
+
+void KFileItemModel::addHiddenItems(QList<ItemData*>& items, InsertItemsBehavior behavior)
+{
+    if (items.isEmpty()) {
+        return;
+    }
+
+    if (!m_hiddenItemsSorted) {
+        // All hidden items are sorted together in sortHiddenItems().
+        m_hiddenItems.append(items);
+        return;
+    }
+
+    if (behavior == SortNewItems) {
+        prepareItemsForSorting(items);
+        sort(items.begin(), items.end());
+    }
+    m_hiddenItems = mergeItemDataLists(m_hiddenItems, items);
+}
+
+void KFileItemModel::sortHiddenItems()
+{
+    if (!m_hiddenItemsSorted) {
+        prepareItemsForSorting(m_hiddenItems);
+        sort(m_hiddenItems.begin(), m_hiddenItems.end());
+        m_hiddenItemsSorted = true;
+    }
+}
+
+bool KFileItemModel::containsHiddenItem(const QUrl& url) const
+{
+    auto hasUrl = [&url](const ItemData* itemData) { return itemData->item.url() == url; };
+    return std::any_of(m_hiddenItems.constBegin(), m_hiddenItems.constEnd(), hasUrl)
+           || std::any_of(m_pendingHiddenItems.constBegin(), m_pendingHiddenItems.constEnd(), hasUrl);
 }
 
 QList<KFileItemModel::RoleInfo> KFileItemModel::rolesInformation()
@@ -792,6 +1222,7 @@ void KFileItemModel::onGroupedSortingChanged(bool current)
 void KFileItemModel::onSortRoleChanged(const QByteArray& current, const QByteArray& previous, bool resortItems)
 {
     Q_UNUSED(previous);
+    finishPendingItemBatches();
     m_sortRole = typeForRole(current);
 
     if (!m_requestRole[m_sortRole]) {
@@ -807,13 +1238,16 @@ void KFileItemModel::onSortRoleChanged(const QByteArray& current, const QByteArr
 
 void KFileItemModel::onSortOrderChanged(Qt::SortOrder current, Qt::SortOrder previous)
 {
-    Q_UNUSED(current);
     Q_UNUSED(previous);
-    resortAllItems();
+    finishPendingItemBatches();
+    m_itemSortOrder = current;
+    reorderAllItems(ReverseSortOrder);
 }
 
 void KFileItemModel::loadSortingSettings()
 {
+    finishPendingItemBatches();
+
     using Choice = GeneralSettings::EnumSortingChoice;
     switch (GeneralSettings::sortingChoice()) {
     case Choice::NaturalSorting:
@@ -834,128 +1268,766 @@ void KFileItemModel::loadSortingSettings()
     // Workaround for bug https://bugreports.qt.io/browse/QTBUG-69361
     // Force the clean state of QCollator in single thread to avoid thread safety problems in sort
     m_collator.compare(QString(), QString());
+
+    // Sort keys can only be used if they respect the numeric mode of the
+    // collator, which is not the case on all platforms (see QCollator::sortKey()).
+    m_useSortKeys = m_naturalSorting
+                    && m_collator.sortKey(QStringLiteral("a2")).compare(m_collator.sortKey(QStringLiteral("a10"))) < 0;
+
+    updateSortKeys(m_itemData);
+    updateSortKeys(m_pendingItemsToInsert);
+    QList<ItemData*> filteredItems = m_filteredItems.values();
+    updateSortKeys(filteredItems);
+    updateSortKeys(m_hiddenItems);
+    updateSortKeys(m_pendingHiddenItems);
 }
 
-void KFileItemModel::resortAllItems()
+void KFileItemModel::loadSnapshot(const QUrl& url)
 {
-    m_resortAllItemsTimer->stop();
-
-    const int itemCount = count();
-    if (itemCount <= 0) {
+    KFileItemModelSnapshot snapshot;
+    if (!snapshot.load(url, m_directoryStamp)) {
         return;
     }
 
-#ifdef KFILEITEMMODEL_DEBUG
-    QElapsedTimer timer;
-    timer.start();
-    qCDebug(DolphinDebug) << "===========================================================";
-    qCDebug(DolphinDebug) << "Resorting" << itemCount << "items";
-#endif
-
-    // Remember the order of the current URLs so
-    // that it can be determined which indexes have
-    // been moved because of the resorting.
-    QList<QUrl> oldUrls;
-    oldUrls.reserve(itemCount);
-    foreach (const ItemData* itemData, m_itemData) {
-        oldUrls.append(itemData->item.url());
-    }
-
-    m_items.clear();
-    m_items.reserve(itemCount);
-
-    // Resort the items
-    sort(m_itemData.begin(), m_itemData.end());
-    for (int i = 0; i < itemCount; ++i) {
-        m_items.insert(m_itemData.at(i)->item.url(), i);
+    const QVector<KFileItemModelSnapshot::Item> snapshotItems = snapshot.items();
+    if (snapshotItems.isEmpty()) {
+        return;
     }
 
-    // Determine the first index that has been moved.
-    int firstMovedIndex = 0;
-    while (firstMovedIndex < itemCount
-           && firstMovedIndex == m_items.value(oldUrls.at(firstMovedIndex))) {
-        ++firstMovedIndex;
+    KFileItemList items;
+    items.reserve(snapshotItems.count());
+    foreach (const KFileItemModelSnapshot::Item& snapshotItem, snapshotItems) {
+        items.append(snapshotItem.item);
     }
 
-    const bool itemsHaveMoved = firstMovedIndex < itemCount;
-    if (itemsHaveMoved) {
-        m_groups.clear();
-
-        int lastMovedIndex = itemCount - 1;
-        while (lastMovedIndex > firstMovedIndex
-               && lastMovedIndex == m_items.value(oldUrls.at(lastMovedIndex))) {
-            --lastMovedIndex;
+    QList<ItemData*> itemDataList = createItemDataList(directory(), items);
+
+    // The first items of the snapshot are sorted if the sorting has not been
+    // changed. They remain sorted if some of them are hidden or filtered.
+    const int sortedItemCount = snapshot.sortSignature() == snapshotSortSignature() ? snapshot.sortedItemCount() : 0;
+    QList<ItemData*> sortedItems;
+    QList<ItemData*> unsortedItems;
+    QList<ItemData*> hiddenItems;
+
+    for (int i = 0; i < itemDataList.count(); ++i) {
+        ItemData* itemData = itemDataList.at(i);
+        const KFileItemModelSnapshot::Item& snapshotItem = snapshotItems.at(i);
+        if (!snapshotItem.iconName.isEmpty()) {
+            itemData->iconName = snapshotItem.iconName;
+            itemData->flags |= HasIconNameFlag | MimeTypeRolesStoredFlag;
         }
-
-        Q_ASSERT(firstMovedIndex <= lastMovedIndex);
-
-        // Create a list movedToIndexes, which has the property that
-        // movedToIndexes[i] is the new index of the item with the old index
-        // firstMovedIndex + i.
-        const int movedItemsCount = lastMovedIndex - firstMovedIndex + 1;
-        QList<int> movedToIndexes;
-        movedToIndexes.reserve(movedItemsCount);
-        for (int i = firstMovedIndex; i <= lastMovedIndex; ++i) {
-            const int newIndex = m_items.value(oldUrls.at(i));
-            movedToIndexes.append(newIndex);
+        if (!snapshotItem.type.isEmpty() && m_requestRole[TypeRole]) {
+            itemData->type = snapshotItem.type;
+            itemData->flags |= HasTypeFlag;
+        }
+        if (snapshotItem.folderItemCount >= 0 && m_requestRole[SizeRole]) {
+            itemData->size = snapshotItem.folderItemCount;
+            itemData->flags |= HasSizeFlag;
         }
 
-        emit itemsMoved(KItemRange(firstMovedIndex, movedItemsCount), movedToIndexes);
-    } else if (groupedSorting()) {
-        // The groups might have changed even if the order of the items has not.
-        const QList<QPair<int, QVariant> > oldGroups = m_groups;
-        m_groups.clear();
-        if (groups() != oldGroups) {
-            emit groupsChanged();
+        if (!isShownItem(itemData->item)) {
+            hiddenItems.append(itemData);
+        } else if (!m_filter.matches(itemData->item)) {
+            m_filteredItems.insert(itemData->item, itemData);
+        } else if (i < sortedItemCount) {
+            sortedItems.append(itemData);
+        } else {
+            unsortedItems.append(itemData);
         }
     }
 
-#ifdef KFILEITEMMODEL_DEBUG
-    qCDebug(DolphinDebug) << "[TIME] Resorting of" << itemCount << "items:" << timer.elapsed();
-#endif
+    // The values of some sort roles must be stored in the items, even if
+    // they are sorted already.
+    prepareItemsForSorting(sortedItems);
+    insertItems(sortedItems, NewItemsAreSorted);
+    insertItems(unsortedItems, SortNewItems);
+    addHiddenItems(hiddenItems);
+
+    m_directoriesToReconcile.insert(directory(), KFileItemList());
 }
 
-void KFileItemModel::slotCompleted()
+void KFileItemModel::saveSnapshot()
 {
-    dispatchPendingItemsToInsert();
+    if (!m_snapshotsEnabled || !m_directoryStampValid || !m_directoryListed || !m_directoriesToReconcile.isEmpty()
+        || m_changeCoalescer->hasPendingChanges() || !m_expandedDirs.isEmpty() || !m_pendingItemsToInsert.isEmpty() || !m_pendingItemBatches.isEmpty()) {
+        return;
+    }
 
-    if (!m_urlsToExpand.isEmpty()) {
-        // Try to find a URL that can be expanded.
-        // Note that the parent folder must be expanded before any of its subfolders become visible.
-        // Therefore, some URLs in m_restoredExpandedUrls might not be visible yet
-        // -> we expand the first visible URL we find in m_restoredExpandedUrls.
-        foreach (const QUrl& url, m_urlsToExpand) {
-            const int indexForUrl = index(url);
-            if (indexForUrl >= 0) {
-                m_urlsToExpand.remove(url);
-                if (setExpanded(indexForUrl, true)) {
-                    // The dir lister has been triggered. This slot will be called
-                    // again after the directory has been expanded.
-                    return;
-                }
+    const int itemCount = m_itemData.count() + m_filteredItems.count() + m_hiddenItems.count() + m_pendingHiddenItems.count();
+    if (itemCount < SnapshotMinimumItemCount) {
+        return;
+    }
+
+    // The properties are copied by the GUI thread, as reading them from
+    // the KFileItems, which are shared with KDirLister, is not thread-safe.
+    QVector<KFileItemModelSnapshot::SavedItem> items;
+    items.reserve(itemCount);
+    auto appendItem = [&items](const ItemData* itemData) {
+        KFileItemModelSnapshot::Item item;
+        item.item = itemData->item;
+        if (itemData->flags & HasTypeFlag) {
+            item.type = itemData->type;
+        }
+        if (itemData->flags & HasIconNameFlag) {
+            item.iconName = itemData->iconName;
+        }
+        if ((itemData->flags & HasSizeFlag) && itemData->item.isDir()) {
+            item.folderItemCount = itemData->size;
+        }
+        items.append(KFileItemModelSnapshot::SavedItem(item));
+    };
+
+    // The shown items are stored first in their current order
+    foreach (const ItemData* itemData, m_itemData) {
+        appendItem(itemData);
+    }
+    foreach (const ItemData* itemData, m_filteredItems) {
+        appendItem(itemData);
+    }
+    foreach (const ItemData* itemData, m_hiddenItems) {
+        appendItem(itemData);
+    }
+    foreach (const ItemData* itemData, m_pendingHiddenItems) {
+        appendItem(itemData);
+    }
+
+    // The order of the shown items is not final while they are resorted.
+    const bool isSorted = !m_resortAllItemsTimer->isActive() && m_itemsToResort.isEmpty() && m_sortingProgressPercent < 0;
+    const int sortedItemCount = isSorted ? m_itemData.count() : 0;
+
+    // Writing the snapshot does not access the model anymore.
+    QtConcurrent::run(&KFileItemModelSnapshot::save, directory(), m_directoryStamp,
+                      snapshotSortSignature(), sortedItemCount, items);
+    m_directoryListed = false;
+}
+
+void KFileItemModel::reconcileDirectory(const QUrl& directoryUrl, bool listingCompleted)
+{
+    const KFileItemList listedItems = m_directoriesToReconcile.take(directoryUrl);
+    dispatchPendingItemsToInsert();
+
+    const ItemData* parentItem = nullptr;
+    if (directoryUrl != directory()) {
+        const int parentIndex = index(directoryUrl);
+        if (parentIndex < 0 || !(m_itemData.at(parentIndex)->flags & IsExpandedFlag)) {
+            // The directory has been collapsed or removed in the meantime
+            return;
+        }
+        parentItem = m_itemData.at(parentIndex);
+    }
+
+    // Collect the current children of the directory, including the
+    // hidden and filtered ones.
+    QHash<QUrl, KFileItem> knownItems;
+    auto addKnownItem = [&knownItems, parentItem](const ItemData* itemData) {
+        if (itemData->parent == parentItem) {
+            knownItems.insert(itemData->item.url(), itemData->item);
+        }
+    };
+    foreach (const ItemData* itemData, m_itemData) {
+        addKnownItem(itemData);
+    }
+    foreach (const ItemData* itemData, m_filteredItems) {
+        addKnownItem(itemData);
+    }
+    foreach (const ItemData* itemData, m_hiddenItems) {
+        addKnownItem(itemData);
+    }
+    foreach (const ItemData* itemData, m_pendingHiddenItems) {
+        addKnownItem(itemData);
+    }
+
+    // A file that has been replaced, e.g., by saving it atomically, has
+    // a new inode even if its size and time are unchanged.
+    auto hasChanged = [](const KFileItem& knownItem, const KFileItem& listedItem) {
+        const qint64 knownInode = knownItem.entry().numberValue(KIO::UDSEntry::UDS_INODE, -1);
+        const qint64 listedInode = listedItem.entry().numberValue(KIO::UDSEntry::UDS_INODE, -1);
+        return knownItem.size() != listedItem.size()
+            || knownItem.mode() != listedItem.mode()
+            || knownItem.permissions() != listedItem.permissions()
+            || knownItem.isLink() != listedItem.isLink()
+            || knownItem.user() != listedItem.user()
+            || knownItem.group() != listedItem.group()
+            || fileTimeInSeconds(knownItem, KFileItem::ModificationTime) != fileTimeInSeconds(listedItem, KFileItem::ModificationTime)
+            || (knownInode != -1 && listedInode != -1 && knownInode != listedInode);
+    };
+
+    KFileItemList newItems;
+    QList<QPair<KFileItem, KFileItem> > changedItems;
+    QSet<QUrl> listedUrls;
+    listedUrls.reserve(listedItems.count());
+
+    foreach (const KFileItem& item, listedItems) {
+        listedUrls.insert(item.url());
+        const QHash<QUrl, KFileItem>::const_iterator it = knownItems.constFind(item.url());
+        if (it == knownItems.constEnd()) {
+            newItems.append(item);
+        } else if (hasChanged(it.value(), item)) {
+            changedItems.append(qMakePair(it.value(), item));
+        }
+    }
+
+    if (listingCompleted) {
+        KFileItemList removedItems;
+        QHash<QUrl, KFileItem>::const_iterator it = knownItems.constBegin();
+        for (; it != knownItems.constEnd(); ++it) {
+            if (!listedUrls.contains(it.key())) {
+                removedItems.append(it.value());
+            }
+        }
+
+        if (!removedItems.isEmpty()) {
+            slotItemsDeleted(removedItems);
+        }
+    }
+
+    if (!changedItems.isEmpty()) {
+        slotRefreshItems(changedItems);
+    }
+
+    if (!newItems.isEmpty()) {
+        slotItemsAdded(directoryUrl, newItems);
+    }
+}
+
+bool KFileItemModel::isCoalescingChanges(const QUrl& directoryUrl) const
+{
+    if (!m_directoryListed) {
+        return false;
+    }
+
+    return directoryUrl.isEmpty()
+        || (!m_directoriesToReconcile.contains(directoryUrl) && !m_urlsBeingExpanded.contains(directoryUrl));
+}
+
+QString KFileItemModel::snapshotSortSignature() const
+{
+    return QStringLiteral("%1 %2 %3 %4 %5 %6").arg(m_sortRole)
+                                             .arg(m_itemSortOrder)
+                                             .arg(m_sortDirsFirst)
+                                             .arg(m_naturalSorting)
+                                             .arg(m_collator.caseSensitivity())
+                                             .arg(m_collator.locale().name());
+}
+
+void KFileItemModel::resortAllItems()
+{
+    m_resortAllItemsTimer->stop();
+    m_itemsToResort.clear();
+
+    // The hidden items are only sorted when they get visible again.
+    m_hiddenItemsSorted = m_hiddenItems.isEmpty();
+
+    const int itemCount = count();
+    if (itemCount <= 0) {
+        return;
+    }
+
+#ifdef KFILEITEMMODEL_DEBUG
+    QElapsedTimer timer;
+    timer.start();
+    qCDebug(DolphinDebug) << "===========================================================";
+    qCDebug(DolphinDebug) << "Resorting" << itemCount << "items";
+#endif
+
+    // Resort the items. ItemData::index still contains the old index
+    // of each item, which is used to determine which indexes have been
+    // moved because of the resorting.
+    prepareItemsForSorting(m_itemData);
+    sort(m_itemData.begin(), m_itemData.end());
+
+    QVector<int> newIndexes(itemCount);
+    for (int i = 0; i < itemCount; ++i) {
+        ItemData* itemData = m_itemData.at(i);
+        newIndexes[itemData->index] = i;
+        itemData->index = i;
+    }
+
+    emitResortingSignals(newIndexes);
+
+#ifdef KFILEITEMMODEL_DEBUG
+    qCDebug(DolphinDebug) << "[TIME] Resorting of" << itemCount << "items:" << timer.elapsed();
+#endif
+}
+
+void KFileItemModel::reorderAllItems(ReorderItemsBehavior behavior)
+{
+    if (!m_itemsToResort.isEmpty()) {
+        // Some items have not been moved to their correct positions yet.
+        resortAllItems();
+        return;
+    }
+
+    m_resortAllItemsTimer->stop();
+
+    // The hidden items are only sorted when they get visible again.
+    m_hiddenItemsSorted = m_hiddenItems.isEmpty();
+
+    const int itemCount = count();
+    if (itemCount <= 0) {
+        return;
+    }
+
+#ifdef KFILEITEMMODEL_DEBUG
+    QElapsedTimer timer;
+    timer.start();
+#endif
+
+    // Reversing the items keeps the groups, but changes their order.
+    QList<QPair<int, QVariant> > newGroups;
+    if (behavior == ReverseSortOrder && !m_groups.isEmpty() && m_expandedDirs.isEmpty()) {
+        int filesBegin = 0;
+        if (m_sortDirsFirst || m_sortRole == SizeRole) {
+            filesBegin = std::partition_point(m_itemData.constBegin(), m_itemData.constEnd(),
+                                              [](const ItemData* itemData) { return itemData->item.isDir(); })
+                         - m_itemData.constBegin();
+        }
+        newGroups = reversedGroups(filesBegin);
+    }
+
+    // ItemData::index still contains the old index of each item, which is
+    // used to determine which indexes have been moved.
+    QList<ItemData*> reorderedItems;
+    reorderedItems.reserve(itemCount);
+    reorderSiblings(reorderedItems, 0, itemCount, behavior);
+    Q_ASSERT(reorderedItems.count() == itemCount);
+    m_itemData = reorderedItems;
+
+    QVector<int> newIndexes(itemCount);
+    for (int i = 0; i < itemCount; ++i) {
+        ItemData* itemData = m_itemData.at(i);
+        newIndexes[itemData->index] = i;
+        itemData->index = i;
+    }
+
+    emitResortingSignals(newIndexes, newGroups);
+
+#ifdef KFILEITEMMODEL_DEBUG
+    qCDebug(DolphinDebug) << "[TIME] Reordering of" << itemCount << "items:" << timer.elapsed();
+#endif
+}
+
+void KFileItemModel::reorderSiblings(QList<ItemData*>& result, int begin, int end, ReorderItemsBehavior behavior) const
+{
+    // Determine the ranges of the siblings, each of them followed by its children.
+    const int siblingLevel = expandedParentsCount(m_itemData.at(begin));
+    QVector<QPair<int, int> > siblings;
+    int index = begin;
+    while (index < end) {
+        int childrenEnd = index + 1;
+        while (childrenEnd < end && expandedParentsCount(m_itemData.at(childrenEnd)) > siblingLevel) {
+            ++childrenEnd;
+        }
+        siblings.append(qMakePair(index, childrenEnd));
+        index = childrenEnd;
+    }
+
+    auto isDir = [this](const QPair<int, int>& sibling) {
+        return m_itemData.at(sibling.first)->item.isDir();
+    };
+
+    switch (behavior) {
+    case ReverseSortOrder: {
+        // If directories are sorted first, they stay in front of the files.
+        QVector<QPair<int, int> >::iterator filesBegin = siblings.begin();
+        if (m_sortDirsFirst || m_sortRole == SizeRole) {
+            filesBegin = std::partition_point(siblings.begin(), siblings.end(), isDir);
+        }
+        std::reverse(siblings.begin(), filesBegin);
+        std::reverse(filesBegin, siblings.end());
+        break;
+    }
+
+    case SortDirectoriesFirst:
+        std::stable_partition(siblings.begin(), siblings.end(), isDir);
+        break;
+
+    case MixDirectoriesAndFiles: {
+        QVector<QPair<int, int> >::iterator filesBegin = std::partition_point(siblings.begin(), siblings.end(), isDir);
+        std::inplace_merge(siblings.begin(), filesBegin, siblings.end(),
+                           [this](const QPair<int, int>& a, const QPair<int, int>& b) {
+                               return lessThan(m_itemData.at(a.first), m_itemData.at(b.first), m_collator);
+                           });
+        break;
+    }
+    }
+
+    foreach (const auto& sibling, siblings) {
+        result.append(m_itemData.at(sibling.first));
+        if (sibling.second > sibling.first + 1) {
+            reorderSiblings(result, sibling.first + 1, sibling.second, behavior);
+        }
+    }
+}
+
+QList<QPair<int, QVariant> > KFileItemModel::reversedGroups(int filesBegin) const
+{
+    const int itemCount = count();
+    QList<QPair<int, QVariant> > result;
+
+    // Each group is reversed within the directories and the files. A group
+    // which contains directories and files is split up.
+    const int rangeEnds[] = {filesBegin, itemCount};
+    int rangeBegin = 0;
+    for (int rangeEnd : rangeEnds) {
+        for (int i = m_groups.count() - 1; i >= 0; --i) {
+            const int groupBegin = qMax(m_groups.at(i).first, rangeBegin);
+            const int groupEnd = qMin(i + 1 < m_groups.count() ? m_groups.at(i + 1).first : itemCount, rangeEnd);
+            if (groupBegin >= groupEnd) {
+                continue;
+            }
+
+            const QVariant& value = m_groups.at(i).second;
+            if (result.isEmpty() || result.last().second != value) {
+                result.append(qMakePair(rangeBegin + rangeEnd - groupEnd, value));
             }
         }
+        rangeBegin = rangeEnd;
+    }
+
+    return result;
+}
 
-        // None of the URLs in m_restoredExpandedUrls could be found in the model. This can happen
-        // if these URLs have been deleted in the meantime.
-        m_urlsToExpand.clear();
+void KFileItemModel::resortChangedItems()
+{
+    m_resortAllItemsTimer->stop();
+
+    const int itemCount = count();
+    if (itemCount <= 0) {
+        m_itemsToResort.clear();
+        return;
+    }
+
+    // If a large part of the items has changed, sorting all items is cheaper
+    // than inserting the changed items one by one.
+    if (m_itemsToResort.count() > itemCount / 4) {
+        resortAllItems();
+        return;
     }
 
+#ifdef KFILEITEMMODEL_DEBUG
+    QElapsedTimer timer;
+    timer.start();
+    qCDebug(DolphinDebug) << "===========================================================";
+    qCDebug(DolphinDebug) << "Resorting" << m_itemsToResort.count() << "of" << itemCount << "items";
+#endif
+
+    // Split the items into the changed items and the remaining items. Both
+    // lists keep the old order, and ItemData::index still contains the old index
+    // of each item, which is used to determine which indexes have been moved.
+    QList<ItemData*> changedItems;
+    QList<ItemData*> unchangedItems;
+    changedItems.reserve(m_itemsToResort.count());
+    unchangedItems.reserve(itemCount);
+    foreach (ItemData* itemData, m_itemData) {
+        if (m_itemsToResort.contains(itemData)) {
+            changedItems.append(itemData);
+        } else {
+            unchangedItems.append(itemData);
+        }
+    }
+    m_itemsToResort.clear();
+
+    // emitItemsChangedAndTriggerResorting() only compares the changed items with
+    // their neighbors at the time of the change. If these neighbors have changed
+    // afterwards, the remaining items might not be sorted anymore.
+    for (int i = 1; i < unchangedItems.count(); ++i) {
+        if (lessThan(unchangedItems.at(i), unchangedItems.at(i - 1), m_collator)) {
+            resortAllItems();
+            return;
+        }
+    }
+
+    prepareItemsForSorting(changedItems);
+    sort(changedItems.begin(), changedItems.end());
+
+    // Binary-search the new position of each changed item in the remaining
+    // items and merge both lists. newIndexes[i] is the new index of the item
+    // with the old index i.
+    QVector<int> newIndexes(itemCount);
+    auto lambdaLessThan = [this] (const ItemData* a, const ItemData* b) {
+        return lessThan(a, b, m_collator);
+    };
+    QList<ItemData*>::const_iterator searchBegin = unchangedItems.constBegin();
+    int unchangedIndex = 0;
+    int newIndex = 0;
+    foreach (ItemData* changedItem, changedItems) {
+        searchBegin = std::upper_bound(searchBegin, unchangedItems.constEnd(), changedItem, lambdaLessThan);
+        const int insertBefore = searchBegin - unchangedItems.constBegin();
+        while (unchangedIndex < insertBefore) {
+            ItemData* itemData = unchangedItems.at(unchangedIndex);
+            m_itemData[newIndex] = itemData;
+            newIndexes[itemData->index] = newIndex;
+            itemData->index = newIndex;
+            ++unchangedIndex;
+            ++newIndex;
+        }
+        m_itemData[newIndex] = changedItem;
+        newIndexes[changedItem->index] = newIndex;
+        changedItem->index = newIndex;
+        ++newIndex;
+    }
+    while (unchangedIndex < unchangedItems.count()) {
+        ItemData* itemData = unchangedItems.at(unchangedIndex);
+        m_itemData[newIndex] = itemData;
+        newIndexes[itemData->index] = newIndex;
+        itemData->index = newIndex;
+        ++unchangedIndex;
+        ++newIndex;
+    }
+    Q_ASSERT(newIndex == itemCount);
+
+    emitResortingSignals(newIndexes);
+
+#ifdef KFILEITEMMODEL_DEBUG
+    qCDebug(DolphinDebug) << "[TIME] Resorting of changed items:" << timer.elapsed();
+#endif
+}
+
+void KFileItemModel::addToItemCounts(const KFileItem& item)
+{
+    if (item.isDir()) {
+        ++m_folderCount;
+    } else {
+        ++m_fileCount;
+        m_totalFileSize += item.size();
+    }
+}
+
+void KFileItemModel::removeFromItemCounts(const KFileItem& item)
+{
+    if (item.isDir()) {
+        --m_folderCount;
+    } else {
+        --m_fileCount;
+        m_totalFileSize -= item.size();
+    }
+}
+
+void KFileItemModel::buildKeyboardSearchIndex() const
+{
+    m_keyboardSearchIndex.clear();
+    m_keyboardSearchIndex.reserve(m_itemData.count());
+    foreach (const ItemData* itemData, m_itemData) {
+        m_keyboardSearchIndex.append({itemData->item.text().toCaseFolded(), itemData});
+    }
+    std::sort(m_keyboardSearchIndex.begin(), m_keyboardSearchIndex.end(), keyboardSearchEntryLessThan);
+    m_keyboardSearchIndexValid = true;
+    m_keyboardSearchSuccessorsValid = false;
+}
+
+void KFileItemModel::addToKeyboardSearchIndex(const QList<ItemData*>& items)
+{
+    if (!m_keyboardSearchIndexValid || items.isEmpty()) {
+        return;
+    }
+
+    m_keyboardSearchSuccessorsValid = false;
+
+    if (items.count() == 1) {
+        // A renamed item
+        const KeyboardSearchEntry entry = {items.first()->item.text().toCaseFolded(), items.first()};
+        const auto it = std::upper_bound(m_keyboardSearchIndex.begin(), m_keyboardSearchIndex.end(), entry, keyboardSearchEntryLessThan);
+        m_keyboardSearchIndex.insert(it, entry);
+        return;
+    }
+
+    // Sort the new entries and merge them with the existing ones, which
+    // requires O(N + M log M) steps for M new entries.
+    const int oldCount = m_keyboardSearchIndex.count();
+    m_keyboardSearchIndex.reserve(oldCount + items.count());
+    foreach (const ItemData* itemData, items) {
+        m_keyboardSearchIndex.append({itemData->item.text().toCaseFolded(), itemData});
+    }
+
+    const auto middle = m_keyboardSearchIndex.begin() + oldCount;
+    std::sort(middle, m_keyboardSearchIndex.end(), keyboardSearchEntryLessThan);
+    std::inplace_merge(m_keyboardSearchIndex.begin(), middle, m_keyboardSearchIndex.end(), keyboardSearchEntryLessThan);
+}
+
+void KFileItemModel::removeFromKeyboardSearchIndex(const QVector<KeyboardSearchEntry>& entries)
+{
+    if (!m_keyboardSearchIndexValid || entries.isEmpty()) {
+        return;
+    }
+
+    m_keyboardSearchSuccessorsValid = false;
+
+    // Find each entry with a binary search and mark it as removed. Entries with
+    // the same key are told apart by their pointers, because the ItemData might
+    // have been deleted already.
+    const auto begin = m_keyboardSearchIndex.begin();
+    const auto end = m_keyboardSearchIndex.end();
+    auto firstRemoved = end;
+    QSet<const ItemData*> missingItems;
+    foreach (const KeyboardSearchEntry& entry, entries) {
+        const auto range = std::equal_range(begin, end, entry, keyboardSearchEntryLessThan);
+        auto it = range.first;
+        while (it != range.second && it->data != entry.data) {
+            ++it;
+        }
+
+        if (it != range.second) {
+            it->data = nullptr;
+            firstRemoved = qMin(firstRemoved, it);
+        } else {
+            missingItems.insert(entry.data);
+        }
+    }
+
+    if (!missingItems.isEmpty()) {
+        // The key of an entry does not match the text of its item anymore,
+        // so the entry cannot be found by a binary search.
+        for (auto it = begin; it != end; ++it) {
+            if (missingItems.contains(it->data)) {
+                it->data = nullptr;
+                firstRemoved = qMin(firstRemoved, it);
+            }
+        }
+    }
+
+    const auto newEnd = std::remove_if(firstRemoved, end, [](const KeyboardSearchEntry& entry) {
+                                           return !entry.data;
+                                       });
+    m_keyboardSearchIndex.erase(newEnd, end);
+}
+
+bool KFileItemModel::keyboardSearchEntryLessThan(const KeyboardSearchEntry& a, const KeyboardSearchEntry& b)
+{
+    return a.key < b.key;
+}
+
+void KFileItemModel::updateItemIndexes(int first)
+{
+    m_keyboardSearchSuccessorsValid = false;
+    for (int i = first, iMax = m_itemData.count(); i < iMax; ++i) {
+        m_itemData.at(i)->index = i;
+    }
+}
+
+void KFileItemModel::emitResortingSignals(const QVector<int>& newIndexes, const QList<QPair<int, QVariant> >& newGroups)
+{
+    // ItemData::index has been changed for the moved items.
+    m_keyboardSearchSuccessorsValid = false;
+
+    const int itemCount = newIndexes.count();
+
+    // Determine the first index that has been moved.
+    int firstMovedIndex = 0;
+    while (firstMovedIndex < itemCount && newIndexes.at(firstMovedIndex) == firstMovedIndex) {
+        ++firstMovedIndex;
+    }
+
+    const bool itemsHaveMoved = firstMovedIndex < itemCount;
+    if (itemsHaveMoved) {
+        m_groups = newGroups;
+
+        int lastMovedIndex = itemCount - 1;
+        while (lastMovedIndex > firstMovedIndex && newIndexes.at(lastMovedIndex) == lastMovedIndex) {
+            --lastMovedIndex;
+        }
+
+        Q_ASSERT(firstMovedIndex <= lastMovedIndex);
+
+        // Create a list movedToIndexes, which has the property that
+        // movedToIndexes[i] is the new index of the item with the old index
+        // firstMovedIndex + i.
+        const int movedItemsCount = lastMovedIndex - firstMovedIndex + 1;
+        const QList<int> movedToIndexes = newIndexes.mid(firstMovedIndex, movedItemsCount).toList();
+
+        emit itemsMoved(KItemRange(firstMovedIndex, movedItemsCount), movedToIndexes);
+    } else if (groupedSorting()) {
+        // The groups might have changed even if the order of the items has not.
+        const QList<QPair<int, QVariant> > oldGroups = m_groups;
+        m_groups.clear();
+        if (groups() != oldGroups) {
+            emit groupsChanged();
+        }
+    }
+}
+
+void KFileItemModel::slotDayChanged()
+{
+    if (m_groupsDate.isValid() && !m_groups.isEmpty()) {
+        m_groups.clear();
+        if (groupedSorting()) {
+            emit groupsChanged();
+        }
+    }
+}
+
+void KFileItemModel::slotCompleted(const QUrl& directoryUrl)
+{
+    const bool rootCompleted = directoryUrl.isEmpty() || directoryUrl == directory();
+    const QUrl completedUrl = rootCompleted ? directory() : directoryUrl;
+    if (m_directoriesToReconcile.contains(completedUrl)) {
+        reconcileDirectory(completedUrl, true);
+    }
+    if (rootCompleted) {
+        m_directoryListed = true;
+    }
+
+    dispatchPendingItemsToInsert();
+    finishExpansion(directoryUrl);
+
+    if (!m_urlsToExpand.isEmpty()) {
+        // Note that the parent folder must be expanded before any of its subfolders become visible.
+        // Therefore, some URLs in m_urlsToExpand might not be visible yet. They are
+        // expanded in one of the next waves after their parent folders have been listed.
+        expandVisibleUrls();
+    }
+
+    if (!m_urlsBeingExpanded.isEmpty()) {
+        // The dir lister has been triggered. This slot will be called
+        // again after the directories have been expanded.
+        return;
+    }
+
+    // None of the remaining URLs in m_urlsToExpand could be found in the model. This can happen
+    // if these URLs have been deleted in the meantime.
+    m_urlsToExpand.clear();
+
     emit directoryLoadingCompleted();
 }
 
 void KFileItemModel::slotCanceled()
 {
+    const QList<QUrl> directoriesToReconcile = m_directoriesToReconcile.keys();
+    foreach (const QUrl& url, directoriesToReconcile) {
+        reconcileDirectory(url, false);
+    }
+
     m_maximumUpdateIntervalTimer->stop();
+    m_urlsBeingExpanded.clear();
     dispatchPendingItemsToInsert();
 
     emit directoryLoadingCanceled();
 }
 
+void KFileItemModel::slotDirectoryCanceled(const QUrl& directoryUrl)
+{
+    if (m_directoriesToReconcile.contains(directoryUrl)) {
+        reconcileDirectory(directoryUrl, false);
+    }
+
+    // The listing of an expanded directory has failed or has been stopped. The
+    // remaining directories are still expanded, and slotCanceled() is invoked
+    // if there are none.
+    finishExpansion(directoryUrl);
+}
+
 void KFileItemModel::slotItemsAdded(const QUrl &directoryUrl, const KFileItemList& items)
 {
     Q_ASSERT(!items.isEmpty());
 
+    const QHash<QUrl, KFileItemList>::iterator reconciledDirectory = m_directoriesToReconcile.find(directoryUrl);
+    if (reconciledDirectory != m_directoriesToReconcile.end()) {
+        // The listed items are compared with the items of the model
+        // in reconcileDirectory().
+        reconciledDirectory.value().append(items);
+        return;
+    }
+
     QUrl parentUrl;
     if (m_expandedDirs.contains(directoryUrl)) {
         parentUrl = m_expandedDirs.value(directoryUrl);
@@ -969,7 +2041,8 @@ void KFileItemModel::slotItemsAdded(const QUrl &directoryUrl, const KFileItemLis
         // might result in emitting the same items twice due to the Keep-parameter.
         // This case happens if an item gets expanded, collapsed and expanded again
         // before the items could be loaded for the first expansion.
-        if (index(items.first().url()) >= 0) {
+        const KFileItem& firstItem = items.first();
+        if (index(firstItem.url()) >= 0 || (!isShownItem(firstItem) && containsHiddenItem(firstItem.url()))) {
             // The items are already part of the model.
             return;
         }
@@ -984,29 +2057,44 @@ void KFileItemModel::slotItemsAdded(const QUrl &directoryUrl, const KFileItemLis
         // they got collapsed again with KFileItemModel::setExpanded(false). So it must be
         // checked whether the parent for new items is still expanded.
         const int parentIndex = index(parentUrl);
-        if (parentIndex >= 0 && !m_itemData[parentIndex]->values.value("isExpanded").toBool()) {
+        if (parentIndex >= 0 && !(m_itemData[parentIndex]->flags & IsExpandedFlag)) {
             // The parent is not expanded.
             return;
         }
     }
 
-    QList<ItemData*> itemDataList = createItemDataList(parentUrl, items);
-
-    if (!m_filter.hasSetFilters()) {
-        m_pendingItemsToInsert.append(itemDataList);
+    if (canPrepareItemsInBackground(parentUrl)) {
+        // Sort the items on a worker thread. The worker only gets copies of
+        // the values that are compared, the GUI thread merges the sorted runs
+        // and creates the items in dispatchPendingItemsToInsert().
+        m_pendingItemBatches.append(QtConcurrent::run(this, &KFileItemModel::sortRecords, createSortRecords(items)));
     } else {
-        // The name or type filter is active. Hide filtered items
-        // before inserting them into the model and remember
-        // the filtered items in m_filteredItems.
-        foreach (ItemData* itemData, itemDataList) {
-            if (m_filter.matches(itemData->item)) {
-                m_pendingItemsToInsert.append(itemData);
-            } else {
-                m_filteredItems.insert(itemData->item, itemData);
+        QList<ItemData*> itemDataList = createItemDataList(parentUrl, items);
+
+        if (!m_filter.hasSetFilters() && m_showHiddenFiles && !m_showDirectoriesOnly) {
+            m_pendingItemsToInsert.append(itemDataList);
+        } else {
+            // Items which are not shown are remembered in m_pendingHiddenItems.
+            // If the name or type filter is active, filtered items are hidden
+            // before inserting them into the model and remembered in m_filteredItems.
+            foreach (ItemData* itemData, itemDataList) {
+                if (!isShownItem(itemData->item)) {
+                    m_pendingHiddenItems.append(itemData);
+                } else if (m_filter.matches(itemData->item)) {
+                    m_pendingItemsToInsert.append(itemData);
+                } else {
+                    m_filteredItems.insert(itemData->item, itemData);
+                }
             }
         }
     }
 
+    if (m_dirLister->localListingEnabled() && m_itemData.isEmpty() && directoryUrl == directory()) {
+        // Local listings deliver a small first batch, which is shown
+        // immediately. The following batches are dispatched periodically.
+        dispatchPendingItemsToInsert();
+    }
+
     if (useMaximumUpdateInterval() && !m_maximumUpdateIntervalTimer->isActive()) {
         // Assure that items get dispatched if no completed() or canceled() signal is
         // emitted during the maximum update interval.
@@ -1018,23 +2106,55 @@ void KFileItemModel::slotItemsDeleted(const KFileItemList& items)
 {
     dispatchPendingItemsToInsert();
 
+    if (!m_directoriesToReconcile.isEmpty()) {
+        // Deleted items must not be added again by reconcileDirectory()
+        QSet<QUrl> deletedUrls;
+        foreach (const KFileItem& item, items) {
+            deletedUrls.insert(item.url());
+        }
+        auto isDeleted = [&deletedUrls](const KFileItem& item) {
+            return deletedUrls.contains(item.url());
+        };
+        for (auto it = m_directoriesToReconcile.begin(); it != m_directoriesToReconcile.end(); ++it) {
+            KFileItemList& listedItems = it.value();
+            listedItems.erase(std::remove_if(listedItems.begin(), listedItems.end(), isDeleted), listedItems.end());
+        }
+    }
+
     QVector<int> indexesToRemove;
     indexesToRemove.reserve(items.count());
 
+    QSet<QUrl> hiddenUrlsToRemove;
+
     foreach (const KFileItem& item, items) {
         const int indexForItem = index(item);
         if (indexForItem >= 0) {
             indexesToRemove.append(indexForItem);
         } else {
-            // Probably the item has been filtered.
+            // Probably the item has been filtered or hidden.
             QHash<KFileItem, ItemData*>::iterator it = m_filteredItems.find(item);
             if (it != m_filteredItems.end()) {
-                delete it.value();
+                destroyItemData(it.value());
                 m_filteredItems.erase(it);
+            } else if (!m_hiddenItems.isEmpty()) {
+                hiddenUrlsToRemove.insert(item.url());
             }
         }
     }
 
+    if (!hiddenUrlsToRemove.isEmpty()) {
+        // Removing items keeps the order of m_hiddenItems.
+        QList<ItemData*>::iterator hiddenEnd = std::remove_if(m_hiddenItems.begin(), m_hiddenItems.end(),
+            [this, &hiddenUrlsToRemove](ItemData* itemData) {
+                if (hiddenUrlsToRemove.contains(itemData->item.url())) {
+                    destroyItemData(itemData);
+                    return true;
+                }
+                return false;
+            });
+        m_hiddenItems.erase(hiddenEnd, m_hiddenItems.end());
+    }
+
     std::sort(indexesToRemove.begin(), indexesToRemove.end());
 
     if (m_requestRole[ExpandedParentsCountRole] && !m_expandedDirs.isEmpty()) {
@@ -1069,36 +2189,97 @@ void KFileItemModel::slotRefreshItems(const QList<QPair<KFileItem, KFileItem> >&
     qCDebug(DolphinDebug) << "Refreshing" << items.count() << "items";
 #endif
 
+    // Items which have been hidden before or are hidden now, e.g., because they have
+    // been renamed to or from a dot file, are removed and added again. This moves them
+    // between the model and m_hiddenItems, and assures that the order of
+    // m_hiddenItems is kept.
+    KFileItemList itemsToRemove;
+    QHash<QUrl, KFileItemList> itemsToAdd;
+    for (const auto& itemPair : items) {
+        if (!isShownItem(itemPair.first) || !isShownItem(itemPair.second)) {
+            itemsToRemove.append(itemPair.first);
+            const QUrl directoryUrl = itemPair.second.url().adjusted(QUrl::RemoveFilename | QUrl::StripTrailingSlash);
+            itemsToAdd[directoryUrl].append(itemPair.second);
+        }
+    }
+
+    if (!itemsToRemove.isEmpty()) {
+        slotItemsDeleted(itemsToRemove);
+        for (auto it = itemsToAdd.constBegin(); it != itemsToAdd.constEnd(); ++it) {
+            slotItemsAdded(it.key(), it.value());
+        }
+        dispatchPendingItemsToInsert();
+    }
+
     // Get the indexes of all items that have been refreshed
     QList<int> indexes;
     indexes.reserve(items.count());
 
     QSet<QByteArray> changedRoles;
 
+    // The texts of the refreshed items might have changed
+    QList<ItemData*> refreshedItems;
+    QSet<const ItemData*> refreshedItemsSet;
+    QVector<KeyboardSearchEntry> removedSearchEntries;
+
     QListIterator<QPair<KFileItem, KFileItem> > it(items);
     while (it.hasNext()) {
         const QPair<KFileItem, KFileItem>& itemPair = it.next();
         const KFileItem& oldItem = itemPair.first;
         const KFileItem& newItem = itemPair.second;
+        if (!isShownItem(oldItem) || !isShownItem(newItem)) {
+            // The item has been removed and added again above.
+            continue;
+        }
+
         const int indexForItem = index(oldItem);
         if (indexForItem >= 0) {
-            m_itemData[indexForItem]->item = newItem;
+            ItemData* itemData = m_itemData.at(indexForItem);
+            const QHash<QByteArray, QVariant> oldValues = data(indexForItem);
+            if (m_keyboardSearchIndexValid && !refreshedItemsSet.contains(itemData)) {
+                removedSearchEntries.append({itemData->item.text().toCaseFolded(), itemData});
+                refreshedItems.append(itemData);
+                refreshedItemsSet.insert(itemData);
+            }
+
+            // The selection summary depends on the size and the type of the
+            // items, even if the corresponding roles are not requested.
+            if (itemData->item.isDir() != newItem.isDir()) {
+                changedRoles.insert(sharedValue("isDir"));
+            }
+            if (itemData->item.size() != newItem.size()) {
+                changedRoles.insert(sharedValue("size"));
+            }
+
+            removeFromItemCounts(itemData->item);
+            itemData->item = newItem;
+            m_dataCache.remove(itemData);
+            addToItemCounts(newItem);
+            updateSortKey(itemData);
 
             // Keep old values as long as possible if they could not retrieved synchronously yet.
             // The update of the values will be done asynchronously by KFileItemModelRolesUpdater.
-            QHashIterator<QByteArray, QVariant> it(retrieveData(newItem, m_itemData.at(indexForItem)->parent));
-            QHash<QByteArray, QVariant>& values = m_itemData[indexForItem]->values;
+            storeMimeTypeRoles(itemData);
+            QHashIterator<QByteArray, QVariant> it(retrieveData(newItem, itemData->parent));
             while (it.hasNext()) {
                 it.next();
-                const QByteArray& role = it.key();
-                if (values.value(role) != it.value()) {
-                    values.insert(role, it.value());
+                if (hasStoredValue(itemData, it.key())) {
+                    setStoredValue(itemData, it.key(), it.value());
+                }
+            }
+            m_dataCache.remove(itemData);
+
+            QHashIterator<QByteArray, QVariant> newIt(data(indexForItem));
+            while (newIt.hasNext()) {
+                newIt.next();
+                const QByteArray& role = newIt.key();
+                if (oldValues.value(role) != newIt.value()) {
                     changedRoles.insert(role);
                 }
             }
 
             m_items.remove(oldItem.url());
-            m_items.insert(newItem.url(), indexForItem);
+            m_items.insert(newItem.url(), itemData);
             indexes.append(indexForItem);
         } else {
             // Check if 'oldItem' is one of the filtered items.
@@ -1106,10 +2287,11 @@ void KFileItemModel::slotRefreshItems(const QList<QPair<KFileItem, KFileItem> >&
             if (it != m_filteredItems.end()) {
                 ItemData* itemData = it.value();
                 itemData->item = newItem;
+                updateSortKey(itemData);
 
-                // The data stored in 'values' might have changed. Therefore, we clear
-                // 'values' and re-populate it the next time it is requested via data(int).
-                itemData->values.clear();
+                // The stored values might have changed. Therefore, we clear them
+                // and re-populate them when the item gets visible again.
+                clearStoredValues(itemData);
 
                 m_filteredItems.erase(it);
                 m_filteredItems.insert(newItem, itemData);
@@ -1117,7 +2299,11 @@ void KFileItemModel::slotRefreshItems(const QList<QPair<KFileItem, KFileItem> >&
         }
     }
 
-    // If the changed items have been created recently, they might not be in m_items yet.
+    removeFromKeyboardSearchIndex(removedSearchEntries);
+    addToKeyboardSearchIndex(refreshedItems);
+
+    // If the changed items have been created recently, they might still be in
+    // m_pendingItemsToInsert and not in m_items yet.
     // In that case, the list 'indexes' might be empty.
     if (indexes.isEmpty()) {
         return;
@@ -1135,25 +2321,53 @@ void KFileItemModel::slotClear()
     qCDebug(DolphinDebug) << "Clearing all items";
 #endif
 
-    qDeleteAll(m_filteredItems);
     m_filteredItems.clear();
+    m_hiddenItems.clear();
+    m_pendingHiddenItems.clear();
+    m_hiddenItemsSorted = true;
     m_groups.clear();
 
     m_maximumUpdateIntervalTimer->stop();
     m_resortAllItemsTimer->stop();
+    m_itemsToResort.clear();
 
-    qDeleteAll(m_pendingItemsToInsert);
+    foreach (const QFuture<QVector<SortRecord> >& batch, m_pendingItemBatches) {
+        batch.waitForFinished();
+    }
+    m_pendingItemBatches.clear();
+    m_preparedItems.clear();
     m_pendingItemsToInsert.clear();
 
     const int removedCount = m_itemData.count();
     if (removedCount > 0) {
-        qDeleteAll(m_itemData);
+        emit itemsAboutToBeRemoved(KItemRangeList() << KItemRange(0, removedCount));
+    }
+
+    // All items belong to the arena of the directory. Their destructors are
+    // still invoked, but the memory is released with a few slabs instead of
+    // one heap allocation per item.
+    m_dataCache.clear();
+    m_itemDataArena.clear();
+
+    if (removedCount > 0) {
         m_itemData.clear();
         m_items.clear();
+        m_fileCount = 0;
+        m_folderCount = 0;
+        m_totalFileSize = 0;
+        m_keyboardSearchIndex.clear();
+        m_keyboardSearchIndexValid = false;
+        m_keyboardSearchSuccessors.clear();
+        m_keyboardSearchSuccessorsValid = false;
         emit itemsRemoved(KItemRangeList() << KItemRange(0, removedCount));
     }
 
     m_expandedDirs.clear();
+    m_urlsBeingExpanded.clear();
+
+    m_directoryListed = false;
+    m_directoriesToReconcile.clear();
+    m_changeCoalescer->clear();
 }
 
 void KFileItemModel::slotSortingChoiceChanged()
@@ -1162,15 +2376,306 @@ void KFileItemModel::slotSortingChoiceChanged()
     resortAllItems();
 }
 
+void KFileItemModel::slotListerItemsAdded(const QUrl& directoryUrl, const KFileItemList& items)
+{
+    if (isCoalescingChanges(directoryUrl)) {
+        m_changeCoalescer->addItems(directoryUrl, items);
+    } else {
+        // Apply the pending changes first to keep the order of the changes
+        m_changeCoalescer->flush();
+        slotItemsAdded(directoryUrl, items);
+    }
+}
+
+void KFileItemModel::slotListerItemsDeleted(const KFileItemList& items)
+{
+    if (isCoalescingChanges(QUrl())) {
+        m_changeCoalescer->deleteItems(items);
+    } else {
+        m_changeCoalescer->flush();
+        slotItemsDeleted(items);
+    }
+}
+
+void KFileItemModel::slotListerRefreshItems(const QList<QPair<KFileItem, KFileItem> >& items)
+{
+    if (isCoalescingChanges(QUrl())) {
+        m_changeCoalescer->refreshItems(items);
+    } else {
+        m_changeCoalescer->flush();
+        slotRefreshItems(items);
+    }
+}
+
+void KFileItemModel::slotChangesCoalesced(const KFileItemList& deletedItems,
+                                          const QList<QPair<KFileItem, KFileItem> >& refreshedItems,
+                                          const QHash<QUrl, KFileItemList>& addedItems)
+{
+    if (!deletedItems.isEmpty()) {
+        slotItemsDeleted(deletedItems);
+    }
+
+    if (!refreshedItems.isEmpty()) {
+        slotRefreshItems(refreshedItems);
+    }
+
+    if (!addedItems.isEmpty()) {
+        QHashIterator<QUrl, KFileItemList> it(addedItems);
+        while (it.hasNext()) {
+            it.next();
+            slotItemsAdded(it.key(), it.value());
+        }
+        dispatchPendingItemsToInsert();
+    }
+}
+
 void KFileItemModel::dispatchPendingItemsToInsert()
 {
+    if (!m_pendingHiddenItems.isEmpty()) {
+        addHiddenItems(m_pendingHiddenItems);
+        m_pendingHiddenItems.clear();
+    }
+
     if (!m_pendingItemsToInsert.isEmpty()) {
         insertItems(m_pendingItemsToInsert);
         m_pendingItemsToInsert.clear();
     }
+
+    if (!m_pendingItemBatches.isEmpty()) {
+        QList<ItemData*> preparedItems = takePreparedItems();
+        if (!preparedItems.isEmpty()) {
+            insertItems(preparedItems, NewItemsAreSorted);
+        }
+    }
+}
+
+void KFileItemModel::finishPendingItemBatches()
+{
+    if (!m_pendingItemBatches.isEmpty()) {
+        // The items are added to the unsorted pending items, because the
+        // sorting settings might be changed by the caller.
+        m_pendingItemsToInsert.append(takePreparedItems());
+    }
+}
+
+QList<KFileItemModel::ItemData*> KFileItemModel::takePreparedItems()
+{
+#ifdef KFILEITEMMODEL_DEBUG
+    QElapsedTimer timer;
+    timer.start();
+#endif
+
+    QList<QVector<SortRecord> > runs;
+    foreach (const QFuture<QVector<SortRecord> >& batch, m_pendingItemBatches) {
+        runs.append(batch.result());
+    }
+    m_pendingItemBatches.clear();
+
+    // Merge neighboring runs pairwise, which needs O(n * log(runs)) comparisons.
+    while (runs.count() > 1) {
+        QList<QVector<SortRecord> > mergedRuns;
+        for (int i = 0; i + 1 < runs.count(); i += 2) {
+            mergedRuns.append(mergeSortRecords(runs.at(i), runs.at(i + 1)));
+        }
+        if (runs.count() % 2 == 1) {
+            mergedRuns.append(runs.last());
+        }
+        runs = mergedRuns;
+    }
+
+    const QVector<SortRecord> records = runs.isEmpty() ? QVector<SortRecord>() : runs.first();
+    const QVector<ItemData*> itemDataVector = m_itemDataArena.create(records.count());
+    QList<ItemData*> items;
+    items.reserve(records.count());
+    for (int i = 0; i < records.count(); ++i) {
+        const SortRecord& record = records.at(i);
+        ItemData* itemData = itemDataVector.at(i);
+        itemData->item = m_preparedItems.at(record.index);
+        itemData->parent = nullptr;
+        if (record.sortKey) {
+            itemData->sortKey.reset(new QCollatorSortKey(*record.sortKey));
+        }
+        items.append(itemData);
+    }
+    m_preparedItems.clear();
+
+    if (!m_showHiddenFiles || m_showDirectoriesOnly) {
+        // Move the items which are not shown to m_hiddenItems. Both
+        // resulting lists keep the order of the prepared items.
+        QList<ItemData*> shownItems;
+        QList<ItemData*> hiddenItems;
+        shownItems.reserve(items.count());
+        foreach (ItemData* itemData, items) {
+            if (isShownItem(itemData->item)) {
+                shownItems.append(itemData);
+            } else {
+                hiddenItems.append(itemData);
+            }
+        }
+        addHiddenItems(hiddenItems, NewItemsAreSorted);
+        items = shownItems;
+    }
+
+    if (m_filter.hasSetFilters()) {
+        // Hide the filtered items. The order of the remaining items is kept.
+        QList<ItemData*> visibleItems;
+        visibleItems.reserve(items.count());
+        const QVector<bool> itemsMatch = filterMatches(items);
+        for (int i = 0; i < items.count(); ++i) {
+            ItemData* itemData = items.at(i);
+            if (itemsMatch.at(i)) {
+                visibleItems.append(itemData);
+            } else {
+                m_filteredItems.insert(itemData->item, itemData);
+            }
+        }
+        items = visibleItems;
+    }
+
+#ifdef KFILEITEMMODEL_DEBUG
+    qCDebug(DolphinDebug) << "[TIME] Waiting for and merging" << items.count() << "prepared items:" << timer.elapsed();
+#endif
+
+    return items;
+}
+
+bool KFileItemModel::canPrepareItemsInBackground(const QUrl& parentUrl) const
+{
+    if (!m_itemBatchPipelineEnabled) {
+        return false;
+    }
+
+    // Children of expanded items need their parent, which might be
+    // removed while the worker thread is running.
+    if (index(parentUrl) >= 0) {
+        return false;
+    }
+
+    // The sort records only contain the values of the KFileItem that are
+    // compared for the following sort roles. For all other roles except
+    // the ones below, new items have no stored values yet. The values that
+    // prepareItemsForSorting() stores require a sort on the GUI thread.
+    switch (m_sortRole) {
+    case TypeRole:
+    case PermissionsRole:
+    case OwnerRole:
+    case GroupRole:
+    case DestinationRole:
+    case PathRole:
+    case DeletionTimeRole:
+        return false;
+    default:
+        return true;
+    }
+}
+
+QVector<KFileItemModel::SortRecord> KFileItemModel::createSortRecords(const KFileItemList& items)
+{
+    QVector<SortRecord> records;
+    records.reserve(items.count());
+
+    foreach (const KFileItem& item, items) {
+        SortRecord record;
+        record.text = item.text();
+        record.name = item.name();
+        record.url = item.url().url();
+        record.isDir = item.isDir();
+        record.index = m_preparedItems.count();
+
+        // Folders have no stored number of sub-items yet, see sortRoleCompare().
+        switch (m_sortRole) {
+        case SizeRole:
+            record.value = record.isDir ? -1 : qint64(item.size());
+            break;
+        case ModificationTimeRole:
+            record.value = item.entry().numberValue(KIO::UDSEntry::UDS_MODIFICATION_TIME, -1);
+            break;
+        case CreationTimeRole:
+            record.value = item.entry().numberValue(KIO::UDSEntry::UDS_CREATION_TIME, -1);
+            break;
+        default:
+            record.value = 0;
+            break;
+        }
+
+        records.append(record);
+        m_preparedItems.append(item);
+    }
+
+    return records;
+}
+
+QVector<KFileItemModel::SortRecord> KFileItemModel::sortRecords(QVector<SortRecord> records) const
+{
+    if (m_useSortKeys) {
+        for (int i = 0; i < records.count(); ++i) {
+            records[i].sortKey.reset(new QCollatorSortKey(m_collator.sortKey(records.at(i).text)));
+        }
+    }
+
+    // The records are sorted by this thread only, other pool threads
+    // are busy with the remaining batches.
+    mergeSort(records.begin(), records.end(), [this](const SortRecord& a, const SortRecord& b) {
+        return sortRecordLessThan(a, b);
+    });
+
+    return records;
+}
+
+QVector<KFileItemModel::SortRecord> KFileItemModel::mergeSortRecords(const QVector<SortRecord>& a, const QVector<SortRecord>& b) const
+{
+    QVector<SortRecord> result;
+    result.reserve(a.count() + b.count());
+    std::merge(a.constBegin(), a.constEnd(), b.constBegin(), b.constEnd(), std::back_inserter(result),
+               [this](const SortRecord& x, const SortRecord& y) { return sortRecordLessThan(x, y); });
+    return result;
+}
+
+bool KFileItemModel::sortRecordLessThan(const SortRecord& a, const SortRecord& b) const
+{
+    // See KFileItemModel::lessThan() and KFileItemModel::sortRoleCompare().
+    if (m_sortDirsFirst || m_sortRole == SizeRole) {
+        if (a.isDir && !b.isDir) {
+            return true;
+        } else if (!a.isDir && b.isDir) {
+            return false;
+        }
+    }
+
+    int result = 0;
+    if (a.value < b.value) {
+        result = -1;
+    } else if (a.value > b.value) {
+        result = +1;
+    }
+
+    if (result == 0) {
+        if (a.sortKey && b.sortKey) {
+            result = a.sortKey->compare(*b.sortKey);
+        } else {
+            result = stringCompare(a.text, b.text, m_collator);
+        }
+    }
+    if (result == 0) {
+        result = stringCompare(a.name, b.name, m_collator);
+    }
+    if (result == 0) {
+        result = QString::compare(a.url, b.url, Qt::CaseSensitive);
+    }
+
+    return (m_itemSortOrder == Qt::AscendingOrder) ? result < 0 : result > 0;
+}
+
+QList<KFileItemModel::ItemData*> KFileItemModel::mergeItemDataLists(const QList<ItemData*>& a, const QList<ItemData*>& b) const
+{
+    QList<ItemData*> result;
+    result.reserve(a.count() + b.count());
+    std::merge(a.constBegin(), a.constEnd(), b.constBegin(), b.constEnd(), std::back_inserter(result),
+               [this](const ItemData* x, const ItemData* y) { return lessThan(x, y, m_collator); });
+    return result;
 }
 
-void KFileItemModel::insertItems(QList<ItemData*>& newItems)
+void KFileItemModel::insertItems(QList<ItemData*>& newItems, InsertItemsBehavior behavior)
 {
     if (newItems.isEmpty()) {
         return;
@@ -1183,19 +2688,22 @@ void KFileItemModel::insertItems(QList<ItemData*>& newItems)
     qCDebug(DolphinDebug) << "Inserting" << newItems.count() << "items";
 #endif
 
-    m_groups.clear();
-    prepareItemsForSorting(newItems);
+    // Items that have been prepared by a worker thread are sorted
+    // already, see KFileItemModel::takePreparedItems().
+    if (behavior == SortNewItems) {
+        prepareItemsForSorting(newItems);
+
+        if (m_sortRole == NameRole && m_naturalSorting && !m_useSortKeys) {
+            // Natural sorting of items without sort keys can be very slow. However,
+            // it becomes much faster if the input sequence is already mostly sorted.
+            // Therefore, we first sort 'newItems' according to the QStrings returned by
+            // KFileItem::text() using QString::operator<(), which is quite fast.
+            parallelMergeSort(newItems.begin(), newItems.end(), nameLessThan, QThread::idealThreadCount());
+        }
 
-    if (m_sortRole == NameRole && m_naturalSorting) {
-        // Natural sorting of items can be very slow. However, it becomes much
-        // faster if the input sequence is already mostly sorted. Therefore, we
-        // first sort 'newItems' according to the QStrings returned by
-        // KFileItem::text() using QString::operator<(), which is quite fast.
-        parallelMergeSort(newItems.begin(), newItems.end(), nameLessThan, QThread::idealThreadCount());
+        sort(newItems.begin(), newItems.end());
     }
 
-    sort(newItems.begin(), newItems.end());
-
 #ifdef KFILEITEMMODEL_DEBUG
     qCDebug(DolphinDebug) << "[TIME] Sorting:" << timer.elapsed();
 #endif
@@ -1211,6 +2719,22 @@ void KFileItemModel::insertItems(QList<ItemData*>& newItems)
         m_itemData = newItems;
         itemRanges << KItemRange(0, newItemCount);
     } else {
+        // If all new items are children of the same expanded item, they can
+        // only be inserted between the existing children of this item. The
+        // index of the parent and the end of its children replace the walk
+        // through the parent chains in lessThan() for all other items.
+        int compareBegin = 0;
+        int compareEnd = existingItemCount;
+        const ItemData* parent = commonParent(newItems);
+        if (parent) {
+            compareBegin = parent->index + 1;
+            compareEnd = compareBegin;
+            const int parentLevel = expandedParentsCount(parent);
+            while (compareEnd < existingItemCount && expandedParentsCount(m_itemData.at(compareEnd)) > parentLevel) {
+                ++compareEnd;
+            }
+        }
+
         m_itemData.reserve(totalItemCount);
         for (int i = existingItemCount; i < totalItemCount; ++i) {
             m_itemData.append(nullptr);
@@ -1226,7 +2750,14 @@ void KFileItemModel::insertItems(QList<ItemData*>& newItems)
 
         while (sourceIndexNewItems >= 0) {
             ItemData* newItem = newItems.at(sourceIndexNewItems);
-            if (sourceIndexExistingItems >= 0 && lessThan(newItem, m_itemData.at(sourceIndexExistingItems), m_collator)) {
+            bool isExistingItemGreater = false;
+            if (sourceIndexExistingItems >= compareEnd) {
+                isExistingItemGreater = true;
+            } else if (sourceIndexExistingItems >= compareBegin) {
+                isExistingItemGreater = lessThan(newItem, m_itemData.at(sourceIndexExistingItems), m_collator);
+            }
+
+            if (isExistingItemGreater) {
                 // Move an existing item to its new position. If any new items
                 // are behind it, push the item range to itemRanges.
                 if (rangeCount > 0) {
@@ -1254,9 +2785,16 @@ void KFileItemModel::insertItems(QList<ItemData*>& newItems)
         std::reverse(itemRanges.begin(), itemRanges.end());
     }
 
-    // The indexes in m_items are not correct anymore. Therefore, we clear m_items.
-    // It will be re-populated with the updated indices if index(const QUrl&) is called.
-    m_items.clear();
+    // Only the URLs of the new items have to be added to m_items. The indexes
+    // of the items behind the first inserted item have changed.
+    m_items.reserve(totalItemCount);
+    foreach (ItemData* newItem, newItems) {
+        m_items.insert(newItem->item.url(), newItem);
+        addToItemCounts(newItem->item);
+    }
+    addToKeyboardSearchIndex(newItems);
+    updateItemIndexes(itemRanges.first().index);
+    updateGroupsAfterInsertion(itemRanges);
 
     emit itemsInserted(itemRanges);
 
@@ -1265,22 +2803,47 @@ void KFileItemModel::insertItems(QList<ItemData*>& newItems)
 #endif
 }
 
+void KFileItemModel::destroyItemData(ItemData* itemData)
+{
+    // The arena reuses the slot of the destroyed item, so no references
+    // to it may be kept.
+    m_itemsToResort.remove(itemData);
+    m_dataCache.remove(itemData);
+    m_itemDataArena.destroy(itemData);
+}
+
 void KFileItemModel::removeItems(const KItemRangeList& itemRanges, RemoveItemsBehavior behavior)
 {
     if (itemRanges.isEmpty()) {
         return;
     }
 
-    m_groups.clear();
+    emit itemsAboutToBeRemoved(itemRanges);
 
     // Step 1: Remove the items from m_itemData, and free the ItemData.
     int removedItemsCount = 0;
+    QVector<KeyboardSearchEntry> removedSearchEntries;
     foreach (const KItemRange& range, itemRanges) {
         removedItemsCount += range.count;
 
         for (int index = range.index; index < range.index + range.count; ++index) {
+            ItemData* itemData = m_itemData.at(index);
+            removeFromItemCounts(itemData->item);
+            if (m_keyboardSearchIndexValid) {
+                removedSearchEntries.append({itemData->item.text().toCaseFolded(), itemData});
+            }
+
+            // If the model contains multiple items with the same URL (see
+            // KFileItemModelTest::testInconsistentModel()), m_items might
+            // refer to another one of them.
+            const QUrl url = itemData->item.url();
+            QHash<QUrl, ItemData*>::iterator it = m_items.find(url);
+            if (it != m_items.end() && it.value() == itemData) {
+                m_items.erase(it);
+            }
+
             if (behavior == DeleteItemData) {
-                delete m_itemData.at(index);
+                destroyItemData(itemData);
             }
 
             m_itemData[index] = nullptr;
@@ -1306,10 +2869,9 @@ void KFileItemModel::removeItems(const KItemRangeList& itemRanges, RemoveItemsBe
     }
 
     m_itemData.erase(m_itemData.end() - removedItemsCount, m_itemData.end());
-
-    // The indexes in m_items are not correct anymore. Therefore, we clear m_items.
-    // It will be re-populated with the updated indices if index(const QUrl&) is called.
-    m_items.clear();
+    removeFromKeyboardSearchIndex(removedSearchEntries);
+    updateItemIndexes(itemRanges.at(0).index);
+    updateGroupsAfterRemoval(itemRanges);
 
     emit itemsRemoved(itemRanges);
 }
@@ -1326,16 +2888,22 @@ QList<KFileItemModel::ItemData*> KFileItemModel::createItemDataList(const QUrl&
     const int parentIndex = index(parentUrl);
     ItemData* parentItem = parentIndex < 0 ? nullptr : m_itemData.at(parentIndex);
 
+    const QVector<ItemData*> itemDataVector = m_itemDataArena.create(items.count());
     QList<ItemData*> itemDataList;
     itemDataList.reserve(items.count());
 
-    foreach (const KFileItem& item, items) {
-        ItemData* itemData = new ItemData();
-        itemData->item = item;
+    const int expandedParentsCount = parentItem ? parentItem->expandedParentsCount + 1 : 0;
+
+    for (int i = 0; i < items.count(); ++i) {
+        ItemData* itemData = itemDataVector.at(i);
+        itemData->item = items.at(i);
         itemData->parent = parentItem;
+        itemData->expandedParentsCount = expandedParentsCount;
         itemDataList.append(itemData);
     }
 
+    updateSortKeys(itemDataList);
+
     return itemDataList;
 }
 
@@ -1347,23 +2915,25 @@ void KFileItemModel::prepareItemsForSorting(QList<ItemData*>& itemDataList)
     case GroupRole:
     case DestinationRole:
     case PathRole:
-    case DeletionTimeRole:
+    case DeletionTimeRole: {
         // These roles can be determined with retrieveData, and they have to be stored
-        // in the QHash "values" for the sorting.
+        // in the ItemData for the sorting.
+        const QByteArray role = roleForType(m_sortRole);
         foreach (ItemData* itemData, itemDataList) {
-            if (itemData->values.isEmpty()) {
-                itemData->values = retrieveData(itemData->item, itemData->parent);
+            if (!hasStoredValue(itemData, role)) {
+                setStoredValue(itemData, role, retrieveData(itemData->item, itemData->parent).value(role));
             }
         }
         break;
+    }
 
     case TypeRole:
-        // At least store the data including the file type for items with known MIME type.
+        // At least store the file type for items with known MIME type.
         foreach (ItemData* itemData, itemDataList) {
-            if (itemData->values.isEmpty()) {
+            if (!(itemData->flags & MimeTypeRolesStoredFlag)) {
                 const KFileItem item = itemData->item;
                 if (item.isDir() || item.isMimeTypeKnown()) {
-                    itemData->values = retrieveData(itemData->item, itemData->parent);
+                    storeMimeTypeRoles(itemData);
                 }
             }
         }
@@ -1372,28 +2942,64 @@ void KFileItemModel::prepareItemsForSorting(QList<ItemData*>& itemDataList)
     default:
         // The other roles are either resolved by KFileItemModelRolesUpdater
         // (this includes the SizeRole for directories), or they do not need
-        // to be stored in the QHash "values" for sorting because the data can
-        // be retrieved directly from the KFileItem (NameRole, SizeRole for files,
+        // to be stored in the ItemData for sorting because the data can be
+        // retrieved directly from the KFileItem (NameRole, SizeRole for files,
         // DateRole).
         break;
     }
 }
 
-int KFileItemModel::expandedParentsCount(const ItemData* data)
+const KFileItemModel::ItemData* KFileItemModel::commonParent(const QList<ItemData*>& items) const
 {
-    // The hash 'values' is only guaranteed to contain the key "expandedParentsCount"
-    // if the corresponding item is expanded, and it is not a top-level item.
-    const ItemData* parent = data->parent;
-    if (parent) {
-        if (parent->parent) {
-            Q_ASSERT(parent->values.contains("expandedParentsCount"));
-            return parent->values.value("expandedParentsCount").toInt() + 1;
-        } else {
-            return 1;
+    const ItemData* parent = items.first()->parent;
+    if (!parent || parent->index >= m_itemData.count() || m_itemData.at(parent->index) != parent) {
+        return nullptr;
+    }
+
+    foreach (const ItemData* itemData, items) {
+        if (itemData->parent != parent) {
+            return nullptr;
         }
-    } else {
-        return 0;
     }
+
+    return parent;
+}
+
+void KFileItemModel::expandVisibleUrls()
+{
+    // setExpanded() might add the previously expanded children to m_urlsToExpand.
+    const QSet<QUrl> urlsToExpand = m_urlsToExpand;
+    foreach (const QUrl& url, urlsToExpand) {
+        const int indexForUrl = index(url);
+        if (indexForUrl >= 0) {
+            m_urlsToExpand.remove(url);
+
+            // The dir lister might complete the listing of a cached directory
+            // within setExpanded(), so the URL must be registered before.
+            const QUrl strippedUrl = url.adjusted(QUrl::StripTrailingSlash);
+            m_urlsBeingExpanded.insert(strippedUrl);
+            if (!setExpanded(indexForUrl, true)) {
+                m_urlsBeingExpanded.remove(strippedUrl);
+            }
+        }
+    }
+}
+
+void KFileItemModel::finishExpansion(const QUrl& directoryUrl)
+{
+    if (!m_urlsBeingExpanded.isEmpty()) {
+        // The dir lister might use the target URL of the expanded item.
+        const QUrl url = directoryUrl.adjusted(QUrl::StripTrailingSlash);
+        m_urlsBeingExpanded.remove(url);
+        m_urlsBeingExpanded.remove(m_expandedDirs.value(url).adjusted(QUrl::StripTrailingSlash));
+    }
+}
+
+int KFileItemModel::expandedParentsCount(const ItemData* data)
+{
+    // The expansion level is determined in createItemDataList() and
+    // never changes during the lifetime of the ItemData.
+    return data->expandedParentsCount;
 }
 
 void KFileItemModel::removeExpandedItems()
@@ -1417,12 +3023,23 @@ void KFileItemModel::removeExpandedItems()
 
     while (it != end) {
         if (it.value()->parent) {
-            delete it.value();
+            destroyItemData(it.value());
             it = m_filteredItems.erase(it);
         } else {
             ++it;
         }
     }
+
+    // And all hidden items which have a parent.
+    QList<ItemData*>::iterator hiddenEnd = std::remove_if(m_hiddenItems.begin(), m_hiddenItems.end(),
+        [this](ItemData* itemData) {
+            if (itemData->parent) {
+                destroyItemData(itemData);
+                return true;
+            }
+            return false;
+        });
+    m_hiddenItems.erase(hiddenEnd, m_hiddenItems.end());
 }
 
 void KFileItemModel::emitItemsChangedAndTriggerResorting(const KItemRangeList& itemRanges, const QSet<QByteArray>& changedRoles)
@@ -1431,7 +3048,10 @@ void KFileItemModel::emitItemsChangedAndTriggerResorting(const KItemRangeList& i
 
     // Trigger a resorting if necessary. Note that this can happen even if the sort
     // role has not changed at all because the file name can be used as a fallback.
+    // Only the items of the ranges that are out of order are remembered, so that
+    // resortChangedItems() does not need to sort all items again.
     if (changedRoles.contains(sortRole()) || changedRoles.contains(roleForType(NameRole))) {
+        bool resortingTriggered = false;
         foreach (const KItemRange& range, itemRanges) {
             bool needsResorting = false;
 
@@ -1458,10 +3078,17 @@ void KFileItemModel::emitItemsChangedAndTriggerResorting(const KItemRangeList& i
             }
 
             if (needsResorting) {
-                m_resortAllItemsTimer->start();
-                return;
+                for (int index = first; index <= last; ++index) {
+                    m_itemsToResort.insert(m_itemData.at(index));
+                }
+                resortingTriggered = true;
             }
         }
+
+        if (resortingTriggered) {
+            m_resortAllItemsTimer->start();
+            return;
+        }
     }
 
     if (groupedSorting() && changedRoles.contains(sortRole())) {
@@ -1629,42 +3256,182 @@ QHash<QByteArray, QVariant> KFileItemModel::retrieveData(const KFileItem& item,
             }
         }
 
-        const int index = path.lastIndexOf(item.text());
-        path = path.mid(0, index - 1);
-        data.insert(sharedValue("path"), path);
+        const int index = path.lastIndexOf(item.text());
+        path = path.mid(0, index - 1);
+        data.insert(sharedValue("path"), path);
+    }
+
+    if (m_requestRole[DeletionTimeRole]) {
+        QDateTime deletionTime;
+        if (item.url().scheme() == QLatin1String("trash")) {
+            deletionTime = QDateTime::fromString(item.entry().stringValue(KIO::UDSEntry::UDS_EXTRA + 1), Qt::ISODate);
+        }
+        data.insert(sharedValue("deletiontime"), deletionTime);
+    }
+
+    if (m_requestRole[IsExpandableRole] && isDir) {
+        data.insert(sharedValue("isExpandable"), true);
+    }
+
+    if (m_requestRole[ExpandedParentsCountRole]) {
+        if (parent) {
+            const int level = expandedParentsCount(parent) + 1;
+            data.insert(sharedValue("expandedParentsCount"), level);
+        }
+    }
+
+    return data;
+}
+
+void KFileItemModel::storeMimeTypeRoles(ItemData* data) const
+{
+    const KFileItem& item = data->item;
+    if (item.isMimeTypeKnown()) {
+        data->iconName = item.iconName();
+        data->flags |= HasIconNameFlag;
+
+        if (m_requestRole[TypeRole]) {
+            data->type = item.mimeComment();
+            data->flags |= HasTypeFlag;
+        }
+    } else if (m_requestRole[TypeRole] && item.isDir()) {
+        static const QString folderMimeType = item.mimeComment();
+        data->type = folderMimeType;
+        data->flags |= HasTypeFlag;
+    }
+
+    data->flags |= MimeTypeRolesStoredFlag;
+}
+
+bool KFileItemModel::hasStoredValue(const ItemData* data, const QByteArray& role) const
+{
+    if (role == "iconName") {
+        return data->flags & HasIconNameFlag;
+    }
+
+    switch (typeForRole(role)) {
+    case SizeRole:         return (data->flags & HasSizeFlag) || data->extraValues.contains(role);
+    case TypeRole:         return data->flags & HasTypeFlag;
+    case IsExpandedRole:   return data->flags & HasIsExpandedFlag;
+    case IsExpandableRole: return data->flags & HasIsExpandableFlag;
+    default:               return data->extraValues.contains(role);
+    }
+}
+
+QVariant KFileItemModel::storedValue(const ItemData* data, const QByteArray& role) const
+{
+    if (role == "iconName") {
+        return (data->flags & HasIconNameFlag) ? QVariant(data->iconName) : QVariant();
     }
 
-    if (m_requestRole[DeletionTimeRole]) {
-        QDateTime deletionTime;
-        if (item.url().scheme() == QLatin1String("trash")) {
-            deletionTime = QDateTime::fromString(item.entry().stringValue(KIO::UDSEntry::UDS_EXTRA + 1), Qt::ISODate);
+    switch (typeForRole(role)) {
+    case SizeRole:
+        if (data->flags & HasSizeFlag) {
+            return data->size;
         }
-        data.insert(sharedValue("deletiontime"), deletionTime);
+        return data->extraValues.value(role);
+    case TypeRole:
+        return (data->flags & HasTypeFlag) ? QVariant(data->type) : QVariant();
+    case IsExpandedRole:
+        return (data->flags & HasIsExpandedFlag) ? QVariant(bool(data->flags & IsExpandedFlag)) : QVariant();
+    case IsExpandableRole:
+        return (data->flags & HasIsExpandableFlag) ? QVariant(bool(data->flags & IsExpandableFlag)) : QVariant();
+    default:
+        return data->extraValues.value(role);
     }
+}
 
-    if (m_requestRole[IsExpandableRole] && isDir) {
-        data.insert(sharedValue("isExpandable"), true);
+void KFileItemModel::setStoredValue(ItemData* data, const QByteArray& role, const QVariant& value) const
+{
+    if (role == "iconName") {
+        data->iconName = value.toString();
+        data->flags |= HasIconNameFlag;
+        return;
     }
 
-    if (m_requestRole[ExpandedParentsCountRole]) {
-        if (parent) {
-            const int level = expandedParentsCount(parent) + 1;
-            data.insert(sharedValue("expandedParentsCount"), level);
+    switch (typeForRole(role)) {
+    case NameRole:
+        // The name is always retrieved from the KFileItem, see setData().
+        break;
+    case SizeRole:
+        if (data->item.isDir() && !value.isNull()) {
+            // Only the number of sub-items of directories is stored. The size
+            // of files is retrieved from the KFileItem.
+            data->size = value.toInt();
+            data->flags |= HasSizeFlag;
+            data->extraValues.remove(role);
+        } else {
+            // Drop a previously stored number of sub-items, otherwise
+            // storedValue() would keep returning the outdated count.
+            data->flags &= ~HasSizeFlag;
+            if (value.isNull()) {
+                data->extraValues.remove(role);
+            } else {
+                data->extraValues.insert(sharedValue(role), value);
+            }
+        }
+        break;
+    case TypeRole:
+        data->type = value.toString();
+        data->flags |= HasTypeFlag;
+        break;
+    case IsExpandedRole:
+        data->flags |= HasIsExpandedFlag;
+        if (value.toBool()) {
+            data->flags |= IsExpandedFlag;
+        } else {
+            data->flags &= ~IsExpandedFlag;
+        }
+        break;
+    case IsExpandableRole:
+        data->flags |= HasIsExpandableFlag;
+        if (value.toBool()) {
+            data->flags |= IsExpandableFlag;
+        } else {
+            data->flags &= ~IsExpandableFlag;
         }
+        break;
+    default:
+        data->extraValues.insert(sharedValue(role), value);
+        break;
     }
+}
 
-    if (item.isMimeTypeKnown()) {
-        data.insert(sharedValue("iconName"), item.iconName());
+void KFileItemModel::insertStoredValues(const ItemData* data, QHash<QByteArray, QVariant>& values) const
+{
+    const quint8 flags = data->flags;
+    if (flags & HasIconNameFlag) {
+        values.insert(sharedValue("iconName"), data->iconName);
+    }
+    if (flags & HasTypeFlag) {
+        values.insert(sharedValue("type"), data->type);
+    }
+    if (flags & HasSizeFlag) {
+        values.insert(sharedValue("size"), data->size);
+    }
+    if (flags & HasIsExpandedFlag) {
+        values.insert(sharedValue("isExpanded"), bool(flags & IsExpandedFlag));
+    }
+    if (flags & HasIsExpandableFlag) {
+        values.insert(sharedValue("isExpandable"), bool(flags & IsExpandableFlag));
+    }
 
-        if (m_requestRole[TypeRole]) {
-            data.insert(sharedValue("type"), item.mimeComment());
-        }
-    } else if (m_requestRole[TypeRole] && isDir) {
-        static const QString folderMimeType = item.mimeComment();
-        data.insert(sharedValue("type"), folderMimeType);
+    QHash<QByteArray, QVariant>::const_iterator it = data->extraValues.constBegin();
+    const QHash<QByteArray, QVariant>::const_iterator end = data->extraValues.constEnd();
+    while (it != end) {
+        values.insert(it.key(), it.value());
+        ++it;
     }
+}
 
-    return data;
+void KFileItemModel::clearStoredValues(ItemData* data)
+{
+    m_dataCache.remove(data);
+    data->type.clear();
+    data->iconName.clear();
+    data->extraValues.clear();
+    data->size = 0;
+    data->flags = 0;
 }
 
 bool KFileItemModel::lessThan(const ItemData* a, const ItemData* b, const QCollator& collator) const
@@ -1714,7 +3481,7 @@ bool KFileItemModel::lessThan(const ItemData* a, const ItemData* b, const QColla
 
     result = sortRoleCompare(a, b, collator);
 
-    return (sortOrder() == Qt::AscendingOrder) ? result < 0 : result > 0;
+    return (m_itemSortOrder == Qt::AscendingOrder) ? result < 0 : result > 0;
 }
 
 void KFileItemModel::sort(QList<KFileItemModel::ItemData*>::iterator begin,
@@ -1725,19 +3492,127 @@ void KFileItemModel::sort(QList<KFileItemModel::ItemData*>::iterator begin,
         return lessThan(a, b, m_collator);
     };
 
-    if (m_sortRole == NameRole) {
-        // Sorting by name can be expensive, in particular if natural sorting is
-        // enabled. Use all CPU cores to speed up the sorting process.
-        static const int numberOfThreads = QThread::idealThreadCount();
+    // The comparison functions only read values that have been stored by
+    // prepareItemsForSorting() before, so all CPU cores can be used to speed
+    // up the sorting process independent from the sort role.
+    static const int numberOfThreads = QThread::idealThreadCount();
+    if (!sortByNumericKey(begin, end, numberOfThreads)) {
         parallelMergeSort(begin, end, lambdaLessThan, numberOfThreads);
-    } else {
-        // Sorting by other roles is quite fast. Use only one thread to prevent
-        // problems caused by non-reentrant comparison functions, see
-        // https://bugs.kde.org/show_bug.cgi?id=312679
-        mergeSort(begin, end, lambdaLessThan);
     }
 }
 
+bool KFileItemModel::sortByNumericKey(QList<ItemData*>::iterator begin,
+                                      QList<ItemData*>::iterator end,
+                                      int numberOfThreads) const
+{
+    switch (m_sortRole) {
+    case SizeRole:
+    case ModificationTimeRole:
+    case CreationTimeRole:
+    case RatingRole:
+    case WidthRole:
+    case HeightRole:
+    case WordCountRole:
+    case LineCountRole:
+    case TrackRole:
+    case ReleaseYearRole:
+        break;
+    default:
+        return false;
+    }
+
+    const int span = end - begin;
+    if (span < 2) {
+        return true;
+    }
+
+    // The keys are only sufficient if lessThan() does not have to take the
+    // parents of expanded items into account.
+    const ItemData* parent = (*begin)->parent;
+    for (QList<ItemData*>::iterator it = begin; it != end; ++it) {
+        if ((*it)->parent != parent) {
+            return false;
+        }
+    }
+
+    // Signed values are mapped to unsigned keys with the same order by
+    // flipping the sign bit. For a descending sort order, all bits are
+    // inverted. Folders are sorted separately if required, see lessThan().
+    const quint64 signBit = Q_UINT64_C(1) << 63;
+    const bool descending = (m_itemSortOrder == Qt::DescendingOrder);
+    const QByteArray role = roleForType(m_sortRole);
+    auto keyForItem = [&](const ItemData* data) -> quint64 {
+        quint64 key = 0;
+        switch (m_sortRole) {
+        case SizeRole:
+            if (data->item.isDir()) {
+                key = quint64(qint64((data->flags & HasSizeFlag) ? data->size : -1)) ^ signBit;
+            } else {
+                key = data->item.size();
+            }
+            break;
+        case ModificationTimeRole:
+            key = quint64(qint64(data->item.entry().numberValue(KIO::UDSEntry::UDS_MODIFICATION_TIME, -1))) ^ signBit;
+            break;
+        case CreationTimeRole:
+            key = quint64(qint64(data->item.entry().numberValue(KIO::UDSEntry::UDS_CREATION_TIME, -1))) ^ signBit;
+            break;
+        default:
+            key = quint64(qint64(data->extraValues.value(role).toInt())) ^ signBit;
+            break;
+        }
+        return descending ? ~key : key;
+    };
+
+    QVector<KeyedItem<ItemData*> > dirs;
+    QVector<KeyedItem<ItemData*> > files;
+    const bool separateDirs = m_sortDirsFirst || m_sortRole == SizeRole;
+    if (separateDirs) {
+        dirs.reserve(span);
+    }
+    files.reserve(span);
+    for (QList<ItemData*>::iterator it = begin; it != end; ++it) {
+        const KeyedItem<ItemData*> keyedItem = { keyForItem(*it), *it };
+        if (separateDirs && (*it)->item.isDir()) {
+            dirs.append(keyedItem);
+        } else {
+            files.append(keyedItem);
+        }
+    }
+
+    parallelRadixSort(dirs, numberOfThreads);
+    parallelRadixSort(files, numberOfThreads);
+
+    // Copy the sorted items back. Items with equal keys are ordered by the
+    // fallbacks of sortRoleCompare(), e.g., the name.
+    auto lambdaLessThan = [&] (const ItemData* a, const ItemData* b)
+    {
+        return lessThan(a, b, m_collator);
+    };
+    QList<ItemData*>::iterator target = begin;
+    const QVector<KeyedItem<ItemData*> >* parts[] = { &dirs, &files };
+    for (const QVector<KeyedItem<ItemData*> >* part : parts) {
+        int runStart = 0;
+        while (runStart < part->count()) {
+            int runEnd = runStart + 1;
+            while (runEnd < part->count() && part->at(runEnd).key == part->at(runStart).key) {
+                ++runEnd;
+            }
+            for (int i = runStart; i < runEnd; ++i) {
+                *(target + i - runStart) = part->at(i).value;
+            }
+            if (runEnd - runStart > 1) {
+                parallelMergeSort(target, target + (runEnd - runStart), lambdaLessThan, numberOfThreads);
+            }
+            target += runEnd - runStart;
+            runStart = runEnd;
+        }
+    }
+    Q_ASSERT(target == end);
+
+    return true;
+}
+
 int KFileItemModel::sortRoleCompare(const ItemData* a, const ItemData* b, const QCollator& collator) const
 {
     const KFileItem& itemA = a->item;
@@ -1755,16 +3630,16 @@ int KFileItemModel::sortRoleCompare(const ItemData* a, const ItemData* b, const
             // See "if (m_sortFoldersFirst || m_sortRole == SizeRole)" in KFileItemModel::lessThan():
             Q_ASSERT(itemB.isDir());
 
-            const QVariant valueA = a->values.value("size");
-            const QVariant valueB = b->values.value("size");
-            if (valueA.isNull() && valueB.isNull()) {
+            const bool hasSizeA = a->flags & HasSizeFlag;
+            const bool hasSizeB = b->flags & HasSizeFlag;
+            if (!hasSizeA && !hasSizeB) {
                 result = 0;
-            } else if (valueA.isNull()) {
+            } else if (!hasSizeA) {
                 result = -1;
-            } else if (valueB.isNull()) {
+            } else if (!hasSizeB) {
                 result = +1;
             } else {
-                result = valueA.toInt() - valueB.toInt();
+                result = a->size - b->size;
             }
         } else {
             // See "if (m_sortFoldersFirst || m_sortRole == SizeRole)" in KFileItemModel::lessThan():
@@ -1805,8 +3680,8 @@ int KFileItemModel::sortRoleCompare(const ItemData* a, const ItemData* b, const
     }
 
     case DeletionTimeRole: {
-        const QDateTime dateTimeA = a->values.value("deletiontime").toDateTime();
-        const QDateTime dateTimeB = b->values.value("deletiontime").toDateTime();
+        const QDateTime dateTimeA = a->extraValues.value("deletiontime").toDateTime();
+        const QDateTime dateTimeB = b->extraValues.value("deletiontime").toDateTime();
         if (dateTimeA < dateTimeB) {
             result = -1;
         } else if (dateTimeA > dateTimeB) {
@@ -1822,14 +3697,15 @@ int KFileItemModel::sortRoleCompare(const ItemData* a, const ItemData* b, const
     case LineCountRole:
     case TrackRole:
     case ReleaseYearRole: {
-        result = a->values.value(roleForType(m_sortRole)).toInt() - b->values.value(roleForType(m_sortRole)).toInt();
+        const QByteArray role = roleForType(m_sortRole);
+        result = a->extraValues.value(role).toInt() - b->extraValues.value(role).toInt();
         break;
     }
 
     default: {
         const QByteArray role = roleForType(m_sortRole);
-        result = QString::compare(a->values.value(role).toString(),
-                                  b->values.value(role).toString());
+        result = QString::compare(storedValue(a, role).toString(),
+                                  storedValue(b, role).toString());
         break;
     }
 
@@ -1841,7 +3717,11 @@ int KFileItemModel::sortRoleCompare(const ItemData* a, const ItemData* b, const
     }
 
     // Fallback #1: Compare the text of the items
-    result = stringCompare(itemA.text(), itemB.text(), collator);
+    if (a->sortKey && b->sortKey) {
+        result = a->sortKey->compare(*b->sortKey);
+    } else {
+        result = stringCompare(itemA.text(), itemB.text(), collator);
+    }
     if (result != 0) {
         return result;
     }
@@ -1875,21 +3755,204 @@ int KFileItemModel::stringCompare(const QString& a, const QString& b, const QCol
     return QString::compare(a, b, Qt::CaseSensitive);
 }
 
+void KFileItemModel::updateSortKeys(QList<ItemData*>& itemDataList) const
+{
+    if (!m_useSortKeys) {
+        foreach (ItemData* itemData, itemDataList) {
+            itemData->sortKey.reset();
+        }
+        return;
+    }
+
+    // QCollator::sortKey() is reentrant after the collator has been initialized
+    // in loadSortingSettings(). Use all CPU cores for large directories.
+    const int parallelThreshold = 1000;
+    if (itemDataList.count() > parallelThreshold) {
+        QtConcurrent::blockingMap(itemDataList, [this](ItemData* itemData) {
+            updateSortKey(itemData);
+        });
+    } else {
+        foreach (ItemData* itemData, itemDataList) {
+            updateSortKey(itemData);
+        }
+    }
+}
+
+void KFileItemModel::updateSortKey(ItemData* data) const
+{
+    if (m_useSortKeys) {
+        data->sortKey.reset(new QCollatorSortKey(m_collator.sortKey(data->item.text())));
+    } else {
+        data->sortKey.reset();
+    }
+}
+
 bool KFileItemModel::useMaximumUpdateInterval() const
 {
-    return !m_dirLister->url().isLocalFile();
+    return !m_dirLister->directoryUrl().isLocalFile() || m_dirLister->localListingEnabled();
+}
+
+const qint64 KFileItemModel::InvalidFileTime = std::numeric_limits<qint64>::min();
+const int KFileItemModel::SnapshotMinimumItemCount = 2000;
+
+QList<QPair<int, QVariant> > KFileItemModel::groupsForRange(int begin, int end) const
+{
+    switch (typeForRole(sortRole())) {
+    case NameRole:        return nameRoleGroups(begin, end);
+    case SizeRole:        return sizeRoleGroups(begin, end);
+    case ModificationTimeRole:
+        return timeRoleGroups([](const ItemData *item) {
+            return fileTimeInSeconds(item->item, KFileItem::ModificationTime);
+        }, begin, end);
+    case CreationTimeRole:
+        return timeRoleGroups([](const ItemData *item) {
+            return fileTimeInSeconds(item->item, KFileItem::CreationTime);
+        }, begin, end);
+    case AccessTimeRole:
+        return timeRoleGroups([](const ItemData *item) {
+            return fileTimeInSeconds(item->item, KFileItem::AccessTime);
+        }, begin, end);
+    case DeletionTimeRole:
+        return timeRoleGroups([](const ItemData *item) {
+            const QDateTime time = item->extraValues.value("deletiontime").toDateTime();
+            return time.isValid() ? time.toSecsSinceEpoch() : InvalidFileTime;
+        }, begin, end);
+    case PermissionsRole: return permissionRoleGroups(begin, end);
+    case RatingRole:      return ratingRoleGroups(begin, end);
+    default:              return genericStringRoleGroups(sortRole(), begin, end);
+    }
+}
+
+void KFileItemModel::updateGroupsAfterInsertion(const KItemRangeList& itemRanges)
+{
+    if (m_groups.isEmpty()) {
+        // The groups have not been requested yet
+        return;
+    }
+
+    if (m_groupsDate.isValid() && m_groupsDate != QDate::currentDate()) {
+        // The existing groups have been calculated for another day, their
+        // values like "Today" might not be correct anymore.
+        m_groups.clear();
+        return;
+    }
+
+    if (!m_expandedDirs.isEmpty()) {
+        // Inserting child items might change the boundaries of
+        // the surrounding groups, calculate all groups again.
+        m_groups.clear();
+        return;
+    }
+
+    const QList<QPair<int, QVariant> > oldGroups = m_groups;
+    const int oldGroupCount = oldGroups.count();
+    int oldItemCount = count();
+    foreach (const KItemRange& range, itemRanges) {
+        oldItemCount -= range.count;
+    }
+
+    // Move the boundaries of the existing groups and merge the groups of the
+    // inserted items, which are determined by groupsForRange(). The indexes
+    // in itemRanges refer to the model before the insertion.
+    QList<QPair<int, QVariant> > groups;
+    groups.reserve(oldGroupCount);
+
+    auto appendGroup = [&groups](int index, const QVariant& value) {
+        if (groups.isEmpty() || groups.last().second != value) {
+            groups.append(QPair<int, QVariant>(index, value));
+        }
+    };
+
+    int oldGroupIndex = 0;
+    int insertedCount = 0;
+    foreach (const KItemRange& range, itemRanges) {
+        while (oldGroupIndex < oldGroupCount && oldGroups.at(oldGroupIndex).first < range.index) {
+            const QPair<int, QVariant>& group = oldGroups.at(oldGroupIndex);
+            appendGroup(group.first + insertedCount, group.second);
+            ++oldGroupIndex;
+        }
+
+        const bool hasPreviousGroup = !groups.isEmpty();
+        const QVariant previousValue = hasPreviousGroup ? groups.last().second : QVariant();
+
+        const int begin = range.index + insertedCount;
+        const int end = begin + range.count;
+        foreach (const auto& group, groupsForRange(begin, end)) {
+            appendGroup(group.first, group.second);
+        }
+        insertedCount += range.count;
+
+        // If the inserted items split an existing group, the rest of
+        // this group needs a new boundary behind the inserted items.
+        const bool groupStartsBehindRange = oldGroupIndex < oldGroupCount && oldGroups.at(oldGroupIndex).first == range.index;
+        if (range.index < oldItemCount && !groupStartsBehindRange && hasPreviousGroup) {
+            appendGroup(end, previousValue);
+        }
+    }
+
+    while (oldGroupIndex < oldGroupCount) {
+        const QPair<int, QVariant>& group = oldGroups.at(oldGroupIndex);
+        appendGroup(group.first + insertedCount, group.second);
+        ++oldGroupIndex;
+    }
+
+    m_groups = groups;
 }
 
-QList<QPair<int, QVariant> > KFileItemModel::nameRoleGroups() const
+void KFileItemModel::updateGroupsAfterRemoval(const KItemRangeList& itemRanges)
 {
-    Q_ASSERT(!m_itemData.isEmpty());
+    if (m_groups.isEmpty()) {
+        return;
+    }
+
+    if (!m_expandedDirs.isEmpty() || m_itemData.isEmpty()) {
+        m_groups.clear();
+        return;
+    }
+
+    // The indexes in itemRanges refer to the model before the removal. A group
+    // that starts at a removed item continues at the first item behind the removed
+    // range, unless that item starts another group.
+    QList<QPair<int, QVariant> > groups;
+    groups.reserve(m_groups.count());
+
+    const int itemCount = count();
+    int rangeIndex = 0;
+    int removedCount = 0;
+    foreach (const auto& group, m_groups) {
+        while (rangeIndex < itemRanges.count() && itemRanges.at(rangeIndex).index + itemRanges.at(rangeIndex).count <= group.first) {
+            removedCount += itemRanges.at(rangeIndex).count;
+            ++rangeIndex;
+        }
+
+        int index = group.first - removedCount;
+        if (rangeIndex < itemRanges.count() && itemRanges.at(rangeIndex).index <= group.first) {
+            index = itemRanges.at(rangeIndex).index - removedCount;
+        }
+
+        if (index >= itemCount) {
+            break;
+        }
 
-    const int maxIndex = count() - 1;
+        if (!groups.isEmpty() && groups.last().first == index) {
+            // The previous group does not contain any items anymore
+            groups.removeLast();
+        }
+        if (groups.isEmpty() || groups.last().second != group.second) {
+            groups.append(QPair<int, QVariant>(index, group.second));
+        }
+    }
+
+    m_groups = groups;
+}
+
+QList<QPair<int, QVariant> > KFileItemModel::nameRoleGroups(int begin, int end) const
+{
     QList<QPair<int, QVariant> > groups;
 
     QString groupValue;
     QChar firstChar;
-    for (int i = 0; i <= maxIndex; ++i) {
+    for (int i = begin; i < end; ++i) {
         if (isChildItem(i)) {
             continue;
         }
@@ -1947,15 +4010,12 @@ QList<QPair<int, QVariant> > KFileItemModel::nameRoleGroups() const
     return groups;
 }
 
-QList<QPair<int, QVariant> > KFileItemModel::sizeRoleGroups() const
+QList<QPair<int, QVariant> > KFileItemModel::sizeRoleGroups(int begin, int end) const
 {
-    Q_ASSERT(!m_itemData.isEmpty());
-
-    const int maxIndex = count() - 1;
     QList<QPair<int, QVariant> > groups;
 
     QString groupValue;
-    for (int i = 0; i <= maxIndex; ++i) {
+    for (int i = begin; i < end; ++i) {
         if (isChildItem(i)) {
             continue;
         }
@@ -1982,124 +4042,65 @@ QList<QPair<int, QVariant> > KFileItemModel::sizeRoleGroups() const
     return groups;
 }
 
-QList<QPair<int, QVariant> > KFileItemModel::timeRoleGroups(std::function<QDateTime(const ItemData *)> fileTimeCb) const
+QList<QPair<int, QVariant> > KFileItemModel::timeRoleGroups(std::function<qint64(const ItemData *)> fileTimeCb, int begin, int end) const
 {
-    Q_ASSERT(!m_itemData.isEmpty());
-
-    const int maxIndex = count() - 1;
     QList<QPair<int, QVariant> > groups;
 
     const QDate currentDate = QDate::currentDate();
 
-    QDate previousFileDate;
+    // The group of an item only depends on the date of its time. All items from
+    // the beginning of the previous month until today are grouped by day, all older
+    // items by month. The start times of the recent days are determined once,
+    // so that the time of an item only must be compared with the boundaries
+    // of the previous group in most cases.
+    const QDate lastMonthDate = currentDate.addMonths(-1);
+    QVector<qint64> recentDayStarts;
+    for (QDate date(lastMonthDate.year(), lastMonthDate.month(), 1); date <= currentDate.addDays(1); date = date.addDays(1)) {
+        recentDayStarts.append(QDateTime(date).toSecsSinceEpoch());
+    }
+
+    qint64 rangeStart = 0;
+    qint64 rangeEnd = 0;
     QString groupValue;
-    for (int i = 0; i <= maxIndex; ++i) {
+    for (int i = begin; i < end; ++i) {
         if (isChildItem(i)) {
             continue;
         }
 
-        const QDateTime fileTime = fileTimeCb(m_itemData.at(i));
-        const QDate fileDate = fileTime.date();
-        if (fileDate == previousFileDate) {
+        const qint64 fileTime = fileTimeCb(m_itemData.at(i));
+        if (fileTime >= rangeStart && fileTime < rangeEnd) {
             // The current item is in the same group as the previous item
             continue;
         }
-        previousFileDate = fileDate;
 
-        const int daysDistance = fileDate.daysTo(currentDate);
-
-        QString newGroupValue;
-        if (currentDate.year() == fileDate.year() &&
-            currentDate.month() == fileDate.month()) {
-
-            switch (daysDistance / 7) {
-            case 0:
-                switch (daysDistance) {
-                case 0:  newGroupValue = i18nc("@title:group Date", "Today"); break;
-                case 1:  newGroupValue = i18nc("@title:group Date", "Yesterday"); break;
-                default:
-                    newGroupValue = fileTime.toString(
-                        i18nc("@title:group Date: The week day name: dddd", "dddd"));
-                    newGroupValue = i18nc("Can be used to script translation of \"dddd\""
-                        "with context @title:group Date", "%1", newGroupValue);
-                }
-                break;
-            case 1:
-                newGroupValue = i18nc("@title:group Date", "One Week Ago");
-                break;
-            case 2:
-                newGroupValue = i18nc("@title:group Date", "Two Weeks Ago");
-                break;
-            case 3:
-                newGroupValue = i18nc("@title:group Date", "Three Weeks Ago");
-                break;
-            case 4:
-            case 5:
-                newGroupValue = i18nc("@title:group Date", "Earlier this Month");
-                break;
-            default:
-                Q_ASSERT(false);
-            }
+        QDateTime rangeDateTime;
+        if (fileTime == InvalidFileTime) {
+            rangeStart = InvalidFileTime;
+            rangeEnd = InvalidFileTime + 1;
+        } else if (fileTime >= recentDayStarts.first() && fileTime < recentDayStarts.last()) {
+            const auto it = std::upper_bound(recentDayStarts.constBegin(), recentDayStarts.constEnd(), fileTime);
+            rangeStart = *(it - 1);
+            rangeEnd = *it;
+            rangeDateTime = QDateTime::fromSecsSinceEpoch(rangeStart);
         } else {
-            const QDate lastMonthDate = currentDate.addMonths(-1);
-            if  (lastMonthDate.year() == fileDate.year() &&
-                 lastMonthDate.month() == fileDate.month()) {
-
-                if (daysDistance == 1) {
-                    newGroupValue = fileTime.toString(i18nc("@title:group Date: "
-                        "MMMM is full month name in current locale, and yyyy is "
-                        "full year number", "'Yesterday' (MMMM, yyyy)"));
-                    newGroupValue = i18nc("Can be used to script translation of "
-                        "\"'Yesterday' (MMMM, yyyy)\" with context @title:group Date",
-                        "%1", newGroupValue);
-                } else if (daysDistance <= 7) {
-                    newGroupValue = fileTime.toString(i18nc("@title:group Date: "
-                        "The week day name: dddd, MMMM is full month name "
-                        "in current locale, and yyyy is full year number",
-                        "dddd (MMMM, yyyy)"));
-                    newGroupValue = i18nc("Can be used to script translation of "
-                        "\"dddd (MMMM, yyyy)\" with context @title:group Date",
-                        "%1", newGroupValue);
-                } else if (daysDistance <= 7 * 2) {
-                    newGroupValue = fileTime.toString(i18nc("@title:group Date: "
-                        "MMMM is full month name in current locale, and yyyy is "
-                        "full year number", "'One Week Ago' (MMMM, yyyy)"));
-                    newGroupValue = i18nc("Can be used to script translation of "
-                        "\"'One Week Ago' (MMMM, yyyy)\" with context @title:group Date",
-                        "%1", newGroupValue);
-                } else if (daysDistance <= 7 * 3) {
-                    newGroupValue = fileTime.toString(i18nc("@title:group Date: "
-                        "MMMM is full month name in current locale, and yyyy is "
-                        "full year number", "'Two Weeks Ago' (MMMM, yyyy)"));
-                    newGroupValue = i18nc("Can be used to script translation of "
-                        "\"'Two Weeks Ago' (MMMM, yyyy)\" with context @title:group Date",
-                        "%1", newGroupValue);
-                } else if (daysDistance <= 7 * 4) {
-                    newGroupValue = fileTime.toString(i18nc("@title:group Date: "
-                        "MMMM is full month name in current locale, and yyyy is "
-                        "full year number", "'Three Weeks Ago' (MMMM, yyyy)"));
-                    newGroupValue = i18nc("Can be used to script translation of "
-                        "\"'Three Weeks Ago' (MMMM, yyyy)\" with context @title:group Date",
-                        "%1", newGroupValue);
-                } else {
-                    newGroupValue = fileTime.toString(i18nc("@title:group Date: "
-                        "MMMM is full month name in current locale, and yyyy is "
-                        "full year number", "'Earlier on' MMMM, yyyy"));
-                    newGroupValue = i18nc("Can be used to script translation of "
-                        "\"'Earlier on' MMMM, yyyy\" with context @title:group Date",
-                        "%1", newGroupValue);
-                }
+            const QDate fileDate = QDateTime::fromSecsSinceEpoch(fileTime).date();
+            QDate rangeStartDate;
+            QDate rangeEndDate;
+            if (fileTime < recentDayStarts.first()) {
+                rangeStartDate = QDate(fileDate.year(), fileDate.month(), 1);
+                rangeEndDate = rangeStartDate.addMonths(1);
             } else {
-                newGroupValue = fileTime.toString(i18nc("@title:group "
-                    "The month and year: MMMM is full month name in current locale, "
-                    "and yyyy is full year number", "MMMM, yyyy"));
-                newGroupValue = i18nc("Can be used to script translation of "
-                    "\"MMMM, yyyy\" with context @title:group Date",
-                    "%1", newGroupValue);
+                // The time is in the future
+                rangeStartDate = fileDate;
+                rangeEndDate = fileDate.addDays(1);
             }
+            rangeDateTime = QDateTime(rangeStartDate);
+            rangeStart = rangeDateTime.toSecsSinceEpoch();
+            rangeEnd = QDateTime(rangeEndDate).toSecsSinceEpoch();
         }
 
-        if (newGroupValue != groupValue) {
+        const QString newGroupValue = timeRoleGroupValue(rangeDateTime, currentDate);
+        if (newGroupValue != groupValue || groups.isEmpty()) {
             groupValue = newGroupValue;
             groups.append(QPair<int, QVariant>(i, newGroupValue));
         }
@@ -2108,22 +4109,139 @@ QList<QPair<int, QVariant> > KFileItemModel::timeRoleGroups(std::function<QDateT
     return groups;
 }
 
-QList<QPair<int, QVariant> > KFileItemModel::permissionRoleGroups() const
+QString KFileItemModel::timeRoleGroupValue(const QDateTime& fileTime, const QDate& currentDate)
+{
+    const QDate fileDate = fileTime.date();
+    const int daysDistance = fileDate.daysTo(currentDate);
+
+    QString newGroupValue;
+    if (currentDate.year() == fileDate.year() &&
+        currentDate.month() == fileDate.month()) {
+
+        switch (daysDistance / 7) {
+        case 0:
+            switch (daysDistance) {
+            case 0:  newGroupValue = i18nc("@title:group Date", "Today"); break;
+            case 1:  newGroupValue = i18nc("@title:group Date", "Yesterday"); break;
+            default:
+                newGroupValue = fileTime.toString(
+                    i18nc("@title:group Date: The week day name: dddd", "dddd"));
+                newGroupValue = i18nc("Can be used to script translation of \"dddd\""
+                    "with context @title:group Date", "%1", newGroupValue);
+            }
+            break;
+        case 1:
+            newGroupValue = i18nc("@title:group Date", "One Week Ago");
+            break;
+        case 2:
+            newGroupValue = i18nc("@title:group Date", "Two Weeks Ago");
+            break;
+        case 3:
+            newGroupValue = i18nc("@title:group Date", "Three Weeks Ago");
+            break;
+        case 4:
+        case 5:
+            newGroupValue = i18nc("@title:group Date", "Earlier this Month");
+            break;
+        default:
+            Q_ASSERT(false);
+        }
+    } else {
+        const QDate lastMonthDate = currentDate.addMonths(-1);
+        if  (lastMonthDate.year() == fileDate.year() &&
+             lastMonthDate.month() == fileDate.month()) {
+
+            if (daysDistance == 1) {
+                newGroupValue = fileTime.toString(i18nc("@title:group Date: "
+                    "MMMM is full month name in current locale, and yyyy is "
+                    "full year number", "'Yesterday' (MMMM, yyyy)"));
+                newGroupValue = i18nc("Can be used to script translation of "
+                    "\"'Yesterday' (MMMM, yyyy)\" with context @title:group Date",
+                    "%1", newGroupValue);
+            } else if (daysDistance <= 7) {
+                newGroupValue = fileTime.toString(i18nc("@title:group Date: "
+                    "The week day name: dddd, MMMM is full month name "
+                    "in current locale, and yyyy is full year number",
+                    "dddd (MMMM, yyyy)"));
+                newGroupValue = i18nc("Can be used to script translation of "
+                    "\"dddd (MMMM, yyyy)\" with context @title:group Date",
+                    "%1", newGroupValue);
+            } else if (daysDistance <= 7 * 2) {
+                newGroupValue = fileTime.toString(i18nc("@title:group Date: "
+                    "MMMM is full month name in current locale, and yyyy is "
+                    "full year number", "'One Week Ago' (MMMM, yyyy)"));
+                newGroupValue = i18nc("Can be used to script translation of "
+                    "\"'One Week Ago' (MMMM, yyyy)\" with context @title:group Date",
+                    "%1", newGroupValue);
+            } else if (daysDistance <= 7 * 3) {
+                newGroupValue = fileTime.toString(i18nc("@title:group Date: "
+                    "MMMM is full month name in current locale, and yyyy is "
+                    "full year number", "'Two Weeks Ago' (MMMM, yyyy)"));
+                newGroupValue = i18nc("Can be used to script translation of "
+                    "\"'Two Weeks Ago' (MMMM, yyyy)\" with context @title:group Date",
+                    "%1", newGroupValue);
+            } else if (daysDistance <= 7 * 4) {
+                newGroupValue = fileTime.toString(i18nc("@title:group Date: "
+                    "MMMM is full month name in current locale, and yyyy is "
+                    "full year number", "'Three Weeks Ago' (MMMM, yyyy)"));
+                newGroupValue = i18nc("Can be used to script translation of "
+                    "\"'Three Weeks Ago' (MMMM, yyyy)\" with context @title:group Date",
+                    "%1", newGroupValue);
+            } else {
+                newGroupValue = fileTime.toString(i18nc("@title:group Date: "
+                    "MMMM is full month name in current locale, and yyyy is "
+                    "full year number", "'Earlier on' MMMM, yyyy"));
+                newGroupValue = i18nc("Can be used to script translation of "
+                    "\"'Earlier on' MMMM, yyyy\" with context @title:group Date",
+                    "%1", newGroupValue);
+            }
+        } else {
+            newGroupValue = fileTime.toString(i18nc("@title:group "
+                "The month and year: MMMM is full month name in current locale, "
+                "and yyyy is full year number", "MMMM, yyyy"));
+            newGroupValue = i18nc("Can be used to script translation of "
+                "\"MMMM, yyyy\" with context @title:group Date",
+                "%1", newGroupValue);
+        }
+    }
+
+    return newGroupValue;
+}
+
+qint64 KFileItemModel::fileTimeInSeconds(const KFileItem& item, KFileItem::FileTimes which)
 {
-    Q_ASSERT(!m_itemData.isEmpty());
+    uint field;
+    switch (which) {
+    case KFileItem::ModificationTime: field = KIO::UDSEntry::UDS_MODIFICATION_TIME; break;
+    case KFileItem::AccessTime:       field = KIO::UDSEntry::UDS_ACCESS_TIME; break;
+    case KFileItem::CreationTime:     field = KIO::UDSEntry::UDS_CREATION_TIME; break;
+    default:                          field = 0; break;
+    }
+
+    const long long seconds = field ? item.entry().numberValue(field, -1) : -1;
+    if (seconds != -1) {
+        return seconds;
+    }
+
+    // The time is not part of the UDS entry, e.g., because the item
+    // has been created for a local file without a KIO job.
+    const QDateTime time = item.time(which);
+    return time.isValid() ? time.toSecsSinceEpoch() : InvalidFileTime;
+}
 
-    const int maxIndex = count() - 1;
+QList<QPair<int, QVariant> > KFileItemModel::permissionRoleGroups(int begin, int end) const
+{
     QList<QPair<int, QVariant> > groups;
 
     QString permissionsString;
     QString groupValue;
-    for (int i = 0; i <= maxIndex; ++i) {
+    for (int i = begin; i < end; ++i) {
         if (isChildItem(i)) {
             continue;
         }
 
         const ItemData* itemData = m_itemData.at(i);
-        const QString newPermissionsString = itemData->values.value("permissions").toString();
+        const QString newPermissionsString = itemData->extraValues.value("permissions").toString();
         if (newPermissionsString == permissionsString) {
             continue;
         }
@@ -2180,19 +4298,16 @@ QList<QPair<int, QVariant> > KFileItemModel::permissionRoleGroups() const
     return groups;
 }
 
-QList<QPair<int, QVariant> > KFileItemModel::ratingRoleGroups() const
+QList<QPair<int, QVariant> > KFileItemModel::ratingRoleGroups(int begin, int end) const
 {
-    Q_ASSERT(!m_itemData.isEmpty());
-
-    const int maxIndex = count() - 1;
     QList<QPair<int, QVariant> > groups;
 
     int groupValue = -1;
-    for (int i = 0; i <= maxIndex; ++i) {
+    for (int i = begin; i < end; ++i) {
         if (isChildItem(i)) {
             continue;
         }
-        const int newGroupValue = m_itemData.at(i)->values.value("rating", 0).toInt();
+        const int newGroupValue = m_itemData.at(i)->extraValues.value("rating", 0).toInt();
         if (newGroupValue != groupValue) {
             groupValue = newGroupValue;
             groups.append(QPair<int, QVariant>(i, newGroupValue));
@@ -2202,20 +4317,17 @@ QList<QPair<int, QVariant> > KFileItemModel::ratingRoleGroups() const
     return groups;
 }
 
-QList<QPair<int, QVariant> > KFileItemModel::genericStringRoleGroups(const QByteArray& role) const
+QList<QPair<int, QVariant> > KFileItemModel::genericStringRoleGroups(const QByteArray& role, int begin, int end) const
 {
-    Q_ASSERT(!m_itemData.isEmpty());
-
-    const int maxIndex = count() - 1;
     QList<QPair<int, QVariant> > groups;
 
     bool isFirstGroupValue = true;
     QString groupValue;
-    for (int i = 0; i <= maxIndex; ++i) {
+    for (int i = begin; i < end; ++i) {
         if (isChildItem(i)) {
             continue;
         }
-        const QString newGroupValue = m_itemData.at(i)->values.value(role).toString();
+        const QString newGroupValue = storedValue(m_itemData.at(i), role).toString();
         if (newGroupValue != groupValue || isFirstGroupValue) {
             groupValue = newGroupValue;
             groups.append(QPair<int, QVariant>(i, newGroupValue));
@@ -2226,6 +4338,29 @@ QList<QPair<int, QVariant> > KFileItemModel::genericStringRoleGroups(const QByte
     return groups;
 }
 
+void KFileItemModel::setResolvedMimeType(int index, const QString& mimeType, const QString& iconName)
+{
+    if (index < 0 || index >= count() || mimeType.isEmpty()) {
+        return;
+    }
+
+    ItemData* itemData = m_itemData.at(index);
+    const KFileItem& item = itemData->item;
+    if ((item.isMimeTypeKnown() && item.isFinalIconKnown()) || item.entry().count() == 0) {
+        return;
+    }
+
+    KIO::UDSEntry entry = item.entry();
+    entry.replace(KIO::UDSEntry::UDS_MIME_TYPE, mimeType);
+    if (!iconName.isEmpty()) {
+        entry.replace(KIO::UDSEntry::UDS_ICON_NAME, iconName);
+    }
+
+    // The URL of the item stays the same, so m_items does not need to be updated.
+    itemData->item = KFileItem(entry, item.url());
+    m_dataCache.remove(itemData);
+}
+
 void KFileItemModel::emitSortProgress(int resolvedCount)
 {
     // Be tolerant against a resolvedCount with a wrong range.
@@ -2238,8 +4373,7 @@ void KFileItemModel::emitSortProgress(int resolvedCount)
     if (resolvedCount >= itemCount) {
         m_sortingProgressPercent = -1;
         if (m_resortAllItemsTimer->isActive()) {
-            m_resortAllItemsTimer->stop();
-            resortAllItems();
+            resortChangedItems();
         }
 
         emit directorySortingProgress(100);
@@ -2332,9 +4466,10 @@ QByteArray KFileItemModel::sharedValue(const QByteArray& value)
 
 bool KFileItemModel::isConsistent() const
 {
-    // m_items may contain less items than m_itemData because m_items
-    // is populated lazily, see KFileItemModel::index(const QUrl& url).
+    // m_items may contain less items than m_itemData if the model contains
+    // several items with the same URL (see KFileItemModelTest::testInconsistentModel()).
     if (m_items.count() > m_itemData.count()) {
+        qCWarning(DolphinDebug) << "m_items contains" << m_items.count() << "URLs, but there are" << m_itemData.count() << "items";
         return false;
     }
 
@@ -2346,6 +4481,11 @@ bool KFileItemModel::isConsistent() const
             return false;
         }
 
+        if (m_itemData.at(i)->index != i) {
+            qCWarning(DolphinDebug) << "Item" << i << "has a wrong stored index:" << m_itemData.at(i)->index;
+            return false;
+        }
+
         const int itemIndex = index(item);
         if (itemIndex != i) {
             qCWarning(DolphinDebug) << "Item" << i << "has a wrong index:" << itemIndex;
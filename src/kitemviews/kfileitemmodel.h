@@ -22,17 +22,27 @@
 
 #include "dolphin_export.h"
 #include "kitemviews/kitemmodelbase.h"
+#include "kitemviews/private/kfileitemmodelarena.h"
 #include "kitemviews/private/kfileitemmodelfilter.h"
+#include "kitemviews/private/kfileitemmodelsnapshot.h"
+#include "kitemviews/private/krangesuccessorindex.h"
 
 #include <KFileItem>
 
+#include <QCache>
 #include <QCollator>
+#include <QDate>
+#include <QFuture>
 #include <QHash>
+#include <QScopedPointer>
+#include <QSharedPointer>
 #include <QSet>
 #include <QUrl>
+#include <QVector>
 
 #include <functional>
 
+class KFileItemModelChangeCoalescer;
 class KFileItemModelDirLister;
 class QTimer;
 
@@ -63,8 +73,11 @@ public:
     void loadDirectory(const QUrl& url);
 
     /**
-     * Throws away all currently loaded items and refreshes the directory
-     * by reloading all items again.
+     * Refreshes the directory by listing all items again. If \a url is the
+     * current directory, the listed items are compared with the items of the
+     * model, and only the differences result in signals. The values of
+     * unchanged items are kept. Otherwise all currently loaded items are
+     * thrown away.
      */
     void refreshDirectory(const QUrl& url);
 
@@ -86,6 +99,13 @@ public:
     QHash<QByteArray, QVariant> data(int index) const override;
     bool setData(int index, const QHash<QByteArray, QVariant>& values) override;
 
+    /**
+     * Sets the values of several items (key: index) at once. In contrast to
+     * calling setData() for each item, the signal itemsChanged() is emitted
+     * only once. The role "text" must not be changed with this method.
+     */
+    void setItemsData(const QHash<int, QHash<QByteArray, QVariant> >& values);
+
     /**
      * Sets a separate sorting with directories first (true) or a mixed
      * sorting of files and directories (false).
@@ -93,16 +113,41 @@ public:
     void setSortDirectoriesFirst(bool dirsFirst);
     bool sortDirectoriesFirst() const;
 
+    /**
+     * Shows or hides the hidden files. The dir lister always lists hidden files,
+     * so toggling the setting only moves items between the model and
+     * m_hiddenItems.
+     */
     void setShowHiddenFiles(bool show);
     bool showHiddenFiles() const;
 
     /**
      * If set to true, only directories are shown as items of the model. Files
-     * are ignored.
+     * are ignored. If the setting is enabled before a directory has been loaded,
+     * the files are not listed at all.
      */
     void setShowDirectoriesOnly(bool enabled);
     bool showDirectoriesOnly() const;
 
+    /**
+     * If set to true, local directories are read directly instead of by the
+     * KIO file worker, see KFileItemModelDirLister::setLocalListingEnabled().
+     * The setting takes effect when the next directory is loaded.
+     */
+    void setLocalListingEnabled(bool enabled);
+    bool localListingEnabled() const;
+
+    /**
+     * If set to true, a snapshot of a large local directory is saved to the
+     * cache when the directory is left. When the directory is loaded again
+     * and has not been changed in the meantime, the items of the snapshot are
+     * shown immediately. They are reconciled with the items of the real
+     * listing afterwards, which only results in signals for the items that
+     * have been changed. Is false per default.
+     */
+    void setSnapshotsEnabled(bool enabled);
+    bool snapshotsEnabled() const;
+
     QMimeData* createMimeData(const KItemSet& indexes) const override;
 
     int indexForKeyboardSearch(const QString& text, int startFromIndex = 0) const override;
@@ -140,6 +185,30 @@ public:
      */
     int index(const QUrl &url) const;
 
+    bool isDir(int index) const override;
+    qulonglong fileSize(int index) const override;
+
+    /**
+     * @return The number of files and folders in the model and the total
+     *         size of the files. The values are updated whenever items are
+     *         inserted, removed or refreshed, so the runtime complexity of
+     *         these calls is O(1).
+     */
+    int fileCount() const;
+    int folderCount() const;
+    KIO::filesize_t totalFileSize() const;
+
+    /**
+     * @return Statistics about the changes of the listed directories, which
+     *         are merged before they are applied to the model: the number of
+     *         item changes which have been reported by the dir lister, the
+     *         number of merged updates, and the number of item changes which
+     *         have been applied by these updates.
+     */
+    qint64 receivedChangeCount() const;
+    qint64 appliedUpdateCount() const;
+    qint64 appliedChangeCount() const;
+
     /**
      * @return Root item of all items representing the item
      *         for KFileItemModel::dir().
@@ -167,7 +236,9 @@ public:
     /**
      * Marks the URLs in \a urls as sub-directories which were expanded previously.
      * After calling loadDirectory() or refreshDirectory() the marked sub-directories
-     * will be expanded step-by-step.
+     * will be expanded in waves: all marked sub-directories which are part of the
+     * model are listed concurrently, and their marked sub-directories are expanded
+     * as soon as they get visible.
      */
     void restoreExpandedDirectories(const QSet<QUrl>& urls);
 
@@ -270,14 +341,46 @@ private slots:
      */
     void resortAllItems();
 
-    void slotCompleted();
+    /**
+     * Moves the items from m_itemsToResort to their correct positions. The
+     * other items are not sorted again, unless their order turns out to be
+     * incorrect or too many items have changed, in which case
+     * resortAllItems() is used.
+     */
+    void resortChangedItems();
+
+    /**
+     * Calculates the groups again if they depend on the current date, e.g.,
+     * because items are grouped as "Today" and "Yesterday".
+     */
+    void slotDayChanged();
+
+    void slotCompleted(const QUrl& directoryUrl = QUrl());
     void slotCanceled();
+    void slotDirectoryCanceled(const QUrl& directoryUrl);
     void slotItemsAdded(const QUrl& directoryUrl, const KFileItemList& items);
     void slotItemsDeleted(const KFileItemList& items);
     void slotRefreshItems(const QList<QPair<KFileItem, KFileItem> >& items);
     void slotClear();
     void slotSortingChoiceChanged();
 
+    /**
+     * Receive the changes of the dir lister. After the directory has been
+     * listed, the changes are passed to m_changeCoalescer, which merges the
+     * changes of an item.
+     */
+    void slotListerItemsAdded(const QUrl& directoryUrl, const KFileItemList& items);
+    void slotListerItemsDeleted(const KFileItemList& items);
+    void slotListerRefreshItems(const QList<QPair<KFileItem, KFileItem> >& items);
+
+    /**
+     * Applies the changes which have been merged by m_changeCoalescer
+     * as one update.
+     */
+    void slotChangesCoalesced(const KFileItemList& deletedItems,
+                              const QList<QPair<KFileItem, KFileItem> >& refreshedItems,
+                              const QHash<QUrl, KFileItemList>& addedItems);
+
     void dispatchPendingItemsToInsert();
 
 private:
@@ -295,11 +398,36 @@ private:
         RolesCount
     };
 
+    enum ItemDataFlag {
+        IsExpandedFlag = 0x01,
+        HasIsExpandedFlag = 0x02,
+        IsExpandableFlag = 0x04,
+        HasIsExpandableFlag = 0x08,
+        HasSizeFlag = 0x10,
+        HasTypeFlag = 0x20,
+        HasIconNameFlag = 0x40,
+        MimeTypeRolesStoredFlag = 0x80
+    };
+
+    /**
+     * Roles that can be retrieved quickly from the KFileItem are not stored
+     * but determined by retrieveData() on demand. The values of all other roles
+     * are kept in typed members if they are used frequently, and in the sparse
+     * hash 'extraValues' otherwise (e.g. "iconPixmap" or the Baloo roles). An
+     * empty QHash does not allocate any memory.
+     */
     struct ItemData
     {
         KFileItem item;
-        QHash<QByteArray, QVariant> values;
         ItemData* parent;
+        QString type;                   // Valid if HasTypeFlag is set
+        QString iconName;               // Valid if HasIconNameFlag is set
+        QHash<QByteArray, QVariant> extraValues;
+        QScopedPointer<QCollatorSortKey> sortKey; // Collation key for item.text(), see updateSortKeys()
+        int size;                       // Number of sub-items of a directory, valid if HasSizeFlag is set
+        int index;                      // Position in m_itemData, only valid for visible items
+        qint16 expandedParentsCount;
+        quint8 flags;                   // Combination of ItemDataFlag values
     };
 
     enum RemoveItemsBehavior {
@@ -307,9 +435,60 @@ private:
         DeleteItemData
     };
 
-    void insertItems(QList<ItemData*>& items);
+    enum InsertItemsBehavior {
+        SortNewItems,
+        NewItemsAreSorted
+    };
+
+    enum ApplyFiltersBehavior {
+        FilterAllItems,
+        FilterVisibleItemsOnly
+    };
+
+    enum ReorderItemsBehavior {
+        ReverseSortOrder,
+        SortDirectoriesFirst,
+        MixDirectoriesAndFiles
+    };
+
+    /**
+     * Values of a new top-level item that are required for sorting it on a
+     * worker thread, see slotItemsAdded(). They are copied from the KFileItem
+     * on the GUI thread, because the KFileItem is shared with the cache of
+     * KDirLister and must not be accessed by other threads. \a value is the
+     * size or the time that is compared for the sort role, and \a index is
+     * the position of the item in m_preparedItems.
+     */
+    struct SortRecord
+    {
+        QString text;
+        QString name;
+        QString url;
+        QSharedPointer<QCollatorSortKey> sortKey;
+        qint64 value;
+        bool isDir;
+        int index;
+    };
+
+    /**
+     * Entry of the prefix index that is used by indexForKeyboardSearch().
+     * \a key is the case folded text of the item.
+     */
+    struct KeyboardSearchEntry
+    {
+        QString key;
+        const ItemData* data;
+    };
+
+    void insertItems(QList<ItemData*>& items, InsertItemsBehavior behavior = SortNewItems);
     void removeItems(const KItemRangeList& itemRanges, RemoveItemsBehavior behavior);
 
+    /**
+     * Destroys \a itemData and removes it from m_itemsToResort. Must be used
+     * instead of m_itemDataArena.destroy(), as the arena reuses the memory.
+     */
+    void destroyItemData(ItemData* itemData);
+
     /**
      * Helper method for insertItems() and removeItems(): Creates
      * a list of ItemData elements based on the given items.
@@ -319,16 +498,135 @@ private:
     QList<ItemData*> createItemDataList(const QUrl& parentUrl, const KFileItemList& items) const;
 
     /**
-     * Prepares the items for sorting. Normally, the hash 'values' in ItemData is filled
-     * lazily to save time and memory, but for some sort roles, it is expected that the
-     * sort role data is stored in 'values'.
+     * @return True if the items for the parent \a parentUrl can be created
+     *         and sorted by a worker thread.
+     */
+    bool canPrepareItemsInBackground(const QUrl& parentUrl) const;
+
+    /**
+     * Appends \a items to m_preparedItems and creates the sort records for
+     * them. Must be invoked by the GUI thread.
+     */
+    QVector<SortRecord> createSortRecords(const KFileItemList& items);
+
+    /**
+     * Creates the collation keys for \a records and sorts them. Is invoked
+     * by a worker thread and must only read the sorting settings.
+     */
+    QVector<SortRecord> sortRecords(QVector<SortRecord> records) const;
+
+    /**
+     * Merges the sorted records \a a and \a b into one sorted list.
+     */
+    QVector<SortRecord> mergeSortRecords(const QVector<SortRecord>& a, const QVector<SortRecord>& b) const;
+
+    /**
+     * @return True if \a a is sorted before \a b. Is the equivalent
+     *         of lessThan() for top-level items that have no stored values.
+     */
+    bool sortRecordLessThan(const SortRecord& a, const SortRecord& b) const;
+
+    /**
+     * Merges the sorted lists \a a and \a b into one sorted list.
+     */
+    QList<ItemData*> mergeItemDataLists(const QList<ItemData*>& a, const QList<ItemData*>& b) const;
+
+    /**
+     * Waits for the records that are sorted by worker threads, merges them,
+     * creates the items and moves the filtered items to m_filteredItems.
+     * @return The sorted visible items. m_pendingItemBatches is empty afterwards.
+     */
+    QList<ItemData*> takePreparedItems();
+
+    /**
+     * Moves the items from m_pendingItemBatches to m_pendingItemsToInsert. Must
+     * be invoked before the sorting settings are changed.
+     */
+    void finishPendingItemBatches();
+
+    /**
+     * Prepares the items for sorting. Normally, only the roles that cannot be
+     * retrieved from the KFileItem are stored in ItemData to save time and memory,
+     * but for some sort roles, it is expected that the sort role data is stored.
      */
     void prepareItemsForSorting(QList<ItemData*>& itemDataList);
 
+    /**
+     * @return The parent of \a items if all of them have the same parent,
+     *         which must be part of the model. Otherwise nullptr is returned.
+     */
+    const ItemData* commonParent(const QList<ItemData*>& items) const;
+
     static int expandedParentsCount(const ItemData* data);
 
+    /**
+     * Expands all items from m_urlsToExpand which are part of the model. The
+     * dir lister lists the children of the expanded items concurrently.
+     */
+    void expandVisibleUrls();
+
+    /**
+     * Removes \a directoryUrl from m_urlsBeingExpanded after it has been listed.
+     */
+    void finishExpansion(const QUrl& directoryUrl);
+
     void removeExpandedItems();
 
+    /**
+     * Updates ItemData::index for all items starting at the index \a first.
+     */
+    void updateItemIndexes(int first);
+
+    /**
+     * Adds \a item to m_fileCount or m_folderCount and m_totalFileSize, or
+     * removes it from these counters.
+     */
+    void addToItemCounts(const KFileItem& item);
+    void removeFromItemCounts(const KFileItem& item);
+
+    /**
+     * Creates m_keyboardSearchIndex for all items of m_itemData. The index is
+     * created lazily when indexForKeyboardSearch() is called the first time,
+     * and patched by addToKeyboardSearchIndex() and removeFromKeyboardSearchIndex()
+     * afterwards.
+     */
+    void buildKeyboardSearchIndex() const;
+    void addToKeyboardSearchIndex(const QList<ItemData*>& items);
+    void removeFromKeyboardSearchIndex(const QVector<KeyboardSearchEntry>& entries);
+    static bool keyboardSearchEntryLessThan(const KeyboardSearchEntry& a, const KeyboardSearchEntry& b);
+
+    /**
+     * Emits itemsMoved() after resorting the items, or groupsChanged() if
+     * only the groups have changed. \a newIndexes[i] must be the new index
+     * of the item with the old index i. If \a newGroups is not empty, it
+     * replaces the cached groups instead of determining them again.
+     */
+    void emitResortingSignals(const QVector<int>& newIndexes,
+                              const QList<QPair<int, QVariant> >& newGroups = QList<QPair<int, QVariant> >());
+
+    /**
+     * Brings the sorted items into the order for the changed sort order or
+     * 'sort directories first' setting in linear time. The items are not
+     * compared, except for merging the directories and files with
+     * MixDirectoriesAndFiles. Falls back to resortAllItems() if the items
+     * are not sorted completely.
+     */
+    void reorderAllItems(ReorderItemsBehavior behavior);
+
+    /**
+     * Appends the items in the range from \a begin to \a end of m_itemData
+     * to \a result in the order for \a behavior. Children stay behind
+     * their parent and are reordered recursively.
+     */
+    void reorderSiblings(QList<ItemData*>& result, int begin, int end, ReorderItemsBehavior behavior) const;
+
+    /**
+     * @return The groups after reversing the items in the ranges from 0 to
+     *         \a filesBegin and from \a filesBegin to count(), which can be
+     *         derived from the cached groups.
+     */
+    QList<QPair<int, QVariant> > reversedGroups(int filesBegin) const;
+
     /**
      * This function is called by setData() and slotRefreshItems(). It emits
      * the itemsChanged() signal, checks if the sort order is still correct,
@@ -355,6 +653,34 @@ private:
 
     QHash<QByteArray, QVariant> retrieveData(const KFileItem& item, const ItemData* parent) const;
 
+    /**
+     * Stores the roles of \a data that depend on the MIME-type ("iconName" and "type")
+     * if they can be determined without blocking. Values that have been stored before
+     * are kept if the MIME-type is not known yet.
+     */
+    void storeMimeTypeRoles(ItemData* data) const;
+
+    /**
+     * @return True if a value for \a role is stored in \a data, i.e., if it has been
+     *         set with setData() or stored by prepareItemsForSorting() or
+     *         storeMimeTypeRoles().
+     */
+    bool hasStoredValue(const ItemData* data, const QByteArray& role) const;
+
+    QVariant storedValue(const ItemData* data, const QByteArray& role) const;
+    void setStoredValue(ItemData* data, const QByteArray& role, const QVariant& value) const;
+
+    /**
+     * Inserts all values that are stored in \a data into \a values.
+     */
+    void insertStoredValues(const ItemData* data, QHash<QByteArray, QVariant>& values) const;
+
+    /**
+     * Removes all values that are stored in \a data. They will be stored again
+     * the next time they are set or needed.
+     */
+    void clearStoredValues(ItemData* data);
+
     /**
      * @return True if \a a has a KFileItem whose text is 'less than' the one
      *         of \a b according to QString::operator<(const QString&).
@@ -373,6 +699,16 @@ private:
      */
     void sort(QList<ItemData*>::iterator begin, QList<ItemData*>::iterator end) const;
 
+    /**
+     * Sorts the items between \a begin and \a end with a radix sort if the
+     * sort role has a numeric value and all items have the same parent.
+     * Items with equal values are ordered by lessThan().
+     * @return False if the items cannot be sorted by a numeric key.
+     */
+    bool sortByNumericKey(QList<ItemData*>::iterator begin,
+                          QList<ItemData*>::iterator end,
+                          int numberOfThreads) const;
+
     /**
      * Helper method for lessThan() and expandedParentsCountCompare(): Compares
      * the passed item-data using m_sortRole as criteria. Both items must
@@ -382,14 +718,52 @@ private:
 
     int stringCompare(const QString& a, const QString& b, const QCollator& collator) const;
 
+    /**
+     * Calculates the collation keys for the texts of the items if natural sorting
+     * is used, or removes them otherwise. Comparing two keys is much cheaper than
+     * QCollator::compare(), which would redo the collation work on every comparison.
+     */
+    void updateSortKeys(QList<ItemData*>& itemDataList) const;
+    void updateSortKey(ItemData* data) const;
+
     bool useMaximumUpdateInterval() const;
 
-    QList<QPair<int, QVariant> > nameRoleGroups() const;
-    QList<QPair<int, QVariant> > sizeRoleGroups() const;
-    QList<QPair<int, QVariant> > timeRoleGroups(std::function<QDateTime(const ItemData *)> fileTimeCb) const;
-    QList<QPair<int, QVariant> > permissionRoleGroups() const;
-    QList<QPair<int, QVariant> > ratingRoleGroups() const;
-    QList<QPair<int, QVariant> > genericStringRoleGroups(const QByteArray& typeForRole) const;
+    /**
+     * @return Groups for the items in the range [begin, end) according to the
+     *         current sort role. The first item of the range always starts a group.
+     */
+    QList<QPair<int, QVariant> > groupsForRange(int begin, int end) const;
+
+    QList<QPair<int, QVariant> > nameRoleGroups(int begin, int end) const;
+    QList<QPair<int, QVariant> > sizeRoleGroups(int begin, int end) const;
+    QList<QPair<int, QVariant> > timeRoleGroups(std::function<qint64(const ItemData *)> fileTimeCb, int begin, int end) const;
+    QList<QPair<int, QVariant> > permissionRoleGroups(int begin, int end) const;
+    QList<QPair<int, QVariant> > ratingRoleGroups(int begin, int end) const;
+    QList<QPair<int, QVariant> > genericStringRoleGroups(const QByteArray& typeForRole, int begin, int end) const;
+
+    /**
+     * @return Group title for items with the time \a fileTime, which is used by
+     *         timeRoleGroups(). The title only depends on the date of \a fileTime.
+     */
+    static QString timeRoleGroupValue(const QDateTime& fileTime, const QDate& currentDate);
+
+    /**
+     * @return Time \a which of \a item in seconds since the epoch, or
+     *         InvalidFileTime if the time is unknown. In contrast to
+     *         KFileItem::time(), no QDateTime is created if the time is
+     *         part of the UDS entry.
+     */
+    static qint64 fileTimeInSeconds(const KFileItem& item, KFileItem::FileTimes which);
+    static const qint64 InvalidFileTime;
+
+    /**
+     * Update the cached groups m_groups after items have been inserted or removed.
+     * Only the groups of the inserted items are determined, the boundaries of the
+     * other groups are moved. If items are expanded, the groups are cleared and
+     * calculated again in groups().
+     */
+    void updateGroupsAfterInsertion(const KItemRangeList& itemRanges);
+    void updateGroupsAfterRemoval(const KItemRangeList& itemRanges);
 
     /**
      * Helper method for all xxxRoleGroups() methods to check whether the
@@ -407,22 +781,110 @@ private:
      */
     void emitSortProgress(int resolvedCount);
 
+    /**
+     * Is invoked by KFileItemModelRolesUpdater if the MIME type and icon of
+     * the item with the index \a index have been determined by a worker
+     * thread. The item is replaced by an item with the known MIME type, so
+     * that the type is not determined again in the GUI thread.
+     */
+    void setResolvedMimeType(int index, const QString& mimeType, const QString& iconName);
+
     /**
      * Applies the filters set through @ref setNameFilter and @ref setMimeTypeFilters.
+     * If \a behavior is FilterVisibleItemsOnly, the items that are hidden already
+     * are not checked again, because the filter has only been narrowed.
+     */
+    void applyFilters(ApplyFiltersBehavior behavior = FilterAllItems);
+
+    /**
+     * @return For each item of \a itemDataList whether it matches with m_filter.
+     *         Large lists are checked in parallel if the filter permits it.
      */
-    void applyFilters();
+    QVector<bool> filterMatches(const QList<ItemData*>& itemDataList) const;
 
     /**
-     * Removes filtered items whose expanded parents have been deleted
+     * Removes filtered and hidden items whose expanded parents have been deleted
      * or collapsed via setExpanded(parentIndex, false).
      */
     void removeFilteredChildren(const KItemRangeList& parents);
 
+    /**
+     * @return True if \a item is shown with the current settings for hidden
+     *         files and directories only. Items that are not shown are kept
+     *         in m_hiddenItems.
+     */
+    bool isShownItem(const KFileItem& item) const;
+
+    /**
+     * Moves the items that are not shown anymore from the model and from
+     * m_filteredItems to m_hiddenItems, and inserts the hidden items that
+     * are shown now. Is invoked if the settings for hidden files or
+     * directories only have been changed.
+     */
+    void updateShownItems();
+
+    /**
+     * Adds \a items to m_hiddenItems. If \a behavior is SortNewItems,
+     * the items are sorted first.
+     */
+    void addHiddenItems(QList<ItemData*>& items, InsertItemsBehavior behavior = SortNewItems);
+
+    /**
+     * Sorts m_hiddenItems if the sorting settings have been changed
+     * since the items have been hidden.
+     */
+    void sortHiddenItems();
+
+    /**
+     * @return True if m_hiddenItems or m_pendingHiddenItems contain an item with the URL \a url.
+     */
+    bool containsHiddenItem(const QUrl& url) const;
+
     /**
      * Loads the selected choice of sorting method from Dolphin General Settings
      */
     void loadSortingSettings();
 
+    /**
+     * Shows the items of the snapshot of the directory \a url if a valid
+     * snapshot exists, see setSnapshotsEnabled().
+     */
+    void loadSnapshot(const QUrl& url);
+
+    /**
+     * Saves a snapshot of the current directory in the background if the
+     * directory has been listed completely and contains enough items.
+     */
+    void saveSnapshot();
+
+    /**
+     * Compares the items which have been listed for the directory \a directoryUrl
+     * with the children of the directory in the model. Only new, removed and
+     * changed items are updated, which keeps the values of the other items.
+     * Items of the model which have not been listed are only removed if
+     * \a listingCompleted is true.
+     */
+    void reconcileDirectory(const QUrl& directoryUrl, bool listingCompleted);
+
+    /**
+     * @return True if the changes of the directory \a directoryUrl are passed
+     *         to m_changeCoalescer. Items which are listed initially, e.g., when
+     *         entering, refreshing or expanding a directory, are inserted
+     *         without delay.
+     */
+    bool isCoalescingChanges(const QUrl& directoryUrl) const;
+
+    /**
+     * @return Description of the current sorting, which tells whether the
+     *         order of the items in a snapshot can be used by the model.
+     */
+    QString snapshotSortSignature() const;
+
+    /**
+     * Snapshots are only saved for directories with at least this number of items.
+     */
+    static const int SnapshotMinimumItemCount;
+
     /**
      * Maps the QByteArray-roles to RoleTypes and provides translation- and
      * group-contexts.
@@ -466,43 +928,108 @@ private:
 
     QCollator m_collator;
     bool m_naturalSorting;
+    bool m_useSortKeys;         // True if ItemData::sortKey is used for natural sorting
     bool m_sortDirsFirst;
+    Qt::SortOrder m_itemSortOrder; // Copy of sortOrder() that is safe to read for the worker threads
 
     RoleType m_sortRole;
     int m_sortingProgressPercent; // Value of directorySortingProgress() signal
     QSet<QByteArray> m_roles;
 
+    // Owns all ItemData instances of the model. The instances are destroyed
+    // with destroyItemData(), or all at once in slotClear().
+    mutable KFileItemModelArena<ItemData> m_itemDataArena;
+
     QList<ItemData*> m_itemData;
 
-    // m_items is a cache for the method index(const QUrl&). If it contains N
-    // entries, it is guaranteed that these correspond to the first N items in
-    // the model, i.e., that (for every i between 0 and N - 1)
-    // m_items.value(fileItem(i).url()) == i
-    mutable QHash<QUrl, int> m_items;
+    // Values returned by data() for the recently accessed items. An entry must
+    // be removed whenever the values of the item change, see data(). Is only
+    // accessed by the GUI thread.
+    mutable QCache<const ItemData*, QHash<QByteArray, QVariant> > m_dataCache;
+
+    // Summary of the items in m_itemData, see addToItemCounts()
+    int m_fileCount;
+    int m_folderCount;
+    KIO::filesize_t m_totalFileSize;
+
+    // m_items contains the URLs of all items in m_itemData and is used by the
+    // method index(const QUrl&) together with ItemData::index. It is updated
+    // incrementally when items are inserted, removed or renamed, and it is not
+    // affected by resorting.
+    QHash<QUrl, ItemData*> m_items;
+
+    // Entries for all items in m_itemData, sorted by their case folded text.
+    // Items that start with a given text are stored next to each other, and
+    // ItemData::index gives their current position in the model.
+    mutable QVector<KeyboardSearchEntry> m_keyboardSearchIndex;
+    mutable bool m_keyboardSearchIndexValid;
+
+    // Contains ItemData::index of each entry of m_keyboardSearchIndex, so that the
+    // next item in the model that starts with a given text is found in O(log N)
+    // steps. It is rebuilt lazily after the entries or the indexes have changed.
+    mutable KRangeSuccessorIndex m_keyboardSearchSuccessors;
+    mutable bool m_keyboardSearchSuccessorsValid;
 
     KFileItemModelFilter m_filter;
     QHash<KFileItem, ItemData*> m_filteredItems; // Items that got hidden by KFileItemModel::setNameFilter()
 
+    // Hidden files, and files if only directories are shown. The items are
+    // sorted if m_hiddenItemsSorted is true, which allows to show them again
+    // by merging them with m_itemData.
+    bool m_showHiddenFiles;
+    bool m_showDirectoriesOnly;
+    QList<ItemData*> m_hiddenItems;
+    QList<ItemData*> m_pendingHiddenItems;
+    bool m_hiddenItemsSorted;
+
     bool m_requestRole[RolesCount];
 
     QTimer* m_maximumUpdateIntervalTimer;
     QTimer* m_resortAllItemsTimer;
+    QSet<const ItemData*> m_itemsToResort; // Items that are resorted by resortChangedItems()
     QList<ItemData*> m_pendingItemsToInsert;
+    QList<QFuture<QVector<SortRecord> > > m_pendingItemBatches; // Sorted runs of m_preparedItems
+    KFileItemList m_preparedItems;
+    bool m_itemBatchPipelineEnabled;
 
     // Cache for KFileItemModel::groups()
     mutable QList<QPair<int, QVariant> > m_groups;
 
+    // Date for which the groups of time roles have been calculated. It is
+    // invalid if the groups do not depend on the current date.
+    mutable QDate m_groupsDate;
+    QTimer* m_dayChangedTimer;
+
     // Stores the URLs (key: target url, value: url) of the expanded directories.
     QHash<QUrl, QUrl> m_expandedDirs;
 
     // URLs that must be expanded. The expanding is initially triggered in setExpanded()
-    // and done step after step in slotCompleted().
+    // and done wave after wave in slotCompleted().
     QSet<QUrl> m_urlsToExpand;
 
-    friend class KFileItemModelRolesUpdater;   // Accesses emitSortProgress() method
+    // URLs of the directories which have been expanded by expandVisibleUrls()
+    // and whose children are still being listed.
+    QSet<QUrl> m_urlsBeingExpanded;
+
+    bool m_snapshotsEnabled;
+    // State of the directory when its listing has been started. A snapshot
+    // is only saved if m_directoryListed is true.
+    bool m_directoryStampValid;
+    KFileItemModelSnapshot::DirectoryStamp m_directoryStamp;
+    bool m_directoryListed;
+
+    // Directories whose listed items are collected instead of being inserted
+    // (value: listed items). The items are compared with the items of the
+    // model in reconcileDirectory() when the listing has been completed.
+    QHash<QUrl, KFileItemList> m_directoriesToReconcile;
+
+    KFileItemModelChangeCoalescer* m_changeCoalescer;
+
+    friend class KFileItemModelRolesUpdater;   // Accesses emitSortProgress() and setResolvedMimeType()
     friend class KFileItemModelTest;           // For unit testing
     friend class KFileItemModelBenchmark;      // For unit testing
     friend class KFileItemListViewTest;        // For unit testing
+    friend class KItemListKeyboardSearchManagerTest; // For unit testing
     friend class DolphinPart;                  // Accesses m_dirLister
 };
 
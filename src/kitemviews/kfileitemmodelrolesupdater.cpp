@@ -19,12 +19,15 @@
 
 #include "kfileitemmodelrolesupdater.h"
 
+#include "dolphindebug.h"
 #include "kfileitemmodel.h"
 #include "private/kdirectorycontentscounter.h"
 #include "private/kpixmapmodifier.h"
+#include "private/kpreviewpixmapcache.h"
 
 #include <KConfig>
 #include <KConfigGroup>
+#include <KFileSystemType>
 #include <KIO/JobUiDelegate>
 #include <KIO/PreviewJob>
 #include <KIconLoader>
@@ -42,8 +45,11 @@
 #include <QApplication>
 #include <QPainter>
 #include <QElapsedTimer>
+#include <QThread>
 #include <QTimer>
 
+#include <algorithm>
+
 
 // #define KFILEITEMMODELROLESUPDATER_DEBUG
 
@@ -59,6 +65,25 @@ namespace {
     // Not only the visible area, but up to ReadAheadPages before and after
     // this area will be resolved.
     const int ReadAheadPages = 5;
+
+    // Maximum number of items which are passed to the worker threads
+    // of KFileItemRolesResolver at once. Keeping this small allows to
+    // react quickly if the visible area changes.
+    const int MaximumResolvingItems = 64;
+
+    // Maximum number of preview jobs which run at the same time. Each
+    // preview job uses its own thumbnail worker.
+    const int MaximumPreviewJobs = 8;
+
+    // Maximum number of concurrent preview jobs for network file systems
+    const int MaximumNetworkPreviewJobs = 2;
+
+    // Maximum number of items which are passed to one preview job. Limiting
+    // the size of the jobs keeps all jobs busy until the queue is empty.
+    const int MaximumItemsPerPreviewJob = 64;
+
+    // Default maximum size in MiB of the previews in the model
+    const int DefaultPreviewMemoryBudget = 256;
 }
 
 KFileItemModelRolesUpdater::KFileItemModelRolesUpdater(KFileItemModel* model, QObject* parent) :
@@ -75,14 +100,25 @@ KFileItemModelRolesUpdater::KFileItemModelRolesUpdater(KFileItemModel* model, QO
     m_iconSize(),
     m_firstVisibleIndex(0),
     m_lastVisibleIndex(-1),
+    m_scrollingForward(true),
     m_maximumVisibleItems(50),
     m_roles(),
     m_resolvableRoles(),
     m_enabledPlugins(),
     m_pendingSortRoleItems(),
-    m_pendingIndexes(),
-    m_pendingPreviewItems(),
-    m_previewJob(),
+    m_pendingItems(),
+    m_resolvingItems(),
+    m_rolesResolver(nullptr),
+    m_previewJobs(),
+    m_previewJobCountDirectory(),
+    m_maximumPreviewJobCount(1),
+    m_interestingItems(),
+    m_previewMemoryBudget(qint64(DefaultPreviewMemoryBudget) * 1024 * 1024),
+    m_previewMemoryUsage(0),
+    m_previewUsages(),
+    m_previewUsageCounter(0),
+    m_evictedItems(),
+    m_failedEvictionUsage(0),
     m_recentlyChangedItemsTimer(nullptr),
     m_recentlyChangedItems(),
     m_changedItems(),
@@ -95,6 +131,7 @@ KFileItemModelRolesUpdater::KFileItemModelRolesUpdater(KFileItemModel* model, QO
 
     const KConfigGroup globalConfig(KSharedConfig::openConfig(), "PreviewSettings");
     m_enabledPlugins = globalConfig.readEntry("Plugins", KIO::PreviewJob::defaultPlugins());
+    m_previewMemoryBudget = qint64(globalConfig.readEntry("MaximumMemoryUsage", DefaultPreviewMemoryBudget)) * 1024 * 1024;
 
     connect(m_model, &KFileItemModel::itemsInserted,
             this,    &KFileItemModelRolesUpdater::slotItemsInserted);
@@ -121,6 +158,10 @@ KFileItemModelRolesUpdater::KFileItemModelRolesUpdater(KFileItemModel* model, QO
     m_resolvableRoles += KBalooRolesProvider::instance().roles();
 #endif
 
+    m_rolesResolver = new KFileItemRolesResolver(this);
+    connect(m_rolesResolver, &KFileItemRolesResolver::itemsResolved,
+            this,            &KFileItemModelRolesUpdater::slotRolesResolved);
+
     m_directoryContentsCounter = new KDirectoryContentsCounter(m_model, this);
     connect(m_directoryContentsCounter, &KDirectoryContentsCounter::result,
             this,                       &KFileItemModelRolesUpdater::slotDirectoryContentsCountReceived);
@@ -177,9 +218,26 @@ void KFileItemModelRolesUpdater::setVisibleIndexRange(int index, int count)
         return;
     }
 
+    if (index != m_firstVisibleIndex) {
+        m_scrollingForward = (index > m_firstVisibleIndex);
+    }
+
     m_firstVisibleIndex = index;
     m_lastVisibleIndex = qMin(index + count - 1, m_model->count() - 1);
 
+    // Previews which have been visible before might be evicted now
+    m_failedEvictionUsage = 0;
+
+    // The previews of the visible items are the most recently used ones.
+    if (!m_previewUsages.isEmpty()) {
+        for (int i = m_firstVisibleIndex; i <= m_lastVisibleIndex; ++i) {
+            auto it = m_previewUsages.find(m_model->fileItem(i));
+            if (it != m_previewUsages.end()) {
+                it->lastUsed = ++m_previewUsageCounter;
+            }
+        }
+    }
+
     startUpdating();
 }
 
@@ -197,6 +255,10 @@ void KFileItemModelRolesUpdater::setPreviewsShown(bool show)
     m_previewShown = show;
     if (!show) {
         m_clearPreviews = true;
+        m_previewUsages.clear();
+        m_evictedItems.clear();
+        m_previewMemoryUsage = 0;
+        m_failedEvictionUsage = 0;
     }
 
     updateAllPreviews();
@@ -222,10 +284,31 @@ bool KFileItemModelRolesUpdater::enlargeSmallPreviews() const
     return m_enlargeSmallPreviews;
 }
 
+void KFileItemModelRolesUpdater::setPreviewMemoryBudget(qint64 bytes)
+{
+    m_previewMemoryBudget = bytes;
+    m_failedEvictionUsage = 0;
+    evictPreviews();
+}
+
+qint64 KFileItemModelRolesUpdater::previewMemoryBudget() const
+{
+    return m_previewMemoryBudget;
+}
+
+qint64 KFileItemModelRolesUpdater::previewMemoryUsage() const
+{
+    return m_previewMemoryUsage;
+}
+
 void KFileItemModelRolesUpdater::setEnabledPlugins(const QStringList& list)
 {
     if (m_enabledPlugins != list) {
         m_enabledPlugins = list;
+
+        // The cached previews might have been created by other plugins.
+        KPreviewPixmapCache::instance().clear();
+
         if (m_previewShown) {
             updateAllPreviews();
         }
@@ -381,16 +464,21 @@ void KFileItemModelRolesUpdater::slotItemsRemoved(const KItemRangeList& itemRang
 
         m_finishedItems.clear();
         m_pendingSortRoleItems.clear();
-        m_pendingIndexes.clear();
-        m_pendingPreviewItems.clear();
+        m_pendingItems.clear();
+        m_interestingItems.clear();
+        m_previewUsages.clear();
+        m_evictedItems.clear();
+        m_previewMemoryUsage = 0;
+        m_resolvingItems.clear();
+        m_rolesResolver->clear();
         m_recentlyChangedItems.clear();
         m_recentlyChangedItemsTimer->stop();
         m_changedItems.clear();
 
         killPreviewJob();
     } else {
-        // Only remove the items from m_finishedItems. They will be removed
-        // from the other sets later on.
+        // Only remove the items from m_finishedItems and m_evictedItems. They
+        // will be removed from the other sets later on.
         QSet<KFileItem>::iterator it = m_finishedItems.begin();
         while (it != m_finishedItems.end()) {
             if (m_model->index(*it) < 0) {
@@ -400,6 +488,15 @@ void KFileItemModelRolesUpdater::slotItemsRemoved(const KItemRangeList& itemRang
             }
         }
 
+        it = m_evictedItems.begin();
+        while (it != m_evictedItems.end()) {
+            if (m_model->index(*it) < 0) {
+                it = m_evictedItems.erase(it);
+            } else {
+                ++it;
+            }
+        }
+
         // The visible items might have changed.
         startUpdating();
     }
@@ -493,6 +590,9 @@ void KFileItemModelRolesUpdater::slotGotPreview(const KFileItem& item, const QPi
         return;
     }
 
+    QHash<QByteArray, QVariant> data = rolesData(item);
+    const QStringList overlays = data["iconOverlays"].toStringList();
+
     QPixmap scaledPixmap = pixmap;
 
     if (!pixmap.hasAlpha()
@@ -531,9 +631,6 @@ void KFileItemModelRolesUpdater::slotGotPreview(const KFileItem& item, const QPi
         scaledPixmap.setDevicePixelRatio(qApp->devicePixelRatio());
     }
 
-    QHash<QByteArray, QVariant> data = rolesData(item);
-
-    const QStringList overlays = data["iconOverlays"].toStringList();
     // Strangely KFileItem::overlays() returns empty string-values, so
     // we need to check first whether an overlay must be drawn at all.
     // It is more efficient to do it here, as KIconLoader::drawOverlays()
@@ -548,6 +645,8 @@ void KFileItemModelRolesUpdater::slotGotPreview(const KFileItem& item, const QPi
         }
     }
 
+    KPreviewPixmapCache::instance().insert(previewCacheKey(item, overlays), scaledPixmap);
+
     data.insert("iconPixmap", scaledPixmap);
 
     disconnect(m_model, &KFileItemModel::itemsChanged,
@@ -557,6 +656,9 @@ void KFileItemModelRolesUpdater::slotGotPreview(const KFileItem& item, const QPi
             this,    &KFileItemModelRolesUpdater::slotItemsChanged);
 
     m_finishedItems.insert(item);
+
+    addPreviewUsage(item, scaledPixmap);
+    evictPreviews();
 }
 
 void KFileItemModelRolesUpdater::slotPreviewFailed(const KFileItem& item)
@@ -583,19 +685,19 @@ void KFileItemModelRolesUpdater::slotPreviewFailed(const KFileItem& item)
     }
 }
 
-void KFileItemModelRolesUpdater::slotPreviewJobFinished()
+void KFileItemModelRolesUpdater::slotPreviewJobFinished(KJob* job)
 {
-    m_previewJob = nullptr;
+    m_previewJobs.removeOne(static_cast<KIO::PreviewJob*>(job));
 
     if (m_state != PreviewJobRunning) {
         return;
     }
 
-    m_state = Idle;
-
-    if (!m_pendingPreviewItems.isEmpty()) {
+    if (!m_pendingItems.isEmpty()) {
         startPreviewJob();
-    } else {
+    } else if (m_previewJobs.isEmpty()) {
+        m_state = Idle;
+
         if (!m_changedItems.isEmpty()) {
             updateChangedItems();
         }
@@ -647,11 +749,19 @@ void KFileItemModelRolesUpdater::resolveNextPendingRoles()
         return;
     }
 
-    while (!m_pendingIndexes.isEmpty()) {
-        const int index = m_pendingIndexes.takeFirst();
-        const KFileItem item = m_model->fileItem(index);
+    // Local items are passed to m_rolesResolver, which determines the MIME
+    // types in worker threads. The results are applied in slotRolesResolved().
+    while (!m_pendingItems.isEmpty() && m_rolesResolver->pendingCount() < MaximumResolvingItems) {
+        const KFileItem item = m_pendingItems.takeFirst();
+        const int index = m_model->index(item);
 
-        if (m_finishedItems.contains(item)) {
+        if (index < 0 || m_finishedItems.contains(item) || m_resolvingItems.contains(item)) {
+            continue;
+        }
+
+        if (item.isLocalFile()) {
+            m_resolvingItems.insert(item);
+            m_rolesResolver->resolve(item);
             continue;
         }
 
@@ -661,9 +771,12 @@ void KFileItemModelRolesUpdater::resolveNextPendingRoles()
         break;
     }
 
-    if (!m_pendingIndexes.isEmpty()) {
-        QTimer::singleShot(0, this, &KFileItemModelRolesUpdater::resolveNextPendingRoles);
-    } else {
+    if (!m_pendingItems.isEmpty()) {
+        if (m_rolesResolver->pendingCount() < MaximumResolvingItems) {
+            QTimer::singleShot(0, this, &KFileItemModelRolesUpdater::resolveNextPendingRoles);
+        }
+        // Otherwise slotRolesResolved() continues the resolving.
+    } else if (m_rolesResolver->isIdle()) {
         m_state = Idle;
 
         if (m_clearPreviews) {
@@ -692,6 +805,47 @@ void KFileItemModelRolesUpdater::resolveNextPendingRoles()
     }
 }
 
+void KFileItemModelRolesUpdater::slotRolesResolved(const QVector<KFileItemRolesResolver::Result>& results)
+{
+    QHash<int, QHash<QByteArray, QVariant> > itemsData;
+    itemsData.reserve(results.count());
+
+    for (const KFileItemRolesResolver::Result& result : results) {
+        m_resolvingItems.remove(result.item);
+
+        const int index = m_model->index(result.item);
+        if (index < 0) {
+            continue;
+        }
+
+        m_model->setResolvedMimeType(index, result.mimeType, result.iconName);
+
+        const KFileItem item = m_model->fileItem(index);
+        QHash<QByteArray, QVariant> data = rolesData(item, &result);
+        data.insert("iconName", result.iconName);
+        if (m_clearPreviews) {
+            data.insert("iconPixmap", QPixmap());
+        }
+        itemsData.insert(index, data);
+
+        m_finishedItems.insert(item);
+        m_changedItems.remove(item);
+    }
+
+    if (!itemsData.isEmpty()) {
+        // Apply all results with one update of the model.
+        disconnect(m_model, &KFileItemModel::itemsChanged,
+                   this,    &KFileItemModelRolesUpdater::slotItemsChanged);
+        m_model->setItemsData(itemsData);
+        connect(m_model, &KFileItemModel::itemsChanged,
+                this,    &KFileItemModelRolesUpdater::slotItemsChanged);
+    }
+
+    if (m_state == ResolvingAllRoles) {
+        resolveNextPendingRoles();
+    }
+}
+
 void KFileItemModelRolesUpdater::resolveRecentlyChangedItems()
 {
     m_changedItems += m_recentlyChangedItems;
@@ -788,9 +942,9 @@ void KFileItemModelRolesUpdater::startUpdating()
         return;
     }
 
-    // Terminate all updates that are currently active.
+    // Terminate the preview jobs that are currently active. The items which
+    // are still pending are kept in m_pendingItems.
     killPreviewJob();
-    m_pendingIndexes.clear();
 
     QElapsedTimer timer;
     timer.start();
@@ -804,24 +958,14 @@ void KFileItemModelRolesUpdater::startUpdating()
         return;
     }
 
-    // Start the preview job or the asynchronous resolving of all roles.
-    QList<int> indexes = indexesToResolve();
+    // Start the preview jobs or the asynchronous resolving of all roles.
+    updatePendingItems();
 
     if (m_previewShown) {
-        m_pendingPreviewItems.clear();
-        m_pendingPreviewItems.reserve(indexes.count());
-
-        foreach (int index, indexes) {
-            const KFileItem item = m_model->fileItem(index);
-            if (!m_finishedItems.contains(item)) {
-                m_pendingPreviewItems.append(item);
-            }
-        }
-
         startPreviewJob();
-    } else {
-        m_pendingIndexes = indexes;
-        // Trigger the asynchronous resolving of all roles.
+    } else if (m_state != ResolvingAllRoles) {
+        // Trigger the asynchronous resolving of all roles. If the resolving
+        // is in progress already, it continues with the updated queue.
         m_state = ResolvingAllRoles;
         QTimer::singleShot(0, this, &KFileItemModelRolesUpdater::resolveNextPendingRoles);
     }
@@ -857,10 +1001,19 @@ void KFileItemModelRolesUpdater::startPreviewJob()
 {
     m_state = PreviewJobRunning;
 
-    if (m_pendingPreviewItems.isEmpty()) {
-        QTimer::singleShot(0, this, &KFileItemModelRolesUpdater::slotPreviewJobFinished);
+    if (m_pendingItems.isEmpty()) {
+        if (m_previewJobs.isEmpty()) {
+            QTimer::singleShot(0, this, [this]() { slotPreviewJobFinished(nullptr); });
+        }
+        return;
+    }
+
+    const int jobCount = maximumPreviewJobCount() - m_previewJobs.count();
+    if (jobCount <= 0) {
+        // The next jobs are started by slotPreviewJobFinished().
         return;
     }
+    const int maximumItemCount = jobCount * MaximumItemsPerPreviewJob;
 
     // PreviewJob internally caches items always with the size of
     // 128 x 128 pixels or 256 x 256 pixels. A (slow) downscaling is done
@@ -872,19 +1025,26 @@ void KFileItemModelRolesUpdater::startPreviewJob()
 
     // KIO::filePreview() will request the MIME-type of all passed items, which (in the
     // worst case) might block the application for several seconds. To prevent such
-    // a blocking, we only pass items with known mime type to the preview job.
-    const int count = m_pendingPreviewItems.count();
+    // a blocking, we only pass items with known mime type to the preview jobs.
     KFileItemList itemSubSet;
-    itemSubSet.reserve(count);
+    itemSubSet.reserve(qMin(m_pendingItems.count(), maximumItemCount));
+
+    // Items whose previews are cached already don't need a preview job.
+    // The cached previews are applied to the model with one update.
+    QHash<int, QHash<QByteArray, QVariant> > cachedPreviews;
 
-    if (m_pendingPreviewItems.first().isMimeTypeKnown()) {
+    if (m_pendingItems.first().isMimeTypeKnown()) {
         // Some mime types are known already, probably because they were
         // determined when loading the icons for the visible items. Start
-        // a preview job for all items at the beginning of the list which
+        // preview jobs for the items at the beginning of the queue which
         // have a known mime type.
         do {
-            itemSubSet.append(m_pendingPreviewItems.takeFirst());
-        } while (!m_pendingPreviewItems.isEmpty() && m_pendingPreviewItems.first().isMimeTypeKnown());
+            const KFileItem item = m_pendingItems.takeFirst();
+            if (!takeCachedPreview(item, cachedPreviews)) {
+                itemSubSet.append(item);
+            }
+        } while (!m_pendingItems.isEmpty() && m_pendingItems.first().isMimeTypeKnown()
+                 && itemSubSet.count() < maximumItemCount);
     } else {
         // Determine mime types for MaxBlockTimeout ms, and start a preview
         // job for the corresponding items.
@@ -892,27 +1052,145 @@ void KFileItemModelRolesUpdater::startPreviewJob()
         timer.start();
 
         do {
-            const KFileItem item = m_pendingPreviewItems.takeFirst();
-            item.determineMimeType();
-            itemSubSet.append(item);
-        } while (!m_pendingPreviewItems.isEmpty() && timer.elapsed() < MaxBlockTimeout);
+            const KFileItem item = m_pendingItems.takeFirst();
+            if (!takeCachedPreview(item, cachedPreviews)) {
+                item.determineMimeType();
+                itemSubSet.append(item);
+            }
+        } while (!m_pendingItems.isEmpty() && timer.elapsed() < MaxBlockTimeout
+                 && itemSubSet.count() < maximumItemCount);
+    }
+
+    if (!cachedPreviews.isEmpty()) {
+        disconnect(m_model, &KFileItemModel::itemsChanged,
+                   this,    &KFileItemModelRolesUpdater::slotItemsChanged);
+        m_model->setItemsData(cachedPreviews);
+        connect(m_model, &KFileItemModel::itemsChanged,
+                this,    &KFileItemModelRolesUpdater::slotItemsChanged);
+
+        evictPreviews();
+    }
+
+#ifdef KFILEITEMMODELROLESUPDATER_DEBUG
+    const KPreviewPixmapCache& cache = KPreviewPixmapCache::instance();
+    qCDebug(DolphinDebug) << "Cached previews:" << cachedPreviews.count()
+                          << "hits:" << cache.hitCount()
+                          << "misses:" << cache.missCount()
+                          << "size:" << cache.size();
+#endif
+
+    if (itemSubSet.isEmpty()) {
+        // All taken items have been cached. Continue with the remaining
+        // pending items, or finish if no job is running.
+        if (m_previewJobs.isEmpty()) {
+            QTimer::singleShot(0, this, [this]() { slotPreviewJobFinished(nullptr); });
+        }
+        return;
+    }
+
+    const QVector<KFileItemList> jobItems = distributeItems(itemSubSet, jobCount);
+    for (const KFileItemList& items : jobItems) {
+        KIO::PreviewJob* job = new KIO::PreviewJob(items, cacheSize, &m_enabledPlugins);
+
+        job->setIgnoreMaximumSize(items.first().isLocalFile());
+        if (job->uiDelegate()) {
+            KJobWidgets::setWindow(job, qApp->activeWindow());
+        }
+
+        connect(job,  &KIO::PreviewJob::gotPreview,
+                this, &KFileItemModelRolesUpdater::slotGotPreview);
+        connect(job,  &KIO::PreviewJob::failed,
+                this, &KFileItemModelRolesUpdater::slotPreviewFailed);
+        connect(job,  &KIO::PreviewJob::finished,
+                this, &KFileItemModelRolesUpdater::slotPreviewJobFinished);
+
+        m_previewJobs.append(job);
+    }
+}
+
+int KFileItemModelRolesUpdater::maximumPreviewJobCount()
+{
+    // Determining the file system type might block, so it is only done
+    // once for each directory.
+    const QUrl directory = m_model->directory();
+    if (directory == m_previewJobCountDirectory) {
+        return m_maximumPreviewJobCount;
+    }
+    m_previewJobCountDirectory = directory;
+
+    if (!directory.isLocalFile()) {
+        // Remote files must be downloaded to create the previews.
+        m_maximumPreviewJobCount = 1;
+        return m_maximumPreviewJobCount;
+    }
+
+    switch (KFileSystemType::fileSystemType(directory.toLocalFile())) {
+    case KFileSystemType::Nfs:
+    case KFileSystemType::Smb:
+        m_maximumPreviewJobCount = MaximumNetworkPreviewJobs;
+        break;
+    default:
+        m_maximumPreviewJobCount = qBound(1, QThread::idealThreadCount() / 2, MaximumPreviewJobs);
+        break;
+    }
+    return m_maximumPreviewJobCount;
+}
+
+QVector<KFileItemList> KFileItemModelRolesUpdater::distributeItems(const KFileItemList& items, int jobCount)
+{
+    if (items.isEmpty() || jobCount <= 0) {
+        return QVector<KFileItemList>();
+    }
+
+    // Split the items across the jobs in turn, so that each job handles the
+    // items in the order of their priorities, and the previews of all jobs
+    // arrive approximately in the same order as with one job.
+    const int itemsPerJob = (items.count() + jobCount - 1) / jobCount;
+    const int usedJobCount = (items.count() + itemsPerJob - 1) / itemsPerJob;
+
+    QVector<KFileItemList> jobItems(usedJobCount);
+    for (int i = 0; i < items.count(); ++i) {
+        jobItems[i % usedJobCount].append(items.at(i));
+    }
+    return jobItems;
+}
+
+KPreviewPixmapCache::Key KFileItemModelRolesUpdater::previewCacheKey(const KFileItem& item,
+                                                                     const QStringList& overlays) const
+{
+    KPreviewPixmapCache::Key key;
+    key.url = item.url();
+    key.modificationTime = item.time(KFileItem::ModificationTime).toMSecsSinceEpoch();
+    key.iconSize = m_iconSize;
+    key.devicePixelRatio = qApp->devicePixelRatio();
+    key.enlargeSmallPreviews = m_enlargeSmallPreviews;
+    key.overlays = overlays;
+    return key;
+}
+
+bool KFileItemModelRolesUpdater::takeCachedPreview(const KFileItem& item,
+                                                   QHash<int, QHash<QByteArray, QVariant> >& itemsData)
+{
+    const int index = m_model->index(item);
+    if (index < 0) {
+        return false;
     }
 
-    KIO::PreviewJob* job = new KIO::PreviewJob(itemSubSet, cacheSize, &m_enabledPlugins);
+    const QStringList overlays = item.overlays() + pluginOverlays(item.url());
 
-    job->setIgnoreMaximumSize(itemSubSet.first().isLocalFile());
-    if (job->uiDelegate()) {
-        KJobWidgets::setWindow(job, qApp->activeWindow());
+    QPixmap pixmap;
+    if (!KPreviewPixmapCache::instance().find(previewCacheKey(item, overlays), &pixmap)) {
+        return false;
     }
 
-    connect(job,  &KIO::PreviewJob::gotPreview,
-            this, &KFileItemModelRolesUpdater::slotGotPreview);
-    connect(job,  &KIO::PreviewJob::failed,
-            this, &KFileItemModelRolesUpdater::slotPreviewFailed);
-    connect(job,  &KIO::PreviewJob::finished,
-            this, &KFileItemModelRolesUpdater::slotPreviewJobFinished);
+    QHash<QByteArray, QVariant> data = rolesData(item, nullptr, &overlays);
+    data.insert("iconPixmap", pixmap);
+    itemsData.insert(index, data);
 
-    m_previewJob = job;
+    m_finishedItems.insert(item);
+    m_changedItems.remove(item);
+    addPreviewUsage(item, pixmap);
+    return true;
 }
 
 void KFileItemModelRolesUpdater::updateChangedItems()
@@ -931,7 +1209,7 @@ void KFileItemModelRolesUpdater::updateChangedItems()
         m_pendingSortRoleItems += m_changedItems;
 
         if (m_state != ResolvingSortRole) {
-            // Stop the preview job if necessary, and trigger the
+            // Stop the preview jobs if necessary, and trigger the
             // asynchronous determination of the sort role.
             killPreviewJob();
             m_state = ResolvingSortRole;
@@ -941,41 +1219,32 @@ void KFileItemModelRolesUpdater::updateChangedItems()
         return;
     }
 
-    QList<int> visibleChangedIndexes;
-    QList<int> invisibleChangedIndexes;
+    const bool resolvingInProgress = !m_pendingItems.isEmpty();
 
-    foreach (const KFileItem& item, m_changedItems) {
-        const int index = m_model->index(item);
+    // Visible changed items are handled before the pending items, and the
+    // other changed items after them.
+    QSet<KFileItem>::iterator it = m_changedItems.begin();
+    while (it != m_changedItems.end()) {
+        const int index = m_model->index(*it);
 
         if (index < 0) {
-            m_changedItems.remove(item);
+            it = m_changedItems.erase(it);
             continue;
         }
 
         if (index >= m_firstVisibleIndex && index <= m_lastVisibleIndex) {
-            visibleChangedIndexes.append(index);
+            m_pendingItems.insert(*it, VisiblePriority, index - m_firstVisibleIndex);
         } else {
-            invisibleChangedIndexes.append(index);
+            m_pendingItems.insert(*it, RemainingPriority, index);
         }
+        ++it;
     }
 
-    std::sort(visibleChangedIndexes.begin(), visibleChangedIndexes.end());
-
     if (m_previewShown) {
-        foreach (int index, visibleChangedIndexes) {
-            m_pendingPreviewItems.append(m_model->fileItem(index));
-        }
-
-        foreach (int index, invisibleChangedIndexes) {
-            m_pendingPreviewItems.append(m_model->fileItem(index));
-        }
-
-        if (!m_previewJob) {
-            startPreviewJob();
-        }
+        // Only starts new jobs if fewer than maximumPreviewJobCount()
+        // jobs are running.
+        startPreviewJob();
     } else {
-        const bool resolvingInProgress = !m_pendingIndexes.isEmpty();
-        m_pendingIndexes = visibleChangedIndexes + m_pendingIndexes + invisibleChangedIndexes;
         if (!resolvingInProgress) {
             // Trigger the asynchronous resolving of the changed roles.
             m_state = ResolvingAllRoles;
@@ -1058,7 +1327,9 @@ bool KFileItemModelRolesUpdater::applyResolvedRoles(int index, ResolveHint hint)
     return false;
 }
 
-QHash<QByteArray, QVariant> KFileItemModelRolesUpdater::rolesData(const KFileItem& item)
+QHash<QByteArray, QVariant> KFileItemModelRolesUpdater::rolesData(const KFileItem& item,
+                                                                  const KFileItemRolesResolver::Result* resolved,
+                                                                  const QStringList* overlays)
 {
     QHash<QByteArray, QVariant> data;
 
@@ -1077,14 +1348,16 @@ QHash<QByteArray, QVariant> KFileItemModelRolesUpdater::rolesData(const KFileIte
     }
 
     if (m_roles.contains("type")) {
-        data.insert("type", item.mimeComment());
+        data.insert("type", resolved ? resolved->type : item.mimeComment());
     }
 
-    QStringList overlays = item.overlays();
-    foreach(KOverlayIconPlugin *it, m_overlayIconsPlugin) {
-        overlays.append(it->getOverlays(item.url()));
+    // KFileItem::overlays() accesses the non-thread-safe KSambaShare and
+    // KNFSShare singletons, so the overlays are not resolved by worker threads.
+    if (overlays) {
+        data.insert("iconOverlays", *overlays);
+    } else {
+        data.insert("iconOverlays", item.overlays() + pluginOverlays(item.url()));
     }
-    data.insert("iconOverlays", overlays);
 
 #ifdef HAVE_BALOO
     if (m_balooFileMonitor) {
@@ -1103,14 +1376,20 @@ void KFileItemModelRolesUpdater::slotOverlaysChanged(const QUrl& url, const QStr
     }
     const int index = m_model->index(item);
     QHash<QByteArray, QVariant> data =  m_model->data(index);
-    QStringList overlays = item.overlays();
-    foreach (KOverlayIconPlugin *it, m_overlayIconsPlugin) {
-        overlays.append(it->getOverlays(url));
-    }
+    const QStringList overlays = item.overlays() + pluginOverlays(url);
     data.insert("iconOverlays", overlays);
     m_model->setData(index, data);
 }
 
+QStringList KFileItemModelRolesUpdater::pluginOverlays(const QUrl& url) const
+{
+    QStringList overlays;
+    foreach (KOverlayIconPlugin* it, m_overlayIconsPlugin) {
+        overlays.append(it->getOverlays(url));
+    }
+    return overlays;
+}
+
 void KFileItemModelRolesUpdater::updateAllPreviews()
 {
     if (m_state == Paused) {
@@ -1123,29 +1402,50 @@ void KFileItemModelRolesUpdater::updateAllPreviews()
 
 void KFileItemModelRolesUpdater::killPreviewJob()
 {
-    if (m_previewJob) {
-        disconnect(m_previewJob,  &KIO::PreviewJob::gotPreview,
+    foreach (KIO::PreviewJob* job, m_previewJobs) {
+        disconnect(job,  &KIO::PreviewJob::gotPreview,
                    this, &KFileItemModelRolesUpdater::slotGotPreview);
-        disconnect(m_previewJob,  &KIO::PreviewJob::failed,
+        disconnect(job,  &KIO::PreviewJob::failed,
                    this, &KFileItemModelRolesUpdater::slotPreviewFailed);
-        disconnect(m_previewJob,  &KIO::PreviewJob::finished,
+        disconnect(job,  &KIO::PreviewJob::finished,
                    this, &KFileItemModelRolesUpdater::slotPreviewJobFinished);
-        m_previewJob->kill();
-        m_previewJob = nullptr;
-        m_pendingPreviewItems.clear();
+        job->kill();
     }
+    m_previewJobs.clear();
 }
 
-QList<int> KFileItemModelRolesUpdater::indexesToResolve() const
+void KFileItemModelRolesUpdater::updatePendingItems()
 {
     const int count = m_model->count();
 
-    QList<int> result;
-    result.reserve(ResolveAllItemsLimit);
+    // Items which are interesting for the current visible area. The first
+    // priority that is assigned to an item wins.
+    QSet<KFileItem> interestingItems;
+    interestingItems.reserve(ResolveAllItemsLimit);
+
+    auto addItem = [this, &interestingItems](int index, Priority priority, int order) {
+        const KFileItem item = m_model->fileItem(index);
+        if (interestingItems.contains(item)) {
+            return;
+        }
+
+        interestingItems.insert(item);
+        if (m_finishedItems.contains(item) || m_resolvingItems.contains(item)) {
+            return;
+        }
+
+        // Creating an evicted preview again for an item that is far away from
+        // the visible area would only result in evicting it again.
+        if (priority > ReadAheadPriority && m_evictedItems.contains(item)) {
+            return;
+        }
+
+        m_pendingItems.insert(item, priority, order);
+    };
 
     // Add visible items.
     for (int i = m_firstVisibleIndex; i <= m_lastVisibleIndex; ++i) {
-        result.append(i);
+        addItem(i, VisiblePriority, i - m_firstVisibleIndex);
     }
 
     // We need a reasonable upper limit for number of items to resolve after
@@ -1153,43 +1453,163 @@ QList<int> KFileItemModelRolesUpdater::indexesToResolve() const
     // when using Compact View.
     const int readAheadItems = qMin(ReadAheadPages * m_maximumVisibleItems, ResolveAllItemsLimit / 2);
 
-    // Add items after the visible range.
+    // Add items after and before the visible range. The items in scroll
+    // direction are preferred.
+    const Priority afterPriority = m_scrollingForward ? ReadAheadPriority : ReadBehindPriority;
+    const Priority beforePriority = m_scrollingForward ? ReadBehindPriority : ReadAheadPriority;
+
     const int endExtendedVisibleRange = qMin(m_lastVisibleIndex + readAheadItems, count - 1);
     for (int i = m_lastVisibleIndex + 1; i <= endExtendedVisibleRange; ++i) {
-        result.append(i);
+        addItem(i, afterPriority, i - m_lastVisibleIndex);
     }
 
-    // Add items before the visible range in reverse order.
     const int beginExtendedVisibleRange = qMax(0, m_firstVisibleIndex - readAheadItems);
     for (int i = m_firstVisibleIndex - 1; i >= beginExtendedVisibleRange; --i) {
-        result.append(i);
+        addItem(i, beforePriority, m_firstVisibleIndex - i);
     }
 
-    // Add items on the last page.
+    // Add items on the last page and on the first page.
     const int beginLastPage = qMax(qMin(endExtendedVisibleRange + 1, count - 1), count - m_maximumVisibleItems);
     for (int i = beginLastPage; i < count; ++i) {
-        result.append(i);
+        addItem(i, FirstAndLastPagePriority, i - beginLastPage);
     }
 
-    // Add items on the first page.
     const int endFirstPage = qMin(qMax(beginExtendedVisibleRange - 1, 0), m_maximumVisibleItems);
     for (int i = 0; i <= endFirstPage; ++i) {
-        result.append(i);
+        addItem(i, FirstAndLastPagePriority, count + i);
     }
 
     // Continue adding items until ResolveAllItemsLimit is reached.
-    int remainingItems = ResolveAllItemsLimit - result.count();
+    int remainingItems = ResolveAllItemsLimit - interestingItems.count();
 
     for (int i = endExtendedVisibleRange + 1; i < beginLastPage && remainingItems > 0; ++i) {
-        result.append(i);
+        addItem(i, RemainingPriority, i - endExtendedVisibleRange);
         --remainingItems;
     }
 
     for (int i = beginExtendedVisibleRange - 1; i > endFirstPage && remainingItems > 0; --i) {
-        result.append(i);
+        addItem(i, RemainingPriority, beginExtendedVisibleRange - i);
         --remainingItems;
     }
 
-    return result;
+    // Cancel the items which are not interesting anymore.
+    foreach (const KFileItem& item, m_pendingItems.items()) {
+        if (!interestingItems.contains(item)) {
+            m_pendingItems.remove(item);
+        }
+    }
+
+    // The previews of interesting items are evicted last.
+    m_interestingItems.swap(interestingItems);
+
+#ifdef KFILEITEMMODELROLESUPDATER_DEBUG
+    qCDebug(DolphinDebug) << "Pending items:" << m_pendingItems.count()
+                          << "maximum:" << m_pendingItems.maximumCount()
+                          << "average latency:" << m_pendingItems.averageLatency()
+                          << "maximum latency:" << m_pendingItems.maximumLatency();
+#endif
 }
 
+void KFileItemModelRolesUpdater::addPreviewUsage(const KFileItem& item, const QPixmap& pixmap)
+{
+    const qint64 bytes = qint64(pixmap.width()) * pixmap.height() * pixmap.depth() / 8;
+
+    m_evictedItems.remove(item);
+
+    PreviewUsage& usage = m_previewUsages[item];
+    m_previewMemoryUsage += bytes - usage.bytes;
+    usage.bytes = bytes;
+    usage.lastUsed = ++m_previewUsageCounter;
+}
+
+void KFileItemModelRolesUpdater::evictPreviews()
+{
+    if (m_previewMemoryUsage <= m_previewMemoryBudget || m_previewMemoryUsage <= m_failedEvictionUsage) {
+        return;
+    }
+
+    // Evict more previews than necessary, so that the candidates
+    // don't need to be sorted for each new preview.
+    const qint64 targetUsage = m_previewMemoryBudget / 4 * 3;
+
+    // The previews of the visible items are never evicted.
+    const int lastVisibleIndex = (m_lastVisibleIndex >= m_firstVisibleIndex)
+                                 ? m_lastVisibleIndex : m_firstVisibleIndex + m_maximumVisibleItems - 1;
+
+    struct Candidate
+    {
+        bool interesting;
+        int distance;           // Distance of the item to the visible area
+        quint64 lastUsed;
+        KFileItem item;
+    };
+
+    QVector<Candidate> candidates;
+    candidates.reserve(m_previewUsages.count());
+
+    auto it = m_previewUsages.begin();
+    while (it != m_previewUsages.end()) {
+        const int index = m_model->index(it.key());
+        if (index < 0) {
+            // The item has been removed from the model.
+            m_previewMemoryUsage -= it->bytes;
+            it = m_previewUsages.erase(it);
+            continue;
+        }
+
+        if (index < m_firstVisibleIndex || index > lastVisibleIndex) {
+            Candidate candidate;
+            candidate.interesting = m_interestingItems.contains(it.key());
+            candidate.distance = (index < m_firstVisibleIndex) ? m_firstVisibleIndex - index : index - lastVisibleIndex;
+            candidate.lastUsed = it->lastUsed;
+            candidate.item = it.key();
+            candidates.append(candidate);
+        }
+        ++it;
+    }
+
+    // The least recently used previews of items which are not interesting
+    // are evicted first. The previews of the interesting items are evicted
+    // starting with the items which are farthest away from the visible area.
+    std::sort(candidates.begin(), candidates.end(), [](const Candidate& a, const Candidate& b) {
+        if (a.interesting != b.interesting) {
+            return !a.interesting;
+        }
+        return a.interesting ? a.distance > b.distance : a.lastUsed < b.lastUsed;
+    });
+
+    QHash<QByteArray, QVariant> data;
+    data.insert("iconPixmap", QPixmap());
+
+    QHash<int, QHash<QByteArray, QVariant> > itemsData;
+    for (int i = 0; i < candidates.count() && m_previewMemoryUsage > targetUsage; ++i) {
+        const KFileItem& item = candidates.at(i).item;
+        itemsData.insert(m_model->index(item), data);
+
+        // The preview is created again, or taken from KPreviewPixmapCache,
+        // when the item comes close to the visible area again.
+        m_finishedItems.remove(item);
+        m_evictedItems.insert(item);
+        m_previewMemoryUsage -= m_previewUsages.take(item).bytes;
+    }
+
+    if (!itemsData.isEmpty()) {
+        disconnect(m_model, &KFileItemModel::itemsChanged,
+                   this,    &KFileItemModelRolesUpdater::slotItemsChanged);
+        m_model->setItemsData(itemsData);
+        connect(m_model, &KFileItemModel::itemsChanged,
+                this,    &KFileItemModelRolesUpdater::slotItemsChanged);
+    }
+
+    // If the previews of the visible items alone exceed the budget, the next
+    // attempt is postponed until the usage has grown noticeably. Otherwise
+    // each new preview would result in iterating all previews in vain.
+    m_failedEvictionUsage = (m_previewMemoryUsage > m_previewMemoryBudget)
+                            ? m_previewMemoryUsage + m_previewMemoryBudget / 4 : 0;
+
+#ifdef KFILEITEMMODELROLESUPDATER_DEBUG
+    qCDebug(DolphinDebug) << "Evicted previews:" << itemsData.count()
+                          << "memory usage:" << m_previewMemoryUsage
+                          << "budget:" << m_previewMemoryBudget;
+#endif
+}
@@ -22,16 +22,21 @@
 
 #include "dolphin_export.h"
 #include "kitemviews/kitemmodelbase.h"
+#include "kitemviews/private/kfileitempriorityqueue.h"
+#include "kitemviews/private/kfileitemrolesresolver.h"
+#include "kitemviews/private/kpreviewpixmapcache.h"
 
 #include <KFileItem>
 #include <config-baloo.h>
 
+#include <QHash>
 #include <QObject>
 #include <QSet>
 #include <QSize>
 #include <QStringList>
 
 class KDirectoryContentsCounter;
+class KJob;
 class KFileItemModel;
 class QPixmap;
 class QTimer;
@@ -62,6 +67,11 @@ namespace KIO {
  * that aims to minimize the risk that the user sees items with unknown icons
  * in the view when scrolling or pressing Home or End.
  *
+ * The items are kept in the priority queue m_pendingItems. When the visible
+ * area changes, the priorities of the queued items are updated in place, and
+ * items which are not interesting anymore are removed, so that the work which
+ * has been queued already is not thrown away when scrolling.
+ *
  * Determining the roles is done in several phases:
  *
  * 1.   If the sort role is "slow", it is determined for all items. If this
@@ -76,10 +86,14 @@ namespace KIO {
  *
  *      (a) If previews are disabled, icons and all other roles are determined
  *          asynchronously for the interesting items. This is done by the
- *          function \a resolveNextPendingRoles().
+ *          function \a resolveNextPendingRoles(). The MIME types of local
+ *          items are determined by worker threads of \a KFileItemRolesResolver,
+ *          and the results are applied to the model in batches.
  *
- *      (b) If previews are enabled, a \a KIO::PreviewJob is started that loads
- *          the previews for the interesting items. At the same time, the icons
+ *      (b) If previews are enabled, several instances of \a KIO::PreviewJob
+ *          are started that load the previews for the interesting items.
+ *          The number of concurrent jobs depends on the number of CPU cores
+ *          and the file system of the directory. At the same time, the icons
  *          for these items are determined asynchronously as fast as possible
  *          by \a resolveNextPendingRoles(). This minimizes the risk that the
  *          user sees "unknown" icons when scrolling before the previews have
@@ -123,6 +137,25 @@ public:
     void setEnlargeSmallPreviews(bool enlarge);
     bool enlargeSmallPreviews() const;
 
+    /**
+     * Sets the maximum size in bytes of the previews in the model. If the
+     * previews need more memory, the least recently used previews of items
+     * far away from the visible area are removed from the model. They are
+     * created again or taken from KPreviewPixmapCache when the items become
+     * visible again. Only the previews of the visible items are never
+     * removed, so the size exceeds the budget if the visible previews alone
+     * need more memory.
+     * Per default the budget is read from the entry "MaximumMemoryUsage"
+     * (in MiB) of the group "PreviewSettings".
+     */
+    void setPreviewMemoryBudget(qint64 bytes);
+    qint64 previewMemoryBudget() const;
+
+    /**
+     * @return Size in bytes of the previews which have been stored in the model.
+     */
+    qint64 previewMemoryUsage() const;
+
     /**
      * If \a paused is set to true the asynchronous resolving of roles will be paused.
      * State changes during pauses like changing the icon size or the preview-shown
@@ -176,12 +209,12 @@ private slots:
     void slotPreviewFailed(const KFileItem& item);
 
     /**
-     * Is invoked when the preview job has been finished. Starts a new preview
-     * job if there are any interesting items without previews left, or updates
-     * the changed items otherwise.     *
+     * Is invoked when a preview job has been finished. Starts new preview
+     * jobs if there are any interesting items without previews left, or updates
+     * the changed items if all preview jobs have been finished.
      * @see startPreviewJob()
      */
-    void slotPreviewJobFinished();
+    void slotPreviewJobFinished(KJob* job);
 
     /**
      * Is invoked when one of the KOverlayIconPlugin emit the signal that an overlay has changed
@@ -197,11 +230,18 @@ private slots:
 
     /**
      * Resolves the icon name and (if previews are disabled) all other roles
-     * for the next interesting item. If there are no pending items left, any
+     * for the items with the highest priorities in m_pendingItems. Local items
+     * are passed to m_rolesResolver. If there are no pending items left, any
      * changed items are updated.
      */
     void resolveNextPendingRoles();
 
+    /**
+     * Applies the roles which have been determined by m_rolesResolver
+     * to the model with a single update.
+     */
+    void slotRolesResolved(const QVector<KFileItemRolesResolver::Result>& results);
+
     /**
      * Resolves items that have not been resolved yet after the change has been
      * notified by slotItemsChanged(). Is invoked if the m_changedItemsTimer
@@ -230,14 +270,42 @@ private:
     void updateVisibleIcons();
 
     /**
-     * Creates previews for the items starting from the first item in
-     * m_pendingPreviewItems.
+     * Creates previews for the items with the highest priorities in
+     * m_pendingItems. Starts preview jobs until maximumPreviewJobCount()
+     * jobs are running. The items are split across the new jobs in turn.
      * @see slotGotPreview()
      * @see slotPreviewFailed()
      * @see slotPreviewJobFinished()
      */
     void startPreviewJob();
 
+    /**
+     * @return Maximum number of preview jobs which may run concurrently
+     *         for the current directory. The value is only determined
+     *         again if the directory of the model has been changed.
+     */
+    int maximumPreviewJobCount();
+
+    /**
+     * Splits the items \a items in turn across at most \a jobCount lists,
+     * so that each list keeps the order of the items.
+     */
+    static QVector<KFileItemList> distributeItems(const KFileItemList& items, int jobCount);
+
+    /**
+     * @return Key of the preview of the item \a item with the overlays
+     *         \a overlays in KPreviewPixmapCache.
+     */
+    KPreviewPixmapCache::Key previewCacheKey(const KFileItem& item, const QStringList& overlays) const;
+
+    /**
+     * Checks whether KPreviewPixmapCache contains a preview for the item
+     * \a item. In this case the roles of the item including the preview are
+     * added to \a itemsData, and the item is marked as finished.
+     * @return True if the preview has been cached.
+     */
+    bool takeCachedPreview(const KFileItem& item, QHash<int, QHash<QByteArray, QVariant> >& itemsData);
+
     /**
      * Ensures that icons, previews, and other roles are determined for any
      * items that have been changed.
@@ -256,7 +324,22 @@ private:
         ResolveAll
     };
     bool applyResolvedRoles(int index, ResolveHint hint);
-    QHash<QByteArray, QVariant> rolesData(const KFileItem& item);
+
+    /**
+     * @return The roles of the item \a item. If \a resolved is given, the
+     *         roles which have been determined by m_rolesResolver are taken
+     *         from it. If \a overlays is given, it is used for the role
+     *         "iconOverlays" instead of determining the overlays again.
+     */
+    QHash<QByteArray, QVariant> rolesData(const KFileItem& item,
+                                          const KFileItemRolesResolver::Result* resolved = nullptr,
+                                          const QStringList* overlays = nullptr);
+
+    /**
+     * @return Overlays of the file \a url provided by the instances
+     *         of KOverlayIconPlugin.
+     */
+    QStringList pluginOverlays(const QUrl& url) const;
 
     /**
      * @return The number of items of the path \a path.
@@ -269,9 +352,43 @@ private:
      */
     void updateAllPreviews();
 
+    /**
+     * Kills all running preview jobs.
+     */
     void killPreviewJob();
 
-    QList<int> indexesToResolve() const;
+    /**
+     * Remembers that the preview \a pixmap has been stored in the model
+     * for the item \a item.
+     */
+    void addPreviewUsage(const KFileItem& item, const QPixmap& pixmap);
+
+    /**
+     * Removes previews of items which are not visible from the model, until
+     * the previews need clearly less memory than m_previewMemoryBudget. The
+     * least recently used previews of items which are not interesting are
+     * removed first, then the previews of the interesting items which are
+     * farthest away from the visible area.
+     */
+    void evictPreviews();
+
+    /**
+     * Priorities of the items in m_pendingItems. Lower values are handled first.
+     */
+    enum Priority {
+        VisiblePriority,
+        ReadAheadPriority,          // Items after the visible area in scroll direction
+        ReadBehindPriority,         // Items before the visible area in scroll direction
+        FirstAndLastPagePriority,
+        RemainingPriority
+    };
+
+    /**
+     * Updates the priorities of the items in m_pendingItems for the current
+     * visible area and adds the interesting items which have not been
+     * resolved yet. Items which are not interesting anymore are removed.
+     */
+    void updatePendingItems();
 
 private:
     enum State {
@@ -309,6 +426,7 @@ private:
     QSize m_iconSize;
     int m_firstVisibleIndex;
     int m_lastVisibleIndex;
+    bool m_scrollingForward;    // Direction of the last change of the visible area
     int m_maximumVisibleItems;
     QSet<QByteArray> m_roles;
     QSet<QByteArray> m_resolvableRoles;
@@ -317,15 +435,42 @@ private:
     // Items for which the sort role still has to be determined.
     QSet<KFileItem> m_pendingSortRoleItems;
 
-    // Indexes of items which still have to be handled by
-    // resolveNextPendingRoles().
-    QList<int> m_pendingIndexes;
+    // Items which still have to be handled by resolveNextPendingRoles(),
+    // or by a preview job if previews are shown.
+    KFileItemPriorityQueue m_pendingItems;
+
+    // Items which have been passed to m_rolesResolver
+    QSet<KFileItem> m_resolvingItems;
+    KFileItemRolesResolver* m_rolesResolver;
+
+    QList<KIO::PreviewJob*> m_previewJobs;
+
+    // Directory for which m_maximumPreviewJobCount has been determined
+    QUrl m_previewJobCountDirectory;
+    int m_maximumPreviewJobCount;
 
-    // Items which have been left over from the last call of startPreviewJob().
-    // A new preview job will be started from them once the first one finishes.
-    KFileItemList m_pendingPreviewItems;
+    // Items which have been considered by updatePendingItems() the last time.
+    // Their previews are evicted after the previews of other items.
+    QSet<KFileItem> m_interestingItems;
 
-    KIO::PreviewJob* m_previewJob;
+    struct PreviewUsage
+    {
+        qint64 bytes = 0;
+        quint64 lastUsed = 0;   // Value of m_previewUsageCounter
+    };
+
+    qint64 m_previewMemoryBudget;
+    qint64 m_previewMemoryUsage;
+    QHash<KFileItem, PreviewUsage> m_previewUsages;   // Items with a preview in the model
+    quint64 m_previewUsageCounter;
+
+    // Items whose previews have been evicted. updatePendingItems() only
+    // queues them again when they are visible or in the read-ahead range.
+    QSet<KFileItem> m_evictedItems;
+
+    // Memory usage up to which evictPreviews() does not try again, because
+    // the visible previews alone have exceeded the budget. 0 if unset.
+    qint64 m_failedEvictionUsage;
 
     // When downloading or copying large files, the slot slotItemsChanged()
     // will be called periodically within a quite short delay. To prevent
@@ -346,6 +491,8 @@ private:
     Baloo::FileMonitor* m_balooFileMonitor;
     Baloo::IndexerConfig m_balooConfig;
 #endif
+
+    friend class KFileItemModelRolesUpdaterTest;   // For unit testing
 };
 
 #endif
@@ -29,7 +29,12 @@ KItemListSelectionManager::KItemListSelectionManager(QObject* parent) :
     m_anchorItem(-1),
     m_selectedItems(),
     m_isAnchoredSelectionActive(false),
-    m_model(nullptr)
+    m_model(nullptr),
+    m_summaryValid(true),
+    m_summaryAdjustedForRemoval(false),
+    m_selectedFolderCount(0),
+    m_selectedFileCount(0),
+    m_selectedFileSize(0)
 {
 }
 
@@ -54,6 +59,7 @@ void KItemListSelectionManager::setCurrentItem(int current)
         if (m_isAnchoredSelectionActive) {
             const KItemSet selection = selectedItems();
             if (selection != previousSelection) {
+                updateSelectionSummary(previousSelection, selection);
                 emit selectionChanged(selection, previousSelection);
             }
         }
@@ -69,7 +75,9 @@ void KItemListSelectionManager::setSelectedItems(const KItemSet& items)
 {
     if (m_selectedItems != items) {
         const KItemSet previous = m_selectedItems;
+        const KItemSet previousSelection = selectedItems();
         m_selectedItems = items;
+        updateSelectionSummary(previousSelection, selectedItems());
         emit selectionChanged(m_selectedItems, previous);
     }
 }
@@ -159,6 +167,43 @@ void KItemListSelectionManager::setSelected(int index, int count, SelectionMode
 
     const KItemSet selection = selectedItems();
     if (selection != previous) {
+        updateSelectionSummary(previous, selection);
+        emit selectionChanged(selection, previous);
+    }
+}
+
+void KItemListSelectionManager::setSelected(const KItemSet& items, SelectionMode mode)
+{
+    if (items.isEmpty() || !m_model || items.first() < 0 || items.last() >= m_model->count()) {
+        return;
+    }
+
+    endAnchoredSelection();
+    const KItemSet previous = selectedItems();
+
+    switch (mode) {
+    case Select:
+        m_selectedItems = m_selectedItems + items;
+        break;
+
+    case Deselect:
+        // The union contains all items from 'items', which are removed again
+        // by the symmetric difference.
+        m_selectedItems = (m_selectedItems + items) ^ items;
+        break;
+
+    case Toggle:
+        m_selectedItems = m_selectedItems ^ items;
+        break;
+
+    default:
+        Q_ASSERT(false);
+        break;
+    }
+
+    const KItemSet selection = selectedItems();
+    if (selection != previous) {
+        updateSelectionSummary(previous, selection);
         emit selectionChanged(selection, previous);
     }
 }
@@ -169,6 +214,10 @@ void KItemListSelectionManager::clearSelection()
     if (!previous.isEmpty()) {
         m_selectedItems.clear();
         m_isAnchoredSelectionActive = false;
+        m_summaryValid = true;
+        m_selectedFolderCount = 0;
+        m_selectedFileCount = 0;
+        m_selectedFileSize = 0;
         emit selectionChanged(KItemSet(), previous);
     }
 }
@@ -176,8 +225,12 @@ void KItemListSelectionManager::clearSelection()
 void KItemListSelectionManager::beginAnchoredSelection(int anchor)
 {
     if (anchor >= 0 && m_model && anchor < m_model->count()) {
+        const KItemSet previous = selectedItems();
         m_isAnchoredSelectionActive = true;
         m_anchorItem = anchor;
+        if (anchor != m_currentItem) {
+            updateSelectionSummary(previous, selectedItems());
+        }
     }
 }
 
@@ -189,6 +242,7 @@ void KItemListSelectionManager::endAnchoredSelection()
         const int from = qMin(m_anchorItem, m_currentItem);
         const int to = qMax(m_anchorItem, m_currentItem);
 
+        // The anchored selection is already part of the selection summary.
         for (int index = from; index <= to; ++index) {
             m_selectedItems.insert(index);
         }
@@ -207,11 +261,40 @@ KItemModelBase* KItemListSelectionManager::model() const
     return m_model;
 }
 
+int KItemListSelectionManager::selectedFolderCount() const
+{
+    ensureSelectionSummary();
+    return m_selectedFolderCount;
+}
+
+int KItemListSelectionManager::selectedFileCount() const
+{
+    ensureSelectionSummary();
+    return m_selectedFileCount;
+}
+
+qulonglong KItemListSelectionManager::selectedFileSize() const
+{
+    ensureSelectionSummary();
+    return m_selectedFileSize;
+}
+
 void KItemListSelectionManager::setModel(KItemModelBase* model)
 {
+    if (m_model) {
+        disconnect(m_model, &KItemModelBase::itemsAboutToBeRemoved, this, &KItemListSelectionManager::slotItemsAboutToBeRemoved);
+        disconnect(m_model, &KItemModelBase::itemsChanged, this, &KItemListSelectionManager::slotItemsChanged);
+    }
+
     m_model = model;
-    if (model && model->count() > 0) {
-        m_currentItem = 0;
+    m_summaryValid = false;
+    m_summaryAdjustedForRemoval = false;
+    if (model) {
+        connect(model, &KItemModelBase::itemsAboutToBeRemoved, this, &KItemListSelectionManager::slotItemsAboutToBeRemoved);
+        connect(model, &KItemModelBase::itemsChanged, this, &KItemListSelectionManager::slotItemsChanged);
+        if (model->count() > 0) {
+            m_currentItem = 0;
+        }
     }
 }
 
@@ -272,6 +355,21 @@ void KItemListSelectionManager::itemsInserted(const KItemRangeList& itemRanges)
         }
     }
 
+    // Inserted items that are part of the anchored selection are selected, too.
+    if (m_summaryValid && m_isAnchoredSelectionActive && m_anchorItem != m_currentItem) {
+        const int from = qMin(m_anchorItem, m_currentItem);
+        const int to = qMax(m_anchorItem, m_currentItem);
+        int inc = 0;
+        foreach (const KItemRange& itemRange, itemRanges) {
+            const int firstInsertedIndex = itemRange.index + inc;
+            const int lastInsertedIndex = firstInsertedIndex + itemRange.count - 1;
+            for (int index = qMax(from, firstInsertedIndex); index <= qMin(to, lastInsertedIndex); ++index) {
+                addToSelectionSummary(index, 1);
+            }
+            inc += itemRange.count;
+        }
+    }
+
     const KItemSet selection = selectedItems();
     if (selection != previousSelection) {
         emit selectionChanged(selection, previousSelection);
@@ -283,6 +381,16 @@ void KItemListSelectionManager::itemsRemoved(const KItemRangeList& itemRanges)
     // Store the current selection (needed in the selectionChanged() signal)
     const KItemSet previousSelection = selectedItems();
     const int previousCurrent = m_currentItem;
+    const int previousAnchor = m_anchorItem;
+    const bool wasInAnchoredSelection = m_isAnchoredSelectionActive && m_anchorItem != m_currentItem;
+
+    // The removed items have been subtracted from the selection summary in
+    // slotItemsAboutToBeRemoved(). If the model did not announce the removal,
+    // the summary must be recalculated.
+    if (!m_summaryAdjustedForRemoval && !previousSelection.isEmpty()) {
+        m_summaryValid = false;
+    }
+    m_summaryAdjustedForRemoval = false;
 
     // Update the current item
     m_currentItem = indexAfterRangesRemoving(m_currentItem, itemRanges, DiscardRemovedIndex);
@@ -318,6 +426,27 @@ void KItemListSelectionManager::itemsRemoved(const KItemRangeList& itemRanges)
     }
 
     const KItemSet selection = selectedItems();
+
+    // If the anchor item or the current item has been removed, the anchored
+    // selection might contain other items now. The remaining items of the
+    // previous anchored selection are still contiguous after the removal.
+    if (m_summaryValid && wasInAnchoredSelection) {
+        const int from = qMin(previousAnchor, previousCurrent);
+        const int to = qMax(previousAnchor, previousCurrent);
+        int removedBeforeFrom = 0;
+        int removedBeforeEnd = 0;
+        foreach (const KItemRange& itemRange, itemRanges) {
+            removedBeforeFrom += qBound(0, from - itemRange.index, itemRange.count);
+            removedBeforeEnd += qBound(0, to + 1 - itemRange.index, itemRange.count);
+        }
+
+        KItemSet previous = m_selectedItems;
+        for (int index = from - removedBeforeFrom; index <= to - removedBeforeEnd; ++index) {
+            previous.insert(index);
+        }
+        updateSelectionSummary(previous, selection);
+    }
+
     if (selection != previousSelection) {
         emit selectionChanged(selection, previousSelection);
     }
@@ -339,6 +468,9 @@ void KItemListSelectionManager::itemsMoved(const KItemRange& itemRange, const QL
     // individually later in this function.
     endAnchoredSelection();
 
+    // The moved items keep their selection state, so the selection summary
+    // does not change.
+
     // Update the current item
     if (m_currentItem >= itemRange.index && m_currentItem < itemRange.index + itemRange.count) {
         const int previousCurrentItem = m_currentItem;
@@ -402,3 +534,93 @@ int KItemListSelectionManager::indexAfterRangesRemoving(int index, const KItemRa
     return qBound(-1, index - dec, m_model->count() - 1);
 }
 
+void KItemListSelectionManager::slotItemsAboutToBeRemoved(const KItemRangeList& itemRanges)
+{
+    m_summaryAdjustedForRemoval = true;
+    if (!m_summaryValid || !hasSelection()) {
+        return;
+    }
+
+    if (itemRanges.count() == 1 && itemRanges.first().index == 0 && itemRanges.first().count == m_model->count()) {
+        // All items are removed
+        m_selectedFolderCount = 0;
+        m_selectedFileCount = 0;
+        m_selectedFileSize = 0;
+        return;
+    }
+
+    foreach (const KItemRange& itemRange, itemRanges) {
+        for (int index = itemRange.index; index < itemRange.index + itemRange.count; ++index) {
+            if (isSelected(index)) {
+                addToSelectionSummary(index, -1);
+            }
+        }
+    }
+}
+
+void KItemListSelectionManager::slotItemsChanged(const KItemRangeList& itemRanges, const QSet<QByteArray>& roles)
+{
+    // The summary only depends on the type and the size of the selected items.
+    // An empty set of roles indicates that all roles might have been changed.
+    if (!m_summaryValid || !hasSelection()) {
+        return;
+    }
+
+    if (!roles.isEmpty() && !roles.contains("size") && !roles.contains("isDir")) {
+        return;
+    }
+
+    foreach (const KItemRange& itemRange, itemRanges) {
+        for (int index = itemRange.index; index < itemRange.index + itemRange.count; ++index) {
+            if (isSelected(index)) {
+                // The previous values of the item are unknown.
+                m_summaryValid = false;
+                return;
+            }
+        }
+    }
+}
+
+void KItemListSelectionManager::updateSelectionSummary(const KItemSet& previous, const KItemSet& current)
+{
+    if (!m_summaryValid || !m_model) {
+        m_summaryValid = false;
+        return;
+    }
+
+    const KItemSet changedItems = previous ^ current;
+    for (int index : changedItems) {
+        addToSelectionSummary(index, current.contains(index) ? 1 : -1);
+    }
+}
+
+void KItemListSelectionManager::ensureSelectionSummary() const
+{
+    if (m_summaryValid) {
+        return;
+    }
+
+    m_selectedFolderCount = 0;
+    m_selectedFileCount = 0;
+    m_selectedFileSize = 0;
+    m_summaryValid = true;
+    if (m_model) {
+        for (int index : selectedItems()) {
+            addToSelectionSummary(index, 1);
+        }
+    }
+}
+
+void KItemListSelectionManager::addToSelectionSummary(int index, int sign) const
+{
+    if (m_model->isDir(index)) {
+        m_selectedFolderCount += sign;
+    } else {
+        m_selectedFileCount += sign;
+        if (sign > 0) {
+            m_selectedFileSize += m_model->fileSize(index);
+        } else {
+            m_selectedFileSize -= m_model->fileSize(index);
+        }
+    }
+}
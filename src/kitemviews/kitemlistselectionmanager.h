@@ -62,6 +62,13 @@ public:
     bool hasSelection() const;
 
     void setSelected(int index, int count = 1, SelectionMode mode = Select);
+
+    /**
+     * Selects, deselects or toggles all \a items at once. In contrast to calling
+     * setSelected(int, int, SelectionMode) for each item, the signal
+     * selectionChanged() is emitted only once.
+     */
+    void setSelected(const KItemSet& items, SelectionMode mode = Select);
     void clearSelection();
 
     void beginAnchoredSelection(int anchor);
@@ -70,6 +77,17 @@ public:
 
     KItemModelBase* model() const;
 
+    /**
+     * @return Number of selected folders, files and the total size of the
+     *         selected files, including the items of the anchored selection.
+     *         The values are maintained incrementally while the selection
+     *         changes, so querying them does not require to iterate over all
+     *         selected items.
+     */
+    int selectedFolderCount() const;
+    int selectedFileCount() const;
+    qulonglong selectedFileSize() const;
+
 signals:
     void currentChanged(int current, int previous);
     void selectionChanged(const KItemSet& current, const KItemSet& previous);
@@ -79,7 +97,27 @@ private:
     void itemsInserted(const KItemRangeList& itemRanges);
     void itemsRemoved(const KItemRangeList& itemRanges);
     void itemsMoved(const KItemRange& itemRange, const QList<int>& movedToIndexes);
+    void slotItemsAboutToBeRemoved(const KItemRangeList& itemRanges);
+    void slotItemsChanged(const KItemRangeList& itemRanges, const QSet<QByteArray>& roles);
 
+    /**
+     * Updates the selection summary after the selection has been changed from
+     * \a previous to \a current. Only the items that are part of either
+     * \a previous or \a current, but not of both, are taken into account.
+     */
+    void updateSelectionSummary(const KItemSet& previous, const KItemSet& current);
+
+    /**
+     * Recalculates the selection summary of selectedItems() if it has been
+     * invalidated.
+     */
+    void ensureSelectionSummary() const;
+
+    /**
+     * Adds (\a sign is 1) or subtracts (\a sign is -1) the item with the
+     * index \a index to or from the selection summary.
+     */
+    void addToSelectionSummary(int index, int sign) const;
 
     /**
      * Helper method for itemsRemoved. Returns the changed index after removing
@@ -95,6 +133,13 @@ private:
 
     KItemModelBase* m_model;
 
+    // The selection summary contains all items of selectedItems()
+    mutable bool m_summaryValid;
+    bool m_summaryAdjustedForRemoval;
+    mutable int m_selectedFolderCount;
+    mutable int m_selectedFileCount;
+    mutable qulonglong m_selectedFileSize;
+
     friend class KItemListController; // Calls setModel()
     friend class KItemListView;       // Calls itemsInserted(), itemsRemoved() and itemsMoved()
     friend class KItemListSelectionManagerTest;
@@ -175,6 +175,11 @@ bool KItemModelBase::isDir(int index) const
     return data(index).value("isDir").toBool();
 }
 
+qulonglong KItemModelBase::fileSize(int index) const
+{
+    return isDir(index) ? 0 : data(index).value("size").toULongLong();
+}
+
 QUrl KItemModelBase::directory() const
 {
     return QUrl();
@@ -193,6 +193,12 @@ public:
      */
     virtual bool isDir(int index) const;
 
+    /**
+     * @return Size in bytes of the item at specified index, or 0 if
+     *         the item is a directory
+     */
+    virtual qulonglong fileSize(int index) const;
+
     /**
      * @return Parent directory of the items that are shown
      */
@@ -212,6 +218,13 @@ signals:
      */
     void itemsInserted(const KItemRangeList& itemRanges);
 
+    /**
+     * Is emitted before the items of the item-ranges get removed, so that
+     * their data can still be accessed. The signal itemsRemoved() with the
+     * same item-ranges is emitted afterwards.
+     */
+    void itemsAboutToBeRemoved(const KItemRangeList& itemRanges);
+
     /**
      * Is emitted if one or more items have been removed. Each item-range consists
      * of:
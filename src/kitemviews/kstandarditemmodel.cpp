@@ -100,6 +100,8 @@ void KStandardItemModel::changeItem(int index, KStandardItem* item)
 void KStandardItemModel::removeItem(int index)
 {
     if (index >= 0 && index < count()) {
+        emit itemsAboutToBeRemoved(KItemRangeList() << KItemRange(index, 1));
+
         KStandardItem* item = m_items[index];
         m_indexesForItems.remove(item);
         m_items.removeAt(index);
@@ -124,6 +126,7 @@ void KStandardItemModel::removeItem(int index)
 void KStandardItemModel::clear()
 {
     int size = m_items.size();
+    emit itemsAboutToBeRemoved(KItemRangeList() << KItemRange(0, size));
     m_items.clear();
     m_indexesForItems.clear();
 
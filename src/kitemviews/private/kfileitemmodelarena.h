@@ -0,0 +1,203 @@
+/***************************************************************************
+ *   Copyright (C) 2019 by Dolphin developers <kfm-devel@kde.org>          *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA            *
+ ***************************************************************************/
+
+#ifndef KFILEITEMMODELARENA_H
+#define KFILEITEMMODELARENA_H
+
+#include <QMutex>
+#include <QMutexLocker>
+#include <QVector>
+
+#include <new>
+#include <type_traits>
+
+/**
+ * @brief Allocates objects of the type T in slabs.
+ *
+ * KFileItemModel creates one object per item of a directory, and deletes
+ * all of them when another directory is loaded. Allocating the objects in
+ * slabs of SlabSize objects reduces the number of heap allocations and the
+ * fragmentation of the heap. The slots of destroyed objects are reused by
+ * create(). clear() invokes the destructors of all remaining objects and
+ * releases the memory of the slabs afterwards, which needs only one
+ * deallocation per slab.
+ *
+ * The methods may be invoked by several threads.
+ */
+template <typename T>
+class KFileItemModelArena
+{
+public:
+    KFileItemModelArena() :
+        m_mutex(),
+        m_slabs(),
+        m_usedSlotsInLastSlab(SlabSize),
+        m_freeSlots(nullptr),
+        m_count(0),
+        m_allocationCount(0)
+    {
+    }
+
+    ~KFileItemModelArena()
+    {
+        clear();
+    }
+
+    /**
+     * @return New value-initialized object.
+     */
+    T* create()
+    {
+        QMutexLocker locker(&m_mutex);
+        return new (takeSlot()) T();
+    }
+
+    /**
+     * Creates \a count value-initialized objects while locking the arena only once.
+     */
+    QVector<T*> create(int count)
+    {
+        QVector<T*> objects;
+        objects.reserve(count);
+
+        QMutexLocker locker(&m_mutex);
+        for (int i = 0; i < count; ++i) {
+            objects.append(new (takeSlot()) T());
+        }
+        return objects;
+    }
+
+    /**
+     * Destroys the object \a object, which must have been created by this arena.
+     */
+    void destroy(T* object)
+    {
+        if (!object) {
+            return;
+        }
+
+        object->~T();
+
+        QMutexLocker locker(&m_mutex);
+        Slot* slot = reinterpret_cast<Slot*>(object);
+        slot->used = false;
+        slot->nextFree = m_freeSlots;
+        m_freeSlots = slot;
+        --m_count;
+    }
+
+    /**
+     * Destroys all objects one by one and releases the slabs.
+     */
+    void clear()
+    {
+        QMutexLocker locker(&m_mutex);
+        if (m_count > 0) {
+            for (int i = 0; i < m_slabs.count(); ++i) {
+                Slot* slab = m_slabs.at(i);
+                const int usedSlots = (i == m_slabs.count() - 1) ? m_usedSlotsInLastSlab : int(SlabSize);
+                for (int j = 0; j < usedSlots; ++j) {
+                    if (slab[j].used) {
+                        reinterpret_cast<T*>(&slab[j].storage)->~T();
+                    }
+                }
+            }
+        }
+
+        foreach (Slot* slab, m_slabs) {
+            ::operator delete(slab);
+        }
+        m_slabs.clear();
+        m_usedSlotsInLastSlab = SlabSize;
+        m_freeSlots = nullptr;
+        m_count = 0;
+    }
+
+    /**
+     * @return Number of objects which have not been destroyed yet.
+     */
+    int count() const
+    {
+        QMutexLocker locker(&m_mutex);
+        return m_count;
+    }
+
+    /**
+     * @return Number of slabs which are allocated currently.
+     */
+    int slabCount() const
+    {
+        QMutexLocker locker(&m_mutex);
+        return m_slabs.count();
+    }
+
+    /**
+     * @return Number of heap allocations since creating the arena.
+     */
+    qint64 allocationCount() const
+    {
+        QMutexLocker locker(&m_mutex);
+        return m_allocationCount;
+    }
+
+private:
+    Q_DISABLE_COPY(KFileItemModelArena)
+
+    enum { SlabSize = 1024 };
+
+    struct Slot
+    {
+        typename std::aligned_storage<sizeof(T), alignof(T)>::type storage; // Must be the first member
+        Slot* nextFree;
+        bool used;
+    };
+
+    /**
+     * @return Unused slot, which is marked as used. The caller must lock m_mutex.
+     */
+    void* takeSlot()
+    {
+        Slot* slot = m_freeSlots;
+        if (slot) {
+            m_freeSlots = slot->nextFree;
+        } else {
+            if (m_usedSlotsInLastSlab == SlabSize) {
+                m_slabs.append(static_cast<Slot*>(::operator new(SlabSize * sizeof(Slot))));
+                m_usedSlotsInLastSlab = 0;
+                ++m_allocationCount;
+            }
+            slot = m_slabs.last() + m_usedSlotsInLastSlab;
+            ++m_usedSlotsInLastSlab;
+        }
+
+        slot->used = true;
+        ++m_count;
+        return &slot->storage;
+    }
+
+private:
+    mutable QMutex m_mutex;
+    QVector<Slot*> m_slabs;
+    int m_usedSlotsInLastSlab;
+    Slot* m_freeSlots;  // Slots of destroyed objects
+    int m_count;
+    qint64 m_allocationCount;
+};
+
+#endif
@@ -0,0 +1,290 @@
+/***************************************************************************
+ *   Copyright (C) 2019 by Dolphin developers <kfm-devel@kde.org>          *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA            *
+ ***************************************************************************/
+
+#include "kfileitemmodelchangecoalescer.h"
+
+#include <QTimer>
+
+#include <cmath>
+
+namespace {
+    // The window grows by this number of milliseconds per signal per second,
+    // e.g., receiving 20 signals per second results in a window of 200 ms.
+    const qreal WindowPerChangeRate = 10;
+
+    // Upper bound for the delay of a change
+    const int MaximumWindow = 1000;
+
+    // Time in milliseconds, after which the estimated rate has decayed
+    // to 1/e if no further signals are received
+    const qreal ChangeRateDecayTime = 500;
+}
+
+KFileItemModelChangeCoalescer::KFileItemModelChangeCoalescer(QObject* parent) :
+    QObject(parent),
+    m_changes(),
+    m_changeIndexes(),
+    m_timer(nullptr),
+    m_clock(),
+    m_changeRate(0),
+    m_changeRateTime(0),
+    m_receivedChangeCount(0),
+    m_emittedUpdateCount(0),
+    m_emittedChangeCount(0)
+{
+    m_timer = new QTimer(this);
+    m_timer->setSingleShot(true);
+    connect(m_timer, &QTimer::timeout, this, &KFileItemModelChangeCoalescer::flush);
+
+    m_clock.start();
+}
+
+KFileItemModelChangeCoalescer::~KFileItemModelChangeCoalescer()
+{
+}
+
+void KFileItemModelChangeCoalescer::addItems(const QUrl& directoryUrl, const KFileItemList& items)
+{
+    foreach (const KFileItem& item, items) {
+        const int index = m_changeIndexes.value(item.url(), -1);
+        if (index < 0) {
+            appendChange(ItemAdded, KFileItem(), item, directoryUrl);
+            continue;
+        }
+
+        Change& change = m_changes[index];
+        switch (change.type) {
+        case ItemAdded:
+        case ItemRefreshed:
+            change.newItem = item;
+            break;
+        case ItemDeleted:
+            if (change.oldItem.isDir()) {
+                // The children of a deleted directory must be removed, so
+                // the directory is not refreshed but added again.
+                appendChange(ItemAdded, KFileItem(), item, directoryUrl);
+            } else {
+                change.type = ItemRefreshed;
+                change.newItem = item;
+            }
+            break;
+        default:
+            Q_ASSERT(false);
+            break;
+        }
+    }
+
+    changesReceived(items.count());
+}
+
+void KFileItemModelChangeCoalescer::deleteItems(const KFileItemList& items)
+{
+    foreach (const KFileItem& item, items) {
+        const int index = m_changeIndexes.value(item.url(), -1);
+        if (index < 0) {
+            appendChange(ItemDeleted, item, KFileItem());
+            continue;
+        }
+
+        Change& change = m_changes[index];
+        switch (change.type) {
+        case ItemAdded:
+            // The receiver does not know the item at all
+            change.type = NoChange;
+            m_changeIndexes.remove(item.url());
+            break;
+        case ItemRefreshed:
+            change.type = ItemDeleted;
+            change.newItem = KFileItem();
+            break;
+        case ItemDeleted:
+            break;
+        default:
+            Q_ASSERT(false);
+            break;
+        }
+    }
+
+    changesReceived(items.count());
+}
+
+void KFileItemModelChangeCoalescer::refreshItems(const QList<QPair<KFileItem, KFileItem> >& items)
+{
+    for (const auto& itemPair : items) {
+        const QUrl oldUrl = itemPair.first.url();
+        const int index = m_changeIndexes.value(oldUrl, -1);
+        if (index < 0) {
+            appendChange(ItemRefreshed, itemPair.first, itemPair.second);
+            updateUrl(m_changes.count() - 1, oldUrl);
+            continue;
+        }
+
+        Change& change = m_changes[index];
+        switch (change.type) {
+        case ItemAdded:
+        case ItemRefreshed:
+            change.newItem = itemPair.second;
+            updateUrl(index, oldUrl);
+            break;
+        case ItemDeleted:
+            break;
+        default:
+            Q_ASSERT(false);
+            break;
+        }
+    }
+
+    changesReceived(items.count());
+}
+
+void KFileItemModelChangeCoalescer::flush()
+{
+    m_timer->stop();
+    decayChangeRate();
+    if (m_changes.isEmpty()) {
+        return;
+    }
+
+    KFileItemList deletedItems;
+    QList<QPair<KFileItem, KFileItem> > refreshedItems;
+    QHash<QUrl, KFileItemList> addedItems;
+
+    foreach (const Change& change, m_changes) {
+        switch (change.type) {
+        case ItemAdded:
+            addedItems[change.directoryUrl].append(change.newItem);
+            break;
+        case ItemRefreshed:
+            refreshedItems.append(qMakePair(change.oldItem, change.newItem));
+            break;
+        case ItemDeleted:
+            deletedItems.append(change.oldItem);
+            break;
+        default:
+            break;
+        }
+    }
+
+    m_changes.clear();
+    m_changeIndexes.clear();
+
+    int changeCount = deletedItems.count() + refreshedItems.count();
+    foreach (const KFileItemList& items, addedItems) {
+        changeCount += items.count();
+    }
+    if (changeCount == 0) {
+        // All changes have cancelled each other out
+        return;
+    }
+
+    ++m_emittedUpdateCount;
+    m_emittedChangeCount += changeCount;
+    emit changesCoalesced(deletedItems, refreshedItems, addedItems);
+}
+
+void KFileItemModelChangeCoalescer::clear()
+{
+    m_timer->stop();
+    m_changes.clear();
+    m_changeIndexes.clear();
+}
+
+bool KFileItemModelChangeCoalescer::hasPendingChanges() const
+{
+    return !m_changes.isEmpty();
+}
+
+int KFileItemModelChangeCoalescer::window() const
+{
+    return qMin(MaximumWindow, int(changeRate() * WindowPerChangeRate));
+}
+
+qint64 KFileItemModelChangeCoalescer::receivedChangeCount() const
+{
+    return m_receivedChangeCount;
+}
+
+qint64 KFileItemModelChangeCoalescer::emittedUpdateCount() const
+{
+    return m_emittedUpdateCount;
+}
+
+qint64 KFileItemModelChangeCoalescer::emittedChangeCount() const
+{
+    return m_emittedChangeCount;
+}
+
+void KFileItemModelChangeCoalescer::changesReceived(int count)
+{
+    m_receivedChangeCount += count;
+
+    // The window of the first change is based on the rate of the previous
+    // signals, so that a single change after a quiet period is emitted
+    // without delay. The timer is not restarted by further changes, which
+    // limits the delay of the first change to the window.
+    decayChangeRate();
+    if (!m_timer->isActive() && !m_changes.isEmpty()) {
+        m_timer->start(window());
+    }
+
+    // The rate is estimated from the signals of the dir lister, independent
+    // from the number of items per signal.
+    m_changeRate += 1000 / ChangeRateDecayTime;
+}
+
+qreal KFileItemModelChangeCoalescer::changeRate() const
+{
+    const qint64 elapsed = m_clock.elapsed() - m_changeRateTime;
+    return m_changeRate * std::exp(-elapsed / ChangeRateDecayTime);
+}
+
+void KFileItemModelChangeCoalescer::decayChangeRate()
+{
+    m_changeRate = changeRate();
+    m_changeRateTime = m_clock.elapsed();
+}
+
+void KFileItemModelChangeCoalescer::appendChange(ChangeType type, const KFileItem& oldItem, const KFileItem& newItem,
+                                                 const QUrl& directoryUrl)
+{
+    Change change;
+    change.type = type;
+    change.oldItem = oldItem;
+    change.newItem = newItem;
+    change.directoryUrl = directoryUrl;
+    m_changes.append(change);
+
+    const KFileItem& item = newItem.isNull() ? oldItem : newItem;
+    m_changeIndexes.insert(item.url(), m_changes.count() - 1);
+}
+
+void KFileItemModelChangeCoalescer::updateUrl(int index, const QUrl& oldUrl)
+{
+    Change& change = m_changes[index];
+    const QUrl newUrl = change.newItem.url();
+    if (newUrl == oldUrl) {
+        return;
+    }
+
+    m_changeIndexes.remove(oldUrl);
+    m_changeIndexes.insert(newUrl, index);
+    if (change.type == ItemAdded) {
+        change.directoryUrl = newUrl.adjusted(QUrl::RemoveFilename | QUrl::StripTrailingSlash);
+    }
+}
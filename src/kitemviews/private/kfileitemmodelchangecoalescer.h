@@ -0,0 +1,161 @@
+/***************************************************************************
+ *   Copyright (C) 2019 by Dolphin developers <kfm-devel@kde.org>          *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA            *
+ ***************************************************************************/
+
+#ifndef KFILEITEMMODELCHANGECOALESCER_H
+#define KFILEITEMMODELCHANGECOALESCER_H
+
+#include "dolphin_export.h"
+
+#include <KFileItem>
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QObject>
+#include <QPair>
+#include <QUrl>
+#include <QVector>
+
+class QTimer;
+
+/**
+ * @brief Merges the changes of items which are reported by the dir lister.
+ *
+ * Directories which are written to constantly result in a large number of
+ * added, deleted and refreshed items. The changes are collected per URL
+ * during a window, and are emitted as one batch with the signal
+ * changesCoalesced(). E.g., an item which is added and deleted during the
+ * window is not reported at all, and several refreshes of an item result
+ * in one refresh.
+ *
+ * The window is adjusted to the rate of the received changes. The estimated
+ * rate decays while no changes are received, so if changes are received
+ * rarely, they are emitted in the next iteration of the event loop.
+ */
+class DOLPHIN_EXPORT KFileItemModelChangeCoalescer : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit KFileItemModelChangeCoalescer(QObject* parent = nullptr);
+    ~KFileItemModelChangeCoalescer() override;
+
+    void addItems(const QUrl& directoryUrl, const KFileItemList& items);
+    void deleteItems(const KFileItemList& items);
+    void refreshItems(const QList<QPair<KFileItem, KFileItem> >& items);
+
+    /**
+     * Emits the pending changes immediately.
+     */
+    void flush();
+
+    /**
+     * Discards the pending changes.
+     */
+    void clear();
+
+    bool hasPendingChanges() const;
+
+    /**
+     * @return Current window in milliseconds, during which changes are collected.
+     */
+    int window() const;
+
+    /**
+     * @return Number of item changes which have been passed to this class.
+     */
+    qint64 receivedChangeCount() const;
+
+    /**
+     * @return Number of batches which have been emitted with changesCoalesced().
+     */
+    qint64 emittedUpdateCount() const;
+
+    /**
+     * @return Number of item changes which have been emitted with changesCoalesced().
+     */
+    qint64 emittedChangeCount() const;
+
+signals:
+    /**
+     * Is emitted when the collected changes should be applied. The items in
+     * \a deletedItems must be removed first, then the items in \a refreshedItems
+     * are refreshed, and finally the items in \a addedItems (key: directory URL)
+     * are added.
+     */
+    void changesCoalesced(const KFileItemList& deletedItems,
+                          const QList<QPair<KFileItem, KFileItem> >& refreshedItems,
+                          const QHash<QUrl, KFileItemList>& addedItems);
+
+private:
+    enum ChangeType {
+        NoChange,
+        ItemAdded,
+        ItemRefreshed,
+        ItemDeleted
+    };
+
+    struct Change
+    {
+        ChangeType type;
+        KFileItem oldItem;      // Item which is known by the receiver
+        KFileItem newItem;
+        QUrl directoryUrl;      // Only used for added items
+    };
+
+    /**
+     * Updates the rate of the received changes and starts the timer
+     * which emits the changes.
+     */
+    void changesReceived(int count);
+
+    /**
+     * @return Estimated number of signals per second, which has been
+     *         decayed since the last update of m_changeRate.
+     */
+    qreal changeRate() const;
+
+    /**
+     * Stores the decayed rate changeRate() in m_changeRate.
+     */
+    void decayChangeRate();
+
+    void appendChange(ChangeType type, const KFileItem& oldItem, const KFileItem& newItem,
+                      const QUrl& directoryUrl = QUrl());
+
+    /**
+     * Updates the URL of the change with the index \a index after an item
+     * has been renamed from \a oldUrl.
+     */
+    void updateUrl(int index, const QUrl& oldUrl);
+
+private:
+    QVector<Change> m_changes;
+    QHash<QUrl, int> m_changeIndexes;   // Current URL of an item -> index in m_changes
+
+    QTimer* m_timer;
+    QElapsedTimer m_clock;
+    qreal m_changeRate;                 // Estimated number of signals per second
+    qint64 m_changeRateTime;            // Time of m_clock when m_changeRate has been estimated
+
+    qint64 m_receivedChangeCount;
+    qint64 m_emittedUpdateCount;
+    qint64 m_emittedChangeCount;
+};
+
+#endif
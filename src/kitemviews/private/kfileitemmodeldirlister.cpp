@@ -19,11 +19,36 @@
 
 #include "kfileitemmodeldirlister.h"
 
+#include "kfileitemmodellocallister.h"
+
+#include <KDirWatch>
 #include <KLocalizedString>
+#include <KIO/Global>
 #include <KIO/Job>
 
+#include <QTimer>
+
+namespace {
+    // Delay in ms before a changed local directory is listed again. Changes
+    // which occur during the delay are handled by the same update.
+    const int DirectoryUpdateDelay = 200;
+}
+
 KFileItemModelDirLister::KFileItemModelDirLister(QObject* parent) :
-    KDirLister(parent)
+    KDirLister(parent),
+    m_localListingEnabled(false),
+    m_autoUpdate(true),
+    m_localLister(nullptr),
+    m_localUrl(),
+    m_localRootItem(),
+    m_localUrls(),
+    m_pendingUrls(),
+    m_localItems(),
+    m_updatedItems(),
+    m_dirWatch(nullptr),
+    m_watchedDirs(),
+    m_dirtyUrls(),
+    m_dirtyTimer(nullptr)
 {
     setAutoErrorHandlingEnabled(false, nullptr);
 }
@@ -46,3 +71,371 @@ void KFileItemModelDirLister::handleError(KIO::Job* job)
     }
 }
 
+
+void KFileItemModelDirLister::setLocalListingEnabled(bool enabled)
+{
+    if (enabled && !m_localLister) {
+        m_localLister = new KFileItemModelLocalLister(this);
+        connect(m_localLister, &KFileItemModelLocalLister::itemsAdded, this, &KFileItemModelDirLister::slotLocalItemsAdded);
+        connect(m_localLister, &KFileItemModelLocalLister::completed, this, &KFileItemModelDirLister::slotLocalCompleted);
+        connect(m_localLister, &KFileItemModelLocalLister::canceled, this, &KFileItemModelDirLister::slotLocalCanceled);
+        connect(m_localLister, &KFileItemModelLocalLister::error, this, &KFileItemModelDirLister::slotLocalError);
+
+        m_dirWatch = new KDirWatch(this);
+        connect(m_dirWatch, &KDirWatch::dirty, this, &KFileItemModelDirLister::slotDirectoryDirty);
+        connect(m_dirWatch, &KDirWatch::deleted, this, &KFileItemModelDirLister::slotDirectoryDirty);
+
+        m_dirtyTimer = new QTimer(this);
+        m_dirtyTimer->setSingleShot(true);
+        m_dirtyTimer->setInterval(DirectoryUpdateDelay);
+        connect(m_dirtyTimer, &QTimer::timeout, this, &KFileItemModelDirLister::slotUpdateDirtyDirectories);
+    }
+    m_localListingEnabled = enabled;
+}
+
+bool KFileItemModelDirLister::localListingEnabled() const
+{
+    return m_localListingEnabled;
+}
+
+bool KFileItemModelDirLister::openUrl(const QUrl& url, OpenUrlFlags flags)
+{
+    const bool keep = flags & Keep;
+    const bool listLocally = (isListingLocally() && keep)
+                             ? KFileItemModelLocalLister::isSupported(url)
+                             : m_localListingEnabled && !keep && KFileItemModelLocalLister::isSupported(url);
+    if (!listLocally) {
+        if (isListingLocally() && !keep) {
+            stopLocalListing();
+        }
+        return KDirLister::openUrl(url, flags);
+    }
+
+    if (!keep) {
+        if (isListingLocally()) {
+            resetLocalListing();
+        } else {
+            // Let KDirLister stop listing and watching the previous directories.
+            // The directories which are listed locally are watched by m_dirWatch.
+            KDirLister::stop();
+            m_autoUpdate = autoUpdate();
+            setAutoUpdate(false);
+        }
+
+        m_localUrl = url;
+        emit clear();
+    }
+
+    if (m_updatedItems.contains(url)) {
+        // The update of the directory is replaced by the new listing
+        m_localLister->stop(url);
+    }
+    m_localItems.remove(url);
+    m_dirtyUrls.remove(url);
+
+    if (!m_localUrls.contains(url)) {
+        m_localUrls.append(url);
+    }
+    if (m_autoUpdate) {
+        watchDirectory(url);
+    }
+
+    m_localLister->setDelayedMimeTypes(delayedMimeTypes());
+    m_localLister->setDirOnlyMode(dirOnlyMode());
+    m_localLister->openUrl(url);
+    m_pendingUrls.insert(url);
+    emit started(url);
+    return true;
+}
+
+void KFileItemModelDirLister::stop()
+{
+    if (!isListingLocally()) {
+        KDirLister::stop();
+        return;
+    }
+
+    const bool listing = !m_pendingUrls.isEmpty();
+    m_localLister->stop();
+    if (listing) {
+        emit canceled();
+    }
+}
+
+void KFileItemModelDirLister::stop(const QUrl& url)
+{
+    if (!isListingLocally()) {
+        KDirLister::stop(url);
+        return;
+    }
+
+    m_localUrls.removeOne(url);
+    m_localItems.remove(url);
+    m_dirtyUrls.remove(url);
+    stopWatchingDirectory(url);
+
+    const bool listing = m_pendingUrls.contains(url);
+    m_localLister->stop(url);
+    if (listing && m_pendingUrls.isEmpty()) {
+        emit canceled();
+    }
+}
+
+void KFileItemModelDirLister::emitChanges()
+{
+    if (!isListingLocally()) {
+        KDirLister::emitChanges();
+        return;
+    }
+
+    // The listed directories are updated, so that only the items which
+    // are added or removed by the changed directory-only mode are emitted.
+    if (dirOnlyMode() != m_localLister->dirOnlyMode()) {
+        const QList<QUrl> urls = m_localUrls;
+        for (const QUrl& url : urls) {
+            if (m_pendingUrls.contains(url)) {
+                // The pending listing still uses the previous mode
+                openUrl(url, Keep);
+            } else {
+                updateDirectory(url);
+            }
+        }
+    }
+}
+
+QUrl KFileItemModelDirLister::directoryUrl() const
+{
+    return isListingLocally() ? m_localUrl : url();
+}
+
+KFileItem KFileItemModelDirLister::directoryItem() const
+{
+    if (!isListingLocally()) {
+        return rootItem();
+    }
+
+    if (m_localRootItem.isNull()) {
+        // The properties of a local item are determined by KFileItem itself
+        m_localRootItem = KFileItem(m_localUrl);
+    }
+    return m_localRootItem;
+}
+
+bool KFileItemModelDirLister::isListingFinished() const
+{
+    return isListingLocally() ? m_pendingUrls.isEmpty() : isFinished();
+}
+
+void KFileItemModelDirLister::slotLocalItemsAdded(const QUrl& directoryUrl, const KFileItemList& items)
+{
+    KFileItemList shownItems;
+    if (showingDotFiles()) {
+        shownItems = items;
+    } else {
+        shownItems.reserve(items.count());
+        for (const KFileItem& item : items) {
+            if (!item.isHidden()) {
+                shownItems.append(item);
+            }
+        }
+    }
+
+    auto it = m_updatedItems.find(directoryUrl);
+    if (it != m_updatedItems.end()) {
+        it.value() += shownItems;
+        return;
+    }
+
+    m_localItems[directoryUrl] += shownItems;
+    if (!shownItems.isEmpty()) {
+        emit itemsAdded(directoryUrl, shownItems);
+        emit newItems(shownItems);
+    }
+}
+
+void KFileItemModelDirLister::slotLocalCompleted(const QUrl& url)
+{
+    if (m_updatedItems.contains(url)) {
+        applyDirectoryUpdate(url, m_updatedItems.take(url));
+        scheduleDirectoryUpdates();
+        return;
+    }
+
+    m_pendingUrls.remove(url);
+    emit completed(url);
+    if (m_pendingUrls.isEmpty()) {
+        emit completed();
+    }
+    scheduleDirectoryUpdates();
+}
+
+void KFileItemModelDirLister::slotLocalCanceled(const QUrl& url)
+{
+    if (m_updatedItems.remove(url) > 0) {
+        return;
+    }
+
+    m_pendingUrls.remove(url);
+    emit canceled(url);
+}
+
+void KFileItemModelDirLister::slotLocalError(const QUrl& url, int error)
+{
+    if (m_updatedItems.remove(url) > 0) {
+        if (error == KIO::ERR_DOES_NOT_EXIST) {
+            // The directory has been deleted together with its items
+            const KFileItemList items = m_localItems.take(url);
+            if (!items.isEmpty()) {
+                emit itemsDeleted(items);
+            }
+        }
+        return;
+    }
+
+    if (error == KIO::ERR_IS_FILE) {
+        emit urlIsFileError(url);
+    } else {
+        emit errorMessage(KIO::buildErrorString(error, url.toDisplayString()));
+    }
+
+    m_localUrls.removeOne(url);
+    m_localItems.remove(url);
+    stopWatchingDirectory(url);
+    m_pendingUrls.remove(url);
+    emit canceled(url);
+    if (m_pendingUrls.isEmpty()) {
+        emit canceled();
+    }
+}
+
+void KFileItemModelDirLister::slotDirectoryDirty(const QString& path)
+{
+    for (const QUrl& url : qAsConst(m_localUrls)) {
+        if (url.adjusted(QUrl::StripTrailingSlash).toLocalFile() == path) {
+            m_dirtyUrls.insert(url);
+            scheduleDirectoryUpdates();
+            return;
+        }
+    }
+}
+
+void KFileItemModelDirLister::slotUpdateDirtyDirectories()
+{
+    const QSet<QUrl> dirtyUrls = m_dirtyUrls;
+    for (const QUrl& url : dirtyUrls) {
+        // Directories which are being listed are updated after the
+        // listing has been completed, see scheduleDirectoryUpdates().
+        if (!m_pendingUrls.contains(url) && !m_updatedItems.contains(url)) {
+            m_dirtyUrls.remove(url);
+            updateDirectory(url);
+        }
+    }
+}
+
+bool KFileItemModelDirLister::isListingLocally() const
+{
+    return !m_localUrl.isEmpty();
+}
+
+void KFileItemModelDirLister::updateDirectory(const QUrl& url)
+{
+    if (m_updatedItems.contains(url)) {
+        m_localLister->stop(url);
+    }
+
+    m_updatedItems.insert(url, KFileItemList());
+    m_localLister->setDelayedMimeTypes(delayedMimeTypes());
+    m_localLister->setDirOnlyMode(dirOnlyMode());
+    m_localLister->openUrl(url);
+}
+
+void KFileItemModelDirLister::applyDirectoryUpdate(const QUrl& url, const KFileItemList& items)
+{
+    const KFileItemList previousItems = m_localItems.value(url);
+    QHash<QString, KFileItem> previousItemsByName;
+    previousItemsByName.reserve(previousItems.count());
+    for (const KFileItem& item : previousItems) {
+        previousItemsByName.insert(item.name(), item);
+    }
+
+    KFileItemList addedItems;
+    QList<QPair<KFileItem, KFileItem> > refreshedItems;
+    for (const KFileItem& item : items) {
+        auto it = previousItemsByName.find(item.name());
+        if (it == previousItemsByName.end()) {
+            addedItems.append(item);
+        } else {
+            if (!it.value().cmp(item)) {
+                refreshedItems.append(qMakePair(it.value(), item));
+            }
+            previousItemsByName.erase(it);
+        }
+    }
+
+    m_localItems.insert(url, items);
+
+    if (!previousItemsByName.isEmpty()) {
+        emit itemsDeleted(previousItemsByName.values());
+    }
+    if (!refreshedItems.isEmpty()) {
+        emit refreshItems(refreshedItems);
+    }
+    if (!addedItems.isEmpty()) {
+        emit itemsAdded(url, addedItems);
+        emit newItems(addedItems);
+    }
+}
+
+void KFileItemModelDirLister::scheduleDirectoryUpdates()
+{
+    if (m_dirtyTimer->isActive()) {
+        return;
+    }
+
+    for (const QUrl& url : qAsConst(m_dirtyUrls)) {
+        if (!m_pendingUrls.contains(url) && !m_updatedItems.contains(url)) {
+            m_dirtyTimer->start();
+            return;
+        }
+    }
+}
+
+void KFileItemModelDirLister::watchDirectory(const QUrl& url)
+{
+    const QString path = url.adjusted(QUrl::StripTrailingSlash).toLocalFile();
+    if (!m_watchedDirs.contains(path)) {
+        m_dirWatch->addDir(path);
+        m_watchedDirs.insert(path);
+    }
+}
+
+void KFileItemModelDirLister::stopWatchingDirectory(const QUrl& url)
+{
+    const QString path = url.adjusted(QUrl::StripTrailingSlash).toLocalFile();
+    if (m_watchedDirs.remove(path)) {
+        m_dirWatch->removeDir(path);
+    }
+}
+
+void KFileItemModelDirLister::resetLocalListing()
+{
+    m_localLister->stop();
+    for (const QString& path : qAsConst(m_watchedDirs)) {
+        m_dirWatch->removeDir(path);
+    }
+    m_watchedDirs.clear();
+    m_dirtyTimer->stop();
+    m_dirtyUrls.clear();
+    m_localItems.clear();
+    m_updatedItems.clear();
+    m_pendingUrls.clear();
+    m_localUrl.clear();
+    m_localRootItem = KFileItem();
+    m_localUrls.clear();
+}
+
+void KFileItemModelDirLister::stopLocalListing()
+{
+    resetLocalListing();
+    setAutoUpdate(m_autoUpdate);
+}
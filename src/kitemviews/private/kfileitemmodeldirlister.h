@@ -24,12 +24,21 @@
 
 #include <KDirLister>
 
+#include <QHash>
+#include <QSet>
 #include <QUrl>
 
+class KDirWatch;
+class KFileItemModelLocalLister;
+class QTimer;
+
 /**
  * @brief Extends the class KDirLister by emitting a signal when an
  *        error occurred instead of showing an error dialog.
  *        KDirLister::autoErrorHandlingEnabled() is set to false.
+ *
+ * Optionally local directories are listed by KFileItemModelLocalLister
+ * instead of KIO, see setLocalListingEnabled().
  */
 class DOLPHIN_EXPORT KFileItemModelDirLister : public KDirLister
 {
@@ -39,6 +48,51 @@ public:
     explicit KFileItemModelDirLister(QObject* parent = nullptr);
     ~KFileItemModelDirLister() override;
 
+    /**
+     * If set to true, local directories are read directly by the
+     * class KFileItemModelLocalLister instead of the KIO file worker,
+     * which avoids the overhead of transferring the entries from
+     * the worker process. Is false per default.
+     *
+     * Directories which have been listed this way are watched by
+     * KDirWatch if KDirLister::autoUpdate() is enabled. Changed
+     * directories are listed again and the differences are emitted by
+     * the signals itemsAdded(), itemsDeleted() and refreshItems(). The
+     * name and MIME filters of KDirLister are not applied. The items are
+     * not shared with the cache of KDirLister, contain no ACLs or extended
+     * attributes, and only names starting with a dot are hidden. The
+     * setting takes effect for the next URL that is opened without the
+     * flag KDirLister::Keep.
+     */
+    void setLocalListingEnabled(bool enabled);
+    bool localListingEnabled() const;
+
+    bool openUrl(const QUrl& url, OpenUrlFlags flags = NoFlags) override;
+    void stop() override;
+    void stop(const QUrl& url) override;
+    void emitChanges() override;
+
+    /**
+     * @return URL of the directory which has been opened without the
+     *         flag KDirLister::Keep. In contrast to KDirLister::url()
+     *         directories which are listed locally are respected.
+     */
+    QUrl directoryUrl() const;
+
+    /**
+     * @return Item for the directory directoryUrl(). In contrast to
+     *         KDirLister::rootItem() directories which are listed
+     *         locally are respected.
+     */
+    KFileItem directoryItem() const;
+
+    /**
+     * @return True if no directory is being listed. In contrast to
+     *         KDirLister::isFinished() directories which are listed
+     *         locally are respected.
+     */
+    bool isListingFinished() const;
+
 signals:
     /** Is emitted whenever an error has occurred. */
     void errorMessage(const QString& msg);
@@ -51,6 +105,68 @@ signals:
 
 protected:
     void handleError(KIO::Job* job) override;
+
+private slots:
+    void slotLocalItemsAdded(const QUrl& directoryUrl, const KFileItemList& items);
+    void slotLocalCompleted(const QUrl& url);
+    void slotLocalCanceled(const QUrl& url);
+    void slotLocalError(const QUrl& url, int error);
+    void slotDirectoryDirty(const QString& path);
+    void slotUpdateDirtyDirectories();
+
+private:
+    bool isListingLocally() const;
+
+    /**
+     * Lists the local directory \a url again. The differences to the
+     * items which have been listed before are emitted when the listing
+     * has been completed, see applyDirectoryUpdate().
+     */
+    void updateDirectory(const QUrl& url);
+    void applyDirectoryUpdate(const QUrl& url, const KFileItemList& items);
+
+    /**
+     * Starts the timer for updating the changed directories if a
+     * directory which is not being listed anymore has been changed.
+     */
+    void scheduleDirectoryUpdates();
+
+    void watchDirectory(const QUrl& url);
+    void stopWatchingDirectory(const QUrl& url);
+
+    /**
+     * Stops the local listings and forgets about the listed directories.
+     */
+    void resetLocalListing();
+
+    /**
+     * Stops listing directories locally and passes the listing
+     * of directories back to KDirLister.
+     */
+    void stopLocalListing();
+
+private:
+    bool m_localListingEnabled;
+    bool m_autoUpdate;
+    KFileItemModelLocalLister* m_localLister;
+    QUrl m_localUrl;
+    mutable KFileItem m_localRootItem;
+    QList<QUrl> m_localUrls;
+
+    // Directories which are listed locally and have not been completed
+    // yet. Updates of changed directories are not part of the set.
+    QSet<QUrl> m_pendingUrls;
+
+    // Items of the completed local listings. They are compared to the
+    // items of m_updatedItems, which collects the items of the updates
+    // of changed directories.
+    QHash<QUrl, KFileItemList> m_localItems;
+    QHash<QUrl, KFileItemList> m_updatedItems;
+
+    KDirWatch* m_dirWatch;
+    QSet<QString> m_watchedDirs;    // Required as KDirWatch does not offer a getter method
+    QSet<QUrl> m_dirtyUrls;
+    QTimer* m_dirtyTimer;
 };
 
 #endif
@@ -24,35 +24,38 @@
 
 
 KFileItemModelFilter::KFileItemModelFilter() :
-    m_useRegExp(false),
-    m_regExp(nullptr),
-    m_lowerCasePattern(),
+    m_patternType(SubstringPattern),
+    m_patternText(),
+    m_regExp(),
     m_pattern()
 {
+    m_regExp.setPatternOptions(QRegularExpression::CaseInsensitiveOption);
 }
 
 KFileItemModelFilter::~KFileItemModelFilter()
 {
-    delete m_regExp;
-    m_regExp = nullptr;
 }
 
 void KFileItemModelFilter::setPattern(const QString& filter)
 {
     m_pattern = filter;
-    m_lowerCasePattern = filter.toLower();
-
-    if (filter.contains('*') || filter.contains('?') || filter.contains('[')) {
-        if (!m_regExp) {
-            m_regExp = new QRegExp();
-            m_regExp->setCaseSensitivity(Qt::CaseInsensitive);
-            m_regExp->setMinimal(false);
-            m_regExp->setPatternSyntax(QRegExp::WildcardUnix);
+    m_patternType = patternType(filter, m_patternText);
+
+    if (m_patternType == RegularExpressionPattern) {
+        QString regExp;
+        bool isValid = wildcardToRegularExpression(filter, regExp);
+        if (isValid) {
+            m_regExp.setPattern(regExp);
+            m_regExp.optimize();
+            isValid = m_regExp.isValid();
+        }
+
+        if (!isValid) {
+            // Like before the pattern has been recognized as wildcard
+            // expression, use it as sub-string.
+            m_patternType = SubstringPattern;
+            m_patternText = filter;
         }
-        m_regExp->setPattern(filter);
-        m_useRegExp = m_regExp->isValid();
-    } else {
-        m_useRegExp = false;
     }
 }
 
@@ -61,6 +64,34 @@ QString KFileItemModelFilter::pattern() const
     return m_pattern;
 }
 
+bool KFileItemModelFilter::isNarrowedBy(const QString& pattern) const
+{
+    if (m_pattern.isEmpty()) {
+        return true;
+    }
+
+    QString text;
+    const PatternType type = patternType(pattern, text);
+
+    switch (m_patternType) {
+    case MatchAllPattern:
+        return true;
+
+    case SubstringPattern:
+        return (type == SubstringPattern || type == PrefixPattern || type == SuffixPattern)
+               && text.contains(m_patternText, Qt::CaseInsensitive);
+
+    case PrefixPattern:
+        return type == PrefixPattern && text.startsWith(m_patternText, Qt::CaseInsensitive);
+
+    case SuffixPattern:
+        return type == SuffixPattern && text.endsWith(m_patternText, Qt::CaseInsensitive);
+
+    default:
+        return false;
+    }
+}
+
 void KFileItemModelFilter::setMimeTypes(const QStringList& types)
 {
     m_mimeTypes = types;
@@ -100,13 +131,130 @@ bool KFileItemModelFilter::matches(const KFileItem& item) const
     return matchesType(item);
 }
 
+bool KFileItemModelFilter::isThreadSafe() const
+{
+    return m_mimeTypes.isEmpty();
+}
+
+KFileItemModelFilter::PatternType KFileItemModelFilter::patternType(const QString& pattern, QString& text)
+{
+    text.clear();
+
+    if (!pattern.contains('*') && !pattern.contains('?') && !pattern.contains('[')) {
+        text = pattern;
+        return SubstringPattern;
+    }
+
+    if (pattern.contains('?') || pattern.contains('[') || pattern.contains('\\')) {
+        return RegularExpressionPattern;
+    }
+
+    // The pattern only contains '*' as wildcard. Check whether it is
+    // of the form "*text", "text*" or "*text*".
+    const int length = pattern.length();
+    int first = 0;
+    while (first < length && pattern.at(first) == QLatin1Char('*')) {
+        ++first;
+    }
+    if (first == length) {
+        return MatchAllPattern;
+    }
+
+    int last = length;
+    while (pattern.at(last - 1) == QLatin1Char('*')) {
+        --last;
+    }
+
+    const QString innerText = pattern.mid(first, last - first);
+    if (innerText.contains('*')) {
+        return RegularExpressionPattern;
+    }
+
+    text = innerText;
+    if (first > 0 && last < length) {
+        return SubstringPattern;
+    } else if (first > 0) {
+        return SuffixPattern;
+    }
+    return PrefixPattern;
+}
+
+bool KFileItemModelFilter::wildcardToRegularExpression(const QString& pattern, QString& regularExpression)
+{
+    QString result;
+    result.reserve(pattern.length() * 2);
+
+    const int length = pattern.length();
+    int i = 0;
+    while (i < length) {
+        const QChar c = pattern.at(i);
+        if (c == QLatin1Char('\\') && i + 1 < length) {
+            // An escaped wildcard character
+            result += QRegularExpression::escape(pattern.mid(i + 1, 1));
+            i += 2;
+        } else if (c == QLatin1Char('*')) {
+            result += QLatin1String(".*");
+            ++i;
+        } else if (c == QLatin1Char('?')) {
+            result += QLatin1Char('.');
+            ++i;
+        } else if (c == QLatin1Char('[')) {
+            // A character set. A ']' directly behind the opening '[' or '[!'
+            // is part of the set.
+            int start = i + 1;
+            const bool negated = start < length && (pattern.at(start) == QLatin1Char('!') || pattern.at(start) == QLatin1Char('^'));
+            if (negated) {
+                ++start;
+            }
+            int end = start;
+            if (end < length && pattern.at(end) == QLatin1Char(']')) {
+                ++end;
+            }
+            while (end < length && pattern.at(end) != QLatin1Char(']')) {
+                ++end;
+            }
+            if (end >= length) {
+                return false;
+            }
+
+            result += negated ? QLatin1String("[^") : QLatin1String("[");
+            for (int j = start; j < end; ++j) {
+                const QChar setChar = pattern.at(j);
+                if (setChar == QLatin1Char('\\') || setChar == QLatin1Char('[') || setChar == QLatin1Char(']') || setChar == QLatin1Char('^')) {
+                    result += QLatin1Char('\\');
+                }
+                result += setChar;
+            }
+            result += QLatin1Char(']');
+            i = end + 1;
+        } else {
+            result += QRegularExpression::escape(pattern.mid(i, 1));
+            ++i;
+        }
+    }
+
+    regularExpression = QLatin1String("\\A(?:") + result + QLatin1String(")\\z");
+    return true;
+}
+
 bool KFileItemModelFilter::matchesPattern(const KFileItem& item) const
 {
-    if (m_useRegExp) {
-        return m_regExp->exactMatch(item.text());
-    } else {
-        return item.text().toLower().contains(m_lowerCasePattern);
+    const QString text = item.text();
+
+    switch (m_patternType) {
+    case MatchAllPattern:
+        return true;
+    case SubstringPattern:
+        return text.contains(m_patternText, Qt::CaseInsensitive);
+    case PrefixPattern:
+        return text.startsWith(m_patternText, Qt::CaseInsensitive);
+    case SuffixPattern:
+        return text.endsWith(m_patternText, Qt::CaseInsensitive);
+    case RegularExpressionPattern:
+        return m_regExp.match(text).hasMatch();
     }
+
+    return false;
 }
 
 bool KFileItemModelFilter::matchesType(const KFileItem& item) const
@@ -23,10 +23,10 @@
 
 #include "dolphin_export.h"
 
+#include <QRegularExpression>
 #include <QStringList>
 
 class KFileItem;
-class QRegExp;
 
 /**
  * @brief Allows to check whether an item of the KFileItemModel
@@ -47,11 +47,24 @@ public:
      * Sets the pattern that is used for a comparison with the item
      * in KFileItemModelFilter::matches(). Per default the pattern
      * defines a sub-string. As soon as the pattern contains at least
-     * a '*', '?' or '[' the pattern represents a regular expression.
+     * a '*', '?' or '[' the pattern represents a wildcard expression.
+     *
+     * Wildcard expressions that only consist of a text and leading or
+     * trailing '*' characters, like "*.png" or "Image*", are checked
+     * with simple string comparisons. A regular expression is only used
+     * for all other wildcard expressions.
      */
     void setPattern(const QString& pattern);
     QString pattern() const;
 
+    /**
+     * @return True if all items that match with \a pattern also match with the
+     *         current pattern. This is the case if the user has typed further
+     *         characters into the filter bar: Items that have been hidden by the
+     *         current pattern will also be hidden after setPattern(pattern).
+     */
+    bool isNarrowedBy(const QString& pattern) const;
+
     /**
      * Set the list of mimetypes that are used for comparison with the
      * item in KFileItemModelFilter::matchesMimeType.
@@ -70,7 +83,37 @@ public:
      */
     bool matches(const KFileItem& item) const;
 
+    /**
+     * @return True if matches() may be called from several threads at
+     *         the same time. This is not the case if a MIME type filter
+     *         has been set, because determining the MIME type of an item
+     *         modifies the item.
+     */
+    bool isThreadSafe() const;
+
 private:
+    enum PatternType {
+        MatchAllPattern,
+        SubstringPattern,
+        PrefixPattern,
+        SuffixPattern,
+        RegularExpressionPattern
+    };
+
+    /**
+     * @return Type of \a pattern. If the pattern can be checked without a
+     *         regular expression, the text that must be contained in the
+     *         item text is written into \a text.
+     */
+    static PatternType patternType(const QString& pattern, QString& text);
+
+    /**
+     * Converts the wildcard expression \a pattern, which uses the same syntax
+     * as QRegExp::WildcardUnix, into a regular expression.
+     * @return False if \a pattern contains an unterminated character set.
+     */
+    static bool wildcardToRegularExpression(const QString& pattern, QString& regularExpression);
+
     /**
      * @return True if item matches pattern set by @ref setPattern.
      */
@@ -81,11 +124,10 @@ private:
      */
     bool matchesType(const KFileItem& item) const;
 
-    bool m_useRegExp;           // If true, m_regExp is used for filtering,
-                                // otherwise m_lowerCaseFilter is used.
-    QRegExp* m_regExp;
-    QString m_lowerCasePattern; // Lowercase version of m_filter for
-                                // faster comparison in matches().
+    PatternType m_patternType;
+    QString m_patternText;      // Text that is compared with the item text, if
+                                // m_patternType is not RegularExpressionPattern.
+    QRegularExpression m_regExp;
     QString m_pattern;          // Property set by setPattern().
     QStringList m_mimeTypes;    // Property set by setMimeTypes()
 };
@@ -0,0 +1,515 @@
+/***************************************************************************
+ *   Copyright (C) 2019 by Dolphin developers <kfm-devel@kde.org>          *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA            *
+ ***************************************************************************/
+
+#include "kfileitemmodellocallister.h"
+
+#include <KIO/Global>
+#include <KIO/UDSEntry>
+
+#include <QAtomicInt>
+#include <QFile>
+#include <QFuture>
+#include <QMutex>
+#include <QThread>
+#include <QtConcurrentRun>
+
+#ifdef Q_OS_LINUX
+#include <fcntl.h>
+#include <grp.h>
+#include <limits.h>
+#include <pwd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace {
+    // Number of entries which are stat'ed by one thread of the stat thread pool
+    const int StatSliceSize = 256;
+
+    // The first batch is kept small, so that the view can show the first
+    // items as early as possible. The following batches are larger to keep
+    // the number of signal emissions low.
+    const int FirstBatchSize = 256;
+    const int BatchSize = 4096;
+
+    const int DirentBufferSize = 256 * 1024;
+}
+
+struct KFileItemModelLocalLister::Listing
+{
+    Listing() :
+        delayedMimeTypes(false),
+        dirOnlyMode(false),
+        canceled(0),
+        finished(false),
+        deliveryScheduled(false),
+        error(0)
+    {
+    }
+
+    QUrl url;
+    bool delayedMimeTypes;
+    bool dirOnlyMode;
+    QAtomicInt canceled;
+
+    // Shared between the worker thread and the GUI thread; protected by mutex
+    QMutex mutex;
+    QVector<KFileItem> items;
+    bool finished;
+    bool deliveryScheduled;
+    int error;
+};
+
+#ifdef Q_OS_LINUX
+namespace {
+    struct LinuxDirent64
+    {
+        quint64 d_ino;
+        qint64 d_off;
+        unsigned short d_reclen;
+        unsigned char d_type;
+        char d_name[1];
+    };
+
+    struct EntryStat
+    {
+        mode_t mode;
+        quint64 inode;
+        uid_t uid;
+        gid_t gid;
+        qint64 size;
+        qint64 modificationTime;
+        qint64 accessTime;
+        qint64 creationTime;  // -1 if unknown
+    };
+
+    bool statEntry(int directoryFd, const char* name, bool followLinks, EntryStat* result)
+    {
+#if defined(STATX_BASIC_STATS)
+        struct statx buff;
+        const int flags = AT_NO_AUTOMOUNT | (followLinks ? 0 : AT_SYMLINK_NOFOLLOW);
+        if (statx(directoryFd, name, flags, STATX_BASIC_STATS | STATX_BTIME, &buff) != 0) {
+            return false;
+        }
+        result->mode = buff.stx_mode;
+        result->inode = buff.stx_ino;
+        result->uid = buff.stx_uid;
+        result->gid = buff.stx_gid;
+        result->size = buff.stx_size;
+        result->modificationTime = buff.stx_mtime.tv_sec;
+        result->accessTime = buff.stx_atime.tv_sec;
+        result->creationTime = (buff.stx_mask & STATX_BTIME) ? buff.stx_btime.tv_sec : -1;
+#else
+        struct stat buff;
+        if (fstatat(directoryFd, name, &buff, followLinks ? 0 : AT_SYMLINK_NOFOLLOW) != 0) {
+            return false;
+        }
+        result->mode = buff.st_mode;
+        result->inode = buff.st_ino;
+        result->uid = buff.st_uid;
+        result->gid = buff.st_gid;
+        result->size = buff.st_size;
+        result->modificationTime = buff.st_mtime;
+        result->accessTime = buff.st_atime;
+        result->creationTime = -1;
+#endif
+        return true;
+    }
+
+    QString userName(uid_t uid, QHash<uid_t, QString>& cache)
+    {
+        auto it = cache.constFind(uid);
+        if (it != cache.constEnd()) {
+            return it.value();
+        }
+
+        QString name;
+        struct passwd pwd;
+        struct passwd* result = nullptr;
+        char buffer[4096];
+        if (getpwuid_r(uid, &pwd, buffer, sizeof(buffer), &result) == 0 && result) {
+            name = QString::fromLocal8Bit(result->pw_name);
+        } else {
+            name = QString::number(uid);
+        }
+        cache.insert(uid, name);
+        return name;
+    }
+
+    QString groupName(gid_t gid, QHash<gid_t, QString>& cache)
+    {
+        auto it = cache.constFind(gid);
+        if (it != cache.constEnd()) {
+            return it.value();
+        }
+
+        QString name;
+        struct group grp;
+        struct group* result = nullptr;
+        char buffer[4096];
+        if (getgrgid_r(gid, &grp, buffer, sizeof(buffer), &result) == 0 && result) {
+            name = QString::fromLocal8Bit(result->gr_name);
+        } else {
+            name = QString::number(gid);
+        }
+        cache.insert(gid, name);
+        return name;
+    }
+
+    int errorFromErrno(int errorNumber)
+    {
+        switch (errorNumber) {
+        case ENOENT:  return KIO::ERR_DOES_NOT_EXIST;
+        case EACCES:
+        case EPERM:   return KIO::ERR_ACCESS_DENIED;
+        case ENOTDIR: return KIO::ERR_IS_FILE;
+        default:      return KIO::ERR_CANNOT_ENTER_DIRECTORY;
+        }
+    }
+}
+#endif
+
+KFileItemModelLocalLister::KFileItemModelLocalLister(QObject* parent) :
+    QObject(parent),
+    m_delayedMimeTypes(false),
+    m_dirOnlyMode(false),
+    m_listings(),
+    m_listingThreadPool(),
+    m_statThreadPool()
+{
+    m_listingThreadPool.setMaxThreadCount(qMax(2, QThread::idealThreadCount()));
+}
+
+KFileItemModelLocalLister::~KFileItemModelLocalLister()
+{
+    for (const QSharedPointer<Listing>& listing : qAsConst(m_listings)) {
+        listing->canceled.store(1);
+    }
+    m_listingThreadPool.waitForDone();
+    m_statThreadPool.waitForDone();
+}
+
+bool KFileItemModelLocalLister::isSupported(const QUrl& url)
+{
+#ifdef Q_OS_LINUX
+    return url.isLocalFile();
+#else
+    Q_UNUSED(url);
+    return false;
+#endif
+}
+
+void KFileItemModelLocalLister::setDelayedMimeTypes(bool delayed)
+{
+    m_delayedMimeTypes = delayed;
+}
+
+bool KFileItemModelLocalLister::delayedMimeTypes() const
+{
+    return m_delayedMimeTypes;
+}
+
+void KFileItemModelLocalLister::setDirOnlyMode(bool dirsOnly)
+{
+    m_dirOnlyMode = dirsOnly;
+}
+
+bool KFileItemModelLocalLister::dirOnlyMode() const
+{
+    return m_dirOnlyMode;
+}
+
+void KFileItemModelLocalLister::openUrl(const QUrl& url)
+{
+    if (!isSupported(url)) {
+        return;
+    }
+
+    if (cancelListing(url)) {
+        emit canceled(url);
+    }
+
+    QSharedPointer<Listing> listing(new Listing());
+    listing->url = url;
+    listing->delayedMimeTypes = m_delayedMimeTypes;
+    listing->dirOnlyMode = m_dirOnlyMode;
+    m_listings.insert(url, listing);
+
+    emit started(url);
+
+    QtConcurrent::run(&m_listingThreadPool, &KFileItemModelLocalLister::listDirectory,
+                      listing, &m_statThreadPool, static_cast<QObject*>(this));
+}
+
+void KFileItemModelLocalLister::stop()
+{
+    const QList<QUrl> urls = m_listings.keys();
+    for (const QUrl& url : urls) {
+        stop(url);
+    }
+}
+
+void KFileItemModelLocalLister::stop(const QUrl& url)
+{
+    if (cancelListing(url)) {
+        emit canceled(url);
+    }
+}
+
+bool KFileItemModelLocalLister::isFinished() const
+{
+    return m_listings.isEmpty();
+}
+
+void KFileItemModelLocalLister::slotItemsPrepared()
+{
+    // Emitting a signal might result in opening or stopping listings, hence
+    // the listings are iterated on a copy and checked before each emission.
+    const QList<QSharedPointer<Listing> > listings = m_listings.values();
+    for (const QSharedPointer<Listing>& listing : listings) {
+        QVector<KFileItem> items;
+        bool finished;
+        int errorCode;
+        {
+            QMutexLocker locker(&listing->mutex);
+            items.swap(listing->items);
+            finished = listing->finished;
+            errorCode = listing->error;
+            listing->deliveryScheduled = false;
+        }
+
+        const QUrl url = listing->url;
+        if (!items.isEmpty() && m_listings.value(url) == listing) {
+            emit itemsAdded(url, items.toList());
+        }
+
+        if (finished && m_listings.value(url) == listing) {
+            m_listings.remove(url);
+            if (errorCode == 0) {
+                emit completed(url);
+            } else {
+                emit error(url, errorCode);
+            }
+        }
+    }
+}
+
+void KFileItemModelLocalLister::listDirectory(QSharedPointer<Listing> listing, QThreadPool* statThreadPool, QObject* receiver)
+{
+    auto publish = [&listing, receiver](QVector<KFileItem>& items, bool finished, int error) {
+        bool scheduleDelivery;
+        {
+            QMutexLocker locker(&listing->mutex);
+            if (listing->items.isEmpty()) {
+                listing->items.swap(items);
+            } else {
+                listing->items += items;
+            }
+            listing->finished = finished;
+            listing->error = error;
+            scheduleDelivery = !listing->deliveryScheduled;
+            listing->deliveryScheduled = true;
+        }
+        items.clear();
+
+        if (scheduleDelivery) {
+            QMetaObject::invokeMethod(receiver, "slotItemsPrepared", Qt::QueuedConnection);
+        }
+    };
+
+    QVector<KFileItem> items;
+
+#ifdef Q_OS_LINUX
+    const QByteArray path = QFile::encodeName(listing->url.toLocalFile());
+    const int directoryFd = ::open(path.constData(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (directoryFd < 0) {
+        publish(items, true, errorFromErrno(errno));
+        return;
+    }
+
+    // Stats the collected names in slices on the stat thread pool
+    auto createBatch = [&](const QVector<QByteArray>& names) {
+        const int sliceCount = (names.count() + StatSliceSize - 1) / StatSliceSize;
+        QVector<QVector<KFileItem> > slices(sliceCount);
+        QVector<QFuture<void> > futures;
+        futures.reserve(sliceCount);
+        for (int i = 0; i < sliceCount; ++i) {
+            const int begin = i * StatSliceSize;
+            const int end = qMin(begin + StatSliceSize, names.count());
+            QVector<KFileItem>* slice = &slices[i];
+            futures.append(QtConcurrent::run(statThreadPool, [&listing, directoryFd, &names, begin, end, slice]() {
+                createItems(listing.data(), directoryFd, &names, begin, end, slice);
+            }));
+        }
+
+        QVector<KFileItem> batch;
+        batch.reserve(names.count());
+        for (int i = 0; i < sliceCount; ++i) {
+            futures[i].waitForFinished();
+            batch += slices[i];
+        }
+        return batch;
+    };
+
+    QByteArray buffer(DirentBufferSize, Qt::Uninitialized);
+    QVector<QByteArray> names;
+    int batchSize = FirstBatchSize;
+    int error = 0;
+
+    while (!listing->canceled.load()) {
+        const long readBytes = syscall(SYS_getdents64, directoryFd, buffer.data(), buffer.size());
+        if (readBytes < 0) {
+            error = KIO::ERR_CANNOT_ENTER_DIRECTORY;
+            break;
+        }
+        if (readBytes == 0) {
+            break;
+        }
+
+        long offset = 0;
+        while (offset < readBytes) {
+            const LinuxDirent64* dirent = reinterpret_cast<const LinuxDirent64*>(buffer.constData() + offset);
+            offset += dirent->d_reclen;
+
+            const char* name = dirent->d_name;
+            if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+                continue;
+            }
+
+            // Skip the stat of entries which are known not to be directories
+            if (listing->dirOnlyMode && dirent->d_type != DT_DIR
+                    && dirent->d_type != DT_LNK && dirent->d_type != DT_UNKNOWN) {
+                continue;
+            }
+
+            names.append(QByteArray(name));
+        }
+
+        if (names.count() >= batchSize) {
+            QVector<KFileItem> batch = createBatch(names);
+            names.clear();
+            publish(batch, false, 0);
+            batchSize = BatchSize;
+        }
+    }
+
+    if (error == 0 && !names.isEmpty() && !listing->canceled.load()) {
+        items = createBatch(names);
+    }
+
+    ::close(directoryFd);
+    publish(items, true, error);
+#else
+    Q_UNUSED(statThreadPool);
+    publish(items, true, KIO::ERR_UNSUPPORTED_ACTION);
+#endif
+}
+
+void KFileItemModelLocalLister::createItems(const Listing* listing, int directoryFd,
+                                            const QVector<QByteArray>* names, int begin, int end,
+                                            QVector<KFileItem>* items)
+{
+#ifdef Q_OS_LINUX
+    QHash<uid_t, QString> userNames;
+    QHash<gid_t, QString> groupNames;
+
+    items->reserve(end - begin);
+    for (int i = begin; i < end; ++i) {
+        if (listing->canceled.load()) {
+            return;
+        }
+
+        const QByteArray& name = names->at(i);
+        EntryStat buff;
+        if (!statEntry(directoryFd, name.constData(), false, &buff)) {
+            // The entry has been removed after reading the directory
+            continue;
+        }
+
+        mode_t type = buff.mode & S_IFMT;
+        mode_t access = buff.mode & 07777;
+        QString linkDest;
+
+        if (S_ISLNK(buff.mode)) {
+            QByteArray target(PATH_MAX, Qt::Uninitialized);
+            const ssize_t length = readlinkat(directoryFd, name.constData(), target.data(), target.size());
+            if (length >= 0) {
+                target.truncate(length);
+                linkDest = QFile::decodeName(target);
+            }
+
+            EntryStat targetBuff;
+            if (statEntry(directoryFd, name.constData(), true, &targetBuff)) {
+                type = targetBuff.mode & S_IFMT;
+                access = targetBuff.mode & 07777;
+                buff.size = targetBuff.size;
+            } else {
+                // A broken link, see kio_file
+                type = S_IFMT - 1;
+                access = S_IRWXU | S_IRWXG | S_IRWXO;
+            }
+        }
+
+        if (listing->dirOnlyMode && type != S_IFDIR) {
+            continue;
+        }
+
+        KIO::UDSEntry entry;
+        entry.reserve(linkDest.isEmpty() ? 10 : 11);
+        entry.fastInsert(KIO::UDSEntry::UDS_NAME, QFile::decodeName(name));
+        entry.fastInsert(KIO::UDSEntry::UDS_FILE_TYPE, type);
+        entry.fastInsert(KIO::UDSEntry::UDS_ACCESS, access);
+        entry.fastInsert(KIO::UDSEntry::UDS_SIZE, buff.size);
+        entry.fastInsert(KIO::UDSEntry::UDS_INODE, qint64(buff.inode));
+        entry.fastInsert(KIO::UDSEntry::UDS_USER, userName(buff.uid, userNames));
+        entry.fastInsert(KIO::UDSEntry::UDS_GROUP, groupName(buff.gid, groupNames));
+        entry.fastInsert(KIO::UDSEntry::UDS_MODIFICATION_TIME, buff.modificationTime);
+        entry.fastInsert(KIO::UDSEntry::UDS_ACCESS_TIME, buff.accessTime);
+        if (buff.creationTime >= 0) {
+            entry.fastInsert(KIO::UDSEntry::UDS_CREATION_TIME, buff.creationTime);
+        }
+        if (!linkDest.isEmpty()) {
+            entry.fastInsert(KIO::UDSEntry::UDS_LINK_DEST, linkDest);
+        }
+
+        items->append(KFileItem(entry, listing->url, listing->delayedMimeTypes, true));
+    }
+#else
+    Q_UNUSED(listing);
+    Q_UNUSED(directoryFd);
+    Q_UNUSED(names);
+    Q_UNUSED(begin);
+    Q_UNUSED(end);
+    Q_UNUSED(items);
+#endif
+}
+
+bool KFileItemModelLocalLister::cancelListing(const QUrl& url)
+{
+    const QSharedPointer<Listing> listing = m_listings.take(url);
+    if (!listing) {
+        return false;
+    }
+
+    // The worker thread stops as soon as possible. Items which are still
+    // delivered afterwards are ignored, as the listing is not known anymore.
+    listing->canceled.store(1);
+    return true;
+}
@@ -0,0 +1,145 @@
+/***************************************************************************
+ *   Copyright (C) 2019 by Dolphin developers <kfm-devel@kde.org>          *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA            *
+ ***************************************************************************/
+
+#ifndef KFILEITEMMODELLOCALLISTER_H
+#define KFILEITEMMODELLOCALLISTER_H
+
+#include "dolphin_export.h"
+
+#include <KFileItem>
+
+#include <QHash>
+#include <QObject>
+#include <QSharedPointer>
+#include <QThreadPool>
+#include <QUrl>
+
+/**
+ * @brief Lists local directories without the KIO file worker.
+ *
+ * The entries of a directory are read with getdents64() into a large buffer
+ * by a worker thread, and they are stat'ed with statx() by the threads of a
+ * separate thread pool. The resulting items are passed to the GUI thread in
+ * batches, which are emitted with the signal itemsAdded().
+ *
+ * Several directories can be listed at the same time. In contrast to
+ * KDirLister, the listed directories are not watched for changes.
+ *
+ * The lister is only available on Linux, see isSupported().
+ */
+class DOLPHIN_EXPORT KFileItemModelLocalLister : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit KFileItemModelLocalLister(QObject* parent = nullptr);
+    ~KFileItemModelLocalLister() override;
+
+    /**
+     * @return True if the directory \a url can be listed by this class.
+     */
+    static bool isSupported(const QUrl& url);
+
+    /**
+     * If set to true, the MIME types of the listed items are determined
+     * when they are needed for the first time.
+     */
+    void setDelayedMimeTypes(bool delayed);
+    bool delayedMimeTypes() const;
+
+    /**
+     * If set to true, only directories and links to directories are listed.
+     */
+    void setDirOnlyMode(bool dirsOnly);
+    bool dirOnlyMode() const;
+
+    /**
+     * Starts listing the directory \a url. A running listing of the same
+     * directory is stopped first.
+     */
+    void openUrl(const QUrl& url);
+
+    /**
+     * Stops listing all directories. The signal canceled() is emitted for
+     * each directory which has not been listed completely.
+     */
+    void stop();
+
+    /**
+     * Stops listing the directory \a url.
+     */
+    void stop(const QUrl& url);
+
+    /**
+     * @return True if no directory is being listed.
+     */
+    bool isFinished() const;
+
+signals:
+    void started(const QUrl& url);
+    void itemsAdded(const QUrl& directoryUrl, const KFileItemList& items);
+    void completed(const QUrl& url);
+    void canceled(const QUrl& url);
+
+    /**
+     * Is emitted if the directory \a url cannot be listed. The error code
+     * \a error is one of the KIO::Error values.
+     */
+    void error(const QUrl& url, int error);
+
+private slots:
+    /**
+     * Emits the items which have been prepared by the worker threads, and
+     * completes the listings which are finished.
+     */
+    void slotItemsPrepared();
+
+private:
+    struct Listing;
+
+    /**
+     * Lists the directory of \a listing. Is invoked by a worker thread.
+     */
+    static void listDirectory(QSharedPointer<Listing> listing, QThreadPool* statThreadPool, QObject* receiver);
+
+    /**
+     * Stats the entries of \a names from \a begin to \a end, and stores the
+     * resulting items in \a items. Is invoked by the threads of the stat
+     * thread pool.
+     */
+    static void createItems(const Listing* listing, int directoryFd,
+                            const QVector<QByteArray>* names, int begin, int end,
+                            QVector<KFileItem>* items);
+
+    /**
+     * Stops listing the directory \a url without emitting a signal.
+     * @return True if the directory has been listed.
+     */
+    bool cancelListing(const QUrl& url);
+
+private:
+    bool m_delayedMimeTypes;
+    bool m_dirOnlyMode;
+
+    QHash<QUrl, QSharedPointer<Listing> > m_listings;
+    QThreadPool m_listingThreadPool;
+    QThreadPool m_statThreadPool;
+};
+
+#endif
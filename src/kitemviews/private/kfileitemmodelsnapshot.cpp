@@ -0,0 +1,417 @@
+/***************************************************************************
+ *   Copyright (C) 2019 by Dolphin developers <kfm-devel@kde.org>          *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA            *
+ ***************************************************************************/
+
+#include "kfileitemmodelsnapshot.h"
+
+#include <KIO/UDSEntry>
+
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QStandardPaths>
+
+#include <cstring>
+
+#include <sys/stat.h>
+
+namespace {
+    const quint32 SnapshotMagic = 0x444f4c53; // "DOLS"
+    const quint32 SnapshotVersion = 1;
+
+    // Limits of the snapshot cache, see KFileItemModelSnapshot::prune()
+    const qint64 SnapshotCacheMaximumSize = 64 * 1024 * 1024;
+    const int SnapshotMaximumAge = 30; // Days
+
+    // Position of a string in the UTF-16 string table of a snapshot
+    struct StringRef
+    {
+        quint32 offset;
+        quint32 length;
+    };
+
+    struct SnapshotHeader
+    {
+        quint32 magic;
+        quint32 version;
+        KFileItemModelSnapshot::DirectoryStamp stamp;
+        quint32 itemCount;
+        quint32 sortedItemCount;
+        quint32 stringTableLength;  // Number of QChars
+        StringRef sortSignature;
+    };
+
+    enum SnapshotEntryFlag {
+        HasTypeFlag = 1,
+        HasIconNameFlag = 2,
+        HasFolderItemCountFlag = 4
+    };
+
+    struct SnapshotEntry
+    {
+        qint64 size;
+        qint64 modificationTime;
+        qint64 accessTime;
+        quint32 fileType;           // See KFileItem::mode()
+        quint32 permissions;
+        quint32 flags;              // Combination of SnapshotEntryFlag values
+        qint32 folderItemCount;
+        StringRef name;
+        StringRef mimeType;
+        StringRef user;
+        StringRef group;
+        StringRef linkDest;
+        StringRef type;
+        StringRef iconName;
+    };
+
+    class StringTableWriter
+    {
+    public:
+        StringRef add(const QString& string)
+        {
+            const StringRef ref = {quint32(m_table.length()), quint32(string.length())};
+            m_table += string;
+            return ref;
+        }
+
+        const QString& table() const
+        {
+            return m_table;
+        }
+
+    private:
+        QString m_table;
+    };
+}
+
+bool KFileItemModelSnapshot::DirectoryStamp::operator==(const DirectoryStamp& other) const
+{
+    return device == other.device
+        && inode == other.inode
+        && modificationTime == other.modificationTime
+        && modificationTimeNsec == other.modificationTimeNsec
+        && changeTime == other.changeTime
+        && changeTimeNsec == other.changeTimeNsec;
+}
+
+KFileItemModelSnapshot::Item::Item() :
+    item(),
+    type(),
+    iconName(),
+    folderItemCount(-1)
+{
+}
+
+KFileItemModelSnapshot::SavedItem::SavedItem() :
+    name(),
+    mimeType(),
+    user(),
+    group(),
+    linkDest(),
+    size(0),
+    modificationTime(-1),
+    accessTime(-1),
+    fileType(0),
+    permissions(0),
+    type(),
+    iconName(),
+    folderItemCount(-1)
+{
+}
+
+KFileItemModelSnapshot::SavedItem::SavedItem(const Item& item) :
+    name(item.item.name()),
+    mimeType(item.item.isMimeTypeKnown() ? item.item.mimetype() : QString()),
+    user(item.item.user()),
+    group(item.item.group()),
+    linkDest(item.item.isLink() ? item.item.linkDest() : QString()),
+    size(item.item.size()),
+    modificationTime(item.item.entry().numberValue(KIO::UDSEntry::UDS_MODIFICATION_TIME, -1)),
+    accessTime(item.item.entry().numberValue(KIO::UDSEntry::UDS_ACCESS_TIME, -1)),
+    fileType(item.item.mode()),
+    permissions(item.item.permissions()),
+    type(item.type),
+    iconName(item.iconName),
+    folderItemCount(item.folderItemCount)
+{
+}
+
+KFileItemModelSnapshot::KFileItemModelSnapshot() :
+    m_sortSignature(),
+    m_sortedItemCount(0),
+    m_items()
+{
+}
+
+KFileItemModelSnapshot::~KFileItemModelSnapshot()
+{
+}
+
+bool KFileItemModelSnapshot::directoryStamp(const QUrl& url, DirectoryStamp* stamp)
+{
+    if (!url.isLocalFile()) {
+        return false;
+    }
+
+    struct stat buff;
+    if (::stat(QFile::encodeName(url.toLocalFile()).constData(), &buff) != 0 || !S_ISDIR(buff.st_mode)) {
+        return false;
+    }
+
+    stamp->device = buff.st_dev;
+    stamp->inode = buff.st_ino;
+    stamp->modificationTime = buff.st_mtime;
+    stamp->changeTime = buff.st_ctime;
+#ifdef Q_OS_LINUX
+    stamp->modificationTimeNsec = buff.st_mtim.tv_nsec;
+    stamp->changeTimeNsec = buff.st_ctim.tv_nsec;
+#else
+    stamp->modificationTimeNsec = 0;
+    stamp->changeTimeNsec = 0;
+#endif
+    return true;
+}
+
+bool KFileItemModelSnapshot::load(const QUrl& url, const DirectoryStamp& stamp)
+{
+    m_sortSignature.clear();
+    m_sortedItemCount = 0;
+    m_items.clear();
+
+    QFile file(filePath(url));
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+
+    const qint64 fileSize = file.size();
+    if (fileSize < qint64(sizeof(SnapshotHeader))) {
+        file.remove();
+        return false;
+    }
+
+    const uchar* data = file.map(0, fileSize);
+    if (!data) {
+        return false;
+    }
+
+    SnapshotHeader header;
+    memcpy(&header, data, sizeof(SnapshotHeader));
+
+    const qint64 entriesSize = qint64(header.itemCount) * sizeof(SnapshotEntry);
+    const qint64 expectedSize = sizeof(SnapshotHeader) + entriesSize + qint64(header.stringTableLength) * sizeof(QChar);
+    if (header.magic != SnapshotMagic || header.version != SnapshotVersion || expectedSize != fileSize
+            || header.sortedItemCount > header.itemCount) {
+        file.unmap(const_cast<uchar*>(data));
+        file.remove();
+        return false;
+    }
+
+    if (!(header.stamp == stamp)) {
+        // The directory has been changed since saving the snapshot
+        file.unmap(const_cast<uchar*>(data));
+        file.remove();
+        return false;
+    }
+
+    const uchar* entries = data + sizeof(SnapshotHeader);
+    const QChar* strings = reinterpret_cast<const QChar*>(entries + entriesSize);
+    const quint32 stringTableLength = header.stringTableLength;
+    bool valid = true;
+
+    auto string = [strings, stringTableLength, &valid](const StringRef& ref) {
+        if (ref.offset > stringTableLength || ref.length > stringTableLength - ref.offset) {
+            valid = false;
+            return QString();
+        }
+        return QString(strings + ref.offset, ref.length);
+    };
+
+    m_sortSignature = string(header.sortSignature);
+    m_sortedItemCount = header.sortedItemCount;
+
+    m_items.reserve(header.itemCount);
+    for (quint32 i = 0; i < header.itemCount && valid; ++i) {
+        SnapshotEntry entry;
+        memcpy(&entry, entries + i * sizeof(SnapshotEntry), sizeof(SnapshotEntry));
+
+        KIO::UDSEntry udsEntry;
+        udsEntry.reserve(10);
+        udsEntry.fastInsert(KIO::UDSEntry::UDS_NAME, string(entry.name));
+        udsEntry.fastInsert(KIO::UDSEntry::UDS_FILE_TYPE, entry.fileType);
+        udsEntry.fastInsert(KIO::UDSEntry::UDS_ACCESS, entry.permissions);
+        udsEntry.fastInsert(KIO::UDSEntry::UDS_SIZE, entry.size);
+        if (entry.modificationTime != -1) {
+            udsEntry.fastInsert(KIO::UDSEntry::UDS_MODIFICATION_TIME, entry.modificationTime);
+        }
+        if (entry.accessTime != -1) {
+            udsEntry.fastInsert(KIO::UDSEntry::UDS_ACCESS_TIME, entry.accessTime);
+        }
+        udsEntry.fastInsert(KIO::UDSEntry::UDS_USER, string(entry.user));
+        udsEntry.fastInsert(KIO::UDSEntry::UDS_GROUP, string(entry.group));
+        if (entry.mimeType.length > 0) {
+            udsEntry.fastInsert(KIO::UDSEntry::UDS_MIME_TYPE, string(entry.mimeType));
+        }
+        if (entry.linkDest.length > 0) {
+            udsEntry.fastInsert(KIO::UDSEntry::UDS_LINK_DEST, string(entry.linkDest));
+        }
+
+        Item item;
+        item.item = KFileItem(udsEntry, url, entry.mimeType.length == 0, true);
+        if (entry.flags & HasTypeFlag) {
+            item.type = string(entry.type);
+        }
+        if (entry.flags & HasIconNameFlag) {
+            item.iconName = string(entry.iconName);
+        }
+        if (entry.flags & HasFolderItemCountFlag) {
+            item.folderItemCount = entry.folderItemCount;
+        }
+        m_items.append(item);
+    }
+
+    file.unmap(const_cast<uchar*>(data));
+
+    if (!valid) {
+        file.remove();
+        m_sortSignature.clear();
+        m_sortedItemCount = 0;
+        m_items.clear();
+        return false;
+    }
+
+    return true;
+}
+
+QString KFileItemModelSnapshot::sortSignature() const
+{
+    return m_sortSignature;
+}
+
+int KFileItemModelSnapshot::sortedItemCount() const
+{
+    return m_sortedItemCount;
+}
+
+QVector<KFileItemModelSnapshot::Item> KFileItemModelSnapshot::items() const
+{
+    return m_items;
+}
+
+bool KFileItemModelSnapshot::save(const QUrl& url, const DirectoryStamp& stamp,
+                                  const QString& sortSignature, int sortedItemCount,
+                                  const QVector<SavedItem>& items)
+{
+    StringTableWriter strings;
+    QVector<SnapshotEntry> entries;
+    entries.reserve(items.count());
+
+    for (const SavedItem& item : items) {
+        SnapshotEntry entry;
+        memset(&entry, 0, sizeof(SnapshotEntry));
+        entry.size = item.size;
+        entry.modificationTime = item.modificationTime;
+        entry.accessTime = item.accessTime;
+        entry.fileType = item.fileType;
+        entry.permissions = item.permissions;
+        entry.name = strings.add(item.name);
+        if (!item.mimeType.isEmpty()) {
+            entry.mimeType = strings.add(item.mimeType);
+        }
+        entry.user = strings.add(item.user);
+        entry.group = strings.add(item.group);
+        if (!item.linkDest.isEmpty()) {
+            entry.linkDest = strings.add(item.linkDest);
+        }
+
+        if (!item.type.isEmpty()) {
+            entry.flags |= HasTypeFlag;
+            entry.type = strings.add(item.type);
+        }
+        if (!item.iconName.isEmpty()) {
+            entry.flags |= HasIconNameFlag;
+            entry.iconName = strings.add(item.iconName);
+        }
+        if (item.folderItemCount >= 0) {
+            entry.flags |= HasFolderItemCountFlag;
+            entry.folderItemCount = item.folderItemCount;
+        }
+
+        entries.append(entry);
+    }
+
+    SnapshotHeader header;
+    memset(&header, 0, sizeof(SnapshotHeader));
+    header.magic = SnapshotMagic;
+    header.version = SnapshotVersion;
+    header.stamp = stamp;
+    header.itemCount = entries.count();
+    header.sortedItemCount = sortedItemCount;
+    header.sortSignature = strings.add(sortSignature);
+    header.stringTableLength = strings.table().length();
+
+    const QString path = filePath(url);
+    QDir().mkpath(QFileInfo(path).absolutePath());
+
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+
+    file.write(reinterpret_cast<const char*>(&header), sizeof(SnapshotHeader));
+    file.write(reinterpret_cast<const char*>(entries.constData()), entries.count() * sizeof(SnapshotEntry));
+    file.write(reinterpret_cast<const char*>(strings.table().constData()), strings.table().length() * sizeof(QChar));
+    if (!file.commit()) {
+        return false;
+    }
+
+    prune(SnapshotCacheMaximumSize);
+    return true;
+}
+
+void KFileItemModelSnapshot::prune(qint64 maximumSize)
+{
+    const QDir dir(QFileInfo(filePath(QUrl())).absolutePath());
+    const QDateTime oldestModificationTime = QDateTime::currentDateTimeUtc().addDays(-SnapshotMaximumAge);
+
+    // The most recently saved snapshots are kept
+    qint64 cacheSize = 0;
+    const QFileInfoList snapshots = dir.entryInfoList(QDir::Files, QDir::Time);
+    foreach (const QFileInfo& snapshot, snapshots) {
+        cacheSize += snapshot.size();
+        if (cacheSize > maximumSize || snapshot.lastModified() < oldestModificationTime) {
+            QFile::remove(snapshot.absoluteFilePath());
+        }
+    }
+}
+
+void KFileItemModelSnapshot::remove(const QUrl& url)
+{
+    QFile::remove(filePath(url));
+}
+
+QString KFileItemModelSnapshot::filePath(const QUrl& url)
+{
+    const QByteArray hash = QCryptographicHash::hash(url.adjusted(QUrl::StripTrailingSlash).toEncoded(),
+                                                     QCryptographicHash::Sha1).toHex();
+    return QStandardPaths::writableLocation(QStandardPaths::CacheLocation)
+           + QLatin1String("/snapshots/") + QString::fromLatin1(hash);
+}
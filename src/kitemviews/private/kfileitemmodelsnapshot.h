@@ -0,0 +1,164 @@
+/***************************************************************************
+ *   Copyright (C) 2019 by Dolphin developers <kfm-devel@kde.org>          *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA            *
+ ***************************************************************************/
+
+#ifndef KFILEITEMMODELSNAPSHOT_H
+#define KFILEITEMMODELSNAPSHOT_H
+
+#include "dolphin_export.h"
+
+#include <KFileItem>
+
+#include <QString>
+#include <QUrl>
+#include <QVector>
+
+/**
+ * @brief Stores the listing of a local directory in a binary cache file.
+ *
+ * KFileItemModel uses snapshots to show the items of a large directory
+ * immediately when the directory is entered again, see
+ * KFileItemModel::setSnapshotsEnabled(). Besides the properties of the
+ * items, a snapshot contains the item order and the resolved type, icon
+ * and number of sub-items.
+ *
+ * A snapshot is only valid as long as the directory has not been changed,
+ * which is checked by comparing the DirectoryStamp of the directory.
+ * Changes of the files themselves are not detected, so the snapshot must
+ * be reconciled with the real listing of the directory.
+ */
+class DOLPHIN_EXPORT KFileItemModelSnapshot
+{
+public:
+    /**
+     * Identifies the state of a directory. The modification and status
+     * change times of a directory are updated when entries are created,
+     * removed or renamed.
+     */
+    struct DirectoryStamp
+    {
+        qint64 device;
+        qint64 inode;
+        qint64 modificationTime;
+        qint64 modificationTimeNsec;
+        qint64 changeTime;
+        qint64 changeTimeNsec;
+
+        bool operator==(const DirectoryStamp& other) const;
+    };
+
+    struct Item
+    {
+        Item();
+
+        KFileItem item;
+        QString type;           // Empty if unknown
+        QString iconName;       // Empty if unknown
+        int folderItemCount;    // -1 if unknown
+    };
+
+    /**
+     * Plain copy of the properties of an Item, which are written by save().
+     * In contrast to KFileItem it may be passed to another thread, because
+     * reading the properties of a KFileItem might determine them lazily.
+     */
+    struct SavedItem
+    {
+        SavedItem();
+
+        /**
+         * Copies the properties of \a item. Must be invoked by the
+         * thread which owns the KFileItem.
+         */
+        explicit SavedItem(const Item& item);
+
+        QString name;
+        QString mimeType;       // Empty if unknown
+        QString user;
+        QString group;
+        QString linkDest;       // Empty if the item is no link
+        qint64 size;
+        qint64 modificationTime;    // -1 if unknown
+        qint64 accessTime;          // -1 if unknown
+        quint32 fileType;
+        quint32 permissions;
+        QString type;
+        QString iconName;
+        int folderItemCount;
+    };
+
+    KFileItemModelSnapshot();
+    ~KFileItemModelSnapshot();
+
+    /**
+     * Determines the stamp of the local directory \a url.
+     * @return False if \a url is no local directory.
+     */
+    static bool directoryStamp(const QUrl& url, DirectoryStamp* stamp);
+
+    /**
+     * Maps the snapshot of the directory \a url and reads its items. The
+     * snapshot is only accepted if it has been saved for the directory
+     * state \a stamp. Invalid snapshots are removed from the cache.
+     * @return True if the snapshot has been read.
+     */
+    bool load(const QUrl& url, const DirectoryStamp& stamp);
+
+    /**
+     * @return Describes the order of the first sortedItemCount() items.
+     *         The items are in an arbitrary order if the signature does
+     *         not match the current sorting of the model.
+     */
+    QString sortSignature() const;
+    int sortedItemCount() const;
+
+    QVector<Item> items() const;
+
+    /**
+     * Saves a snapshot of the directory \a url. Can be invoked by a worker
+     * thread. The first \a sortedItemCount items are sorted as described
+     * by \a sortSignature.
+     */
+    static bool save(const QUrl& url, const DirectoryStamp& stamp,
+                     const QString& sortSignature, int sortedItemCount,
+                     const QVector<SavedItem>& items);
+
+    /**
+     * Removes the snapshots which have not been saved for a month. The most
+     * recently saved snapshots are kept as long as their total size does not
+     * exceed \a maximumSize bytes, the others are removed. Is invoked by save().
+     */
+    static void prune(qint64 maximumSize);
+
+    /**
+     * Removes the snapshot of the directory \a url.
+     */
+    static void remove(const QUrl& url);
+
+    /**
+     * @return Path of the cache file for the directory \a url.
+     */
+    static QString filePath(const QUrl& url);
+
+private:
+    QString m_sortSignature;
+    int m_sortedItemCount;
+    QVector<Item> m_items;
+};
+
+#endif
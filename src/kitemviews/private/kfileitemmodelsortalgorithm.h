@@ -23,6 +23,7 @@
 #define KFILEITEMMODELSORTALGORITHM_H
 
 #include <QtConcurrentRun>
+#include <QVector>
 
 #include <algorithm>
 
@@ -141,5 +142,123 @@ static void merge(RandomAccessIterator begin,
     merge(newPivot, secondCut, end, lessThan);
 }
 
+/**
+ * Item with a 64-bit sort key, see radixSort().
+ */
+
+template <typename T>
+struct KeyedItem
+{
+    quint64 key;
+    T value;
+};
+
+/**
+ * Sorts the items between \a begin and \a end by their key using a
+ * least significant digit radix sort with 8 bits per pass. The sort is
+ * stable, i.e., the order of items with equal keys is preserved. Passes
+ * where all items share the same digit are skipped.
+ *
+ * \a buffer must provide space for at least end - begin items.
+ */
+
+template <typename T>
+static void radixSort(KeyedItem<T>* begin, KeyedItem<T>* end, KeyedItem<T>* buffer)
+{
+    const int span = end - begin;
+    if (span < 2) {
+        return;
+    }
+
+    KeyedItem<T>* source = begin;
+    KeyedItem<T>* target = buffer;
+
+    for (int shift = 0; shift < 64; shift += 8) {
+        int counts[256] = {};
+        for (const KeyedItem<T>* it = source; it != source + span; ++it) {
+            ++counts[(it->key >> shift) & 0xff];
+        }
+
+        if (counts[(source->key >> shift) & 0xff] == span) {
+            // All items have the same digit.
+            continue;
+        }
+
+        int offset = 0;
+        for (int i = 0; i < 256; ++i) {
+            const int count = counts[i];
+            counts[i] = offset;
+            offset += count;
+        }
+
+        for (const KeyedItem<T>* it = source; it != source + span; ++it) {
+            target[counts[(it->key >> shift) & 0xff]++] = *it;
+        }
+
+        qSwap(source, target);
+    }
+
+    if (source != begin) {
+        std::copy(source, source + span, begin);
+    }
+}
+
+/**
+ * Uses up to \a numberOfThreads threads to sort \a items by their key.
+ * Each thread radix-sorts a part of the items, and the sorted parts are
+ * merged afterwards. The sort is stable.
+ */
+
+template <typename T>
+static void parallelRadixSort(QVector<KeyedItem<T> >& items,
+                              int numberOfThreads,
+                              int parallelSortingThreshold = 10000)
+{
+    const int span = items.count();
+    if (span < 2) {
+        return;
+    }
+
+    QVector<KeyedItem<T> > buffer(span);
+    KeyedItem<T>* data = items.data();
+    KeyedItem<T>* bufferData = buffer.data();
+
+    const int partCount = (span > parallelSortingThreshold) ? qMax(1, numberOfThreads) : 1;
+    if (partCount == 1) {
+        radixSort(data, data + span, bufferData);
+        return;
+    }
+
+    QVector<int> bounds;
+    bounds.reserve(partCount + 1);
+    for (int i = 0; i <= partCount; ++i) {
+        bounds.append(int(qint64(span) * i / partCount));
+    }
+
+    QList<QFuture<void> > futures;
+    for (int i = 1; i < partCount; ++i) {
+        futures.append(QtConcurrent::run(radixSort<T>, data + bounds.at(i), data + bounds.at(i + 1), bufferData + bounds.at(i)));
+    }
+    radixSort(data, data + bounds.at(1), bufferData);
+    foreach (QFuture<void> future, futures) {
+        future.waitForFinished();
+    }
+
+    const auto keyLessThan = [](const KeyedItem<T>& a, const KeyedItem<T>& b) {
+        return a.key < b.key;
+    };
+
+    // Merge neighboring parts until only one part is left.
+    for (int width = 1; width < partCount; width *= 2) {
+        for (int i = 0; i + width < partCount; i += 2 * width) {
+            const int first = bounds.at(i);
+            const int middle = bounds.at(i + width);
+            const int last = bounds.at(qMin(i + 2 * width, partCount));
+            std::merge(data + first, data + middle, data + middle, data + last, bufferData + first, keyLessThan);
+            std::copy(bufferData + first, bufferData + last, data + first);
+        }
+    }
+}
+
 #endif
 
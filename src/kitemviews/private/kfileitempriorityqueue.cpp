@@ -0,0 +1,162 @@
+/***************************************************************************
+ *   Copyright (C) 2019 by Dolphin developers <kfm-devel@kde.org>          *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA            *
+ ***************************************************************************/
+
+#include "kfileitempriorityqueue.h"
+
+bool KFileItemPriorityQueue::Key::operator<(const Key& other) const
+{
+    if (priority != other.priority) {
+        return priority < other.priority;
+    }
+    if (order != other.order) {
+        return order < other.order;
+    }
+    return sequence < other.sequence;
+}
+
+KFileItemPriorityQueue::KFileItemPriorityQueue() :
+    m_queue(),
+    m_entries(),
+    m_nextSequence(0),
+    m_clock(),
+    m_maximumCount(0),
+    m_takenCount(0),
+    m_totalLatency(0),
+    m_maximumLatency(0)
+{
+    m_clock.start();
+}
+
+KFileItemPriorityQueue::~KFileItemPriorityQueue()
+{
+}
+
+void KFileItemPriorityQueue::insert(const KFileItem& item, int priority, int order)
+{
+    QHash<KFileItem, Entry>::iterator it = m_entries.find(item);
+    if (it != m_entries.end()) {
+        Key& key = it->key;
+        if (key.priority == priority && key.order == order) {
+            return;
+        }
+
+        // Keep the insertion time, so that the latency covers the whole
+        // time the item has been waiting.
+        m_queue.remove(key);
+        key.priority = priority;
+        key.order = order;
+        m_queue.insert(key, item);
+        return;
+    }
+
+    Entry entry;
+    entry.key.priority = priority;
+    entry.key.order = order;
+    entry.key.sequence = m_nextSequence++;
+    entry.insertionTime = m_clock.elapsed();
+
+    m_entries.insert(item, entry);
+    m_queue.insert(entry.key, item);
+    m_maximumCount = qMax(m_maximumCount, m_queue.count());
+}
+
+bool KFileItemPriorityQueue::remove(const KFileItem& item)
+{
+    QHash<KFileItem, Entry>::iterator it = m_entries.find(item);
+    if (it == m_entries.end()) {
+        return false;
+    }
+
+    m_queue.remove(it->key);
+    m_entries.erase(it);
+    return true;
+}
+
+bool KFileItemPriorityQueue::contains(const KFileItem& item) const
+{
+    return m_entries.contains(item);
+}
+
+KFileItem KFileItemPriorityQueue::first() const
+{
+    return m_queue.isEmpty() ? KFileItem() : m_queue.first();
+}
+
+KFileItem KFileItemPriorityQueue::takeFirst()
+{
+    if (m_queue.isEmpty()) {
+        return KFileItem();
+    }
+
+    const KFileItem item = m_queue.take(m_queue.firstKey());
+    const Entry entry = m_entries.take(item);
+
+    const qint64 latency = m_clock.elapsed() - entry.insertionTime;
+    ++m_takenCount;
+    m_totalLatency += latency;
+    m_maximumLatency = qMax(m_maximumLatency, latency);
+
+    return item;
+}
+
+KFileItemList KFileItemPriorityQueue::items() const
+{
+    KFileItemList result;
+    result.reserve(m_queue.count());
+    foreach (const KFileItem& item, m_queue) {
+        result.append(item);
+    }
+    return result;
+}
+
+bool KFileItemPriorityQueue::isEmpty() const
+{
+    return m_queue.isEmpty();
+}
+
+int KFileItemPriorityQueue::count() const
+{
+    return m_queue.count();
+}
+
+void KFileItemPriorityQueue::clear()
+{
+    m_queue.clear();
+    m_entries.clear();
+}
+
+int KFileItemPriorityQueue::maximumCount() const
+{
+    return m_maximumCount;
+}
+
+qint64 KFileItemPriorityQueue::takenCount() const
+{
+    return m_takenCount;
+}
+
+qint64 KFileItemPriorityQueue::averageLatency() const
+{
+    return m_takenCount > 0 ? m_totalLatency / m_takenCount : 0;
+}
+
+qint64 KFileItemPriorityQueue::maximumLatency() const
+{
+    return m_maximumLatency;
+}
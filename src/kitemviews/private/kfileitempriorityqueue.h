@@ -0,0 +1,131 @@
+/***************************************************************************
+ *   Copyright (C) 2019 by Dolphin developers <kfm-devel@kde.org>          *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA            *
+ ***************************************************************************/
+
+#ifndef KFILEITEMPRIORITYQUEUE_H
+#define KFILEITEMPRIORITYQUEUE_H
+
+#include "dolphin_export.h"
+
+#include <KFileItem>
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QMap>
+
+/**
+ * @brief Queue of items which are ordered by a priority.
+ *
+ * Items with a lower priority value are taken first. Items with the same
+ * priority are ordered by the value \a order that is passed to insert().
+ * The priority of an item that is in the queue already is updated in place,
+ * and removing an item is cheap, which allows to update the queue whenever
+ * the visible items of a view change without starting all over again.
+ *
+ * For instrumentation, the queue tracks the number of items and the time
+ * the items have spent in the queue.
+ */
+class DOLPHIN_EXPORT KFileItemPriorityQueue
+{
+public:
+    KFileItemPriorityQueue();
+    ~KFileItemPriorityQueue();
+
+    /**
+     * Inserts the item \a item, or updates its priority if it is
+     * part of the queue already.
+     */
+    void insert(const KFileItem& item, int priority, int order);
+
+    /**
+     * Removes the item \a item.
+     * @return True if the item has been part of the queue.
+     */
+    bool remove(const KFileItem& item);
+
+    bool contains(const KFileItem& item) const;
+
+    /**
+     * @return The item which would be returned by takeFirst().
+     */
+    KFileItem first() const;
+
+    /**
+     * Removes the item with the highest priority and returns it.
+     */
+    KFileItem takeFirst();
+
+    /**
+     * @return All items of the queue in an arbitrary order.
+     */
+    KFileItemList items() const;
+
+    bool isEmpty() const;
+
+    /**
+     * @return Number of items in the queue.
+     */
+    int count() const;
+
+    void clear();
+
+    /**
+     * @return Maximum number of items which have been in the queue at once.
+     */
+    int maximumCount() const;
+
+    /**
+     * @return Number of items which have been returned by takeFirst().
+     */
+    qint64 takenCount() const;
+
+    /**
+     * @return Average and maximum time in milliseconds between inserting an
+     *         item and taking it, for the items returned by takeFirst().
+     */
+    qint64 averageLatency() const;
+    qint64 maximumLatency() const;
+
+private:
+    struct Key
+    {
+        int priority;
+        int order;
+        quint64 sequence;   // Keeps the keys unique
+
+        bool operator<(const Key& other) const;
+    };
+
+    struct Entry
+    {
+        Key key;
+        qint64 insertionTime;
+    };
+
+    QMap<Key, KFileItem> m_queue;
+    QHash<KFileItem, Entry> m_entries;
+    quint64 m_nextSequence;
+
+    QElapsedTimer m_clock;
+    int m_maximumCount;
+    qint64 m_takenCount;
+    qint64 m_totalLatency;
+    qint64 m_maximumLatency;
+};
+
+#endif
@@ -0,0 +1,242 @@
+/***************************************************************************
+ *   Copyright (C) 2019 by Dolphin developers <kfm-devel@kde.org>          *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA            *
+ ***************************************************************************/
+
+#include "kfileitemrolesresolver.h"
+
+#include <QMutex>
+#include <QMutexLocker>
+#include <QThread>
+#include <QTimer>
+#include <QtConcurrentRun>
+
+namespace {
+    // Maximum number of worker threads
+    const int MaximumThreadCount = 4;
+
+    // Maximum number of concurrent tasks for a mount point which is probably
+    // slow, e.g., a network mount.
+    const int SlowMountTaskLimit = 2;
+
+    // Maximum number of items per task
+    const int ItemsPerTask = 8;
+
+    // The results are emitted at most once per frame.
+    const int EmitResultsInterval = 16;
+}
+
+struct KFileItemRolesResolver::FinishedTasks
+{
+    QMutex mutex;
+    QVector<Task> tasks;
+    bool notificationScheduled = false;
+};
+
+KFileItemRolesResolver::KFileItemRolesResolver(QObject* parent) :
+    QObject(parent),
+    m_threadPool(),
+    m_finishedTasks(new FinishedTasks()),
+    m_mountPoints(),
+    m_mountPointsLoaded(false),
+    m_mountKeys(),
+    m_mounts(),
+    m_generation(0),
+    m_pendingCount(0),
+    m_results(),
+    m_emitResultsTimer(nullptr)
+{
+    m_threadPool.setMaxThreadCount(qBound(1, QThread::idealThreadCount(), MaximumThreadCount));
+
+    m_emitResultsTimer = new QTimer(this);
+    m_emitResultsTimer->setInterval(EmitResultsInterval);
+    m_emitResultsTimer->setSingleShot(true);
+    connect(m_emitResultsTimer, &QTimer::timeout, this, &KFileItemRolesResolver::emitResults);
+}
+
+KFileItemRolesResolver::~KFileItemRolesResolver()
+{
+    m_threadPool.waitForDone();
+}
+
+void KFileItemRolesResolver::resolve(const KFileItem& item)
+{
+    Q_ASSERT(item.isLocalFile());
+
+    const QString directory = item.url().adjusted(QUrl::RemoveFilename | QUrl::StripTrailingSlash).toLocalFile();
+    const QString key = mountKey(directory);
+
+    auto it = m_mounts.find(key);
+    if (it == m_mounts.end()) {
+        Mount mount;
+        mount.running = 0;
+        mount.maximumRunning = m_threadPool.maxThreadCount();
+
+        const KMountPoint::Ptr mountPoint = m_mountPoints.findByPath(directory);
+        if (mountPoint && mountPoint->probablySlow()) {
+            mount.maximumRunning = qMin(mount.maximumRunning, SlowMountTaskLimit);
+        }
+        it = m_mounts.insert(key, mount);
+    }
+
+    it->queue.append(item);
+    ++m_pendingCount;
+
+    startTasks();
+}
+
+void KFileItemRolesResolver::clear()
+{
+    // The results of running tasks are ignored.
+    ++m_generation;
+
+    for (auto it = m_mounts.begin(); it != m_mounts.end(); ++it) {
+        it->queue.clear();
+    }
+
+    m_results.clear();
+    m_emitResultsTimer->stop();
+    m_pendingCount = 0;
+}
+
+int KFileItemRolesResolver::pendingCount() const
+{
+    return m_pendingCount;
+}
+
+bool KFileItemRolesResolver::isIdle() const
+{
+    return m_pendingCount == 0;
+}
+
+void KFileItemRolesResolver::slotTasksFinished()
+{
+    QVector<Task> tasks;
+    {
+        QMutexLocker locker(&m_finishedTasks->mutex);
+        tasks.swap(m_finishedTasks->tasks);
+        m_finishedTasks->notificationScheduled = false;
+    }
+
+    for (const Task& task : tasks) {
+        auto it = m_mounts.find(task.mountKey);
+        if (it != m_mounts.end()) {
+            --it->running;
+        }
+
+        if (task.generation == m_generation) {
+            m_results += task.results;
+        }
+    }
+
+    startTasks();
+
+    if (!m_results.isEmpty() && !m_emitResultsTimer->isActive()) {
+        m_emitResultsTimer->start();
+    }
+}
+
+void KFileItemRolesResolver::emitResults()
+{
+    if (m_results.isEmpty()) {
+        return;
+    }
+
+    QVector<Result> results;
+    results.swap(m_results);
+    m_pendingCount -= results.count();
+
+    emit itemsResolved(results);
+}
+
+QString KFileItemRolesResolver::mountKey(const QString& path)
+{
+    auto it = m_mountKeys.constFind(path);
+    if (it != m_mountKeys.constEnd()) {
+        return *it;
+    }
+
+    if (!m_mountPointsLoaded) {
+        m_mountPoints = KMountPoint::currentMountPoints();
+        m_mountPointsLoaded = true;
+    }
+
+    const KMountPoint::Ptr mountPoint = m_mountPoints.findByPath(path);
+    const QString key = mountPoint ? mountPoint->mountPoint() : QString();
+    m_mountKeys.insert(path, key);
+    return key;
+}
+
+void KFileItemRolesResolver::startTasks()
+{
+    for (auto it = m_mounts.begin(); it != m_mounts.end(); ++it) {
+        Mount& mount = *it;
+        while (!mount.queue.isEmpty() && mount.running < mount.maximumRunning) {
+            Task task;
+            task.mountKey = it.key();
+            task.generation = m_generation;
+
+            const int count = qMin(ItemsPerTask, mount.queue.count());
+            for (int i = 0; i < count; ++i) {
+                const KFileItem& item = mount.queue.at(i);
+                task.items.append(item);
+
+                // KFileItem is implicitly shared, but not thread-safe. The worker
+                // thread gets a copy that does not share any data with the item
+                // of the model.
+                task.copies.append(item.entry().count() > 0 ? KFileItem(item.entry(), item.url(), true)
+                                                           : KFileItem(item.url(), QString(), item.mode()));
+            }
+            mount.queue.remove(0, count);
+
+            ++mount.running;
+            QtConcurrent::run(&m_threadPool, &KFileItemRolesResolver::resolveItems,
+                              task, m_finishedTasks, static_cast<QObject*>(this));
+        }
+    }
+}
+
+void KFileItemRolesResolver::resolveItems(Task task, QSharedPointer<FinishedTasks> finishedTasks, QObject* receiver)
+{
+    task.results.reserve(task.items.count());
+    for (int i = 0; i < task.items.count(); ++i) {
+        const KFileItem& item = task.copies.at(i);
+        item.determineMimeType();
+
+        Result result;
+        result.item = task.items.at(i);
+        result.mimeType = item.mimetype();
+        result.type = item.mimeComment();
+        result.iconName = item.iconName();
+        task.results.append(result);
+    }
+
+    // The copies are not needed by the GUI thread.
+    task.copies.clear();
+
+    bool scheduleNotification;
+    {
+        QMutexLocker locker(&finishedTasks->mutex);
+        finishedTasks->tasks.append(task);
+        scheduleNotification = !finishedTasks->notificationScheduled;
+        finishedTasks->notificationScheduled = true;
+    }
+
+    if (scheduleNotification) {
+        QMetaObject::invokeMethod(receiver, "slotTasksFinished", Qt::QueuedConnection);
+    }
+}
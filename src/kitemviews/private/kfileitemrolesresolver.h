@@ -0,0 +1,149 @@
+/***************************************************************************
+ *   Copyright (C) 2019 by Dolphin developers <kfm-devel@kde.org>          *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA            *
+ ***************************************************************************/
+
+#ifndef KFILEITEMROLESRESOLVER_H
+#define KFILEITEMROLESRESOLVER_H
+
+#include "dolphin_export.h"
+
+#include <KFileItem>
+#include <KMountPoint>
+
+#include <QHash>
+#include <QObject>
+#include <QSharedPointer>
+#include <QThreadPool>
+#include <QVector>
+
+class QTimer;
+
+/**
+ * @brief Determines the MIME type dependent roles of local items in worker threads.
+ *
+ * Determining the MIME type of a file might require reading its content,
+ * which blocks the GUI for a noticeable time on slow network mounts. The
+ * items that are passed to resolve() are handled by a bounded pool of
+ * worker threads. The number of concurrent tasks per mount point is
+ * limited, so that slow mounts like NFS or Samba shares are not flooded
+ * with requests.
+ *
+ * The results are collected and emitted with the signal itemsResolved()
+ * at most once per frame.
+ */
+class DOLPHIN_EXPORT KFileItemRolesResolver : public QObject
+{
+    Q_OBJECT
+
+public:
+    /**
+     * Only the MIME type dependent roles are resolved. Other properties
+     * like KFileItem::overlays() must be determined by the GUI thread,
+     * as they are not thread-safe.
+     */
+    struct Result
+    {
+        KFileItem item;         // Item which has been passed to resolve()
+        QString mimeType;
+        QString type;           // Comment of the MIME type
+        QString iconName;
+    };
+
+    explicit KFileItemRolesResolver(QObject* parent = nullptr);
+    ~KFileItemRolesResolver() override;
+
+    /**
+     * Determines the roles of the local item \a item asynchronously.
+     */
+    void resolve(const KFileItem& item);
+
+    /**
+     * Discards all items which have not been resolved yet.
+     */
+    void clear();
+
+    /**
+     * @return Number of items which have been passed to resolve() and
+     *         whose results have not been emitted yet.
+     */
+    int pendingCount() const;
+
+    bool isIdle() const;
+
+signals:
+    void itemsResolved(const QVector<KFileItemRolesResolver::Result>& results);
+
+private slots:
+    /**
+     * Takes the results of the finished tasks and starts new tasks.
+     * Is invoked by the worker threads.
+     */
+    void slotTasksFinished();
+
+    void emitResults();
+
+private:
+    struct Mount
+    {
+        int running;            // Number of running tasks
+        int maximumRunning;
+        QVector<KFileItem> queue;
+    };
+
+    struct Task
+    {
+        QString mountKey;
+        int generation;
+        KFileItemList items;    // Items passed to resolve()
+        KFileItemList copies;   // Unshared copies of the items for the worker thread
+        QVector<Result> results;
+    };
+
+    struct FinishedTasks;
+
+    /**
+     * @return Key of the mount point that contains the local directory \a path.
+     */
+    QString mountKey(const QString& path);
+
+    /**
+     * Starts tasks for the queued items as far as the limits permit.
+     */
+    void startTasks();
+
+    /**
+     * Resolves the items of \a task. Is invoked by a worker thread.
+     */
+    static void resolveItems(Task task, QSharedPointer<FinishedTasks> finishedTasks, QObject* receiver);
+
+private:
+    QThreadPool m_threadPool;
+    QSharedPointer<FinishedTasks> m_finishedTasks;
+
+    KMountPoint::List m_mountPoints;
+    bool m_mountPointsLoaded;
+    QHash<QString, QString> m_mountKeys;    // Directory -> mount point
+    QHash<QString, Mount> m_mounts;         // Key: mount point
+    int m_generation;                       // Increased by clear()
+
+    int m_pendingCount;
+    QVector<Result> m_results;
+    QTimer* m_emitResultsTimer;
+};
+
+#endif
@@ -0,0 +1,135 @@
+/***************************************************************************
+ *   Copyright (C) 2019 by Dolphin developers <kfm-devel@kde.org>          *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA            *
+ ***************************************************************************/
+
+#include "kpreviewpixmapcache.h"
+
+#include <QCoreApplication>
+#include <QHash>
+
+#include <climits>
+
+namespace {
+    // Default maximum size of all cached pixmaps in KiB
+    const int DefaultMaximumCost = 64 * 1024;
+}
+
+struct KPreviewPixmapCacheSingleton
+{
+    KPreviewPixmapCache instance;
+};
+Q_GLOBAL_STATIC(KPreviewPixmapCacheSingleton, s_previewPixmapCache)
+
+namespace {
+    void clearPreviewPixmapCache()
+    {
+        // The pixmaps must be destroyed while QGuiApplication still exists,
+        // which is not the case when the global static is destroyed.
+        if (s_previewPixmapCache.exists()) {
+            s_previewPixmapCache->instance.clear();
+        }
+    }
+}
+
+bool KPreviewPixmapCache::Key::operator==(const Key& other) const
+{
+    return modificationTime == other.modificationTime &&
+           iconSize == other.iconSize &&
+           qFuzzyCompare(devicePixelRatio, other.devicePixelRatio) &&
+           enlargeSmallPreviews == other.enlargeSmallPreviews &&
+           url == other.url &&
+           overlays == other.overlays;
+}
+
+uint qHash(const KPreviewPixmapCache::Key& key, uint seed)
+{
+    uint hash = qHash(key.url, seed);
+    hash ^= qHash(key.modificationTime) + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+    hash ^= qHash(key.iconSize.width() ^ (key.iconSize.height() << 16)) + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+    hash ^= qHash(key.overlays) + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+    return hash;
+}
+
+KPreviewPixmapCache& KPreviewPixmapCache::instance()
+{
+    return s_previewPixmapCache->instance;
+}
+
+KPreviewPixmapCache::~KPreviewPixmapCache()
+{
+}
+
+bool KPreviewPixmapCache::find(const Key& key, QPixmap* pixmap)
+{
+    const QPixmap* cachedPixmap = m_cache.object(key);
+    if (!cachedPixmap) {
+        ++m_missCount;
+        return false;
+    }
+
+    ++m_hitCount;
+    *pixmap = *cachedPixmap;
+    return true;
+}
+
+void KPreviewPixmapCache::insert(const Key& key, const QPixmap& pixmap)
+{
+    const qint64 bytes = qint64(pixmap.width()) * pixmap.height() * pixmap.depth() / 8;
+    const int cost = qMax(1, int((bytes + 1023) / 1024));
+
+    // QCache deletes the pixmap immediately if the cost exceeds the maximum cost.
+    m_cache.insert(key, new QPixmap(pixmap), cost);
+}
+
+void KPreviewPixmapCache::clear()
+{
+    m_cache.clear();
+}
+
+void KPreviewPixmapCache::setMaximumSize(qint64 bytes)
+{
+    m_cache.setMaxCost(int(qBound(qint64(0), bytes / 1024, qint64(INT_MAX))));
+}
+
+qint64 KPreviewPixmapCache::maximumSize() const
+{
+    return qint64(m_cache.maxCost()) * 1024;
+}
+
+qint64 KPreviewPixmapCache::size() const
+{
+    return qint64(m_cache.totalCost()) * 1024;
+}
+
+qint64 KPreviewPixmapCache::hitCount() const
+{
+    return m_hitCount;
+}
+
+qint64 KPreviewPixmapCache::missCount() const
+{
+    return m_missCount;
+}
+
+KPreviewPixmapCache::KPreviewPixmapCache() :
+    m_cache(DefaultMaximumCost),
+    m_hitCount(0),
+    m_missCount(0)
+{
+    qAddPostRoutine(clearPreviewPixmapCache);
+}
@@ -0,0 +1,102 @@
+/***************************************************************************
+ *   Copyright (C) 2019 by Dolphin developers <kfm-devel@kde.org>          *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA            *
+ ***************************************************************************/
+
+#ifndef KPREVIEWPIXMAPCACHE_H
+#define KPREVIEWPIXMAPCACHE_H
+
+#include "dolphin_export.h"
+
+#include <QCache>
+#include <QPixmap>
+#include <QSize>
+#include <QStringList>
+#include <QUrl>
+
+/**
+ * @brief Caches previews after they have been framed, scaled and decorated
+ *        with overlays by KFileItemModelRolesUpdater.
+ *
+ * The cache is shared by all views of the process, so that changing the zoom
+ * level back and forth or entering a directory again does not require to
+ * create and process the previews again. The least recently used previews are
+ * removed if the size of all pixmaps exceeds maximumSize().
+ *
+ * The cache may only be used by the GUI thread.
+ */
+class DOLPHIN_EXPORT KPreviewPixmapCache
+{
+public:
+    struct Key
+    {
+        QUrl url;
+        qint64 modificationTime;    // Milliseconds since the epoch
+        QSize iconSize;
+        qreal devicePixelRatio;
+        bool enlargeSmallPreviews;
+        QStringList overlays;
+
+        bool operator==(const Key& other) const;
+    };
+
+    static KPreviewPixmapCache& instance();
+    virtual ~KPreviewPixmapCache();
+
+    /**
+     * Copies the cached pixmap for the key \a key to \a pixmap.
+     * @return True if the cache contains a pixmap for the key.
+     */
+    bool find(const Key& key, QPixmap* pixmap);
+
+    void insert(const Key& key, const QPixmap& pixmap);
+
+    void clear();
+
+    /**
+     * Sets the maximum size of all cached pixmaps in bytes.
+     */
+    void setMaximumSize(qint64 bytes);
+    qint64 maximumSize() const;
+
+    /**
+     * @return Size of all cached pixmaps in bytes.
+     */
+    qint64 size() const;
+
+    /**
+     * @return Number of calls of find() which have been successful
+     *         or not successful.
+     */
+    qint64 hitCount() const;
+    qint64 missCount() const;
+
+protected:
+    KPreviewPixmapCache();
+
+private:
+    // The costs of the items of m_cache are measured in KiB.
+    QCache<Key, QPixmap> m_cache;
+    qint64 m_hitCount;
+    qint64 m_missCount;
+
+    friend struct KPreviewPixmapCacheSingleton;
+};
+
+uint qHash(const KPreviewPixmapCache::Key& key, uint seed = 0);
+
+#endif
@@ -0,0 +1,192 @@
+/***************************************************************************
+ *   Copyright (C) 2019 by Dolphin developers <kfm-devel@kde.org>          *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA            *
+ ***************************************************************************/
+
+#include "krangesuccessorindex.h"
+
+#include <QtAlgorithms>
+
+namespace {
+    const int BitsPerWord = 64;
+}
+
+KRangeSuccessorIndex::KRangeSuccessorIndex() :
+    m_count(0),
+    m_levels()
+{
+}
+
+KRangeSuccessorIndex::~KRangeSuccessorIndex()
+{
+}
+
+void KRangeSuccessorIndex::build(const QVector<int>& values)
+{
+    m_count = values.count();
+    m_levels.clear();
+
+    int maximum = 0;
+    for (int value : values) {
+        Q_ASSERT(value >= 0);
+        maximum = qMax(maximum, value);
+    }
+
+    int bitCount = 1;
+    while (bitCount < 31 && (maximum >> bitCount) > 0) {
+        ++bitCount;
+    }
+
+    // Level n stores the bit n of each value, starting with the most
+    // significant bit. The values are ordered stably by the bits of the
+    // previous levels, so the values with a cleared bit come first.
+    const int wordCount = m_count / BitsPerWord + 1;
+    m_levels.resize(bitCount);
+
+    QVector<int> current = values;
+    QVector<int> zeros;
+    QVector<int> ones;
+    zeros.reserve(m_count);
+    ones.reserve(m_count);
+
+    for (int levelIndex = 0; levelIndex < bitCount; ++levelIndex) {
+        Level& level = m_levels[levelIndex];
+        level.bits.fill(0, wordCount);
+        level.ranks.resize(wordCount);
+
+        const int shift = bitCount - 1 - levelIndex;
+        zeros.clear();
+        ones.clear();
+        for (int i = 0; i < m_count; ++i) {
+            const int value = current.at(i);
+            if ((value >> shift) & 1) {
+                level.bits[i / BitsPerWord] |= quint64(1) << (i % BitsPerWord);
+                ones.append(value);
+            } else {
+                zeros.append(value);
+            }
+        }
+
+        int setBits = 0;
+        for (int word = 0; word < wordCount; ++word) {
+            level.ranks[word] = setBits;
+            setBits += qPopulationCount(level.bits.at(word));
+        }
+        level.zeroCount = zeros.count();
+
+        current = zeros;
+        current += ones;
+    }
+}
+
+void KRangeSuccessorIndex::clear()
+{
+    m_count = 0;
+    m_levels.clear();
+}
+
+int KRangeSuccessorIndex::count() const
+{
+    return m_count;
+}
+
+int KRangeSuccessorIndex::successor(int begin, int end, int value) const
+{
+    begin = qMax(0, begin);
+    end = qMin(end, m_count);
+    value = qMax(0, value);
+
+    const int bitCount = m_levels.count();
+    if (begin >= end || bitCount == 0 || (value >> bitCount) > 0) {
+        return -1;
+    }
+
+    // Follow the bits of 'value'. Whenever a bit of 'value' is cleared, the
+    // values of the range with a set bit are greater than 'value'. The
+    // deepest of these candidate ranges contains the smallest successor if
+    // 'value' itself is not part of the range.
+    int candidateLevel = -1;
+    int candidateBegin = 0;
+    int candidateEnd = 0;
+    int candidatePrefix = 0;
+
+    int prefix = 0;
+    for (int levelIndex = 0; levelIndex < bitCount; ++levelIndex) {
+        const Level& level = m_levels.at(levelIndex);
+        const int onesBeforeBegin = rank(level, begin);
+        const int onesBeforeEnd = rank(level, end);
+
+        if ((value >> (bitCount - 1 - levelIndex)) & 1) {
+            begin = level.zeroCount + onesBeforeBegin;
+            end = level.zeroCount + onesBeforeEnd;
+            prefix = (prefix << 1) | 1;
+        } else {
+            if (onesBeforeEnd > onesBeforeBegin) {
+                candidateLevel = levelIndex;
+                candidateBegin = level.zeroCount + onesBeforeBegin;
+                candidateEnd = level.zeroCount + onesBeforeEnd;
+                candidatePrefix = (prefix << 1) | 1;
+            }
+            begin -= onesBeforeBegin;
+            end -= onesBeforeEnd;
+            prefix = prefix << 1;
+        }
+
+        if (begin >= end) {
+            break;
+        }
+    }
+
+    if (begin < end) {
+        // The range contains 'value'
+        Q_ASSERT(prefix == value);
+        return value;
+    }
+
+    if (candidateLevel < 0) {
+        return -1;
+    }
+
+    // Find the smallest value of the candidate range.
+    begin = candidateBegin;
+    end = candidateEnd;
+    prefix = candidatePrefix;
+    for (int levelIndex = candidateLevel + 1; levelIndex < bitCount; ++levelIndex) {
+        const Level& level = m_levels.at(levelIndex);
+        const int onesBeforeBegin = rank(level, begin);
+        const int onesBeforeEnd = rank(level, end);
+
+        if (onesBeforeEnd - onesBeforeBegin < end - begin) {
+            begin -= onesBeforeBegin;
+            end -= onesBeforeEnd;
+            prefix = prefix << 1;
+        } else {
+            begin = level.zeroCount + onesBeforeBegin;
+            end = level.zeroCount + onesBeforeEnd;
+            prefix = (prefix << 1) | 1;
+        }
+    }
+
+    return prefix;
+}
+
+int KRangeSuccessorIndex::rank(const Level& level, int position)
+{
+    const int word = position / BitsPerWord;
+    const quint64 mask = (quint64(1) << (position % BitsPerWord)) - 1;
+    return level.ranks.at(word) + qPopulationCount(level.bits.at(word) & mask);
+}
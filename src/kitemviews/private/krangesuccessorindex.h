@@ -0,0 +1,80 @@
+/***************************************************************************
+ *   Copyright (C) 2019 by Dolphin developers <kfm-devel@kde.org>          *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA            *
+ ***************************************************************************/
+
+#ifndef KRANGESUCCESSORINDEX_H
+#define KRANGESUCCESSORINDEX_H
+
+#include "dolphin_export.h"
+
+#include <QVector>
+
+/**
+ * @brief Allows to find the smallest value that is greater than or equal to
+ *        a given value in any range of a list of non-negative integers.
+ *
+ * Each query requires O(log M) steps, where M is the largest value of the
+ * list. The index is a wavelet matrix, which needs about log M bits per
+ * value and is built in O(N log M) steps for N values. It cannot be
+ * modified after it has been built.
+ *
+ * KFileItemModel uses the index to find the next item that starts with
+ * the text of a keyboard search, see KFileItemModel::indexForKeyboardSearch().
+ */
+class DOLPHIN_EXPORT KRangeSuccessorIndex
+{
+public:
+    KRangeSuccessorIndex();
+    ~KRangeSuccessorIndex();
+
+    /**
+     * Builds the index for \a values, which may not contain negative values.
+     */
+    void build(const QVector<int>& values);
+    void clear();
+
+    int count() const;
+
+    /**
+     * @return The smallest value that is greater than or equal to \a value
+     *         in the range [\a begin, \a end) of the values, or -1 if there
+     *         is no such value.
+     */
+    int successor(int begin, int end, int value) const;
+
+private:
+    struct Level
+    {
+        // Bit n is the bit of the level for the value at position n.
+        QVector<quint64> bits;
+        // Number of set bits in all words before a word of 'bits'.
+        QVector<int> ranks;
+        int zeroCount;
+    };
+
+    /**
+     * @return Number of set bits of \a level before \a position.
+     */
+    static int rank(const Level& level, int position);
+
+private:
+    int m_count;
+    QVector<Level> m_levels;
+};
+
+#endif
@@ -20,11 +20,25 @@
 
 #include <QTest>
 #include <QSignalSpy>
+#include <QElapsedTimer>
+#include <QThread>
 
+#include <algorithm>
 #include <random>
 
+#include <kio/udsentry.h>
+
+#include <sys/resource.h>
+#include <sys/stat.h>
+
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
 #include "kitemviews/kfileitemmodel.h"
+#include "kitemviews/private/kfileitemmodeldirlister.h"
 #include "kitemviews/private/kfileitemmodelsortalgorithm.h"
+#include "testdir.h"
 
 void myMessageOutput(QtMsgType type, const QMessageLogContext& context, const QString& msg)
 {
@@ -59,9 +73,48 @@ public:
 private slots:
     void insertAndRemoveManyItems_data();
     void insertAndRemoveManyItems();
+    void bytesPerItem_data();
+    void bytesPerItem();
+    void itemDataAllocations_data();
+    void itemDataAllocations();
+    void peakResidentSetSize_data();
+    void peakResidentSetSize();
+    void naturalSorting_data();
+    void naturalSorting();
+    void longestStallWhileStreaming_data();
+    void longestStallWhileStreaming();
+    void expandManyFolders_data();
+    void expandManyFolders();
+    void timeToFirstItems_data();
+    void timeToFirstItems();
+    void timeToCompleteListing_data();
+    void timeToCompleteListing();
+    void keyboardSearch_data();
+    void keyboardSearch();
 
 private:
+    static void addListingRows();
+
+    /**
+     * Lists a directory with \a itemCount files in a model. The time until
+     * the first items are inserted and until the listing is completed are
+     * stored in \a firstItemsTime and \a completeTime.
+     */
+    static void listDirectory(bool localListing, int itemCount, qint64* firstItemsTime, qint64* completeTime);
+
     static KFileItemList createFileItemList(const QStringList& fileNames, const QString& urlPrefix = QLatin1String("file:///"));
+
+    /**
+     * @return The number of bytes that are currently allocated on the heap,
+     *         or -1 if this cannot be determined on the current platform.
+     */
+    static qint64 allocatedHeapBytes();
+
+    /**
+     * @return The peak resident set size of the process in bytes, or -1
+     *         if this cannot be determined on the current platform.
+     */
+    static qint64 peakResidentSetBytes();
 };
 
 KFileItemModelBenchmark::KFileItemModelBenchmark()
@@ -162,6 +215,7 @@ void KFileItemModelBenchmark::insertAndRemoveManyItems()
     // Avoid overhead caused by natural sorting
     // and determining the isDir/isLink roles.
     model.m_naturalSorting = false;
+    model.m_useSortKeys = false;
     model.setRoles({"text"});
 
     QSignalSpy spyItemsInserted(&model, &KFileItemModel::itemsInserted);
@@ -204,6 +258,445 @@ void KFileItemModelBenchmark::insertAndRemoveManyItems()
     }
 }
 
+void KFileItemModelBenchmark::bytesPerItem_data()
+{
+    QTest::addColumn<int>("itemCount");
+    QTest::addColumn<bool>("resolveRoles");
+
+    // "loaded":   Only the KFileItems have been inserted into the model.
+    // "resolved": data() has been called for every item, and the roles that are
+    //             usually set by KFileItemModelRolesUpdater have been set.
+    QTest::newRow("loaded--n=100000") << 100000 << false;
+    QTest::newRow("resolved--n=100000") << 100000 << true;
+}
+
+void KFileItemModelBenchmark::bytesPerItem()
+{
+    QFETCH(int, itemCount);
+    QFETCH(bool, resolveRoles);
+
+    if (allocatedHeapBytes() < 0) {
+        QSKIP("The allocated heap size cannot be determined on this platform");
+    }
+
+    QStringList names;
+    names.reserve(itemCount);
+    for (int i = 0; i < itemCount; ++i) {
+        names << QString::number(i);
+    }
+    const KFileItemList items = createFileItemList(names);
+
+    KFileItemModel model;
+    model.m_naturalSorting = false;
+    model.m_useSortKeys = false;
+    model.setRoles({"text", "isDir", "isLink", "size", "modificationtime", "type"});
+
+    const qint64 heapBefore = allocatedHeapBytes();
+
+    model.slotItemsAdded(model.directory(), items);
+    model.slotCompleted();
+    QCOMPARE(model.count(), itemCount);
+
+    if (resolveRoles) {
+        QHash<QByteArray, QVariant> values;
+        values.insert("iconName", QStringLiteral("text-plain"));
+        values.insert("type", QStringLiteral("Plain Text Document"));
+        values.insert("iconOverlays", QStringList());
+        for (int i = 0; i < itemCount; ++i) {
+            model.data(i);
+            model.setData(i, values);
+        }
+    }
+
+    const qint64 heapAfter = allocatedHeapBytes();
+    QTest::setBenchmarkResult(qreal(heapAfter - heapBefore) / itemCount, QTest::BytesAllocated);
+}
+
+void KFileItemModelBenchmark::itemDataAllocations_data()
+{
+    QTest::addColumn<int>("itemCount");
+
+    QTest::newRow("n=100000") << 100000;
+    QTest::newRow("n=1000000") << 1000000;
+}
+
+void KFileItemModelBenchmark::itemDataAllocations()
+{
+    QFETCH(int, itemCount);
+
+    QStringList names;
+    names.reserve(itemCount);
+    for (int i = 0; i < itemCount; ++i) {
+        names << QString::number(i);
+    }
+    const KFileItemList items = createFileItemList(names);
+
+    KFileItemModel model;
+    model.m_naturalSorting = false;
+    model.m_useSortKeys = false;
+
+    // Load the items twice, so that the allocations of both the initial
+    // listing and of reloading the directory are counted.
+    const qint64 allocationsBefore = model.m_itemDataArena.allocationCount();
+    for (int i = 0; i < 2; ++i) {
+        model.slotClear();
+        model.slotItemsAdded(model.directory(), items);
+        model.slotCompleted();
+        QCOMPARE(model.count(), itemCount);
+    }
+    const qint64 allocationsAfter = model.m_itemDataArena.allocationCount();
+
+    QTest::setBenchmarkResult(allocationsAfter - allocationsBefore, QTest::Events);
+}
+
+void KFileItemModelBenchmark::peakResidentSetSize_data()
+{
+    itemDataAllocations_data();
+}
+
+void KFileItemModelBenchmark::peakResidentSetSize()
+{
+    // Note that the peak resident set size covers the whole process, so
+    // this benchmark should be run on its own for meaningful results.
+    QFETCH(int, itemCount);
+
+    if (peakResidentSetBytes() < 0) {
+        QSKIP("The peak resident set size cannot be determined on this platform");
+    }
+
+    QStringList names;
+    names.reserve(itemCount);
+    for (int i = 0; i < itemCount; ++i) {
+        names << QString::number(i);
+    }
+
+    {
+        const KFileItemList items = createFileItemList(names);
+
+        KFileItemModel model;
+        model.m_naturalSorting = false;
+        model.m_useSortKeys = false;
+        model.slotItemsAdded(model.directory(), items);
+        model.slotCompleted();
+        QCOMPARE(model.count(), itemCount);
+        model.slotClear();
+    }
+
+    QTest::setBenchmarkResult(peakResidentSetBytes(), QTest::BytesAllocated);
+}
+
+void KFileItemModelBenchmark::naturalSorting_data()
+{
+    QTest::addColumn<int>("itemCount");
+    QTest::addColumn<bool>("useSortKeys");
+
+    QTest::newRow("QCollator::compare()--n=100000") << 100000 << false;
+    QTest::newRow("QCollatorSortKey--n=100000") << 100000 << true;
+}
+
+void KFileItemModelBenchmark::naturalSorting()
+{
+    QFETCH(int, itemCount);
+    QFETCH(bool, useSortKeys);
+
+    // Mixed text/number names in random order, which is the expensive
+    // case for natural sorting.
+    QStringList names;
+    names.reserve(itemCount);
+    for (int i = 0; i < itemCount; ++i) {
+        names << QStringLiteral("File %1 - Copy %2.txt").arg(i % 1000).arg(i / 1000);
+    }
+    std::mt19937 randomGenerator(42);
+    std::shuffle(names.begin(), names.end(), randomGenerator);
+    const KFileItemList items = createFileItemList(names);
+
+    KFileItemModel model;
+    model.m_naturalSorting = true;
+    model.m_collator.setNumericMode(true);
+    model.m_collator.setCaseSensitivity(Qt::CaseInsensitive);
+    model.m_collator.compare(QString(), QString());
+    model.setRoles({"text"});
+
+    if (useSortKeys) {
+        if (model.m_collator.sortKey(QStringLiteral("a2")).compare(model.m_collator.sortKey(QStringLiteral("a10"))) >= 0) {
+            QSKIP("QCollatorSortKey does not support numeric mode on this platform");
+        }
+    }
+    model.m_useSortKeys = useSortKeys;
+
+    QBENCHMARK {
+        model.slotClear();
+        model.slotItemsAdded(model.directory(), items);
+        model.slotCompleted();
+        QCOMPARE(model.count(), itemCount);
+    }
+
+    QVERIFY(model.isConsistent());
+}
+
+void KFileItemModelBenchmark::longestStallWhileStreaming_data()
+{
+    QTest::addColumn<int>("itemCount");
+    QTest::addColumn<int>("batchSize");
+    QTest::addColumn<bool>("usePipeline");
+
+    QTest::newRow("GUI thread--n=1000000") << 1000000 << 1000 << false;
+    QTest::newRow("worker threads--n=1000000") << 1000000 << 1000 << true;
+}
+
+void KFileItemModelBenchmark::longestStallWhileStreaming()
+{
+    QFETCH(int, itemCount);
+    QFETCH(int, batchSize);
+    QFETCH(bool, usePipeline);
+
+    QStringList names;
+    names.reserve(itemCount);
+    for (int i = 0; i < itemCount; ++i) {
+        names << QStringLiteral("File %1.txt").arg(i);
+    }
+    std::mt19937 randomGenerator(42);
+    std::shuffle(names.begin(), names.end(), randomGenerator);
+    const KFileItemList items = createFileItemList(names);
+
+    KFileItemModel model;
+    model.m_itemBatchPipelineEnabled = usePipeline;
+    model.setRoles({"text"});
+
+    // Measures the longest time that the GUI thread is blocked by the model
+    // while the items are streamed in by the dir lister.
+    qint64 longestStall = 0;
+    QElapsedTimer timer;
+    for (int first = 0; first < itemCount; first += batchSize) {
+        const KFileItemList batch(items.mid(first, batchSize));
+
+        timer.start();
+        model.slotItemsAdded(model.directory(), batch);
+        longestStall = qMax(longestStall, timer.elapsed());
+
+        // Emulate the latency of a slow network file system.
+        QThread::msleep(1);
+    }
+
+    timer.start();
+    model.slotCompleted();
+    longestStall = qMax(longestStall, timer.elapsed());
+
+    QCOMPARE(model.count(), itemCount);
+    QVERIFY(model.isConsistent());
+
+    QTest::setBenchmarkResult(longestStall, QTest::WalltimeMilliseconds);
+}
+
+void KFileItemModelBenchmark::expandManyFolders_data()
+{
+    QTest::addColumn<int>("folderCount");
+    QTest::addColumn<int>("itemsPerFolder");
+
+    QTest::newRow("folders=10, items per folder=5000") << 10 << 5000;
+    QTest::newRow("folders=50, items per folder=5000") << 50 << 5000;
+}
+
+void KFileItemModelBenchmark::expandManyFolders()
+{
+    QFETCH(int, folderCount);
+    QFETCH(int, itemsPerFolder);
+
+    KFileItemList folders;
+    QList<KFileItemList> children;
+    for (int i = 0; i < folderCount; ++i) {
+        const QString folderPath = QStringLiteral("/folder %1").arg(i);
+        folders << KFileItem(QUrl::fromLocalFile(folderPath), QStringLiteral("inode/directory"), S_IFDIR);
+
+        QStringList names;
+        names.reserve(itemsPerFolder);
+        for (int j = 0; j < itemsPerFolder; ++j) {
+            names << QStringLiteral("File %1.txt").arg(j);
+        }
+        std::mt19937 randomGenerator(i);
+        std::shuffle(names.begin(), names.end(), randomGenerator);
+        children << createFileItemList(names, folderPath + QLatin1Char('/'));
+    }
+
+    KFileItemModel model;
+    model.setRoles({"text", "isExpanded", "isExpandable", "expandedParentsCount"});
+
+    // Emulates expanding all folders, like restoring the expanded folders
+    // of the details view does.
+    QBENCHMARK {
+        model.slotClear();
+        model.slotItemsAdded(model.directory(), folders);
+        model.slotCompleted();
+
+        for (int i = 0; i < folderCount; ++i) {
+            const QUrl folderUrl = folders.at(i).url();
+            model.setData(model.index(folderUrl), {{"isExpanded", true}});
+            model.slotItemsAdded(folderUrl, children.at(i));
+            model.slotCompleted();
+        }
+
+        QCOMPARE(model.count(), folderCount * (itemsPerFolder + 1));
+    }
+
+    QVERIFY(model.isConsistent());
+}
+
+void KFileItemModelBenchmark::timeToFirstItems_data()
+{
+    addListingRows();
+}
+
+void KFileItemModelBenchmark::timeToFirstItems()
+{
+    QFETCH(bool, localListing);
+    QFETCH(int, itemCount);
+
+    qint64 firstItemsTime = 0;
+    qint64 completeTime = 0;
+    listDirectory(localListing, itemCount, &firstItemsTime, &completeTime);
+    if (QTest::currentTestFailed()) {
+        return;
+    }
+    QTest::setBenchmarkResult(firstItemsTime, QTest::WalltimeMilliseconds);
+}
+
+void KFileItemModelBenchmark::timeToCompleteListing_data()
+{
+    addListingRows();
+}
+
+void KFileItemModelBenchmark::timeToCompleteListing()
+{
+    QFETCH(bool, localListing);
+    QFETCH(int, itemCount);
+
+    qint64 firstItemsTime = 0;
+    qint64 completeTime = 0;
+    listDirectory(localListing, itemCount, &firstItemsTime, &completeTime);
+    if (QTest::currentTestFailed()) {
+        return;
+    }
+    QTest::setBenchmarkResult(completeTime, QTest::WalltimeMilliseconds);
+}
+
+void KFileItemModelBenchmark::keyboardSearch_data()
+{
+    QTest::addColumn<int>("itemCount");
+
+    QTest::newRow("n=1000") << 1000;
+    QTest::newRow("n=10000") << 10000;
+    QTest::newRow("n=100000") << 100000;
+    QTest::newRow("n=1000000") << 1000000;
+}
+
+void KFileItemModelBenchmark::keyboardSearch()
+{
+    QFETCH(int, itemCount);
+
+    // Create 'itemCount' items that start with "f" and the item "target",
+    // which is the last item of the model.
+    KFileItemList items;
+    items.reserve(itemCount + 1);
+    for (int i = 0; i <= itemCount; ++i) {
+        KIO::UDSEntry entry;
+        entry.insert(KIO::UDSEntry::UDS_NAME, i < itemCount ? QStringLiteral("file%1").arg(i) : QStringLiteral("target"));
+        entry.insert(KIO::UDSEntry::UDS_FILE_TYPE, 0100000);    // S_IFREG might not be defined on non-Unix platforms.
+        items.append(KFileItem(entry, QUrl(QStringLiteral("file:///")), true, true));
+    }
+
+    KFileItemModel model;
+    model.slotItemsAdded(model.directory(), items);
+    model.slotCompleted();
+    QCOMPARE(model.count(), itemCount + 1);
+
+    const QString searchText = QStringLiteral("target");
+    QBENCHMARK {
+        // Type the name of the last item like KItemListController does, and
+        // press "f" afterwards, which matches all other items.
+        int index = 0;
+        for (int i = 1; i <= searchText.length(); ++i) {
+            index = model.indexForKeyboardSearch(searchText.left(i), index);
+        }
+        QCOMPARE(index, itemCount);
+
+        index = model.indexForKeyboardSearch(QStringLiteral("f"), index + 1);
+        QCOMPARE(index, 0);
+    }
+}
+
+void KFileItemModelBenchmark::addListingRows()
+{
+    QTest::addColumn<bool>("localListing");
+    QTest::addColumn<int>("itemCount");
+
+    QTest::newRow("KIO--n=10000") << false << 10000;
+    QTest::newRow("local lister--n=10000") << true << 10000;
+    QTest::newRow("KIO--n=100000") << false << 100000;
+    QTest::newRow("local lister--n=100000") << true << 100000;
+}
+
+void KFileItemModelBenchmark::listDirectory(bool localListing, int itemCount, qint64* firstItemsTime, qint64* completeTime)
+{
+    // A new directory is used for each run, because KDirLister caches the
+    // items of directories which have been listed already.
+    TestDir testDir;
+    QStringList files;
+    files.reserve(itemCount);
+    for (int i = 0; i < itemCount; ++i) {
+        files << QStringLiteral("File %1.txt").arg(i);
+    }
+    testDir.createFiles(files);
+
+    KFileItemModel model;
+    model.setLocalListingEnabled(localListing);
+    model.setRoles({"text"});
+
+    QSignalSpy itemsInsertedSpy(&model, &KFileItemModel::itemsInserted);
+    QSignalSpy loadingCompletedSpy(&model, &KFileItemModel::directoryLoadingCompleted);
+
+    QElapsedTimer timer;
+    timer.start();
+    model.loadDirectory(testDir.url());
+
+    QVERIFY(itemsInsertedSpy.wait(60000));
+    *firstItemsTime = timer.elapsed();
+
+    if (loadingCompletedSpy.isEmpty()) {
+        QVERIFY(loadingCompletedSpy.wait(60000));
+    }
+    *completeTime = timer.elapsed();
+
+    QCOMPARE(model.count(), itemCount);
+    QVERIFY(model.isConsistent());
+}
+
+qint64 KFileItemModelBenchmark::allocatedHeapBytes()
+{
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+    const struct mallinfo2 info = mallinfo2();
+    return static_cast<qint64>(info.uordblks) + static_cast<qint64>(info.hblkhd);
+#elif defined(__GLIBC__)
+    const struct mallinfo info = mallinfo();
+    return static_cast<qint64>(info.uordblks) + static_cast<qint64>(info.hblkhd);
+#else
+    return -1;
+#endif
+}
+
+qint64 KFileItemModelBenchmark::peakResidentSetBytes()
+{
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return -1;
+    }
+#if defined(Q_OS_MACOS)
+    return static_cast<qint64>(usage.ru_maxrss);
+#else
+    // ru_maxrss is measured in kilobytes
+    return static_cast<qint64>(usage.ru_maxrss) * 1024;
+#endif
+}
+
 KFileItemList KFileItemModelBenchmark::createFileItemList(const QStringList& fileNames, const QString& prefix)
 {
     // Suppress 'file does not exist anymore' messages from KFileItemPrivate::init().
@@ -0,0 +1,239 @@
+/***************************************************************************
+ *   Copyright (C) 2019 by Dolphin developers <kfm-devel@kde.org>          *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA            *
+ ***************************************************************************/
+
+#include "kitemviews/private/kfileitemmodeldirlister.h"
+#include "kitemviews/private/kfileitemmodellocallister.h"
+#include "testdir.h"
+
+#include <KIO/Global>
+
+#include <QSignalSpy>
+#include <QTest>
+
+class KFileItemModelDirListerTest : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void init();
+    void cleanup();
+
+    void testListing();
+    void testHiddenFiles();
+    void testDirOnlyMode();
+    void testNonExistingDirectory();
+    void testFileUrl();
+    void testStop();
+    void testAutoUpdate();
+
+private:
+    /**
+     * Opens the test directory and waits until it has been listed.
+     */
+    bool listTestDirectory();
+
+private:
+    KFileItemModelDirLister* m_lister;
+    TestDir* m_testDir;
+    QStringList m_addedNames;
+    QStringList m_deletedNames;
+};
+
+void KFileItemModelDirListerTest::init()
+{
+    m_lister = nullptr;
+    m_testDir = new TestDir();
+    if (!KFileItemModelLocalLister::isSupported(m_testDir->url())) {
+        QSKIP("Directories cannot be listed locally on this platform");
+    }
+
+    m_lister = new KFileItemModelDirLister();
+    m_lister->setLocalListingEnabled(true);
+    m_lister->setDelayedMimeTypes(true);
+    m_lister->setShowingDotFiles(true);
+
+    m_addedNames.clear();
+    m_deletedNames.clear();
+    connect(m_lister, &KFileItemModelDirLister::itemsAdded, this, [this](const QUrl&, const KFileItemList& items) {
+        foreach (const KFileItem& item, items) {
+            m_addedNames.append(item.name());
+        }
+    });
+    connect(m_lister, &KFileItemModelDirLister::itemsDeleted, this, [this](const KFileItemList& items) {
+        foreach (const KFileItem& item, items) {
+            m_deletedNames.append(item.name());
+        }
+    });
+}
+
+void KFileItemModelDirListerTest::cleanup()
+{
+    delete m_lister;
+    m_lister = nullptr;
+
+    delete m_testDir;
+    m_testDir = nullptr;
+}
+
+void KFileItemModelDirListerTest::testListing()
+{
+    m_testDir->createFiles({"a.txt", "b.txt", "c.txt"});
+    m_testDir->createDir("subdir");
+
+    QSignalSpy startedSpy(m_lister, &KFileItemModelDirLister::started);
+    QVERIFY(listTestDirectory());
+
+    QCOMPARE(startedSpy.count(), 1);
+    QCOMPARE(m_lister->directoryUrl(), m_testDir->url());
+    QCOMPARE(m_lister->directoryItem().url(), m_testDir->url());
+    QVERIFY(m_lister->directoryItem().isDir());
+    QVERIFY(m_lister->isListingFinished());
+
+    m_addedNames.sort();
+    QCOMPARE(m_addedNames, QStringList() << "a.txt" << "b.txt" << "c.txt" << "subdir");
+}
+
+void KFileItemModelDirListerTest::testHiddenFiles()
+{
+    m_testDir->createFiles({"a.txt", ".hidden.txt"});
+    m_testDir->createDir(".hiddendir");
+
+    QVERIFY(listTestDirectory());
+    m_addedNames.sort();
+    QCOMPARE(m_addedNames, QStringList() << ".hidden.txt" << ".hiddendir" << "a.txt");
+
+    m_addedNames.clear();
+    m_lister->setShowingDotFiles(false);
+    QVERIFY(listTestDirectory());
+    QCOMPARE(m_addedNames, QStringList() << "a.txt");
+}
+
+void KFileItemModelDirListerTest::testDirOnlyMode()
+{
+    m_testDir->createFiles({"a.txt", "b.txt"});
+    m_testDir->createDir("subdir");
+
+    m_lister->setDirOnlyMode(true);
+    QVERIFY(listTestDirectory());
+    QCOMPARE(m_addedNames, QStringList() << "subdir");
+
+    // Disabling the directory-only mode only adds the files, which have
+    // not been listed before
+    m_addedNames.clear();
+    m_lister->setDirOnlyMode(false);
+    m_lister->emitChanges();
+    QTRY_COMPARE(m_addedNames.count(), 2);
+    m_addedNames.sort();
+    QCOMPARE(m_addedNames, QStringList() << "a.txt" << "b.txt");
+    QVERIFY(m_deletedNames.isEmpty());
+}
+
+void KFileItemModelDirListerTest::testNonExistingDirectory()
+{
+    QUrl url = m_testDir->url();
+    url.setPath(url.path() + "/nonexisting");
+
+    QSignalSpy errorMessageSpy(m_lister, &KFileItemModelDirLister::errorMessage);
+    QSignalSpy canceledSpy(m_lister, static_cast<void(KFileItemModelDirLister::*)()>(&KFileItemModelDirLister::canceled));
+    QSignalSpy completedSpy(m_lister, static_cast<void(KFileItemModelDirLister::*)()>(&KFileItemModelDirLister::completed));
+
+    QVERIFY(m_lister->openUrl(url));
+    QVERIFY(canceledSpy.wait());
+
+    QCOMPARE(errorMessageSpy.count(), 1);
+    QCOMPARE(errorMessageSpy.first().first().toString(),
+             KIO::buildErrorString(KIO::ERR_DOES_NOT_EXIST, url.toDisplayString()));
+    QCOMPARE(completedSpy.count(), 0);
+    QVERIFY(m_lister->isListingFinished());
+    QVERIFY(m_addedNames.isEmpty());
+}
+
+void KFileItemModelDirListerTest::testFileUrl()
+{
+    m_testDir->createFile("a.txt");
+    const QUrl url = QUrl::fromLocalFile(m_testDir->path() + "/a.txt");
+
+    QSignalSpy urlIsFileErrorSpy(m_lister, &KFileItemModelDirLister::urlIsFileError);
+    QSignalSpy errorMessageSpy(m_lister, &KFileItemModelDirLister::errorMessage);
+
+    QVERIFY(m_lister->openUrl(url));
+    QVERIFY(urlIsFileErrorSpy.wait());
+
+    QCOMPARE(urlIsFileErrorSpy.first().first().toUrl(), url);
+    QCOMPARE(errorMessageSpy.count(), 0);
+}
+
+void KFileItemModelDirListerTest::testStop()
+{
+    QStringList files;
+    for (int i = 0; i < 1000; ++i) {
+        files.append(QStringLiteral("file%1").arg(i));
+    }
+    m_testDir->createFiles(files);
+
+    QSignalSpy canceledSpy(m_lister, static_cast<void(KFileItemModelDirLister::*)()>(&KFileItemModelDirLister::canceled));
+    QSignalSpy directoryCanceledSpy(m_lister, static_cast<void(KFileItemModelDirLister::*)(const QUrl&)>(&KFileItemModelDirLister::canceled));
+    QSignalSpy completedSpy(m_lister, static_cast<void(KFileItemModelDirLister::*)()>(&KFileItemModelDirLister::completed));
+
+    QVERIFY(m_lister->openUrl(m_testDir->url()));
+    QVERIFY(!m_lister->isListingFinished());
+
+    // The items are delivered asynchronously, so none of them may
+    // be emitted after the listing has been stopped.
+    m_lister->stop();
+    QCOMPARE(canceledSpy.count(), 1);
+    QCOMPARE(directoryCanceledSpy.count(), 1);
+    QCOMPARE(directoryCanceledSpy.first().first().toUrl(), m_testDir->url());
+    QVERIFY(m_lister->isListingFinished());
+
+    QVERIFY(!completedSpy.wait(500));
+    QVERIFY(m_addedNames.isEmpty());
+
+    // Stopping a finished listing has no effect
+    m_lister->stop();
+    QCOMPARE(canceledSpy.count(), 1);
+}
+
+void KFileItemModelDirListerTest::testAutoUpdate()
+{
+    m_testDir->createFiles({"a.txt", "b.txt"});
+
+    QVERIFY(m_lister->autoUpdate());
+    QVERIFY(listTestDirectory());
+    QCOMPARE(m_addedNames.count(), 2);
+
+    m_addedNames.clear();
+    m_testDir->createFile("c.txt");
+    QTRY_COMPARE_WITH_TIMEOUT(m_addedNames, QStringList() << "c.txt", 5000);
+
+    m_testDir->removeFile("a.txt");
+    QTRY_COMPARE_WITH_TIMEOUT(m_deletedNames, QStringList() << "a.txt", 5000);
+    QCOMPARE(m_addedNames, QStringList() << "c.txt");
+}
+
+bool KFileItemModelDirListerTest::listTestDirectory()
+{
+    QSignalSpy completedSpy(m_lister, static_cast<void(KFileItemModelDirLister::*)()>(&KFileItemModelDirLister::completed));
+    m_lister->openUrl(m_testDir->url());
+    return completedSpy.wait();
+}
+
+QTEST_GUILESS_MAIN(KFileItemModelDirListerTest)
+
+#include "kfileitemmodeldirlistertest.moc"
@@ -0,0 +1,235 @@
+/***************************************************************************
+ *   Copyright (C) 2019 by Dolphin developers <kfm-devel@kde.org>          *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA            *
+ ***************************************************************************/
+
+#include "kitemviews/kfileitemmodel.h"
+#include "kitemviews/kfileitemmodelrolesupdater.h"
+#include "kitemviews/private/kpreviewpixmapcache.h"
+#include "testdir.h"
+
+#include <QPixmap>
+#include <QSignalSpy>
+#include <QTest>
+
+class KFileItemModelRolesUpdaterTest : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void init();
+    void cleanup();
+
+    void testMaximumPreviewJobCount();
+    void testDistributeItems();
+    void testConcurrentPreviewJobs();
+    void testPreviewMemoryBudget();
+
+private:
+    bool loadDirectory(const QUrl& url);
+    bool hasPreview(int index) const;
+
+private:
+    KFileItemModel* m_model;
+    KFileItemModelRolesUpdater* m_updater;
+    TestDir* m_testDir;
+};
+
+void KFileItemModelRolesUpdaterTest::init()
+{
+    m_testDir = new TestDir();
+    m_model = new KFileItemModel();
+    m_updater = new KFileItemModelRolesUpdater(m_model);
+}
+
+void KFileItemModelRolesUpdaterTest::cleanup()
+{
+    delete m_updater;
+    m_updater = nullptr;
+
+    delete m_model;
+    m_model = nullptr;
+
+    delete m_testDir;
+    m_testDir = nullptr;
+}
+
+void KFileItemModelRolesUpdaterTest::testMaximumPreviewJobCount()
+{
+    m_testDir->createFile("a.txt");
+    QVERIFY(loadDirectory(m_testDir->url()));
+
+    const int jobCount = m_updater->maximumPreviewJobCount();
+    QVERIFY(jobCount >= 1);
+    QVERIFY(jobCount <= 8);
+    QCOMPARE(m_updater->m_previewJobCountDirectory, m_testDir->url());
+
+    // The value is not determined again as long as the directory is the same
+    m_updater->m_maximumPreviewJobCount = 42;
+    QCOMPARE(m_updater->maximumPreviewJobCount(), 42);
+
+    TestDir otherDir;
+    otherDir.createFile("b.txt");
+    QVERIFY(loadDirectory(otherDir.url()));
+    QCOMPARE(m_updater->maximumPreviewJobCount(), jobCount);
+    QCOMPARE(m_updater->m_previewJobCountDirectory, otherDir.url());
+}
+
+void KFileItemModelRolesUpdaterTest::testDistributeItems()
+{
+    KFileItemList items;
+    for (int i = 0; i < 10; ++i) {
+        items.append(KFileItem(QUrl::fromLocalFile(m_testDir->path() + QStringLiteral("/%1").arg(i)),
+                               QString(), KFileItem::Unknown));
+    }
+
+    // The items are split in turn, so each job keeps the order of the items
+    QVector<KFileItemList> jobItems = KFileItemModelRolesUpdater::distributeItems(items, 3);
+    QCOMPARE(jobItems.count(), 3);
+    QCOMPARE(jobItems.at(0), KFileItemList() << items.at(0) << items.at(3) << items.at(6) << items.at(9));
+    QCOMPARE(jobItems.at(1), KFileItemList() << items.at(1) << items.at(4) << items.at(7));
+    QCOMPARE(jobItems.at(2), KFileItemList() << items.at(2) << items.at(5) << items.at(8));
+
+    // Fewer jobs are used if there are fewer items than jobs
+    jobItems = KFileItemModelRolesUpdater::distributeItems(items.mid(0, 2), 4);
+    QCOMPARE(jobItems.count(), 2);
+    QCOMPARE(jobItems.at(0), KFileItemList() << items.at(0));
+    QCOMPARE(jobItems.at(1), KFileItemList() << items.at(1));
+
+    jobItems = KFileItemModelRolesUpdater::distributeItems(items, 1);
+    QCOMPARE(jobItems.count(), 1);
+    QCOMPARE(jobItems.at(0), items);
+
+    QVERIFY(KFileItemModelRolesUpdater::distributeItems(KFileItemList(), 4).isEmpty());
+}
+
+void KFileItemModelRolesUpdaterTest::testConcurrentPreviewJobs()
+{
+    QStringList files;
+    for (int i = 0; i < 300; ++i) {
+        files.append(QStringLiteral("image%1.png").arg(i));
+    }
+    m_testDir->createFiles(files);
+    QVERIFY(loadDirectory(m_testDir->url()));
+
+    m_updater->setIconSize(QSize(128, 128));
+    m_updater->setVisibleIndexRange(0, 50);
+    m_updater->setPreviewsShown(true);
+
+    // The preview jobs are started synchronously. Never more than the
+    // maximum number of jobs run concurrently.
+    const int maximumJobCount = m_updater->maximumPreviewJobCount();
+    const int jobCount = m_updater->m_previewJobs.count();
+    QVERIFY(jobCount >= 1);
+    QVERIFY(jobCount <= maximumJobCount);
+    if (maximumJobCount > 1) {
+        QVERIFY(jobCount > 1);
+    }
+}
+
+void KFileItemModelRolesUpdaterTest::testPreviewMemoryBudget()
+{
+    QStringList files;
+    for (int i = 0; i < 100; ++i) {
+        files.append(QStringLiteral("file%1.txt").arg(i, 3, 10, QLatin1Char('0')));
+    }
+    m_testDir->createFiles(files);
+    QVERIFY(loadDirectory(m_testDir->url()));
+    QCOMPARE(m_model->count(), 100);
+
+    const QSize iconSize(32, 32);
+    m_updater->setIconSize(iconSize);
+    m_updater->setMaximumVisibleItems(10);
+    m_updater->setVisibleIndexRange(0, 10);
+
+    // The previews are taken from the cache, so that no preview plugins
+    // are required. The budget is sufficient for 30 previews.
+    KPreviewPixmapCache& cache = KPreviewPixmapCache::instance();
+    cache.clear();
+    QPixmap pixmap(iconSize);
+    pixmap.fill(Qt::red);
+    for (int i = 0; i < m_model->count(); ++i) {
+        const KFileItem item = m_model->fileItem(i);
+        const QStringList overlays = item.overlays() + m_updater->pluginOverlays(item.url());
+        cache.insert(m_updater->previewCacheKey(item, overlays), pixmap);
+    }
+    const qint64 previewBytes = qint64(pixmap.width()) * pixmap.height() * pixmap.depth() / 8;
+    m_updater->setPreviewMemoryBudget(30 * previewBytes);
+
+    auto previewsFinished = [this]() {
+        return m_updater->m_pendingItems.isEmpty() && m_updater->m_previewJobs.isEmpty();
+    };
+
+    m_updater->setPreviewsShown(true);
+    QTRY_VERIFY_WITH_TIMEOUT(previewsFinished(), 5000);
+
+    // The previews far away from the visible area have been evicted
+    QVERIFY(m_updater->previewMemoryUsage() <= m_updater->previewMemoryBudget());
+    for (int i = 0; i < 10; ++i) {
+        QVERIFY(hasPreview(i));
+    }
+    QVERIFY(!hasPreview(99));
+
+    // Scrolling by one item does not queue the evicted items again which
+    // are behind the read-ahead range of 5 pages.
+    QList<int> evictedIndexes;
+    for (int i = 61; i < m_model->count(); ++i) {
+        if (m_updater->m_evictedItems.contains(m_model->fileItem(i))) {
+            evictedIndexes.append(i);
+        }
+    }
+    QVERIFY(evictedIndexes.contains(99));
+
+    m_updater->setVisibleIndexRange(1, 10);
+    foreach (int index, evictedIndexes) {
+        QVERIFY(!m_updater->m_pendingItems.contains(m_model->fileItem(index)));
+    }
+    QTRY_VERIFY_WITH_TIMEOUT(previewsFinished(), 5000);
+    foreach (int index, evictedIndexes) {
+        QVERIFY(!hasPreview(index));
+        QVERIFY(m_updater->m_evictedItems.contains(m_model->fileItem(index)));
+    }
+
+    // The evicted previews are created again when the items become visible,
+    // and the previews far away from the new visible area are evicted
+    m_updater->setVisibleIndexRange(90, 10);
+    QTRY_VERIFY_WITH_TIMEOUT(previewsFinished(), 5000);
+
+    QVERIFY(m_updater->previewMemoryUsage() <= m_updater->previewMemoryBudget());
+    for (int i = 90; i < 100; ++i) {
+        QVERIFY(hasPreview(i));
+    }
+    QVERIFY(!hasPreview(0));
+
+    cache.clear();
+}
+
+bool KFileItemModelRolesUpdaterTest::loadDirectory(const QUrl& url)
+{
+    QSignalSpy loadingCompletedSpy(m_model, &KFileItemModel::directoryLoadingCompleted);
+    m_model->loadDirectory(url);
+    return loadingCompletedSpy.wait();
+}
+
+bool KFileItemModelRolesUpdaterTest::hasPreview(int index) const
+{
+    return !m_model->data(index).value("iconPixmap").value<QPixmap>().isNull();
+}
+
+QTEST_MAIN(KFileItemModelRolesUpdaterTest)
+
+#include "kfileitemmodelrolesupdatertest.moc"
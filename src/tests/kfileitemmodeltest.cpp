@@ -19,13 +19,19 @@
  ***************************************************************************/
 
 #include <QTest>
+#include <QElapsedTimer>
 #include <QSignalSpy>
 #include <QTimer>
 #include <QMimeData>
+#include <QStandardPaths>
+#include <QThreadPool>
+
+#include <algorithm>
 
 #include <kio/job.h>
 
 #include "kitemviews/kfileitemmodel.h"
+#include "kitemviews/private/kfileitemmodelchangecoalescer.h"
 #include "kitemviews/private/kfileitemmodeldirlister.h"
 #include "testdir.h"
 
@@ -58,6 +64,7 @@ class KFileItemModelTest : public QObject
     Q_OBJECT
 
 private slots:
+    void initTestCase();
     void init();
     void cleanup();
 
@@ -66,33 +73,49 @@ private slots:
     void testDefaultGroupedSorting();
     void testNewItems();
     void testRemoveItems();
+    void testItemDataArena();
     void testDirLoadingCompleted();
     void testSetData();
+    void testSetDataWithStoredRoles();
+    void testSetItemsData();
+    void testDataCache();
     void testSetDataWithModifiedSortRole_data();
     void testSetDataWithModifiedSortRole();
     void testChangeSortRole();
     void testResortAfterChangingName();
+    void testResortChangedItems();
     void testModelConsistencyWhenInsertingItems();
     void testItemRangeConsistencyWhenInsertingItems();
+    void testItemsAddedInBatches();
     void testExpandItems();
     void testExpandParentItems();
+    void testRestoreExpandedDirectoriesInWaves();
+    void testSnapshot();
     void testMakeExpandedItemHidden();
     void testRemoveFilteredExpandedItems();
     void testSorting();
+    void testReverseSortOrderWithGroups();
+    void testSortByNumericRole();
     void testIndexForKeyboardSearch();
     void testNameFilter();
     void testEmptyPath();
     void testRefreshExpandedItem();
     void testRemoveHiddenItems();
+    void testToggleHiddenItemsWithoutListing();
     void collapseParentOfHiddenItems();
     void removeParentOfHiddenItems();
     void testGeneralParentChildRelationships();
     void testNameRoleGroups();
     void testNameRoleGroupsWithExpandedItems();
+    void testTimeRoleGroupsAfterDayChange();
+    void testGroupsAfterInsertingAndRemovingItems();
     void testInconsistentModel();
     void testChangeRolesForFilteredItems();
     void testChangeSortRoleWhileFiltering();
     void testRefreshFilteredItems();
+    void testRefreshDirectoryKeepsUnchangedItems();
+    void testCoalesceChanges();
+    void testCoalescerWindowDecay();
     void testCollapseFolderWhileLoading();
     void testCreateMimeData();
     void testDeleteFileMoreThanOnce();
@@ -105,6 +128,12 @@ private:
     TestDir* m_testDir;
 };
 
+void KFileItemModelTest::initTestCase()
+{
+    // Snapshots and other cached data must not be written to the user's cache
+    QStandardPaths::setTestModeEnabled(true);
+}
+
 void KFileItemModelTest::init()
 {
     // The item-model tests result in a huge number of debugging
@@ -197,6 +226,37 @@ void KFileItemModelTest::testRemoveItems()
     QVERIFY(m_model->isConsistent());
 }
 
+void KFileItemModelTest::testItemDataArena()
+{
+    KFileItemList items;
+    for (int i = 0; i < 1500; ++i) {
+        items << KFileItem(QUrl::fromLocalFile(m_testDir->path() + '/' + QString::number(i)), QString(), KFileItem::Unknown);
+    }
+
+    m_model->slotItemsAdded(m_model->directory(), items);
+    m_model->slotCompleted();
+    QCOMPARE(m_model->count(), 1500);
+    QCOMPARE(m_model->m_itemDataArena.count(), 1500);
+    QCOMPARE(m_model->m_itemDataArena.slabCount(), 2);
+
+    // The slots of removed items are reused.
+    m_model->slotItemsDeleted(items.mid(0, 100));
+    QCOMPARE(m_model->count(), 1400);
+    QCOMPARE(m_model->m_itemDataArena.count(), 1400);
+
+    m_model->slotItemsAdded(m_model->directory(), items.mid(0, 100));
+    m_model->slotCompleted();
+    QCOMPARE(m_model->count(), 1500);
+    QCOMPARE(m_model->m_itemDataArena.count(), 1500);
+    QCOMPARE(m_model->m_itemDataArena.slabCount(), 2);
+    QVERIFY(m_model->isConsistent());
+
+    m_model->slotClear();
+    QCOMPARE(m_model->count(), 0);
+    QCOMPARE(m_model->m_itemDataArena.count(), 0);
+    QCOMPARE(m_model->m_itemDataArena.slabCount(), 0);
+}
+
 void KFileItemModelTest::testDirLoadingCompleted()
 {
     QSignalSpy loadingCompletedSpy(m_model, &KFileItemModel::directoryLoadingCompleted);
@@ -265,6 +325,126 @@ void KFileItemModelTest::testSetData()
     QVERIFY(m_model->isConsistent());
 }
 
+void KFileItemModelTest::testSetItemsData()
+{
+    QSignalSpy itemsInsertedSpy(m_model, &KFileItemModel::itemsInserted);
+    QVERIFY(itemsInsertedSpy.isValid());
+    QSignalSpy itemsChangedSpy(m_model, &KFileItemModel::itemsChanged);
+    QVERIFY(itemsChangedSpy.isValid());
+
+    m_testDir->createFiles({"a.txt", "b.txt", "c.txt", "d.txt"});
+
+    m_model->loadDirectory(m_testDir->url());
+    QVERIFY(itemsInsertedSpy.wait());
+    QCOMPARE(m_model->count(), 4);
+
+    QHash<int, QHash<QByteArray, QVariant> > itemsData;
+    itemsData[0].insert("customRole1", "Test0");
+    itemsData[1].insert("customRole1", "Test1");
+    itemsData[3].insert("customRole1", "Test3");
+
+    // All items are changed with one signal.
+    m_model->setItemsData(itemsData);
+    QCOMPARE(itemsChangedSpy.count(), 1);
+    QCOMPARE(itemsChangedSpy.first().at(0).value<KItemRangeList>(), KItemRangeList() << KItemRange(0, 2) << KItemRange(3, 1));
+    QCOMPARE(itemsChangedSpy.first().at(1).value<QSet<QByteArray> >(), QSet<QByteArray>() << "customRole1");
+
+    QCOMPARE(m_model->data(0).value("customRole1").toString(), QString("Test0"));
+    QCOMPARE(m_model->data(1).value("customRole1").toString(), QString("Test1"));
+    QVERIFY(!m_model->data(2).contains("customRole1"));
+    QCOMPARE(m_model->data(3).value("customRole1").toString(), QString("Test3"));
+
+    // Setting the same values again does not emit a signal.
+    m_model->setItemsData(itemsData);
+    QCOMPARE(itemsChangedSpy.count(), 1);
+    QVERIFY(m_model->isConsistent());
+}
+
+void KFileItemModelTest::testDataCache()
+{
+    QSignalSpy itemsInsertedSpy(m_model, &KFileItemModel::itemsInserted);
+    QVERIFY(itemsInsertedSpy.isValid());
+
+    m_testDir->createFiles({"a.txt", "b.txt"});
+
+    m_model->loadDirectory(m_testDir->url());
+    QVERIFY(itemsInsertedSpy.wait());
+    QCOMPARE(m_model->count(), 2);
+
+    // Accessing the values again does not build them again.
+    const QHash<QByteArray, QVariant> values = m_model->data(0);
+    QVERIFY(values.isSharedWith(m_model->data(0)));
+
+    // Changed values are returned immediately.
+    QHash<QByteArray, QVariant> newValues;
+    newValues.insert("customRole1", "Test1");
+    m_model->setData(0, newValues);
+    QCOMPARE(m_model->data(0).value("customRole1").toString(), QString("Test1"));
+    QVERIFY(!m_model->data(1).contains("customRole1"));
+
+    QHash<int, QHash<QByteArray, QVariant> > itemsData;
+    itemsData[1].insert("customRole1", "Test2");
+    m_model->setItemsData(itemsData);
+    QCOMPARE(m_model->data(1).value("customRole1").toString(), QString("Test2"));
+
+    // Renaming an item changes its URL.
+    newValues.clear();
+    newValues.insert("text", "c.txt");
+    m_model->setData(0, newValues);
+    const int index = m_model->index(QUrl::fromLocalFile(m_testDir->path() + "/c.txt"));
+    QVERIFY(index >= 0);
+    QCOMPARE(m_model->data(index).value("url").toUrl(), QUrl::fromLocalFile(m_testDir->path() + "/c.txt"));
+    QVERIFY(m_model->isConsistent());
+}
+
+void KFileItemModelTest::testSetDataWithStoredRoles()
+{
+    QSignalSpy itemsInsertedSpy(m_model, &KFileItemModel::itemsInserted);
+    QVERIFY(itemsInsertedSpy.isValid());
+    QSignalSpy itemsChangedSpy(m_model, &KFileItemModel::itemsChanged);
+    QVERIFY(itemsChangedSpy.isValid());
+
+    m_testDir->createDir("a");
+
+    m_model->loadDirectory(m_testDir->url());
+    QVERIFY(itemsInsertedSpy.wait());
+    QCOMPARE(m_model->count(), 1);
+
+    // Roles with typed storage ("size" of directories, "type", "iconName",
+    // "isExpandable") and roles in the sparse storage ("rating").
+    QHash<QByteArray, QVariant> values;
+    values.insert("size", 3);
+    values.insert("type", "Folder");
+    values.insert("iconName", "folder");
+    values.insert("isExpandable", false);
+    values.insert("rating", 8);
+
+    QVERIFY(m_model->setData(0, values));
+    QCOMPARE(itemsChangedSpy.count(), 1);
+
+    const QHash<QByteArray, QVariant> data = m_model->data(0);
+    QCOMPARE(data.value("text").toString(), QString("a"));
+    QCOMPARE(data.value("size").toInt(), 3);
+    QCOMPARE(data.value("type").toString(), QString("Folder"));
+    QCOMPARE(data.value("iconName").toString(), QString("folder"));
+    QCOMPARE(data.value("isExpandable").toBool(), false);
+    QCOMPARE(data.value("rating").toInt(), 8);
+    QVERIFY(!m_model->isExpandable(0));
+
+    // Setting the same values again does not result in a change.
+    QVERIFY(!m_model->setData(0, values));
+    QCOMPARE(itemsChangedSpy.count(), 1);
+
+    // Resetting the number of sub-items must not leave the old count behind.
+    QHash<QByteArray, QVariant> resetValues;
+    resetValues.insert("size", QVariant());
+    QVERIFY(m_model->setData(0, resetValues));
+    QCOMPARE(itemsChangedSpy.count(), 2);
+    QVERIFY(!m_model->data(0).value("size").isValid());
+    QCOMPARE(m_model->data(0).value("type").toString(), QString("Folder"));
+    QVERIFY(m_model->isConsistent());
+}
+
 void KFileItemModelTest::testSetDataWithModifiedSortRole_data()
 {
     QTest::addColumn<int>("changedIndex");
@@ -428,6 +608,43 @@ void KFileItemModelTest::testResortAfterChangingName()
     QCOMPARE(itemsInModel(), QStringList() << "a.txt" << "b.txt" << "c.txt");
 }
 
+void KFileItemModelTest::testResortChangedItems()
+{
+    QSignalSpy itemsInsertedSpy(m_model, &KFileItemModel::itemsInserted);
+    QSignalSpy itemsMovedSpy(m_model, &KFileItemModel::itemsMoved);
+    QVERIFY(itemsMovedSpy.isValid());
+
+    m_model->setSortRole("rating");
+
+    m_testDir->createFiles({"a", "b", "c", "d", "e", "f", "g", "h", "i", "j"});
+
+    m_model->loadDirectory(m_testDir->url());
+    QVERIFY(itemsInsertedSpy.wait());
+
+    // Give the files the ratings 10, 20, ..., 100. This does not change the order.
+    for (int index = 0; index < m_model->count(); ++index) {
+        QHash<QByteArray, QVariant> rating;
+        rating.insert("rating", (index + 1) * 10);
+        m_model->setData(index, rating);
+    }
+    QCOMPARE(itemsInModel(), QStringList() << "a" << "b" << "c" << "d" << "e" << "f" << "g" << "h" << "i" << "j");
+    QVERIFY(itemsMovedSpy.isEmpty());
+
+    // Only "b" has to be moved, and the itemsMoved() signal
+    // must only contain the range of the items in between.
+    QHash<QByteArray, QVariant> rating;
+    rating.insert("rating", 75);
+    m_model->setData(1, rating);
+
+    QVERIFY(itemsMovedSpy.wait());
+    QCOMPARE(itemsMovedSpy.count(), 1);
+    QCOMPARE(itemsMovedSpy.first().at(0).value<KItemRange>(), KItemRange(1, 6));
+    QCOMPARE(itemsMovedSpy.takeFirst().at(1).value<QList<int> >(), QList<int>() << 6 << 1 << 2 << 3 << 4 << 5);
+    QCOMPARE(itemsInModel(), QStringList() << "a" << "c" << "d" << "e" << "f" << "g" << "b" << "h" << "i" << "j");
+    QCOMPARE(m_model->index(QUrl::fromLocalFile(m_testDir->path() + "/b")), 6);
+    QVERIFY(m_model->isConsistent());
+}
+
 void KFileItemModelTest::testModelConsistencyWhenInsertingItems()
 {
     QSignalSpy itemsInsertedSpy(m_model, &KFileItemModel::itemsInserted);
@@ -509,6 +726,53 @@ void KFileItemModelTest::testItemRangeConsistencyWhenInsertingItems()
     QCOMPARE(itemRangeList, KItemRangeList() << KItemRange(0, 1) << KItemRange(1, 2) << KItemRange(2, 1));
 }
 
+/**
+ * Verifies that items which are added in several batches, and prepared by worker
+ * threads, are inserted correctly, even if the sort order is changed in between.
+ */
+void KFileItemModelTest::testItemsAddedInBatches()
+{
+    QVERIFY(m_model->m_itemBatchPipelineEnabled);
+
+    QStringList expectedItems;
+    QList<KFileItemList> batches;
+    for (int batch = 0; batch < 10; ++batch) {
+        KFileItemList items;
+        for (int i = 0; i < 20; ++i) {
+            // Spread the names of each batch over the whole range.
+            const QString name = QStringLiteral("item%1").arg(i * 10 + batch, 3, 10, QLatin1Char('0'));
+            items << KFileItem(QUrl::fromLocalFile(m_testDir->path() + '/' + name), QString(), KFileItem::Unknown);
+            expectedItems << name;
+        }
+        batches << items;
+    }
+    expectedItems.sort();
+
+    for (int batch = 0; batch < 5; ++batch) {
+        m_model->slotItemsAdded(m_model->directory(), batches.at(batch));
+    }
+    QVERIFY(!m_model->m_pendingItemBatches.isEmpty());
+    QCOMPARE(m_model->count(), 0);
+
+    m_model->setSortOrder(Qt::DescendingOrder);
+    QVERIFY(m_model->m_pendingItemBatches.isEmpty());
+    QVERIFY(m_model->m_preparedItems.isEmpty());
+
+    for (int batch = 5; batch < batches.count(); ++batch) {
+        m_model->slotItemsAdded(m_model->directory(), batches.at(batch));
+    }
+    m_model->slotCompleted();
+
+    std::reverse(expectedItems.begin(), expectedItems.end());
+    QCOMPARE(itemsInModel(), expectedItems);
+    QVERIFY(m_model->isConsistent());
+
+    m_model->setSortOrder(Qt::AscendingOrder);
+    std::reverse(expectedItems.begin(), expectedItems.end());
+    QCOMPARE(itemsInModel(), expectedItems);
+    QVERIFY(m_model->isConsistent());
+}
+
 void KFileItemModelTest::testExpandItems()
 {
     QSignalSpy itemsInsertedSpy(m_model, &KFileItemModel::itemsInserted);
@@ -722,6 +986,142 @@ void KFileItemModelTest::testExpandParentItems()
     QVERIFY(m_model->isConsistent());
 }
 
+/**
+ * Verify that restoring the expanded folders of a deep tree lists all
+ * folders of one level concurrently instead of one folder after another.
+ */
+void KFileItemModelTest::testRestoreExpandedDirectoriesInWaves()
+{
+    QSignalSpy loadingCompletedSpy(m_model, &KFileItemModel::directoryLoadingCompleted);
+
+    QSet<QByteArray> modelRoles = m_model->roles();
+    modelRoles << "isExpanded" << "isExpandable" << "expandedParentsCount";
+    m_model->setRoles(modelRoles);
+
+    // Create a tree with three levels of three folders each, which results
+    // in 39 folders. Each folder on the last level contains one file.
+    const QStringList names = {"a", "b", "c"};
+    QStringList files;
+    QSet<QUrl> expandedUrls;
+    foreach (const QString& level1, names) {
+        expandedUrls.insert(QUrl::fromLocalFile(m_testDir->path() + '/' + level1));
+        foreach (const QString& level2, names) {
+            expandedUrls.insert(QUrl::fromLocalFile(m_testDir->path() + '/' + level1 + '/' + level2));
+            foreach (const QString& level3, names) {
+                const QString path = level1 + '/' + level2 + '/' + level3;
+                expandedUrls.insert(QUrl::fromLocalFile(m_testDir->path() + '/' + path));
+                files << path + "/file";
+            }
+        }
+    }
+    m_testDir->createFiles(files);
+
+    // Remember the maximum number of folders which are listed at the same time.
+    int maximumFoldersBeingExpanded = 0;
+    connect(m_model, &KFileItemModel::itemsInserted, this, [this, &maximumFoldersBeingExpanded]() {
+        maximumFoldersBeingExpanded = qMax(maximumFoldersBeingExpanded, m_model->m_urlsBeingExpanded.count());
+    });
+
+    // Remember the level of each folder when its listing is started.
+    QList<int> startedLevels;
+    connect(m_model->m_dirLister, &KFileItemModelDirLister::started, this, [this, &startedLevels](const QUrl& url) {
+        const QString relativePath = url.adjusted(QUrl::StripTrailingSlash).toLocalFile().mid(m_testDir->path().length());
+        startedLevels.append(relativePath.count('/'));
+    });
+
+    m_model->restoreExpandedDirectories(expandedUrls);
+    m_model->loadDirectory(m_testDir->url());
+    QVERIFY(loadingCompletedSpy.wait());
+
+    // The completion is only reported after all folders have been expanded.
+    QCOMPARE(loadingCompletedSpy.count(), 1);
+    QCOMPARE(m_model->count(), 39 + 27);
+    QCOMPARE(m_model->expandedDirectories(), expandedUrls);
+    QVERIFY(m_model->isConsistent());
+
+    // All folders of a level are listed concurrently, so restoring the tree
+    // needs four round trips to the dir lister instead of one per folder.
+    QVERIFY(maximumFoldersBeingExpanded >= 3);
+
+    // A level is only expanded after all folders of the previous level have
+    // been expanded.
+    QCOMPARE(startedLevels.first(), 0);
+    QCOMPARE(startedLevels.last(), 3);
+    QVERIFY(std::is_sorted(startedLevels.constBegin(), startedLevels.constEnd()));
+}
+
+void KFileItemModelTest::testSnapshot()
+{
+    QStringList files;
+    for (int i = 0; i < KFileItemModel::SnapshotMinimumItemCount; ++i) {
+        files << QStringLiteral("file%1").arg(i);
+    }
+    m_testDir->createFiles(files);
+    KFileItemModelSnapshot::remove(m_testDir->url());
+
+    // Listing the directory and leaving it saves a snapshot.
+    QSignalSpy loadingCompletedSpy(m_model, &KFileItemModel::directoryLoadingCompleted);
+    m_model->setSnapshotsEnabled(true);
+    m_model->loadDirectory(m_testDir->url());
+    QVERIFY(loadingCompletedSpy.wait());
+    QCOMPARE(m_model->count(), files.count());
+
+    m_model->saveSnapshot();
+    QThreadPool::globalInstance()->waitForDone();
+    QVERIFY(QFile::exists(KFileItemModelSnapshot::filePath(m_testDir->url())));
+
+    // The items of the snapshot are shown immediately when loading the
+    // directory again. The real listing does not result in further changes.
+    KFileItemModel model;
+    model.m_dirLister->setAutoUpdate(false);
+    model.setSnapshotsEnabled(true);
+
+    QSignalSpy itemsInsertedSpy(&model, &KFileItemModel::itemsInserted);
+    QSignalSpy itemsRemovedSpy(&model, &KFileItemModel::itemsRemoved);
+    QSignalSpy snapshotLoadingCompletedSpy(&model, &KFileItemModel::directoryLoadingCompleted);
+
+    model.loadDirectory(m_testDir->url());
+    QCOMPARE(model.count(), files.count());
+    QCOMPARE(itemsInsertedSpy.count(), 1);
+    QVERIFY(model.isConsistent());
+
+    QVERIFY(snapshotLoadingCompletedSpy.wait());
+    QCOMPARE(model.count(), files.count());
+    QCOMPARE(itemsInsertedSpy.count(), 1);
+    QCOMPARE(itemsRemovedSpy.count(), 0);
+    QVERIFY(model.isConsistent());
+
+    // Adding a file changes the directory, which invalidates the snapshot.
+    m_testDir->createFile("new file");
+
+    KFileItemModel modelAfterChange;
+    modelAfterChange.m_dirLister->setAutoUpdate(false);
+    modelAfterChange.setSnapshotsEnabled(true);
+    QSignalSpy loadingAfterChangeCompletedSpy(&modelAfterChange, &KFileItemModel::directoryLoadingCompleted);
+    modelAfterChange.loadDirectory(m_testDir->url());
+    QCOMPARE(modelAfterChange.count(), 0);
+    QVERIFY(!QFile::exists(KFileItemModelSnapshot::filePath(m_testDir->url())));
+
+    // The items are not marked as sorted while a resorting is pending.
+    QVERIFY(loadingAfterChangeCompletedSpy.wait());
+    QCOMPARE(modelAfterChange.count(), files.count() + 1);
+    modelAfterChange.m_resortAllItemsTimer->start();
+    modelAfterChange.saveSnapshot();
+    QThreadPool::globalInstance()->waitForDone();
+    modelAfterChange.m_resortAllItemsTimer->stop();
+
+    KFileItemModelSnapshot::DirectoryStamp stamp;
+    QVERIFY(KFileItemModelSnapshot::directoryStamp(m_testDir->url(), &stamp));
+    KFileItemModelSnapshot snapshot;
+    QVERIFY(snapshot.load(m_testDir->url(), stamp));
+    QCOMPARE(snapshot.items().count(), files.count() + 1);
+    QCOMPARE(snapshot.sortedItemCount(), 0);
+
+    // Pruning the cache removes the snapshots that exceed its size.
+    KFileItemModelSnapshot::prune(0);
+    QVERIFY(!QFile::exists(KFileItemModelSnapshot::filePath(m_testDir->url())));
+}
+
 /**
  * Renaming an expanded folder by prepending its name with a dot makes it
  * hidden. Verify that this does not cause an inconsistent model state and
@@ -950,6 +1350,79 @@ void KFileItemModelTest::testSorting()
     // TODO: Sort by other roles; show/hide hidden files
 }
 
+/**
+ * Verify that the groups are still correct after reversing the sort
+ * order, which reuses the groups instead of determining them again.
+ */
+void KFileItemModelTest::testReverseSortOrderWithGroups()
+{
+    QSignalSpy itemsInsertedSpy(m_model, &KFileItemModel::itemsInserted);
+    QSignalSpy itemsMovedSpy(m_model, &KFileItemModel::itemsMoved);
+
+    m_testDir->createDir("a1");
+    m_testDir->createDir("b1");
+    m_testDir->createFiles({"b2", "c2"});
+
+    m_model->setGroupedSorting(true);
+    m_model->loadDirectory(m_testDir->url());
+    QVERIFY(itemsInsertedSpy.wait());
+    QCOMPARE(itemsInModel(), QStringList() << "a1" << "b1" << "b2" << "c2");
+    QCOMPARE(m_model->groups().count(), 3);
+
+    m_model->setSortOrder(Qt::DescendingOrder);
+    QCOMPARE(itemsInModel(), QStringList() << "b1" << "a1" << "c2" << "b2");
+    QCOMPARE(itemsMovedSpy.count(), 1);
+
+    QList<QPair<int, QVariant> > groups = m_model->groups();
+    QCOMPARE(groups.count(), 4);
+    m_model->m_groups.clear();
+    QCOMPARE(m_model->groups(), groups);
+
+    m_model->setSortDirectoriesFirst(false);
+    QCOMPARE(itemsInModel(), QStringList() << "c2" << "b2" << "b1" << "a1");
+    QCOMPARE(m_model->groups().count(), 3);
+
+    m_model->setSortOrder(Qt::AscendingOrder);
+    QCOMPARE(itemsInModel(), QStringList() << "a1" << "b1" << "b2" << "c2");
+
+    groups = m_model->groups();
+    QCOMPARE(groups.count(), 3);
+    m_model->m_groups.clear();
+    QCOMPARE(m_model->groups(), groups);
+}
+
+void KFileItemModelTest::testSortByNumericRole()
+{
+    QSignalSpy itemsInsertedSpy(m_model, &KFileItemModel::itemsInserted);
+
+    m_testDir->createFiles({"a", "b", "c", "d", "e", "f"});
+    m_testDir->createDir("g");
+
+    m_model->loadDirectory(m_testDir->url());
+    QVERIFY(itemsInsertedSpy.wait());
+    QCOMPARE(itemsInModel(), QStringList() << "g" << "a" << "b" << "c" << "d" << "e" << "f");
+
+    const QList<int> ratings = {-1, 30, 10, 30, 20, 10, 0};
+    for (int index = 0; index < m_model->count(); ++index) {
+        QHash<QByteArray, QVariant> rating;
+        rating.insert("rating", ratings.at(index));
+        m_model->setData(index, rating);
+    }
+
+    // Items with equal ratings are sorted by their names.
+    m_model->setSortRole("rating");
+    QCOMPARE(itemsInModel(), QStringList() << "g" << "f" << "b" << "e" << "d" << "a" << "c");
+    QVERIFY(m_model->isConsistent());
+
+    m_model->setSortOrder(Qt::DescendingOrder);
+    QCOMPARE(itemsInModel(), QStringList() << "g" << "c" << "a" << "d" << "e" << "b" << "f");
+    QVERIFY(m_model->isConsistent());
+
+    m_model->setSortDirectoriesFirst(false);
+    QCOMPARE(itemsInModel(), QStringList() << "c" << "a" << "d" << "e" << "b" << "f" << "g");
+    QVERIFY(m_model->isConsistent());
+}
+
 void KFileItemModelTest::testIndexForKeyboardSearch()
 {
     QSignalSpy itemsInsertedSpy(m_model, &KFileItemModel::itemsInserted);
@@ -997,6 +1470,30 @@ void KFileItemModelTest::testIndexForKeyboardSearch()
     QCOMPARE(m_model->indexForKeyboardSearch("TexT", 5), 5);
     QCOMPARE(m_model->indexForKeyboardSearch("IMAGE", 4), 2);
 
+    // Inserting and removing items updates the search index
+    QSignalSpy itemsRemovedSpy(m_model, &KFileItemModel::itemsRemoved);
+
+    m_testDir->createFile("b");
+    m_model->m_dirLister->updateDirectory(m_testDir->url());
+    QVERIFY(itemsInsertedSpy.wait());
+    QCOMPARE(m_model->indexForKeyboardSearch("b", 0), 2);
+    QCOMPARE(m_model->indexForKeyboardSearch("image.png", 0), 4);
+
+    m_testDir->removeFile("aa");
+    m_model->m_dirLister->updateDirectory(m_testDir->url());
+    QVERIFY(itemsRemovedSpy.wait());
+    QCOMPARE(m_model->indexForKeyboardSearch("aa", 0), -1);
+    QCOMPARE(m_model->indexForKeyboardSearch("b", 0), 1);
+    QCOMPARE(m_model->indexForKeyboardSearch("text11", 0), 7);
+
+    // Renaming an item updates the search index
+    QHash<QByteArray, QVariant> data;
+    data.insert("text", "zz");
+    m_model->setData(1, data);
+    QCOMPARE(m_model->indexForKeyboardSearch("b", 0), -1);
+    QCOMPARE(m_model->indexForKeyboardSearch("z", 0), 1);
+    QCOMPARE(m_model->indexForKeyboardSearch("text11", 0), 7);
+
     // TODO: Maybe we should also test keyboard searches in directories which are not sorted by Name?
 }
 
@@ -1026,6 +1523,38 @@ void KFileItemModelTest::testNameFilter()
 
     m_model->setNameFilter(QString()); // Shows again all items
     QCOMPARE(m_model->count(), 5);
+
+    // Wildcard expressions
+    m_model->setNameFilter("a*");
+    QCOMPARE(itemsInModel(), QStringList() << "A1" << "A2" << "Abc");
+
+    m_model->setNameFilter("a1*");
+    QCOMPARE(itemsInModel(), QStringList() << "A1");
+
+    m_model->setNameFilter("*C");
+    QCOMPARE(itemsInModel(), QStringList() << "Abc");
+
+    m_model->setNameFilter("*d*");
+    QCOMPARE(itemsInModel(), QStringList() << "Bcd" << "Cde");
+
+    m_model->setNameFilter("?b?");
+    QCOMPARE(itemsInModel(), QStringList() << "Abc");
+
+    m_model->setNameFilter("[ab]*");
+    QCOMPARE(itemsInModel(), QStringList() << "A1" << "A2" << "Abc" << "Bcd");
+
+    m_model->setNameFilter("[!ab]*");
+    QCOMPARE(itemsInModel(), QStringList() << "Cde");
+
+    m_model->setNameFilter("*");
+    QCOMPARE(m_model->count(), 5);
+
+    // An unterminated character set is used as sub-string
+    m_model->setNameFilter("[a");
+    QCOMPARE(m_model->count(), 0);
+
+    m_model->setNameFilter(QString());
+    QCOMPARE(m_model->count(), 5);
 }
 
 /**
@@ -1136,6 +1665,55 @@ void KFileItemModelTest::testRemoveHiddenItems()
     m_model->setShowHiddenFiles(false);
 }
 
+/**
+ * Verify that showing hidden files or directories only does not list
+ * the directory again, and that renamed items are moved between the
+ * shown and the hidden items.
+ */
+void KFileItemModelTest::testToggleHiddenItemsWithoutListing()
+{
+    m_testDir->createDir("a");
+    m_testDir->createDir(".b");
+    m_testDir->createFiles({".c", "d"});
+
+    QSignalSpy itemsInsertedSpy(m_model, &KFileItemModel::itemsInserted);
+    QSignalSpy loadingStartedSpy(m_model, &KFileItemModel::directoryLoadingStarted);
+
+    m_model->loadDirectory(m_testDir->url());
+    QVERIFY(itemsInsertedSpy.wait());
+    QCOMPARE(itemsInModel(), QStringList() << "a" << "d");
+    QCOMPARE(loadingStartedSpy.count(), 1);
+
+    m_model->setShowHiddenFiles(true);
+    QCOMPARE(itemsInModel(), QStringList() << ".b" << "a" << ".c" << "d");
+
+    m_model->setShowDirectoriesOnly(true);
+    QCOMPARE(itemsInModel(), QStringList() << ".b" << "a");
+
+    m_model->setShowHiddenFiles(false);
+    QCOMPARE(itemsInModel(), QStringList() << "a");
+
+    m_model->setShowDirectoriesOnly(false);
+    QCOMPARE(itemsInModel(), QStringList() << "a" << "d");
+    QVERIFY(m_model->isConsistent());
+
+    // Rename "d" to ".e" using the dir lister's refreshItems() signal.
+    const KFileItem fileItemD = m_model->fileItem(1);
+    KFileItem fileItemE = fileItemD;
+    QUrl urlE = fileItemE.url().adjusted(QUrl::RemoveFilename);
+    urlE.setPath(urlE.path() + ".e");
+    fileItemE.setUrl(urlE);
+
+    m_model->slotRefreshItems({qMakePair(fileItemD, fileItemE)});
+    QCOMPARE(itemsInModel(), QStringList() << "a");
+
+    m_model->setShowHiddenFiles(true);
+    QCOMPARE(itemsInModel(), QStringList() << ".b" << "a" << ".c" << ".e");
+    QVERIFY(m_model->isConsistent());
+
+    QCOMPARE(loadingStartedSpy.count(), 1);
+}
+
 /**
  * Verify that filtered items are removed when their parent is collapsed.
  */
@@ -1397,6 +1975,67 @@ void KFileItemModelTest::testNameRoleGroups()
     QCOMPARE(m_model->groups(), expectedGroups);
 }
 
+void KFileItemModelTest::testGroupsAfterInsertingAndRemovingItems()
+{
+    auto createItems = [this](const QStringList& names) {
+        KFileItemList items;
+        foreach (const QString& name, names) {
+            KIO::UDSEntry entry;
+            entry.insert(KIO::UDSEntry::UDS_NAME, name);
+            entry.insert(KIO::UDSEntry::UDS_FILE_TYPE, 0100000);    // S_IFREG might not be defined on non-Unix platforms.
+            items.append(KFileItem(entry, m_testDir->url(), false, true));
+        }
+        return items;
+    };
+
+    m_model->setGroupedSorting(true);
+    m_model->slotItemsAdded(m_testDir->url(), createItems({"a1", "a2", "c1", "c2"}));
+    m_model->slotCompleted();
+    QCOMPARE(itemsInModel(), QStringList() << "a1" << "a2" << "c1" << "c2");
+
+    QList<QPair<int, QVariant> > expectedGroups;
+    expectedGroups << QPair<int, QVariant>(0, QLatin1String("A"));
+    expectedGroups << QPair<int, QVariant>(2, QLatin1String("C"));
+    QCOMPARE(m_model->groups(), expectedGroups);
+
+    // The groups are updated incrementally and must match with
+    // the groups that are calculated for all items.
+    m_model->slotItemsAdded(m_testDir->url(), createItems({"b1", "b2"}));
+    m_model->slotCompleted();
+    expectedGroups.clear();
+    expectedGroups << QPair<int, QVariant>(0, QLatin1String("A"));
+    expectedGroups << QPair<int, QVariant>(2, QLatin1String("B"));
+    expectedGroups << QPair<int, QVariant>(4, QLatin1String("C"));
+    QCOMPARE(m_model->groups(), expectedGroups);
+    QCOMPARE(m_model->groups(), m_model->groupsForRange(0, m_model->count()));
+
+    m_model->slotItemsAdded(m_testDir->url(), createItems({"a3", "c3", "d1"}));
+    m_model->slotCompleted();
+    QCOMPARE(itemsInModel(), QStringList() << "a1" << "a2" << "a3" << "b1" << "b2" << "c1" << "c2" << "c3" << "d1");
+    expectedGroups.clear();
+    expectedGroups << QPair<int, QVariant>(0, QLatin1String("A"));
+    expectedGroups << QPair<int, QVariant>(3, QLatin1String("B"));
+    expectedGroups << QPair<int, QVariant>(5, QLatin1String("C"));
+    expectedGroups << QPair<int, QVariant>(8, QLatin1String("D"));
+    QCOMPARE(m_model->groups(), expectedGroups);
+    QCOMPARE(m_model->groups(), m_model->groupsForRange(0, m_model->count()));
+
+    m_model->slotItemsDeleted(createItems({"b1", "b2", "c3"}));
+    expectedGroups.clear();
+    expectedGroups << QPair<int, QVariant>(0, QLatin1String("A"));
+    expectedGroups << QPair<int, QVariant>(3, QLatin1String("C"));
+    expectedGroups << QPair<int, QVariant>(5, QLatin1String("D"));
+    QCOMPARE(m_model->groups(), expectedGroups);
+    QCOMPARE(m_model->groups(), m_model->groupsForRange(0, m_model->count()));
+
+    m_model->slotItemsDeleted(createItems({"a1", "a2", "a3"}));
+    expectedGroups.clear();
+    expectedGroups << QPair<int, QVariant>(0, QLatin1String("C"));
+    expectedGroups << QPair<int, QVariant>(2, QLatin1String("D"));
+    QCOMPARE(m_model->groups(), expectedGroups);
+    QCOMPARE(m_model->groups(), m_model->groupsForRange(0, m_model->count()));
+}
+
 void KFileItemModelTest::testNameRoleGroupsWithExpandedItems()
 {
     QSignalSpy itemsInsertedSpy(m_model, &KFileItemModel::itemsInserted);
@@ -1435,6 +2074,41 @@ void KFileItemModelTest::testNameRoleGroupsWithExpandedItems()
     QCOMPARE(m_model->groups(), expectedGroups);
 }
 
+void KFileItemModelTest::testTimeRoleGroupsAfterDayChange()
+{
+    QSignalSpy itemsInsertedSpy(m_model, &KFileItemModel::itemsInserted);
+
+    m_testDir->createFiles({"a", "b"});
+
+    m_model->setGroupedSorting(true);
+    m_model->setSortRole("modificationtime");
+    m_model->loadDirectory(m_testDir->url());
+    QVERIFY(itemsInsertedSpy.wait());
+
+    const QList<QPair<int, QVariant> > groups = m_model->groups();
+    QCOMPARE(groups.count(), 1);
+    QCOMPARE(m_model->m_groupsDate, QDate::currentDate());
+    QVERIFY(m_model->m_dayChangedTimer->isActive());
+
+    // Simulate that the groups have been calculated on the previous day.
+    // Their values must not be reused.
+    m_model->m_groups.first().second = QStringLiteral("Outdated");
+    m_model->m_groupsDate = QDate::currentDate().addDays(-1);
+    QCOMPARE(m_model->groups(), groups);
+
+    // The view is notified when the day changes
+    QSignalSpy groupsChangedSpy(m_model, &KFileItemModel::groupsChanged);
+    m_model->slotDayChanged();
+    QCOMPARE(groupsChangedSpy.count(), 1);
+    QCOMPARE(m_model->groups(), groups);
+
+    // Groups of other roles do not depend on the date
+    m_model->setSortRole("text");
+    m_model->groups();
+    QVERIFY(!m_model->m_groupsDate.isValid());
+    QVERIFY(!m_model->m_dayChangedTimer->isActive());
+}
+
 void KFileItemModelTest::testInconsistentModel()
 {
     QSignalSpy itemsInsertedSpy(m_model, &KFileItemModel::itemsInserted);
@@ -1618,6 +2292,130 @@ void KFileItemModelTest::testRefreshFilteredItems()
     QCOMPARE(itemsInModel(), QStringList() << "a.txt" << "b.txt" << "d.jpg" << "e.jpg");
 }
 
+void KFileItemModelTest::testRefreshDirectoryKeepsUnchangedItems()
+{
+    QSignalSpy loadingCompletedSpy(m_model, &KFileItemModel::directoryLoadingCompleted);
+
+    m_testDir->createFiles({"a", "b", "c"});
+
+    m_model->loadDirectory(m_testDir->url());
+    QVERIFY(loadingCompletedSpy.wait());
+    QCOMPARE(itemsInModel(), QStringList() << "a" << "b" << "c");
+
+    // Values of unchanged items, e.g. resolved roles, must survive a refresh.
+    QHash<QByteArray, QVariant> values;
+    values.insert("testValue", 42);
+    m_model->setData(1, values);
+
+    m_testDir->removeFile("a");
+    m_testDir->createFile("c", "changed content");
+    m_testDir->createFile("d");
+
+    QSignalSpy itemsInsertedSpy(m_model, &KFileItemModel::itemsInserted);
+    QSignalSpy itemsRemovedSpy(m_model, &KFileItemModel::itemsRemoved);
+    QSignalSpy itemsChangedSpy(m_model, &KFileItemModel::itemsChanged);
+
+    m_model->refreshDirectory(m_testDir->url());
+    QVERIFY(loadingCompletedSpy.wait());
+
+    QCOMPARE(itemsInModel(), QStringList() << "b" << "c" << "d");
+    QCOMPARE(m_model->data(0).value("testValue").toInt(), 42);
+    QVERIFY(m_model->isConsistent());
+
+    // Only the differences result in signals.
+    QCOMPARE(itemsRemovedSpy.count(), 1);
+    QCOMPARE(itemsRemovedSpy.first().at(0).value<KItemRangeList>(), KItemRangeList() << KItemRange(0, 1));
+    QCOMPARE(itemsInsertedSpy.count(), 1);
+    QCOMPARE(itemsInsertedSpy.first().at(0).value<KItemRangeList>(), KItemRangeList() << KItemRange(2, 1));
+    QCOMPARE(itemsChangedSpy.count(), 1);
+    QCOMPARE(itemsChangedSpy.first().at(0).value<KItemRangeList>(), KItemRangeList() << KItemRange(1, 1));
+}
+
+void KFileItemModelTest::testCoalesceChanges()
+{
+    QSignalSpy loadingCompletedSpy(m_model, &KFileItemModel::directoryLoadingCompleted);
+
+    m_testDir->createFiles({"a", "b"});
+
+    m_model->loadDirectory(m_testDir->url());
+    QVERIFY(loadingCompletedSpy.wait());
+    QCOMPARE(itemsInModel(), QStringList() << "a" << "b");
+
+    QSignalSpy itemsInsertedSpy(m_model, &KFileItemModel::itemsInserted);
+    QSignalSpy itemsRemovedSpy(m_model, &KFileItemModel::itemsRemoved);
+
+    const QUrl dirUrl = m_testDir->url();
+    const KFileItem itemB = m_model->fileItem(1);
+    const KFileItem itemC(QUrl::fromLocalFile(m_testDir->path() + "/c"), QString(), KFileItem::Unknown);
+    const KFileItem itemTmp(QUrl::fromLocalFile(m_testDir->path() + "/tmp"), QString(), KFileItem::Unknown);
+
+    // Simulate a storm of changes: "b" is refreshed repeatedly, "tmp" is
+    // created and removed again, and "c" is created.
+    for (int i = 0; i < 10; ++i) {
+        m_model->slotListerRefreshItems({qMakePair(itemB, itemB)});
+    }
+    m_model->slotListerItemsAdded(dirUrl, KFileItemList() << itemTmp);
+    m_model->slotListerItemsDeleted(KFileItemList() << itemTmp);
+    m_model->slotListerItemsAdded(dirUrl, KFileItemList() << itemC);
+
+    // The changes are applied later as one update.
+    QCOMPARE(itemsInModel(), QStringList() << "a" << "b");
+    QVERIFY(itemsInsertedSpy.wait());
+
+    QCOMPARE(itemsInModel(), QStringList() << "a" << "b" << "c");
+    QCOMPARE(itemsInsertedSpy.count(), 1);
+    QCOMPARE(itemsRemovedSpy.count(), 0);
+    QVERIFY(m_model->isConsistent());
+
+    QCOMPARE(m_model->receivedChangeCount(), qint64(13));
+    QCOMPARE(m_model->appliedUpdateCount(), qint64(1));
+    QCOMPARE(m_model->appliedChangeCount(), qint64(2));
+}
+
+void KFileItemModelTest::testCoalescerWindowDecay()
+{
+    const QUrl dirUrl = m_testDir->url();
+
+    KFileItemModelChangeCoalescer coalescer;
+    QSignalSpy changesCoalescedSpy(&coalescer, &KFileItemModelChangeCoalescer::changesCoalesced);
+    int addedItemCount = 0;
+    connect(&coalescer, &KFileItemModelChangeCoalescer::changesCoalesced, this,
+            [&addedItemCount, dirUrl](const KFileItemList&, const QList<QPair<KFileItem, KFileItem> >&, const QHash<QUrl, KFileItemList>& addedItems) {
+        addedItemCount = addedItems.value(dirUrl).count();
+    });
+    auto createItem = [dirUrl](int i) {
+        return KFileItem(QUrl::fromLocalFile(dirUrl.toLocalFile() + QStringLiteral("/file%1").arg(i)),
+                         QString(), KFileItem::Unknown);
+    };
+
+    // A single change is emitted in the next iteration of the event loop
+    QCOMPARE(coalescer.window(), 0);
+    coalescer.addItems(dirUrl, KFileItemList() << createItem(0));
+    QVERIFY(changesCoalescedSpy.wait(100));
+
+    // A storm of changes increases the window
+    for (int i = 1; i <= 50; ++i) {
+        coalescer.addItems(dirUrl, KFileItemList() << createItem(i));
+    }
+    QVERIFY(coalescer.window() >= 500);
+    QVERIFY(changesCoalescedSpy.wait(2000));
+    QCOMPARE(changesCoalescedSpy.count(), 2);
+    QCOMPARE(addedItemCount, 50);
+
+    // The window shrinks while no changes are received, so a single change
+    // is not delayed by the previous storm
+    QTest::qWait(2500);
+    QVERIFY(coalescer.window() < 50);
+    QElapsedTimer timer;
+    timer.start();
+    coalescer.addItems(dirUrl, KFileItemList() << createItem(51));
+    QVERIFY(changesCoalescedSpy.wait(500));
+    QVERIFY(timer.elapsed() < 200);
+    QCOMPARE(coalescer.receivedChangeCount(), qint64(52));
+    QCOMPARE(coalescer.emittedUpdateCount(), qint64(3));
+    QCOMPARE(coalescer.emittedChangeCount(), qint64(52));
+}
+
 void KFileItemModelTest::testCreateMimeData()
 {
     QSignalSpy itemsInsertedSpy(m_model, &KFileItemModel::itemsInserted);
@@ -0,0 +1,107 @@
+/***************************************************************************
+ *   Copyright (C) 2019 by Dolphin developers <kfm-devel@kde.org>          *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA            *
+ ***************************************************************************/
+
+#include "kitemviews/private/kfileitempriorityqueue.h"
+
+#include <QTest>
+
+class KFileItemPriorityQueueTest : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testOrder();
+    void testUpdatePriority();
+    void testRemove();
+
+private:
+    static KFileItem createItem(const QString& name);
+    static QStringList takeAll(KFileItemPriorityQueue& queue);
+};
+
+KFileItem KFileItemPriorityQueueTest::createItem(const QString& name)
+{
+    return KFileItem(QUrl::fromLocalFile(QLatin1String("/tmp/") + name), QString(), KFileItem::Unknown);
+}
+
+QStringList KFileItemPriorityQueueTest::takeAll(KFileItemPriorityQueue& queue)
+{
+    QStringList names;
+    while (!queue.isEmpty()) {
+        names.append(queue.takeFirst().name());
+    }
+    return names;
+}
+
+void KFileItemPriorityQueueTest::testOrder()
+{
+    KFileItemPriorityQueue queue;
+    queue.insert(createItem("a"), 1, 0);
+    queue.insert(createItem("b"), 0, 1);
+    queue.insert(createItem("c"), 0, 0);
+    queue.insert(createItem("d"), 1, 0);
+
+    QCOMPARE(queue.count(), 4);
+    QCOMPARE(queue.first().name(), QStringLiteral("c"));
+
+    // Items with the same priority and order keep the insertion order.
+    QCOMPARE(takeAll(queue), QStringList() << "c" << "b" << "a" << "d");
+    QCOMPARE(queue.takenCount(), qint64(4));
+    QCOMPARE(queue.maximumCount(), 4);
+}
+
+void KFileItemPriorityQueueTest::testUpdatePriority()
+{
+    KFileItemPriorityQueue queue;
+    queue.insert(createItem("a"), 0, 0);
+    queue.insert(createItem("b"), 1, 0);
+    queue.insert(createItem("c"), 2, 0);
+
+    // Inserting an item again only changes its priority.
+    queue.insert(createItem("c"), 0, 1);
+    queue.insert(createItem("a"), 3, 0);
+
+    QCOMPARE(queue.count(), 3);
+    QCOMPARE(takeAll(queue), QStringList() << "c" << "b" << "a");
+}
+
+void KFileItemPriorityQueueTest::testRemove()
+{
+    KFileItemPriorityQueue queue;
+    queue.insert(createItem("a"), 0, 0);
+    queue.insert(createItem("b"), 0, 1);
+    queue.insert(createItem("c"), 0, 2);
+
+    QVERIFY(queue.remove(createItem("b")));
+    QVERIFY(!queue.remove(createItem("b")));
+    QVERIFY(!queue.contains(createItem("b")));
+    QVERIFY(queue.contains(createItem("c")));
+
+    QCOMPARE(takeAll(queue), QStringList() << "a" << "c");
+    QCOMPARE(queue.takenCount(), qint64(2));
+
+    queue.insert(createItem("d"), 0, 0);
+    queue.clear();
+    QVERIFY(queue.isEmpty());
+    QVERIFY(queue.first().isNull());
+}
+
+QTEST_GUILESS_MAIN(KFileItemPriorityQueueTest)
+
+#include "kfileitempriorityqueuetest.moc"
@@ -59,6 +59,64 @@ QHash<QByteArray, QVariant> DummyModel::data(int index) const
     return QHash<QByteArray, QVariant>();
 }
 
+/**
+ * Model that provides the roles "isDir" and "size", which are used for the
+ * selection summary. Initially, the first 10 items are folders and the size
+ * of each file is equal to its index.
+ */
+class SizeModel : public KItemModelBase
+{
+    Q_OBJECT
+public:
+    SizeModel();
+    void removeItems(const KItemRangeList& itemRanges);
+    void setSize(int index, int size);
+    int count() const override;
+    QHash<QByteArray, QVariant> data(int index) const override;
+
+private:
+    // The size of each item, or -1 for folders
+    QList<int> m_sizes;
+};
+
+SizeModel::SizeModel() :
+    KItemModelBase(),
+    m_sizes()
+{
+    for (int i = 0; i < 100; ++i) {
+        m_sizes.append(i < 10 ? -1 : i);
+    }
+}
+
+void SizeModel::removeItems(const KItemRangeList& itemRanges)
+{
+    emit itemsAboutToBeRemoved(itemRanges);
+    for (int i = itemRanges.count() - 1; i >= 0; --i) {
+        const KItemRange& itemRange = itemRanges.at(i);
+        m_sizes.erase(m_sizes.begin() + itemRange.index, m_sizes.begin() + itemRange.index + itemRange.count);
+    }
+    emit itemsRemoved(itemRanges);
+}
+
+void SizeModel::setSize(int index, int size)
+{
+    m_sizes[index] = size;
+    emit itemsChanged(KItemRangeList() << KItemRange(index, 1), QSet<QByteArray>() << "size");
+}
+
+int SizeModel::count() const
+{
+    return m_sizes.count();
+}
+
+QHash<QByteArray, QVariant> SizeModel::data(int index) const
+{
+    QHash<QByteArray, QVariant> values;
+    values.insert("isDir", m_sizes.at(index) < 0);
+    values.insert("size", qMax(0, m_sizes.at(index)));
+    return values;
+}
+
 
 class KItemListSelectionManagerTest : public QObject
 {
@@ -73,6 +131,8 @@ private slots:
     void testCurrentItemAnchorItem();
     void testSetSelected_data();
     void testSetSelected();
+    void testSetSelectedItemSet();
+    void testSelectionSummary();
     void testItemsInserted();
     void testItemsRemoved();
     void testAnchoredSelection();
@@ -211,6 +271,130 @@ void KItemListSelectionManagerTest::testSetSelected()
     QCOMPARE(m_selectionManager->selectedItems().count(), expectedSelectionCount);
 }
 
+void KItemListSelectionManagerTest::testSetSelectedItemSet()
+{
+    QSignalSpy spySelectionChanged(m_selectionManager, &KItemListSelectionManager::selectionChanged);
+
+    m_selectionManager->setSelected(5, 5);
+    QCOMPARE(spySelectionChanged.count(), 1);
+
+    KItemSet items;
+    items << 1 << 2 << 8 << 9 << 10 << 11;
+
+    m_selectionManager->setSelected(items, KItemListSelectionManager::Select);
+    QCOMPARE(m_selectionManager->selectedItems(), KItemSet() << 1 << 2 << 5 << 6 << 7 << 8 << 9 << 10 << 11);
+    QCOMPARE(spySelectionChanged.count(), 2);
+
+    m_selectionManager->setSelected(items, KItemListSelectionManager::Deselect);
+    QCOMPARE(m_selectionManager->selectedItems(), KItemSet() << 5 << 6 << 7);
+    QCOMPARE(spySelectionChanged.count(), 3);
+
+    m_selectionManager->setSelected(items, KItemListSelectionManager::Toggle);
+    QCOMPARE(m_selectionManager->selectedItems(), KItemSet() << 1 << 2 << 5 << 6 << 7 << 8 << 9 << 10 << 11);
+    QCOMPARE(spySelectionChanged.count(), 4);
+
+    // Selecting items which are selected already does not emit selectionChanged().
+    m_selectionManager->setSelected(items, KItemListSelectionManager::Select);
+    QCOMPARE(spySelectionChanged.count(), 4);
+
+    // Invalid indexes are ignored.
+    m_selectionManager->setSelected(KItemSet() << 50 << 100, KItemListSelectionManager::Select);
+    QCOMPARE(spySelectionChanged.count(), 4);
+}
+
+void KItemListSelectionManagerTest::testSelectionSummary()
+{
+    SizeModel model;
+    KItemListSelectionManager selectionManager;
+    selectionManager.setModel(&model);
+
+    // The items are removed from the view, which notifies the selection manager.
+    connect(&model, &KItemModelBase::itemsRemoved, &selectionManager, [&selectionManager](const KItemRangeList& itemRanges) {
+        selectionManager.itemsRemoved(itemRanges);
+    });
+
+    // Items 5 - 9 are folders, items 10 - 14 are files
+    selectionManager.setSelected(5, 10);
+    QCOMPARE(selectionManager.selectedFolderCount(), 5);
+    QCOMPARE(selectionManager.selectedFileCount(), 5);
+    QCOMPARE(selectionManager.selectedFileSize(), qulonglong(60));
+
+    selectionManager.setSelected(KItemSet() << 12 << 13, KItemListSelectionManager::Deselect);
+    QCOMPARE(selectionManager.selectedFolderCount(), 5);
+    QCOMPARE(selectionManager.selectedFileCount(), 3);
+    QCOMPARE(selectionManager.selectedFileSize(), qulonglong(35));
+
+    // The anchored selection is part of the summary
+    selectionManager.setCurrentItem(20);
+    selectionManager.beginAnchoredSelection(20);
+    selectionManager.setCurrentItem(22);
+    QCOMPARE(selectionManager.selectedFolderCount(), 5);
+    QCOMPARE(selectionManager.selectedFileCount(), 6);
+    QCOMPARE(selectionManager.selectedFileSize(), qulonglong(98));
+
+    selectionManager.setCurrentItem(21);
+    QCOMPARE(selectionManager.selectedFileCount(), 5);
+    QCOMPARE(selectionManager.selectedFileSize(), qulonglong(76));
+
+    selectionManager.setCurrentItem(22);
+    selectionManager.endAnchoredSelection();
+    QCOMPARE(selectionManager.selectedFolderCount(), 5);
+    QCOMPARE(selectionManager.selectedFileCount(), 6);
+    QCOMPARE(selectionManager.selectedFileSize(), qulonglong(98));
+
+    selectionManager.setSelected(5, 1, KItemListSelectionManager::Toggle);
+    QCOMPARE(selectionManager.selectedFolderCount(), 4);
+
+    // Removing items subtracts the removed selected items from the summary.
+    // The selected items 6 - 11, 14 and 22 are not affected.
+    model.removeItems(KItemRangeList() << KItemRange(0, 2) << KItemRange(20, 2));
+    QCOMPARE(selectionManager.selectedItems(), KItemSet() << 4 << 5 << 6 << 7 << 8 << 9 << 12 << 18);
+    QCOMPARE(selectionManager.selectedFolderCount(), 4);
+    QCOMPARE(selectionManager.selectedFileCount(), 4);
+    QCOMPARE(selectionManager.selectedFileSize(), qulonglong(57));
+
+    // Moving items does not change the summary
+    selectionManager.itemsMoved(KItemRange(4, 2), QList<int>() << 5 << 4);
+    QCOMPARE(selectionManager.selectedFolderCount(), 4);
+    QCOMPARE(selectionManager.selectedFileCount(), 4);
+    QCOMPARE(selectionManager.selectedFileSize(), qulonglong(57));
+
+    // Removing the anchor item of an anchored selection also removes the
+    // remaining items of the anchored selection from the selection.
+    selectionManager.clearSelection();
+    selectionManager.setCurrentItem(30);
+    selectionManager.beginAnchoredSelection(30);
+    selectionManager.setCurrentItem(32);
+    QCOMPARE(selectionManager.selectedFileCount(), 3);
+    model.removeItems(KItemRangeList() << KItemRange(30, 1));
+    QCOMPARE(selectionManager.selectedItems(), KItemSet());
+    QCOMPARE(selectionManager.selectedFolderCount(), 0);
+    QCOMPARE(selectionManager.selectedFileCount(), 0);
+    QCOMPARE(selectionManager.selectedFileSize(), qulonglong(0));
+
+    selectionManager.setSelectedItems(KItemSet() << 1 << 50);
+    QCOMPARE(selectionManager.selectedFolderCount(), 1);
+    QCOMPARE(selectionManager.selectedFileCount(), 1);
+    QCOMPARE(selectionManager.selectedFileSize(), qulonglong(55));
+
+    // The summary is recalculated if the model does not announce the removal
+    selectionManager.itemsRemoved(KItemRangeList() << KItemRange(0, 1));
+    QCOMPARE(selectionManager.selectedFolderCount(), 1);
+    QCOMPARE(selectionManager.selectedFileCount(), 1);
+    QCOMPARE(selectionManager.selectedFileSize(), qulonglong(54));
+
+    // Only changes of the size or the type of selected items invalidate the summary
+    model.setSize(60, 5);
+    QVERIFY(selectionManager.m_summaryValid);
+    emit model.itemsChanged(KItemRangeList() << KItemRange(49, 1), QSet<QByteArray>() << "iconPixmap");
+    QVERIFY(selectionManager.m_summaryValid);
+    model.setSize(49, 10);
+    QVERIFY(!selectionManager.m_summaryValid);
+    QCOMPARE(selectionManager.selectedFolderCount(), 1);
+    QCOMPARE(selectionManager.selectedFileCount(), 1);
+    QCOMPARE(selectionManager.selectedFileSize(), qulonglong(10));
+}
+
 void KItemListSelectionManagerTest::testItemsInserted()
 {
     // Select items 10 to 12
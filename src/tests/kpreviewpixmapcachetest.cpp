@@ -0,0 +1,144 @@
+/***************************************************************************
+ *   Copyright (C) 2019 by Dolphin developers <kfm-devel@kde.org>          *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA            *
+ ***************************************************************************/
+
+
+#include "kitemviews/private/kpreviewpixmapcache.h"
+
+#include <QTest>
+
+class KPreviewPixmapCacheTest : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void init();
+    void cleanup();
+
+    void testFind();
+    void testKey();
+    void testMaximumSize();
+
+private:
+    qint64 m_maximumSize;
+
+    static KPreviewPixmapCache::Key createKey(const QString& name);
+    static QPixmap createPixmap(const QColor& color);
+};
+
+KPreviewPixmapCache::Key KPreviewPixmapCacheTest::createKey(const QString& name)
+{
+    KPreviewPixmapCache::Key key;
+    key.url = QUrl::fromLocalFile(QLatin1String("/tmp/") + name);
+    key.modificationTime = 1000;
+    key.iconSize = QSize(64, 64);
+    key.devicePixelRatio = 1.0;
+    key.enlargeSmallPreviews = true;
+    return key;
+}
+
+QPixmap KPreviewPixmapCacheTest::createPixmap(const QColor& color)
+{
+    QPixmap pixmap(64, 64);
+    pixmap.fill(color);
+    return pixmap;
+}
+
+void KPreviewPixmapCacheTest::init()
+{
+    KPreviewPixmapCache& cache = KPreviewPixmapCache::instance();
+    cache.clear();
+    m_maximumSize = cache.maximumSize();
+}
+
+void KPreviewPixmapCacheTest::cleanup()
+{
+    KPreviewPixmapCache& cache = KPreviewPixmapCache::instance();
+    cache.clear();
+    cache.setMaximumSize(m_maximumSize);
+}
+
+void KPreviewPixmapCacheTest::testFind()
+{
+    KPreviewPixmapCache& cache = KPreviewPixmapCache::instance();
+    const qint64 hitCount = cache.hitCount();
+    const qint64 missCount = cache.missCount();
+
+    QPixmap pixmap;
+    QVERIFY(!cache.find(createKey("a"), &pixmap));
+    QCOMPARE(cache.missCount(), missCount + 1);
+
+    cache.insert(createKey("a"), createPixmap(Qt::red));
+    QVERIFY(cache.find(createKey("a"), &pixmap));
+    QCOMPARE(pixmap.toImage().pixelColor(0, 0), QColor(Qt::red));
+    QCOMPARE(cache.hitCount(), hitCount + 1);
+    QVERIFY(cache.size() > 0);
+}
+
+void KPreviewPixmapCacheTest::testKey()
+{
+    KPreviewPixmapCache& cache = KPreviewPixmapCache::instance();
+    cache.insert(createKey("a"), createPixmap(Qt::red));
+
+    QPixmap pixmap;
+
+    // A modified file, another icon size or other overlays need another preview.
+    KPreviewPixmapCache::Key key = createKey("a");
+    key.modificationTime = 2000;
+    QVERIFY(!cache.find(key, &pixmap));
+
+    key = createKey("a");
+    key.iconSize = QSize(128, 128);
+    QVERIFY(!cache.find(key, &pixmap));
+
+    key = createKey("a");
+    key.devicePixelRatio = 2.0;
+    QVERIFY(!cache.find(key, &pixmap));
+
+    key = createKey("a");
+    key.overlays = QStringList() << "emblem-symbolic-link";
+    QVERIFY(!cache.find(key, &pixmap));
+
+    QVERIFY(cache.find(createKey("a"), &pixmap));
+}
+
+void KPreviewPixmapCacheTest::testMaximumSize()
+{
+    KPreviewPixmapCache& cache = KPreviewPixmapCache::instance();
+
+    // Each pixmap needs 16 KiB with a depth of 32 bits.
+    const qint64 pixmapSize = createPixmap(Qt::red).depth() * 64 * 64 / 8;
+    cache.setMaximumSize(2 * pixmapSize);
+
+    cache.insert(createKey("a"), createPixmap(Qt::red));
+    cache.insert(createKey("b"), createPixmap(Qt::green));
+
+    // Using "a" makes "b" the least recently used pixmap.
+    QPixmap pixmap;
+    QVERIFY(cache.find(createKey("a"), &pixmap));
+
+    cache.insert(createKey("c"), createPixmap(Qt::blue));
+    QVERIFY(cache.size() <= cache.maximumSize());
+    QVERIFY(cache.find(createKey("a"), &pixmap));
+    QVERIFY(!cache.find(createKey("b"), &pixmap));
+    QVERIFY(cache.find(createKey("c"), &pixmap));
+}
+
+QTEST_MAIN(KPreviewPixmapCacheTest)
+
+#include "kpreviewpixmapcachetest.moc"
@@ -0,0 +1,117 @@
+/***************************************************************************
+ *   Copyright (C) 2019 by Dolphin developers <kfm-devel@kde.org>          *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA            *
+ ***************************************************************************/
+
+#include "kitemviews/private/krangesuccessorindex.h"
+
+#include <QTest>
+
+#include <algorithm>
+#include <random>
+
+class KRangeSuccessorIndexTest : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testEmpty();
+    void testSuccessor();
+    void testRandomValues();
+
+private:
+    static int expectedSuccessor(const QVector<int>& values, int begin, int end, int value);
+};
+
+int KRangeSuccessorIndexTest::expectedSuccessor(const QVector<int>& values, int begin, int end, int value)
+{
+    int result = -1;
+    for (int i = qMax(0, begin); i < qMin(end, values.count()); ++i) {
+        if (values.at(i) >= value && (result < 0 || values.at(i) < result)) {
+            result = values.at(i);
+        }
+    }
+    return result;
+}
+
+void KRangeSuccessorIndexTest::testEmpty()
+{
+    KRangeSuccessorIndex index;
+    QCOMPARE(index.count(), 0);
+    QCOMPARE(index.successor(0, 10, 0), -1);
+
+    index.build(QVector<int>());
+    QCOMPARE(index.count(), 0);
+    QCOMPARE(index.successor(0, 10, 0), -1);
+}
+
+void KRangeSuccessorIndexTest::testSuccessor()
+{
+    KRangeSuccessorIndex index;
+    index.build(QVector<int>() << 5 << 2 << 9 << 0 << 7 << 3);
+    QCOMPARE(index.count(), 6);
+
+    QCOMPARE(index.successor(0, 6, 0), 0);
+    QCOMPARE(index.successor(0, 6, 1), 2);
+    QCOMPARE(index.successor(0, 6, 4), 5);
+    QCOMPARE(index.successor(0, 6, 8), 9);
+    QCOMPARE(index.successor(0, 6, 10), -1);
+
+    // Only the values in the range are taken into account
+    QCOMPARE(index.successor(1, 3, 0), 2);
+    QCOMPARE(index.successor(1, 3, 3), 9);
+    QCOMPARE(index.successor(4, 6, 4), 7);
+    QCOMPARE(index.successor(4, 6, 8), -1);
+    QCOMPARE(index.successor(2, 2, 0), -1);
+
+    index.clear();
+    QCOMPARE(index.count(), 0);
+    QCOMPARE(index.successor(0, 6, 0), -1);
+}
+
+void KRangeSuccessorIndexTest::testRandomValues()
+{
+    std::mt19937 randomGenerator(42);
+
+    // A permutation like the indexes of KFileItemModel, and values with duplicates
+    QVector<int> permutation;
+    for (int i = 0; i < 1000; ++i) {
+        permutation.append(i);
+    }
+    std::shuffle(permutation.begin(), permutation.end(), randomGenerator);
+
+    QVector<int> duplicates;
+    for (int i = 0; i < 1000; ++i) {
+        duplicates.append(randomGenerator() % 50);
+    }
+
+    foreach (const QVector<int>& values, QList<QVector<int> >() << permutation << duplicates) {
+        KRangeSuccessorIndex index;
+        index.build(values);
+
+        for (int i = 0; i < 2000; ++i) {
+            const int begin = randomGenerator() % (values.count() + 1);
+            const int end = begin + randomGenerator() % (values.count() + 1 - begin);
+            const int value = randomGenerator() % (values.count() + 10);
+            QCOMPARE(index.successor(begin, end, value), expectedSuccessor(values, begin, end, value));
+        }
+    }
+}
+
+QTEST_GUILESS_MAIN(KRangeSuccessorIndexTest)
+
+#include "krangesuccessorindextest.moc"
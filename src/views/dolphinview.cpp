@@ -68,6 +68,7 @@
 #include <QScrollBar>
 #include <QTimer>
 #include <QVBoxLayout>
+#include <QtConcurrentMap>
 
 DolphinView::DolphinView(const QUrl& url, QWidget* parent) :
     QWidget(parent),
@@ -112,6 +113,7 @@ DolphinView::DolphinView(const QUrl& url, QWidget* parent) :
             this, &DolphinView::emitSelectionChangedSignal);
 
     m_model = new KFileItemModel(this);
+    m_model->setLocalListingEnabled(GeneralSettings::listLocalDirectoriesDirectly());
     m_view = new DolphinItemListView();
     m_view->setEnabledSelectionToggles(GeneralSettings::showSelectionToggle());
     m_view->setVisibleRoles({"text"});
@@ -368,16 +370,58 @@ void DolphinView::selectItems(const QRegExp& pattern, bool enabled)
                                                         : KItemListSelectionManager::Deselect;
     KItemListSelectionManager* selectionManager = m_container->controller()->selectionManager();
 
-    for (int index = 0; index < m_model->count(); index++) {
-        const KFileItem item = m_model->fileItem(index);
-        if (pattern.exactMatch(item.text())) {
-            // An alternative approach would be to store the matching items in a KItemSet and
-            // select them in one go after the loop, but we'd need a new function
-            // KItemListSelectionManager::setSelected(KItemSet, SelectionMode mode)
-            // for that.
-            selectionManager->setSelected(index, 1, mode);
+    // Patterns like "*.o" are matched by comparing the suffix, which is much
+    // faster than QRegExp::exactMatch().
+    QString suffix;
+    if (pattern.patternSyntax() == QRegExp::Wildcard || pattern.patternSyntax() == QRegExp::WildcardUnix) {
+        const QString wildcard = pattern.pattern();
+        if (wildcard.startsWith(QLatin1Char('*'))) {
+            suffix = wildcard.mid(1);
+            if (suffix.contains(QRegExp(QStringLiteral("[*?\\[\\]\\\\]")))) {
+                suffix.clear();
+            }
+        }
+    }
+
+    // The items are matched in chunks by worker threads. Each chunk uses its own
+    // copy of the pattern, because QRegExp stores the state of the last match.
+    struct MatchChunk {
+        KItemRange range;
+        QRegExp pattern;
+        QVector<int> matchingIndexes;
+    };
+
+    const int itemCount = m_model->count();
+    const int chunkSize = 10000;
+    QVector<MatchChunk> chunks;
+    for (int index = 0; index < itemCount; index += chunkSize) {
+        MatchChunk chunk;
+        chunk.range = KItemRange(index, qMin(chunkSize, itemCount - index));
+        chunk.pattern = pattern;
+        chunks.append(chunk);
+    }
+
+    const Qt::CaseSensitivity caseSensitivity = pattern.caseSensitivity();
+    QtConcurrent::blockingMap(chunks, [&](MatchChunk& chunk) {
+        for (int index = chunk.range.index; index < chunk.range.index + chunk.range.count; ++index) {
+            const QString text = m_model->fileItem(index).text();
+            const bool matches = suffix.isEmpty()
+                               ? chunk.pattern.exactMatch(text)
+                               : text.endsWith(suffix, caseSensitivity);
+            if (matches) {
+                chunk.matchingIndexes.append(index);
+            }
+        }
+    });
+
+    KItemSet matchingItems;
+    foreach (const MatchChunk& chunk, chunks) {
+        foreach (int index, chunk.matchingIndexes) {
+            matchingItems.insert(index);
         }
     }
+
+    selectionManager->setSelected(matchingItems, mode);
 }
 
 void DolphinView::setZoomLevel(int level)
@@ -474,6 +518,8 @@ void DolphinView::readSettings()
     const int delay = GeneralSettings::autoExpandFolders() ? 750 : -1;
     m_container->controller()->setAutoActivationDelay(delay);
 
+    m_model->setLocalListingEnabled(GeneralSettings::listLocalDirectoriesDirectly());
+
     const int newZoomLevel = m_view->zoomLevel();
     if (newZoomLevel != oldZoomLevel) {
         emit zoomLevelChanged(newZoomLevel, oldZoomLevel);
@@ -516,28 +562,26 @@ QString DolphinView::statusBarText() const
     int fileCount = 0;
     KIO::filesize_t totalFileSize = 0;
 
-    if (m_container->controller()->selectionManager()->hasSelection()) {
+    const KItemListSelectionManager* selectionManager = m_container->controller()->selectionManager();
+    if (selectionManager->hasSelection()) {
         // Give a summary of the status of the selected files
-        const KFileItemList list = selectedItems();
-        foreach (const KFileItem& item, list) {
-            if (item.isDir()) {
-                ++folderCount;
-            } else {
-                ++fileCount;
-                totalFileSize += item.size();
-            }
-        }
+        folderCount = selectionManager->selectedFolderCount();
+        fileCount = selectionManager->selectedFileCount();
+        totalFileSize = selectionManager->selectedFileSize();
 
         if (folderCount + fileCount == 1) {
             // If only one item is selected, show info about it
-            return list.first().getStatusBarInfo();
+            const int index = selectionManager->selectedItems().first();
+            return m_model->fileItem(index).getStatusBarInfo();
         } else {
             // At least 2 items are selected
             foldersText = i18ncp("@info:status", "1 Folder selected", "%1 Folders selected", folderCount);
             filesText = i18ncp("@info:status", "1 File selected", "%1 Files selected", fileCount);
         }
     } else {
-        calculateItemCount(fileCount, folderCount, totalFileSize);
+        fileCount = m_model->fileCount();
+        folderCount = m_model->folderCount();
+        totalFileSize = m_model->totalFileSize();
         foldersText = i18ncp("@info:status", "1 Folder", "%1 Folders", folderCount);
         filesText = i18ncp("@info:status", "1 File", "%1 Files", fileCount);
     }
@@ -1419,22 +1463,6 @@ void DolphinView::hideToolTip()
 #endif
 }
 
-void DolphinView::calculateItemCount(int& fileCount,
-                                     int& folderCount,
-                                     KIO::filesize_t& totalFileSize) const
-{
-    const int itemCount = m_model->count();
-    for (int i = 0; i < itemCount; ++i) {
-        const KFileItem item = m_model->fileItem(i);
-        if (item.isDir()) {
-            ++folderCount;
-        } else {
-            ++fileCount;
-            totalFileSize += item.size();
-        }
-    }
-}
-
 void DolphinView::slotTwoClicksRenamingTimerTimeout()
 {
     const KItemListSelectionManager* selectionManager = m_container->controller()->selectionManager();